@@ -0,0 +1,337 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "json/json.h"
+
+#include "client/GameSave.h"
+#include "graphics/Graphics.h"
+#include "graphics/PixelSpans.h"
+#include "graphics/Renderer.h"
+#include "simulation/Air.h"
+#include "simulation/FFT.h"
+#include "simulation/Gravity.h"
+#include "simulation/SaveRenderer.h"
+#include "simulation/Simulation.h"
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	double ElapsedMs(Clock::time_point start, Clock::time_point end)
+	{
+		return std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	// mean, median, 99th percentile and extremes of a list of times in milliseconds
+	Json::Value Summarise(std::vector<double> times)
+	{
+		Json::Value summary;
+		if (times.empty())
+			return summary;
+		std::sort(times.begin(), times.end());
+		double total = 0;
+		for (auto time : times)
+			total += time;
+		auto percentile = [&times](double p) {
+			int rank = int(std::ceil(p * times.size())) - 1;
+			return times[std::max(0, std::min(rank, int(times.size()) - 1))];
+		};
+		summary["mean"] = total / times.size();
+		summary["p50"] = percentile(0.5);
+		summary["p99"] = percentile(0.99);
+		summary["min"] = times.front();
+		summary["max"] = times.back();
+		summary["total"] = total;
+		return summary;
+	}
+
+	// Serialises the save and parses the result again a few times, in one of the save formats
+	Json::Value BenchmarkSaveFormat(GameSave *save, bool chunked, int repeats)
+	{
+		std::vector<double> saveTimes, loadTimes;
+		std::vector<char> data;
+		for (int i = 0; i < repeats; i++)
+		{
+			auto start = Clock::now();
+			data = save->Serialise(chunked);
+			auto saved = Clock::now();
+			GameSave loaded(data);
+			auto loadDone = Clock::now();
+			saveTimes.push_back(ElapsedMs(start, saved));
+			loadTimes.push_back(ElapsedMs(saved, loadDone));
+		}
+		Json::Value result;
+		result["bytes"] = Json::Value::UInt64(data.size());
+		result["save"] = Summarise(saveTimes);
+		result["load"] = Summarise(loadTimes);
+		return result;
+	}
+
+	// Renders thumbnails of the save from as many threads as the renderer pool is allowed contexts
+	Json::Value BenchmarkThumbnails(std::vector<char> &saveData, unsigned int contexts, int count)
+	{
+		SaveRenderer::Ref().SetMaxContexts(contexts);
+		// Let the pool create its contexts before timing
+		delete SaveRenderer::Ref().Render((unsigned char *)&saveData[0], saveData.size());
+
+		std::vector<double> times;
+		std::mutex timesMutex;
+		std::atomic<int> next(0);
+		auto start = Clock::now();
+		std::vector<std::thread> threads;
+		for (unsigned int i = 0; i < contexts; i++)
+		{
+			threads.push_back(std::thread([&]() {
+				while (next++ < count)
+				{
+					auto thumbStart = Clock::now();
+					delete SaveRenderer::Ref().Render((unsigned char *)&saveData[0], saveData.size());
+					double elapsed = ElapsedMs(thumbStart, Clock::now());
+					std::lock_guard<std::mutex> g(timesMutex);
+					times.push_back(elapsed);
+				}
+			}));
+		}
+		for (auto &thread : threads)
+			thread.join();
+		double totalMs = ElapsedMs(start, Clock::now());
+
+		Json::Value result;
+		result["contexts"] = contexts;
+		result["render"] = Summarise(times);
+		result["thumbnailsPerSecond"] = totalMs > 0 ? count / (totalMs / 1000.0) : 0.0;
+		return result;
+	}
+
+	// Blends and adds a colour over every row of a window sized buffer, one pixel at a time and with the span
+	// functions, which are only faster where they are vectorised
+	Json::Value BenchmarkPixelSpans(int repeats)
+	{
+		std::vector<pixel> buffer(WINDOWW * WINDOWH, PIXPACK(0x404040));
+		std::vector<int> alphas(WINDOWW);
+		for (int x = 0; x < WINDOWW; x++)
+			alphas[x] = x % 256;
+		auto time = [&](std::function<void(pixel *)> fillRow) {
+			std::vector<double> times;
+			for (int i = 0; i < repeats; i++)
+			{
+				auto start = Clock::now();
+				for (int y = 0; y < WINDOWH; y++)
+					fillRow(&buffer[y * WINDOWW]);
+				times.push_back(ElapsedMs(start, Clock::now()));
+			}
+			return Summarise(times);
+		};
+		Json::Value result;
+		result["vectorised"] = PixelSpans::Vectorised();
+		result["blend"]["scalar"] = time([](pixel *row) { PixelSpans::BlendScalar(row, WINDOWW, 255, 128, 0, 100); });
+		result["blend"]["span"] = time([](pixel *row) { PixelSpans::Blend(row, WINDOWW, 255, 128, 0, 100); });
+		result["add"]["scalar"] = time([](pixel *row) { PixelSpans::AddScalar(row, WINDOWW, 0, 64, 255, 20); });
+		result["add"]["span"] = time([](pixel *row) { PixelSpans::Add(row, WINDOWW, 0, 64, 255, 20); });
+		result["addAlphas"]["scalar"] = time([&alphas](pixel *row) { PixelSpans::AddAlphasScalar(row, WINDOWW, 255, 64, 0, &alphas[0]); });
+		result["addAlphas"]["span"] = time([&alphas](pixel *row) { PixelSpans::AddAlphas(row, WINDOWW, 255, 64, 0, &alphas[0]); });
+		return result;
+	}
+
+	// Times the air and ambient heat updates over a fixed pattern of pressure, velocity and heat on the save's walls,
+	// with the blur done one cell at a time and with SSE2. The air the save loaded with is put back afterwards
+	Json::Value BenchmarkAirBlur(Simulation *sim, int repeats)
+	{
+		Air &air = *sim->air;
+		AirState *saved = new AirState(air);
+		int airMode = air.airMode;
+		air.airMode = 0; // saves with the air update turned off would only time the heat blur
+		auto time = [&](bool scalar) {
+			air.scalarBlur = scalar;
+			for (int y = 0; y < YRES/CELL; y++)
+				for (int x = 0; x < XRES/CELL; x++)
+				{
+					air.pv[y][x] = 40.0f * std::sin(x * 0.21f) * std::cos(y * 0.17f);
+					air.vx[y][x] = 3.0f * std::cos(x * 0.13f + y * 0.07f);
+					air.vy[y][x] = 3.0f * std::sin(x * 0.05f - y * 0.19f);
+					air.hv[y][x] = 295.15f + 200.0f * std::sin((x + y) * 0.11f);
+				}
+			std::vector<double> times;
+			for (int i = 0; i < repeats; i++)
+			{
+				auto start = Clock::now();
+				air.update_air();
+				air.update_airh();
+				times.push_back(ElapsedMs(start, Clock::now()));
+			}
+			return Summarise(times);
+		};
+
+		Json::Value result;
+		result["vectorised"] = Air::BlurVectorised();
+		result["sse2"] = time(false);
+		result["scalar"] = time(true);
+		air.scalarBlur = false;
+		static_cast<AirState &>(air) = *saved;
+		air.airMode = airMode;
+		delete saved;
+		return result;
+	}
+
+	// Times finding the gravity field of a map full of masses with the built in FFT, which is what each update of
+	// gravity costs in builds without FFTW
+	Json::Value BenchmarkGravityField(int repeats)
+	{
+		const int size = (XRES/CELL)*(YRES/CELL);
+		std::vector<float> masses(size), fieldX(size), fieldY(size);
+		for (int i = 0; i < size; i++)
+			masses[i] = (i * 7) % 13 ? 1.0f : 0.0f;
+		GravityConvolution convolution;
+		std::vector<double> times;
+		for (int i = 0; i < repeats; i++)
+		{
+			auto start = Clock::now();
+			convolution.Calculate(&masses[0], &fieldX[0], &fieldY[0]);
+			times.push_back(ElapsedMs(start, Clock::now()));
+		}
+		return Summarise(times);
+	}
+}
+
+int RunBenchmark(ByteString saveFile, int frames, bool render, int threads)
+{
+	std::ifstream file(saveFile.c_str(), std::ios::binary);
+	if (!file.is_open())
+	{
+		std::cerr << "Could not open " << saveFile << std::endl;
+		return 1;
+	}
+	std::vector<char> saveData((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	GameSave *save;
+	try
+	{
+		save = new GameSave(saveData);
+	}
+	catch (ParseException &e)
+	{
+		std::cerr << "Could not load " << saveFile << ": " << e.what() << std::endl;
+		return 1;
+	}
+
+	Json::Value result;
+	try
+	{
+		save->Expand();
+		result["saveFormats"]["OPS1"] = BenchmarkSaveFormat(save, false, 5);
+		result["saveFormats"]["OPS2"] = BenchmarkSaveFormat(save, true, 5);
+	}
+	catch (ParseException &e)
+	{
+		std::cerr << "Could not reload " << saveFile << ": " << e.what() << std::endl;
+		delete save;
+		return 1;
+	}
+
+	if (render)
+	{
+		unsigned int poolSize = SaveRenderer::Ref().GetMaxContexts();
+		result["thumbnails"]["single"] = BenchmarkThumbnails(saveData, 1, 16);
+		result["thumbnails"]["pool"] = BenchmarkThumbnails(saveData, poolSize, 16);
+		result["pixelSpans"] = BenchmarkPixelSpans(20);
+	}
+
+	result["gravityField"] = BenchmarkGravityField(20);
+
+	Simulation *sim = new Simulation();
+	sim->SetUpdateThreads(threads);
+	// The save's settings, the way the game applies them when it opens one
+	sim->gravityMode = save->gravityMode;
+	sim->air->airMode = save->airMode;
+	sim->edgeMode = save->edgeMode;
+	sim->randomSeed = save->rngSeed;
+	sim->legacy_enable = save->legacyEnable;
+	sim->water_equal_test = save->waterEEnabled;
+	sim->aheat_enable = save->aheatEnable;
+	if (save->gravityEnable)
+		sim->grav->start_grav_async();
+	sim->clear_sim();
+	int loadError = sim->Load(save, true);
+	delete save;
+	if (loadError)
+	{
+		std::cerr << "Could not load " << saveFile << std::endl;
+		delete sim;
+		return 1;
+	}
+	result["airBlur"] = BenchmarkAirBlur(sim, 20);
+
+	Graphics *g = NULL;
+	Renderer *ren = NULL;
+	if (render)
+	{
+		g = new Graphics();
+		ren = new Renderer(g, sim);
+	}
+
+	std::vector<double> beforeTimes, updateTimes, afterTimes, renderTimes, frameTimes;
+	int startParticles = sim->NUM_PARTS;
+	double particleTotal = 0;
+	for (int frame = 0; frame < frames; frame++)
+	{
+		auto start = Clock::now();
+		sim->BeforeSim();
+		auto beforeDone = Clock::now();
+		sim->UpdateParticles(0, NPART);
+		auto updateDone = Clock::now();
+		sim->AfterSim();
+		auto afterDone = Clock::now();
+		if (ren)
+		{
+			ren->clearScreen(1.0f);
+			ren->render_parts();
+			ren->render_fire();
+		}
+		auto renderDone = Clock::now();
+
+		beforeTimes.push_back(ElapsedMs(start, beforeDone));
+		updateTimes.push_back(ElapsedMs(beforeDone, updateDone));
+		afterTimes.push_back(ElapsedMs(updateDone, afterDone));
+		if (ren)
+			renderTimes.push_back(ElapsedMs(afterDone, renderDone));
+		frameTimes.push_back(ElapsedMs(start, renderDone));
+		particleTotal += sim->NUM_PARTS;
+	}
+
+	result["save"] = saveFile;
+	result["frames"] = frames;
+	result["threads"] = sim->GetUpdateThreads();
+	result["particles"]["start"] = startParticles;
+	result["particles"]["end"] = sim->NUM_PARTS;
+	result["particles"]["mean"] = frames ? particleTotal / frames : 0.0;
+	result["phases"]["BeforeSim"] = Summarise(beforeTimes);
+	result["phases"]["UpdateParticles"] = Summarise(updateTimes);
+	result["phases"]["AfterSim"] = Summarise(afterTimes);
+	if (ren)
+		result["phases"]["render"] = Summarise(renderTimes);
+	result["phases"]["frame"] = Summarise(frameTimes);
+	double totalMs = result["phases"]["frame"]["total"].asDouble();
+	double updateMs = result["phases"]["UpdateParticles"]["total"].asDouble();
+	result["throughput"]["framesPerSecond"] = totalMs > 0 ? frames / (totalMs / 1000.0) : 0.0;
+	result["throughput"]["particleUpdatesPerSecond"] = updateMs > 0 ? particleTotal / (updateMs / 1000.0) : 0.0;
+
+	Json::StyledWriter writer;
+	std::cout << writer.write(result);
+
+	delete ren;
+	delete g;
+	delete sim;
+	return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "common/String.h"
+
+// Loads a save without opening a window, runs it for a number of frames and prints the time spent in each
+// phase of the frame to stdout as JSON, along with how long the save takes to serialise and parse in each
+// save format. With render, also times rendering and thumbnail throughput with one and with all the thumbnail
+// renderer contexts, and the pixel blending functions with and without SSE2. Also times the air blur with and
+// without SSE2 and the built in gravity FFT. Results are only timed here, the self tests check them. Returns
+// the exit code for the process, which is 1 if the save couldn't be loaded
+int RunBenchmark(ByteString saveFile, int frames, bool render, int threads);
+
+#endif
@@ -95,6 +95,8 @@
 
 #define STAMPS_DIR "stamps"
 
+#define THUMBNAIL_CACHE_DIR "thumbnails"
+
 #define BRUSH_DIR "Brushes"
 
 #ifndef M_GRAV
@@ -120,8 +122,6 @@
 
 #define MAX_DISTANCE sqrt(pow((float)XRES, 2)+pow((float)YRES, 2))
 
-#define GRAV_DIFF
-
 #define MAXSIGNS 16
 
 //CELL, the size of the pressure, gravity, and wall maps. Larger than 1 to prevent extreme lag
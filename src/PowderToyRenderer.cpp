@@ -3,17 +3,25 @@
 #include "graphics/Graphics.h"
 #include "graphics/Renderer.h"
 
+#include <atomic>
+#include <chrono>
 #include <ctime>
 #include <iostream>
 #include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
 #include <vector>
+#include <sys/stat.h>
 
 #include "common/String.h"
 #include "Config.h"
 #include "Format.h"
 #include "gui/interface/Engine.h"
 
+#include "client/Client.h"
 #include "client/GameSave.h"
+#include "common/tpt-rand.h"
 #include "simulation/Simulation.h"
 
 
@@ -56,49 +64,11 @@ void writeFile(ByteString filename, std::vector<char> & fileData)
 	}
 }
 
-int main(int argc, char *argv[])
+// Renders a loaded save the same way every time, or a message if it couldn't be loaded
+VideoBuffer renderSave(Renderer * ren, GameSave * gameSave)
 {
-	ui::Engine * engine;
-	ByteString outputPrefix, inputFilename;
-	std::vector<char> inputFile;
-	ByteString ppmFilename, ptiFilename, ptiSmallFilename, pngFilename, pngSmallFilename;
-	std::vector<char> ppmFile, ptiFile, ptiSmallFile, pngFile, pngSmallFile;
-
-	inputFilename = argv[1];
-	outputPrefix = argv[2];
-
-	ppmFilename = outputPrefix+".ppm";
-	ptiFilename = outputPrefix+".pti";
-	ptiSmallFilename = outputPrefix+"-small.pti";
-	pngFilename = outputPrefix+".png";
-	pngSmallFilename = outputPrefix+"-small.png";
-
-	readFile(inputFilename, inputFile);
-
-	ui::Engine::Ref().g = new Graphics();
-
-	engine = &ui::Engine::Ref();
-	engine->Begin(WINDOWW, WINDOWH);
-
-	GameSave * gameSave = NULL;
-	try
-	{
-		gameSave = new GameSave(inputFile);
-	}
-	catch (ParseException &e)
-	{
-		//Render the save again later or something? I don't know
-		if (ByteString(e.what()).FromUtf8() == "Save from newer version")
-			throw e;
-	}
-
-	Simulation * sim = new Simulation();
-	Renderer * ren = new Renderer(ui::Engine::Ref().g, sim);
-
 	if (gameSave)
 	{
-		sim->Load(gameSave, true);
-
 		//Render save
 		ren->decorations_enable = true;
 		ren->blackDecorations = true;
@@ -122,7 +92,20 @@ int main(int argc, char *argv[])
 	ren->RenderBegin();
 	ren->RenderEnd();
 
-	VideoBuffer screenBuffer = ren->DumpFrame();
+	return ren->DumpFrame();
+}
+
+void writeOutputs(ByteString outputPrefix, VideoBuffer & screenBuffer)
+{
+	ByteString ppmFilename, ptiFilename, ptiSmallFilename, pngFilename, pngSmallFilename;
+	std::vector<char> ppmFile, ptiFile, ptiSmallFile, pngFile, pngSmallFile;
+
+	ppmFilename = outputPrefix+".ppm";
+	ptiFilename = outputPrefix+".pti";
+	ptiSmallFilename = outputPrefix+"-small.pti";
+	pngFilename = outputPrefix+".png";
+	pngSmallFilename = outputPrefix+"-small.png";
+
 	//ppmFile = format::VideoBufferToPPM(screenBuffer);
 	ptiFile = format::VideoBufferToPTI(screenBuffer);
 	pngFile = format::VideoBufferToPNG(screenBuffer);
@@ -131,8 +114,6 @@ int main(int argc, char *argv[])
 	ptiSmallFile = format::VideoBufferToPTI(screenBuffer);
 	pngSmallFile = format::VideoBufferToPNG(screenBuffer);
 
-
-
 	//writeFile(ppmFilename, ppmFile);
 	writeFile(ptiFilename, ptiFile);
 	writeFile(ptiSmallFilename, ptiSmallFile);
@@ -140,4 +121,199 @@ int main(int argc, char *argv[])
 	writeFile(pngSmallFilename, pngSmallFile);
 }
 
+bool isDirectory(ByteString path)
+{
+#ifdef WIN
+	struct _stat s;
+	return _stat(path.c_str(), &s) == 0 && (s.st_mode & S_IFDIR);
+#else
+	struct stat s;
+	return stat(path.c_str(), &s) == 0 && (s.st_mode & S_IFDIR);
+#endif
+}
+
+// Renders every save in a directory, or every save listed in a manifest file (one per line, optionally followed
+// by a tab and the output prefix to use for it), into outputDirectory. Each worker thread keeps its own
+// Simulation and Renderer for all the saves it renders. Prints a line per save, and returns 1 if any failed
+int renderBatch(ByteString input, ByteString outputDirectory, int threadCount)
+{
+	struct Job
+	{
+		ByteString input;
+		ByteString outputPrefix;
+	};
+	std::vector<Job> jobs;
+	auto defaultPrefix = [&outputDirectory](ByteString filename) {
+		ByteString name = filename.SplitFromEndByAny("/\\").After();
+		if (ByteString::Split split = name.SplitFromEndBy('.'))
+			name = split.Before();
+		return outputDirectory + PATH_SEP + name;
+	};
+	if (isDirectory(input))
+	{
+		for (auto &filename : Client::Ref().DirectorySearch(input, "", std::vector<ByteString>{ ".cps", ".stm" }))
+			jobs.push_back(Job{ filename, defaultPrefix(filename) });
+	}
+	else
+	{
+		std::ifstream manifest(input.c_str());
+		if (!manifest.is_open())
+		{
+			std::cerr << "Could not open " << input << std::endl;
+			return 1;
+		}
+		std::string line;
+		while (std::getline(manifest, line))
+		{
+			ByteString entry(line);
+			if (entry.EndsWith("\r"))
+				entry = entry.Substr(0, entry.size()-1);
+			if (!entry.size())
+				continue;
+			if (entry.Contains("\t"))
+				jobs.push_back(Job{ entry.SplitBy('\t').Before(), entry.SplitBy('\t').After() });
+			else
+				jobs.push_back(Job{ entry, defaultPrefix(entry) });
+		}
+	}
+	Client::Ref().MakeDirectory(outputDirectory.c_str());
+
+	std::atomic<int> nextJob(0), failures(0);
+	std::mutex outputMutex;
+	auto batchStart = std::chrono::steady_clock::now();
+	// Each worker renders with a context of its own. They are all built here, one after another, so that
+	// nothing a constructor sets up is ever shared between two constructors running at once
+	struct Context
+	{
+		Graphics * g;
+		Simulation * sim;
+		Renderer * ren;
+	};
+	std::vector<Context> contexts;
+	for (int i = 0; i < threadCount; i++)
+	{
+		Context context;
+		context.g = new Graphics();
+		context.sim = new Simulation();
+		context.ren = new Renderer(context.g, context.sim);
+		contexts.push_back(context);
+	}
+	auto worker = [&](Context context) {
+		RNG rng;
+		RNG::SetThreadRNG(&rng);
+		Simulation * sim = context.sim;
+		Renderer * ren = context.ren;
+		for (int i = nextJob++; i < int(jobs.size()); i = nextJob++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			ByteString error;
+			std::vector<char> inputFile;
+			readFile(jobs[i].input, inputFile);
+			GameSave * gameSave = NULL;
+			if (!inputFile.size())
+				error = "Could not read file";
+			else
+			{
+				try
+				{
+					gameSave = new GameSave(inputFile);
+				}
+				catch (ParseException &e)
+				{
+					error = e.what();
+				}
+			}
+
+			sim->clear_sim();
+			ren->ClearAccumulation();
+			ren->clearScreen(1.0f);
+			if (gameSave && sim->Load(gameSave, true))
+			{
+				error = "Could not load save";
+				delete gameSave;
+				gameSave = NULL;
+			}
+			VideoBuffer screenBuffer = renderSave(ren, gameSave);
+			writeOutputs(jobs[i].outputPrefix, screenBuffer);
+			delete gameSave;
+
+			double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			std::lock_guard<std::mutex> l(outputMutex);
+			if (error.size())
+			{
+				failures++;
+				std::cout << "failed " << jobs[i].input << ": " << error << std::endl;
+			}
+			else
+				std::cout << "ok " << elapsed << " ms " << jobs[i].input << std::endl;
+		}
+		RNG::SetThreadRNG(nullptr);
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < threadCount; i++)
+		threads.push_back(std::thread(worker, contexts[i]));
+	for (auto &thread : threads)
+		thread.join();
+	for (auto &context : contexts)
+	{
+		delete context.ren;
+		delete context.sim;
+		delete context.g;
+	}
+
+	double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - batchStart).count();
+	std::cout << "Rendered " << (int(jobs.size()) - failures) << " of " << jobs.size() << " saves in " << elapsed << " ms with " << threadCount << " threads" << std::endl;
+	return failures ? 1 : 0;
+}
+
+// The self tests are built on top of the renderer and have a main of their own
+#ifndef TESTS
+int main(int argc, char *argv[])
+{
+	ui::Engine * engine;
+	ByteString outputPrefix, inputFilename;
+	std::vector<char> inputFile;
+
+	if (argc > 3 && ByteString(argv[1]) == "--batch")
+	{
+		int threadCount = argc > 4 ? ByteString(argv[4]).ToNumber<int>(true) : 0;
+		if (threadCount <= 0)
+			threadCount = std::max(int(std::thread::hardware_concurrency()), 1);
+		return renderBatch(argv[2], argv[3], threadCount);
+	}
+
+	inputFilename = argv[1];
+	outputPrefix = argv[2];
+
+	readFile(inputFilename, inputFile);
+
+	ui::Engine::Ref().g = new Graphics();
+
+	engine = &ui::Engine::Ref();
+	engine->Begin(WINDOWW, WINDOWH);
+
+	GameSave * gameSave = NULL;
+	try
+	{
+		gameSave = new GameSave(inputFile);
+	}
+	catch (ParseException &e)
+	{
+		//Render the save again later or something? I don't know
+		if (ByteString(e.what()).FromUtf8() == "Save from newer version")
+			throw e;
+	}
+
+	Simulation * sim = new Simulation();
+	Renderer * ren = new Renderer(ui::Engine::Ref().g, sim);
+
+	if (gameSave)
+		sim->Load(gameSave, true);
+
+	VideoBuffer screenBuffer = renderSave(ren, gameSave);
+	writeOutputs(outputPrefix, screenBuffer);
+}
+#endif
+
 #endif
@@ -34,6 +34,7 @@
 
 #include "Format.h"
 #include "Misc.h"
+#include "Benchmark.h"
 
 #include "graphics/Graphics.h"
 
@@ -285,6 +286,10 @@ std::map<ByteString, ByteString> readArguments(int argc, char * argv[])
 	arguments["open"] = "";
 	arguments["ddir"] = "";
 	arguments["ptsave"] = "";
+	arguments["benchmark"] = "";
+	arguments["frames"] = "";
+	arguments["threads"] = "";
+	arguments["render"] = "false";
 
 	for (int i=1; i<argc; i++)
 	{
@@ -339,6 +344,25 @@ std::map<ByteString, ByteString> readArguments(int argc, char * argv[])
 		{
 			arguments["disable-network"] = "true";
 		}
+		else if (!strncmp(argv[i], "benchmark", 10) && i+1<argc)
+		{
+			arguments["benchmark"] = argv[i+1];
+			i++;
+		}
+		else if (!strncmp(argv[i], "frames", 7) && i+1<argc)
+		{
+			arguments["frames"] = argv[i+1];
+			i++;
+		}
+		else if (!strncmp(argv[i], "threads", 8) && i+1<argc)
+		{
+			arguments["threads"] = argv[i+1];
+			i++;
+		}
+		else if (!strncmp(argv[i], "render", 7))
+		{
+			arguments["render"] = "true";
+		}
 	}
 	return arguments;
 }
@@ -651,6 +675,20 @@ int main(int argc, char * argv[])
 
 	std::map<ByteString, ByteString> arguments = readArguments(argc, argv);
 
+	if(arguments["benchmark"].length())
+	{
+		// runs without a window or the data directory, so the save path is relative to where it was started from
+#ifdef X86_SSE
+		_MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+#endif
+#ifdef X86_SSE3
+		_MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
+#endif
+		int frames = arguments["frames"].length() ? arguments["frames"].ToNumber<int>(true) : 1000;
+		int threads = arguments["threads"].length() ? arguments["threads"].ToNumber<int>(true) : 1;
+		return RunBenchmark(arguments["benchmark"], frames, arguments["render"] == "true", threads);
+	}
+
 	if(arguments["ddir"].length())
 #ifdef WIN
 		_chdir(arguments["ddir"].c_str());
@@ -42,6 +42,8 @@
 #include "client/SaveInfo.h"
 #include "client/SaveFile.h"
 #include "client/GameSave.h"
+#include "client/SaveWriterTask.h"
+#include "client/ThumbnailCache.h"
 #include "client/UserInfo.h"
 #include "client/http/Request.h"
 #include "client/http/RequestManager.h"
@@ -1053,7 +1055,7 @@ void Client::DeleteStamp(ByteString stampID)
 	updateStamps();
 }
 
-ByteString Client::AddStamp(GameSave * saveData)
+ByteString Client::prepareStamp(GameSave * saveData)
 {
 	unsigned t=(unsigned)time(NULL);
 	if (lastStampTime!=t)
@@ -1079,9 +1081,16 @@ ByteString Client::AddStamp(GameSave * saveData)
 		stampInfo["links"].append(Client::Ref().authors);
 	}
 	saveData->authors = stampInfo;
+	return saveID;
+}
+
+ByteString Client::AddStamp(GameSave * saveData)
+{
+	ByteString saveID = prepareStamp(saveData);
+	ByteString filename = STAMPS_DIR PATH_SEP + saveID + ".stm";
 
 	unsigned int gameDataLength;
-	char * gameData = saveData->Serialise(gameDataLength);
+	char * gameData = saveData->Serialise(gameDataLength, true);
 	if (gameData == NULL)
 		return "";
 
@@ -1099,6 +1108,21 @@ ByteString Client::AddStamp(GameSave * saveData)
 	return saveID;
 }
 
+SaveWriterTask * Client::AddStampAsync(GameSave * saveData, std::function<void (ByteString)> onDone)
+{
+	ByteString saveID = prepareStamp(saveData);
+	ByteString filename = STAMPS_DIR PATH_SEP + saveID + ".stm";
+	return new SaveWriterTask(saveData, filename, true, [this, saveID, onDone](bool success) {
+		if (success)
+		{
+			stampIDs.push_front(saveID);
+			updateStamps();
+		}
+		if (onDone)
+			onDone(success ? saveID : "");
+	});
+}
+
 void Client::updateStamps()
 {
 	MakeDirectory(STAMPS_DIR);
@@ -1483,7 +1507,9 @@ SaveFile * Client::LoadSaveFile(ByteString filename)
 	SaveFile * file = new SaveFile(filename);
 	try
 	{
-		GameSave * tempSave = new GameSave(ReadFile(filename));
+		std::vector<unsigned char> data = ReadFile(filename);
+		file->SetDataHash(ThumbnailCache::DataHash(data));
+		GameSave * tempSave = new GameSave(data);
 		file->SetGameSave(tempSave);
 	}
 	catch (ParseException & e)
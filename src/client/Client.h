@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <list>
+#include <functional>
 
 #include "common/String.h"
 #include "common/Singleton.h"
@@ -15,6 +16,7 @@ class SaveFile;
 class SaveComment;
 class GameSave;
 class VideoBuffer;
+class SaveWriterTask;
 
 enum LoginStatus {
 	LoginOkay, LoginError
@@ -63,6 +65,8 @@ private:
 	std::list<ByteString> stampIDs;
 	unsigned lastStampTime;
 	int lastStampName;
+	// Picks an ID for a new stamp and fills in its authorship info
+	ByteString prepareStamp(GameSave * saveData);
 
 	//Auth session
 	User authUser;
@@ -131,6 +135,10 @@ public:
 	SaveFile * GetStamp(ByteString stampID);
 	void DeleteStamp(ByteString stampID);
 	ByteString AddStamp(GameSave * saveData);
+	// Returns a task that writes the stamp in the background, it isn't listed with the other stamps until the
+	// task has been polled after finishing. Takes ownership of saveData. onDone gets the stamp ID, or an empty
+	// string if it couldn't be written
+	SaveWriterTask * AddStampAsync(GameSave * saveData, std::function<void (ByteString)> onDone = nullptr);
 	std::vector<ByteString> GetStamps(int start, int count);
 	void RescanStamps();
 	int GetStampsCount();
@@ -5,13 +5,19 @@
 #include <climits>
 #include <memory>
 #include <set>
+#include <thread>
+#include <mutex>
+#include <functional>
 #include <bzlib.h>
+#include <zlib.h>
 #include <cmath>
 
 #include "Config.h"
 #include "Format.h"
 #include "hmap.h"
 
+#include "common/ThreadPool.h"
+
 #include "simulation/Simulation.h"
 #include "simulation/ElementClasses.h"
 
@@ -25,6 +31,7 @@ GameSave::GameSave(GameSave & save):
 	gravityMode(save.gravityMode),
 	airMode(save.airMode),
 	edgeMode(save.edgeMode),
+	rngSeed(save.rngSeed),
 	signs(save.signs),
 	stkm(save.stkm),
 	palette(save.palette),
@@ -93,7 +100,7 @@ GameSave::GameSave(std::vector<char> data)
 	Collapse();
 }
 
-GameSave::GameSave(std::vector<unsigned char> data)
+GameSave::GameSave(std::vector<unsigned char> data, bool metadataOnly)
 {
 	blockWidth = 0;
 	blockHeight = 0;
@@ -105,7 +112,10 @@ GameSave::GameSave(std::vector<unsigned char> data)
 	originalData = std::vector<char>(data.begin(), data.end());
 	try
 	{
-		Expand();
+		if (metadataOnly)
+			readMetadata(&originalData[0], originalData.size());
+		else
+			Expand();
 	}
 	catch(ParseException & e)
 	{
@@ -172,6 +182,7 @@ void GameSave::InitVars()
 	gravityMode = 0;
 	airMode = 0;
 	edgeMode = 0;
+	rngSeed = 0;
 	translated.x = translated.y = 0;
 	pmapbits = 8; // default to 8 bits for older saves
 }
@@ -211,7 +222,7 @@ void GameSave::read(char * data, int dataSize)
 		}
 		else if(data[0] == 'O' && data[1] == 'P' && data[2] == 'S')
 		{
-			if (data[3] != '1')
+			if (data[3] != '1' && data[3] != '2')
 				throw ParseException(ParseException::WrongVersion, "Save format from newer version");
 			readOPS(data, dataSize);
 		}
@@ -256,10 +267,10 @@ void GameSave::setSize(int newWidth, int newHeight)
 	ambientHeat = Allocate2DArray<float>(blockWidth, blockHeight, 0.0f);
 }
 
-std::vector<char> GameSave::Serialise()
+std::vector<char> GameSave::Serialise(bool chunked)
 {
 	unsigned int dataSize;
-	char * data = Serialise(dataSize);
+	char * data = Serialise(dataSize, chunked);
 	if (data == NULL)
 		return std::vector<char>();
 	std::vector<char> dataVect(data, data+dataSize);
@@ -267,11 +278,11 @@ std::vector<char> GameSave::Serialise()
 	return dataVect;
 }
 
-char * GameSave::Serialise(unsigned int & dataSize)
+char * GameSave::Serialise(unsigned int & dataSize, bool chunked)
 {
 	try
 	{
-		return serialiseOPS(dataSize);
+		return serialiseOPS(dataSize, chunked);
 	}
 	catch (BuildException & e)
 	{
@@ -560,6 +571,180 @@ void GameSave::CheckBsonFieldInt(bson_iterator iter, const char *field, int *set
 	}
 }
 
+// OPS2 saves hold the same BSON document as OPS1, but the large binary fields are taken out of it and
+// compressed separately with zlib, so that they can be compressed and decompressed in parallel.
+//   0-7: 'O' 'P' 'S' '2', save version, CELL, width and height in blocks, as in OPS1
+//   8-11: number of chunks
+//   then for each chunk: length of its name (1 byte), name, size (4 bytes), compressed size (4 bytes)
+//   then the compressed data of each chunk, in the same order
+// The first chunk is the BSON document, the others are named after the BSON fields they replace.
+struct SaveChunk
+{
+	ByteString name;
+	std::vector<unsigned char> data;
+	std::vector<unsigned char> compressed;
+	bool failed = false;
+};
+
+// Chunks smaller than this in total aren't worth handing to other threads
+static const size_t parallelChunkBytes = 256*1024;
+
+// Runs fn for each chunk, on the shared chunk pool if the chunks are large enough and nothing else is using it.
+// Saves are loaded and built from several threads at once (thumbnails, the save writer), and a ThreadPool only
+// runs one batch at a time, so whoever finds it busy just works through its own chunks instead of waiting
+static void forEachChunk(int count, size_t totalBytes, std::function<void (int)> fn)
+{
+	static std::mutex poolMutex;
+	static ThreadPool pool(std::max(1, std::min(8, int(std::thread::hardware_concurrency()))));
+	if (count > 1 && totalBytes >= parallelChunkBytes && pool.ThreadCount() > 1)
+	{
+		std::unique_lock<std::mutex> lock(poolMutex, std::try_to_lock);
+		if (lock.owns_lock())
+		{
+			pool.ParallelFor(count, fn);
+			return;
+		}
+	}
+	for (int i = 0; i < count; i++)
+		fn(i);
+}
+
+static void writeInt32(std::vector<unsigned char> &out, unsigned int value)
+{
+	out.push_back(value);
+	out.push_back(value >> 8);
+	out.push_back(value >> 16);
+	out.push_back(value >> 24);
+}
+
+static unsigned int readInt32(const unsigned char *data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((unsigned int)data[3] << 24);
+}
+
+// Only the first chunk, which holds the BSON, is decompressed if bsonOnly is set
+static std::vector<SaveChunk> readChunks(const unsigned char *data, unsigned int dataLength, bool bsonOnly = false)
+{
+	unsigned int pos = 12;
+	if (dataLength < pos)
+		throw ParseException(ParseException::Corrupt, "Chunk table missing");
+	unsigned int count = readInt32(data+8);
+	if (count < 1 || count > 64)
+		throw ParseException(ParseException::Corrupt, "Invalid chunk count");
+	std::vector<SaveChunk> chunks(count);
+	std::vector<unsigned int> sizes(count), compressedSizes(count);
+	for (auto i = 0U; i < count; i++)
+	{
+		if (pos >= dataLength || pos+1+data[pos]+8 > dataLength)
+			throw ParseException(ParseException::Corrupt, "Chunk table truncated");
+		unsigned int nameLength = data[pos];
+		chunks[i].name = ByteString((const char *)data+pos+1, (const char *)data+pos+1+nameLength);
+		pos += 1+nameLength;
+		unsigned int size = readInt32(data+pos);
+		//Check for overflows, don't load saves larger than 200MB
+		if (size > 209715200)
+			throw ParseException(ParseException::InvalidDimensions, "Save data too large, refusing");
+		sizes[i] = size;
+		compressedSizes[i] = readInt32(data+pos+4);
+		pos += 8;
+	}
+	std::vector<unsigned int> offsets(count);
+	for (auto i = 0U; i < count; i++)
+	{
+		if (compressedSizes[i] > dataLength-pos)
+			throw ParseException(ParseException::Corrupt, "Chunk data truncated");
+		offsets[i] = pos;
+		pos += compressedSizes[i];
+	}
+	// The limit applies to the whole save, not to each chunk, and the buffers are allocated here rather than
+	// in the workers so that running out of memory throws on this thread
+	unsigned int decodeCount = bsonOnly ? 1 : count;
+	size_t totalSize = 0;
+	for (auto i = 0U; i < decodeCount; i++)
+		totalSize += sizes[i];
+	if (totalSize > 209715200)
+		throw ParseException(ParseException::InvalidDimensions, "Save data too large, refusing");
+	try
+	{
+		for (auto i = 0U; i < decodeCount; i++)
+			chunks[i].data.resize(sizes[i]);
+	}
+	catch (std::bad_alloc &)
+	{
+		throw ParseException(ParseException::InvalidDimensions, "Save data too large, refusing");
+	}
+	forEachChunk(decodeCount, totalSize, [&](int i) {
+		uLongf size = sizes[i];
+		if (!size)
+			return;
+		if (uncompress(&chunks[i].data[0], &size, data+offsets[i], compressedSizes[i]) != Z_OK || size != chunks[i].data.size())
+			chunks[i].failed = true;
+	});
+	for (auto &chunk : chunks)
+		if (chunk.failed)
+			throw ParseException(ParseException::Corrupt, "Unable to decompress chunk " + chunk.name.FromUtf8());
+	return chunks;
+}
+
+// Reads the size, version and authors of a save without decompressing particles, walls or air. OPS1 saves
+// keep everything in one bzip2 stream with the authors written last, so only the header of those is read.
+// Saves in older formats are read in full
+void GameSave::readMetadata(char * data, int dataLength)
+{
+	unsigned char *inputData = (unsigned char*)data;
+	if (dataLength <= 15 || inputData[0] != 'O' || inputData[1] != 'P' || inputData[2] != 'S')
+	{
+		Expand();
+		return;
+	}
+	if (inputData[3] != '1' && inputData[3] != '2')
+		throw ParseException(ParseException::WrongVersion, "Save format from newer version");
+
+	majorVersion = inputData[4];
+	minorVersion = 0;
+	fromNewerVersion = majorVersion > SAVE_VERSION;
+	if (inputData[5] != CELL)
+		throw ParseException(ParseException::InvalidDimensions, "Incorrect CELL size");
+	if (inputData[6] > XRES/CELL || inputData[7] > YRES/CELL)
+		throw ParseException(ParseException::InvalidDimensions, "Save too large");
+	blockWidth = inputData[6];
+	blockHeight = inputData[7];
+	if (inputData[3] != '2')
+		return;
+
+	std::vector<SaveChunk> chunks = readChunks(inputData, dataLength, true);
+	std::vector<unsigned char> &bsonData = chunks[0].data;
+	//Null terminated for the same reason as in readOPS
+	bsonData.push_back(0);
+
+	bson b;
+	b.data = NULL;
+	bson_iterator iter;
+	set_bson_err_handler([](const char* err) { throw ParseException(ParseException::Corrupt, "BSON error when parsing save: " + ByteString(err).FromUtf8()); });
+	bson_init_data_size(&b, (char*)&bsonData[0], bsonData.size()-1);
+	bson_iterator_init(&iter, &b);
+	while (bson_iterator_next(&iter))
+	{
+		if (!strcmp(bson_iterator_key(&iter), "origin") && bson_iterator_type(&iter) == BSON_OBJECT)
+		{
+			bson_iterator subiter;
+			bson_iterator_subiterator(&iter, &subiter);
+			while (bson_iterator_next(&subiter))
+			{
+				if (bson_iterator_type(&subiter) == BSON_INT && !strcmp(bson_iterator_key(&subiter), "minorVersion"))
+					minorVersion = bson_iterator_int(&subiter);
+			}
+		}
+#ifndef RENDERER
+		else if (!strcmp(bson_iterator_key(&iter), "authors") && bson_iterator_type(&iter) == BSON_OBJECT)
+		{
+			authors.clear();
+			ConvertBsonToJson(&iter, &authors);
+		}
+#endif
+	}
+}
+
 void GameSave::readOPS(char * data, int dataLength)
 {
 	unsigned char *inputData = (unsigned char*)data, *bsonData = NULL, *partsData = NULL, *partsPosData = NULL, *fanData = NULL, *wallData = NULL, *soapLinkData = NULL;
@@ -609,10 +794,19 @@ void GameSave::readOPS(char * data, int dataLength)
 
 	setSize(blockW, blockH);
 
-	bsonDataLen = ((unsigned)inputData[8]);
-	bsonDataLen |= ((unsigned)inputData[9]) << 8;
-	bsonDataLen |= ((unsigned)inputData[10]) << 16;
-	bsonDataLen |= ((unsigned)inputData[11]) << 24;
+	std::vector<SaveChunk> chunks;
+	if (inputData[3] == '2')
+	{
+		chunks = readChunks(inputData, inputDataLen);
+		bsonDataLen = chunks[0].data.size();
+	}
+	else
+	{
+		bsonDataLen = ((unsigned)inputData[8]);
+		bsonDataLen |= ((unsigned)inputData[9]) << 8;
+		bsonDataLen |= ((unsigned)inputData[10]) << 16;
+		bsonDataLen |= ((unsigned)inputData[11]) << 24;
+	}
 
 	//Check for overflows, don't load saves larger than 200MB
 	unsigned int toAlloc = bsonDataLen+1;
@@ -627,10 +821,17 @@ void GameSave::readOPS(char * data, int dataLength)
 	//(bson_iterator_key returns a pointer into bsonData, which is then used with strcmp)
 	bsonData[bsonDataLen] = 0;
 
-	int bz2ret;
-	if ((bz2ret = BZ2_bzBuffToBuffDecompress((char*)bsonData, &bsonDataLen, (char*)(inputData+12), inputDataLen-12, 0, 0)) != BZ_OK)
+	if (chunks.size())
+	{
+		std::copy(chunks[0].data.begin(), chunks[0].data.end(), bsonData);
+	}
+	else
 	{
-		throw ParseException(ParseException::Corrupt, String::Build("Unable to decompress (ret ", bz2ret, ")"));
+		int bz2ret;
+		if ((bz2ret = BZ2_bzBuffToBuffDecompress((char*)bsonData, &bsonDataLen, (char*)(inputData+12), inputDataLen-12, 0, 0)) != BZ_OK)
+		{
+			throw ParseException(ParseException::Corrupt, String::Build("Unable to decompress (ret ", bz2ret, ")"));
+		}
 	}
 
 	set_bson_err_handler([](const char* err) { throw ParseException(ParseException::Corrupt, "BSON error when parsing save: " + ByteString(err).FromUtf8()); });
@@ -659,6 +860,8 @@ void GameSave::readOPS(char * data, int dataLength)
 		CheckBsonFieldInt(iter, "airMode", &airMode);
 		CheckBsonFieldInt(iter, "edgeMode", &edgeMode);
 		CheckBsonFieldInt(iter, "pmapbits", &pmapbits);
+		if (!strcmp(bson_iterator_key(&iter), "rngSeed") && bson_iterator_type(&iter) == BSON_INT)
+			rngSeed = bson_iterator_int(&iter);
 		if (!strcmp(bson_iterator_key(&iter), "signs"))
 		{
 			if (bson_iterator_type(&iter)==BSON_ARRAY)
@@ -856,6 +1059,35 @@ void GameSave::readOPS(char * data, int dataLength)
 #endif
 	}
 
+	//Binary fields stored in their own chunks
+	struct
+	{
+		const char *name;
+		unsigned char **data;
+		unsigned int *length;
+	} chunkFields[] = {
+		{ "parts", &partsData, &partsDataLen },
+		{ "partsPos", &partsPosData, &partsPosDataLen },
+		{ "wallMap", &wallData, &wallDataLen },
+		{ "pressMap", &pressData, &pressDataLen },
+		{ "vxMap", &vxData, &vxDataLen },
+		{ "vyMap", &vyData, &vyDataLen },
+		{ "ambientMap", &ambientData, &ambientDataLen },
+		{ "fanMap", &fanData, &fanDataLen },
+		{ "soapLinks", &soapLinkData, &soapLinkDataLen },
+	};
+	for (size_t i = 1; i < chunks.size(); i++)
+	{
+		for (auto &field : chunkFields)
+		{
+			if (chunks[i].name == field.name && chunks[i].data.size())
+			{
+				*field.data = &chunks[i].data[0];
+				*field.length = chunks[i].data.size();
+			}
+		}
+	}
+
 	//Read wall and fan data
 	if(wallData)
 	{
@@ -2010,7 +2242,7 @@ void GameSave::readPSv(char * saveDataChar, int dataLength)
 	blameSimon_minor = minor;\
 }
 
-char * GameSave::serialiseOPS(unsigned int & dataLength)
+char * GameSave::serialiseOPS(unsigned int & dataLength, bool chunked)
 {
 	int blockX, blockY, blockW, blockH, fullX, fullY, fullW, fullH;
 	int x, y, i;
@@ -2484,6 +2716,20 @@ char * GameSave::serialiseOPS(unsigned int & dataLength)
 	// Use unique_ptr with a custom deleter to ensure that bson_destroy is called even when an exception is thrown
 	std::unique_ptr<bson, decltype(bson_deleter)> b_ptr(&b, bson_deleter);
 
+	// Binary fields go in their own chunks in chunked saves, and in the BSON document otherwise
+	std::vector<SaveChunk> chunks(1);
+	std::vector<std::pair<const unsigned char *, unsigned int>> chunkSources(1);
+	auto appendBinary = [&b, &chunks, &chunkSources, chunked](const char *name, const unsigned char *data, unsigned int length) {
+		if (chunked)
+		{
+			chunks.push_back(SaveChunk());
+			chunks.back().name = name;
+			chunkSources.push_back(std::make_pair(data, length));
+		}
+		else
+			bson_append_binary(&b, name, (char)BSON_BIN_USER, (const char *)data, length);
+	};
+
 	set_bson_err_handler([](const char* err) { throw BuildException("BSON error when parsing save: " + ByteString(err).FromUtf8()); });
 	bson_init(&b);
 	bson_append_start_object(&b, "origin");
@@ -2512,6 +2758,8 @@ char * GameSave::serialiseOPS(unsigned int & dataLength)
 	bson_append_int(&b, "gravityMode", gravityMode);
 	bson_append_int(&b, "airMode", airMode);
 	bson_append_int(&b, "edgeMode", edgeMode);
+	if (rngSeed)
+		bson_append_int(&b, "rngSeed", rngSeed);
 
 	if (stkm.hasData())
 	{
@@ -2544,7 +2792,7 @@ char * GameSave::serialiseOPS(unsigned int & dataLength)
 	bson_append_int(&b, "pmapbits", pmapbits);
 	if (partsData && partsDataLen)
 	{
-		bson_append_binary(&b, "parts", BSON_BIN_USER, (const char *)partsData.get(), partsDataLen);
+		appendBinary("parts", partsData.get(), partsDataLen);
 
 		if (palette.size())
 		{
@@ -2557,22 +2805,22 @@ char * GameSave::serialiseOPS(unsigned int & dataLength)
 		}
 
 		if (partsPosData && partsPosDataLen)
-			bson_append_binary(&b, "partsPos", BSON_BIN_USER, (const char *)partsPosData.get(), partsPosDataLen);
+			appendBinary("partsPos", partsPosData.get(), partsPosDataLen);
 	}
 	if (wallData && hasWallData)
-		bson_append_binary(&b, "wallMap", BSON_BIN_USER, (const char *)wallData.get(), wallDataLen);
+		appendBinary("wallMap", wallData.get(), wallDataLen);
 	if (fanData && fanDataLen)
-		bson_append_binary(&b, "fanMap", BSON_BIN_USER, (const char *)fanData.get(), fanDataLen);
+		appendBinary("fanMap", fanData.get(), fanDataLen);
 	if (pressData && hasPressure && pressDataLen)
-		bson_append_binary(&b, "pressMap", (char)BSON_BIN_USER, (const char*)pressData.get(), pressDataLen);
+		appendBinary("pressMap", pressData.get(), pressDataLen);
 	if (vxData && hasPressure && vxDataLen)
-		bson_append_binary(&b, "vxMap", (char)BSON_BIN_USER, (const char*)vxData.get(), vxDataLen);
+		appendBinary("vxMap", vxData.get(), vxDataLen);
 	if (vyData && hasPressure && vyDataLen)
-		bson_append_binary(&b, "vyMap", (char)BSON_BIN_USER, (const char*)vyData.get(), vyDataLen);
+		appendBinary("vyMap", vyData.get(), vyDataLen);
 	if (ambientData && hasAmbientHeat && this->aheatEnable && ambientDataLen)
-		bson_append_binary(&b, "ambientMap", (char)BSON_BIN_USER, (const char*)ambientData.get(), ambientDataLen);
+		appendBinary("ambientMap", ambientData.get(), ambientDataLen);
 	if (soapLinkData && soapLinkDataLen)
-		bson_append_binary(&b, "soapLinks", BSON_BIN_USER, (const char *)soapLinkData, soapLinkDataLen);
+		appendBinary("soapLinks", soapLinkData, soapLinkDataLen);
 	unsigned int signsCount = 0;
 	for (size_t i = 0; i < signs.size(); i++)
 	{
@@ -2609,6 +2857,43 @@ char * GameSave::serialiseOPS(unsigned int & dataLength)
 
 	unsigned char *finalData = (unsigned char*)bson_data(&b);
 	unsigned int finalDataLen = bson_size(&b);
+	if (chunked)
+	{
+		chunks[0].name = "bson";
+		chunkSources[0] = std::make_pair(finalData, finalDataLen);
+		size_t totalSize = 0;
+		for (size_t i = 0; i < chunks.size(); i++)
+		{
+			totalSize += chunkSources[i].second;
+			chunks[i].compressed.resize(compressBound(chunkSources[i].second));
+		}
+		forEachChunk(chunks.size(), totalSize, [&chunks, &chunkSources](int i) {
+			uLongf compressedSize = chunks[i].compressed.size();
+			if (compress2(&chunks[i].compressed[0], &compressedSize, chunkSources[i].first, chunkSources[i].second, Z_BEST_SPEED) != Z_OK)
+				chunks[i].failed = true;
+			chunks[i].compressed.resize(compressedSize);
+		});
+
+		std::vector<unsigned char> output = { 'O', 'P', 'S', '2', SAVE_VERSION, CELL, (unsigned char)blockW, (unsigned char)blockH };
+		writeInt32(output, chunks.size());
+		for (size_t i = 0; i < chunks.size(); i++)
+		{
+			if (chunks[i].failed)
+				throw BuildException("Save error, could not compress " + chunks[i].name.FromUtf8());
+			output.push_back(chunks[i].name.size());
+			output.insert(output.end(), chunks[i].name.begin(), chunks[i].name.end());
+			writeInt32(output, chunkSources[i].second);
+			writeInt32(output, chunks[i].compressed.size());
+		}
+		for (auto &chunk : chunks)
+			output.insert(output.end(), chunk.compressed.begin(), chunk.compressed.end());
+
+		dataLength = output.size();
+		char *saveData = new char[dataLength];
+		std::copy(output.begin(), output.end(), &saveData[0]);
+		return saveData;
+	}
+
 	auto outputData = std::unique_ptr<unsigned char[]>(new unsigned char[finalDataLen*2+12]);
 	if (!outputData)
 		throw BuildException(String::Build("Save error, out of memory (finalData): ", finalDataLen*2+12));
@@ -97,6 +97,7 @@ public:
 	int gravityMode;
 	int airMode;
 	int edgeMode;
+	unsigned int rngSeed; // seed of a deterministic simulation, see Simulation::deterministic
 
 	//Signs
 	std::vector<sign> signs;
@@ -116,11 +117,15 @@ public:
 	GameSave(int width, int height);
 	GameSave(char * data, int dataSize);
 	GameSave(std::vector<char> data);
-	GameSave(std::vector<unsigned char> data);
+	// With metadataOnly, only the size, version and authors are read until the save is expanded, which may then
+	// throw ParseException if the rest of the save is corrupt
+	GameSave(std::vector<unsigned char> data, bool metadataOnly = false);
 	~GameSave();
 	void setSize(int width, int height);
-	char * Serialise(unsigned int & dataSize);
-	std::vector<char> Serialise();
+	// Chunked (OPS2) saves are compressed and decompressed in parallel with a faster codec, but older
+	// versions and the server only read OPS1, so they are only used for files that stay on this machine
+	char * Serialise(unsigned int & dataSize, bool chunked = false);
+	std::vector<char> Serialise(bool chunked = false);
 	vector2d Translate(vector2d translate);
 	void Transform(matrix2d transform, vector2d translate);
 	void Transform(matrix2d transform, vector2d translate, vector2d translateReal, int newWidth, int newHeight);
@@ -153,9 +158,10 @@ private:
 	template <typename T> void Deallocate2DArray(T ***array, int blockHeight);
 	void dealloc();
 	void read(char * data, int dataSize);
+	void readMetadata(char * data, int dataLength);
 	void readOPS(char * data, int dataLength);
 	void readPSv(char * data, int dataLength);
-	char * serialiseOPS(unsigned int & dataSize);
+	char * serialiseOPS(unsigned int & dataSize, bool chunked);
 	void ConvertJsonToBson(bson *b, Json::Value j, int depth = 0);
 	void ConvertBsonToJson(bson_iterator *b, Json::Value *j, int depth = 0);
 };
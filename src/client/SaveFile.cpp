@@ -5,7 +5,8 @@ SaveFile::SaveFile(SaveFile & save):
 	gameSave(NULL),
 	filename(save.filename),
 	displayName(save.displayName),
-	loadingError(save.loadingError)
+	loadingError(save.loadingError),
+	dataHash(save.dataHash)
 {
 	if (save.gameSave)
 		gameSave = new GameSave(*save.gameSave);
@@ -15,7 +16,8 @@ SaveFile::SaveFile(ByteString filename):
 	gameSave(NULL),
 	filename(filename),
 	displayName(filename.FromUtf8()),
-	loadingError("")
+	loadingError(""),
+	dataHash("")
 {
 
 }
@@ -60,6 +62,16 @@ void SaveFile::SetLoadingError(String error)
 	loadingError = error;
 }
 
+ByteString SaveFile::GetDataHash()
+{
+	return dataHash;
+}
+
+void SaveFile::SetDataHash(ByteString dataHash)
+{
+	this->dataHash = dataHash;
+}
+
 SaveFile::~SaveFile() {
 	delete gameSave;
 }
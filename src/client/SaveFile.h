@@ -18,6 +18,9 @@ public:
 	void SetFileName(ByteString fileName);
 	String GetError();
 	void SetLoadingError(String error);
+	// Hash of the file's contents, see ThumbnailCache::DataHash. Empty if it isn't known
+	ByteString GetDataHash();
+	void SetDataHash(ByteString dataHash);
 
 	virtual ~SaveFile();
 private:
@@ -25,6 +28,7 @@ private:
 	ByteString filename;
 	String displayName;
 	String loadingError;
+	ByteString dataHash;
 };
 
 #endif /* SAVEFILE_H_ */
@@ -0,0 +1,45 @@
+#include "SaveWriterTask.h"
+
+#include "client/Client.h"
+#include "client/GameSave.h"
+
+SaveWriterTask::SaveWriterTask(GameSave *save, ByteString filename, bool chunked, std::function<void (bool)> onDone) :
+	Save(save),
+	Filename(filename),
+	Chunked(chunked),
+	OnDone(onDone)
+{
+}
+
+SaveWriterTask::~SaveWriterTask()
+{
+}
+
+bool SaveWriterTask::doWork()
+{
+	notifyStatus("Serialising save");
+	notifyProgress(0);
+	std::vector<char> saveData = Save->Serialise(Chunked);
+	Save.reset();
+	if (saveData.size() == 0)
+	{
+		notifyError("Unable to serialize game data.");
+		return false;
+	}
+	notifyStatus("Writing " + Filename.FromUtf8());
+	notifyProgress(50);
+	// WriteFile doesn't touch any of Client's state, so it's safe to call from here
+	if (Client::Ref().WriteFile(saveData, Filename))
+	{
+		notifyError("Unable to write save file.");
+		return false;
+	}
+	notifyProgress(100);
+	return true;
+}
+
+void SaveWriterTask::after()
+{
+	if (OnDone)
+		OnDone(success);
+}
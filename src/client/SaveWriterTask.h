@@ -0,0 +1,31 @@
+#ifndef SAVEWRITERTASK_H
+#define SAVEWRITERTASK_H
+
+#include "tasks/AbandonableTask.h"
+
+#include <functional>
+#include <memory>
+
+#include "common/String.h"
+
+class GameSave;
+// Serialises a save and writes it to a file on its own thread, so that big saves don't stall the game.
+// Takes ownership of the save, which should be a copy nothing else uses. onDone is called with the
+// result on the thread that polls the task, once it has finished
+class SaveWriterTask : public AbandonableTask
+{
+	std::unique_ptr<GameSave> Save;
+	ByteString Filename;
+	bool Chunked;
+	std::function<void (bool)> OnDone;
+
+public:
+	SaveWriterTask(GameSave *save, ByteString filename, bool chunked, std::function<void (bool)> onDone = nullptr);
+	virtual ~SaveWriterTask();
+
+	virtual bool doWork() override;
+	virtual void after() override;
+	ByteString GetFilename() { return Filename; }
+};
+
+#endif // SAVEWRITERTASK_H
@@ -0,0 +1,123 @@
+#include "ThumbnailCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <sys/stat.h>
+
+#include "Config.h"
+#include "Format.h"
+#include "client/Client.h"
+#include "client/MD5.h"
+#include "graphics/Graphics.h"
+
+ThumbnailCache::ThumbnailCache():
+	ThumbnailCache(THUMBNAIL_CACHE_DIR, (unsigned long)std::max(Client::Ref().GetPrefInteger("ThumbnailCacheSize", 16384), 0) * 1024)
+{
+}
+
+ThumbnailCache::ThumbnailCache(ByteString directory, unsigned long maxSize):
+	directory(directory),
+	totalSize(0),
+	maxSize(maxSize),
+	loaded(false)
+{
+}
+
+ByteString ThumbnailCache::DataHash(const std::vector<unsigned char> &data)
+{
+	char hash[33];
+	md5_ascii(hash, data.size() ? &data[0] : nullptr, data.size());
+	return ByteString(hash);
+}
+
+ByteString ThumbnailCache::Key(ByteString dataHash, int width, int height, bool autoRescale, bool decorations, bool fire)
+{
+	return ByteString::Build(dataHash, "-", width, "x", height, "-", autoRescale ? 1 : 0, decorations ? 1 : 0, fire ? 1 : 0);
+}
+
+ByteString ThumbnailCache::entryFile(ByteString key)
+{
+	return ByteString::Build(directory, PATH_SEP, key, ".pti");
+}
+
+// The order thumbnails were last used in isn't saved, the files' modification times are the best guess
+void ThumbnailCache::loadIndex()
+{
+	if (loaded)
+		return;
+	loaded = true;
+	Client::Ref().MakeDirectory(directory.c_str());
+
+	std::vector<std::pair<time_t, Entry> > found;
+	for (auto &filename : Client::Ref().DirectorySearch(directory, "", ".pti"))
+	{
+#ifdef WIN
+		struct _stat s;
+		if (_stat(filename.c_str(), &s))
+#else
+		struct stat s;
+		if (stat(filename.c_str(), &s))
+#endif
+			continue;
+		ByteString key = filename.SplitFromEndBy(PATH_SEP).After();
+		key = key.SplitFromEndBy('.').Before();
+		found.push_back(std::make_pair(s.st_mtime, Entry{ key, (unsigned int)s.st_size }));
+	}
+	std::sort(found.begin(), found.end(), [](const std::pair<time_t, Entry> &a, const std::pair<time_t, Entry> &b) {
+		return a.first < b.first;
+	});
+	for (auto &entry : found)
+	{
+		entryMap[entry.second.key] = entries.insert(entries.end(), entry.second);
+		totalSize += entry.second.size;
+	}
+	evict();
+}
+
+void ThumbnailCache::evict()
+{
+	while (totalSize > maxSize && entries.size())
+	{
+		Entry &oldest = entries.front();
+		remove(entryFile(oldest.key).c_str());
+		totalSize -= oldest.size;
+		entryMap.erase(oldest.key);
+		entries.pop_front();
+	}
+}
+
+VideoBuffer * ThumbnailCache::Get(ByteString key)
+{
+	std::lock_guard<std::mutex> g(cacheMutex);
+	loadIndex();
+	auto it = entryMap.find(key);
+	if (it == entryMap.end())
+		return nullptr;
+
+	std::vector<unsigned char> data = Client::Ref().ReadFile(entryFile(key));
+	std::vector<char> ptiData(data.begin(), data.end());
+	VideoBuffer * thumbnail = ptiData.size() ? format::PTIToVideoBuffer(ptiData) : nullptr;
+	if (!thumbnail)
+	{
+		// Missing or corrupt, forget about it so it gets rendered and stored again
+		remove(entryFile(key).c_str());
+		totalSize -= it->second->size;
+		entries.erase(it->second);
+		entryMap.erase(it);
+		return nullptr;
+	}
+	entries.splice(entries.end(), entries, it->second);
+	return thumbnail;
+}
+
+void ThumbnailCache::Put(ByteString key, const VideoBuffer &thumbnail)
+{
+	std::vector<char> data = format::VideoBufferToPTI(thumbnail);
+	std::lock_guard<std::mutex> g(cacheMutex);
+	loadIndex();
+	if (!maxSize || entryMap.count(key) || Client::Ref().WriteFile(data, entryFile(key)))
+		return;
+	entryMap[key] = entries.insert(entries.end(), Entry{ key, (unsigned int)data.size() });
+	totalSize += data.size();
+	evict();
+}
@@ -0,0 +1,50 @@
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include "common/Singleton.h"
+#include "common/String.h"
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <vector>
+
+class VideoBuffer;
+// Keeps rendered thumbnails of local saves and stamps on disk as PTI files, so browsing a folder doesn't
+// have to simulate and render every save again. Entries are named after a hash of the save data and the
+// way the thumbnail was rendered, and the least recently used ones are removed once the cache grows past
+// the ThumbnailCacheSize preference (in kilobytes). Safe to use from several threads
+class ThumbnailCache : public Singleton<ThumbnailCache>
+{
+	struct Entry
+	{
+		ByteString key;
+		unsigned int size;
+	};
+	std::list<Entry> entries; // least recently used first
+	std::map<ByteString, std::list<Entry>::iterator> entryMap;
+	ByteString directory;
+	unsigned long totalSize;
+	unsigned long maxSize;
+	bool loaded;
+	std::mutex cacheMutex;
+
+	void loadIndex();
+	void evict();
+	ByteString entryFile(ByteString key);
+
+public:
+	ThumbnailCache();
+	// A cache of its own in another directory, maxSize is in bytes
+	ThumbnailCache(ByteString directory, unsigned long maxSize);
+
+	// Hash of the save data a thumbnail is rendered from
+	static ByteString DataHash(const std::vector<unsigned char> &data);
+	static ByteString Key(ByteString dataHash, int width, int height, bool autoRescale, bool decorations, bool fire);
+
+	// Returns nullptr if there is no thumbnail for the key
+	VideoBuffer * Get(ByteString key);
+	void Put(ByteString key, const VideoBuffer &thumbnail);
+};
+
+#endif // THUMBNAILCACHE_H
@@ -5,6 +5,7 @@
 #include "graphics/Graphics.h"
 #include "simulation/SaveRenderer.h"
 #include "client/GameSave.h"
+#include "client/ThumbnailCache.h"
 
 ThumbnailRendererTask::ThumbnailRendererTask(GameSave *save, int width, int height, bool autoRescale, bool decorations, bool fire) :
 	Save(new GameSave(*save)),
@@ -39,6 +40,8 @@ bool ThumbnailRendererTask::doWork()
 		{
 			thumbnail->Resize(Width, Height, true);
 		}
+		if (CacheKey.length())
+			ThumbnailCache::Ref().Put(CacheKey, *thumbnail);
 		return true;
 	}
 	else
@@ -5,6 +5,8 @@
 
 #include <memory>
 
+#include "common/String.h"
+
 class GameSave;
 class VideoBuffer;
 class ThumbnailRendererTask : public AbandonableTask
@@ -14,12 +16,16 @@ class ThumbnailRendererTask : public AbandonableTask
 	bool Decorations;
 	bool Fire;
 	bool AutoRescale;
+	ByteString CacheKey;
 	std::unique_ptr<VideoBuffer> thumbnail;
 
 public:
 	ThumbnailRendererTask(GameSave *save, int width, int height, bool autoRescale = false, bool decorations = true, bool fire = true);
 	virtual ~ThumbnailRendererTask();
 
+	// The finished thumbnail is also stored in the ThumbnailCache under this key
+	void SetCacheKey(ByteString cacheKey) { CacheKey = cacheKey; }
+
 	virtual bool doWork() override;
 	std::unique_ptr<VideoBuffer> Finish();
 };
@@ -0,0 +1,65 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int threadCount)
+{
+	for (int i = 1; i < threadCount; i++)
+		workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(poolMutex);
+		stopping = true;
+	}
+	workCv.notify_all();
+	for (auto &worker : workers)
+		worker.join();
+}
+
+void ThreadPool::runJobs(std::unique_lock<std::mutex> &lock)
+{
+	while (nextJob < jobCount)
+	{
+		int index = nextJob++;
+		lock.unlock();
+		job(index);
+		lock.lock();
+		if (!--pending)
+			doneCv.notify_all();
+	}
+}
+
+void ThreadPool::workerLoop()
+{
+	std::unique_lock<std::mutex> lock(poolMutex);
+	while (true)
+	{
+		workCv.wait(lock, [this] { return stopping || nextJob < jobCount; });
+		if (stopping)
+			return;
+		runJobs(lock);
+	}
+}
+
+void ThreadPool::ParallelFor(int count, std::function<void (int)> fn)
+{
+	if (workers.empty() || count <= 1)
+	{
+		for (int i = 0; i < count; i++)
+			fn(i);
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(poolMutex);
+	job = fn;
+	jobCount = count;
+	nextJob = 0;
+	pending = count;
+	workCv.notify_all();
+	runJobs(lock);
+	doneCv.wait(lock, [this] { return !pending; });
+	jobCount = 0;
+	nextJob = 0;
+	job = nullptr;
+}
@@ -0,0 +1,38 @@
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// A fixed set of worker threads that run batches of indexed jobs.
+// The calling thread takes part in every batch, so a pool of n threads only starts n-1 workers.
+class ThreadPool
+{
+	std::vector<std::thread> workers;
+	std::mutex poolMutex;
+	std::condition_variable workCv;
+	std::condition_variable doneCv;
+
+	std::function<void (int)> job;
+	int jobCount = 0;
+	int nextJob = 0;
+	int pending = 0;
+	bool stopping = false;
+
+	void runJobs(std::unique_lock<std::mutex> &lock);
+	void workerLoop();
+
+public:
+	ThreadPool(int threadCount);
+	~ThreadPool();
+
+	int ThreadCount() const { return int(workers.size()) + 1; }
+
+	// Calls fn(0) .. fn(count-1), spread over the pool, and returns once all of them have finished
+	void ParallelFor(int count, std::function<void (int)> fn);
+};
+
+#endif /* THREADPOOL_H_ */
@@ -9,8 +9,19 @@ static inline uint64_t rotl(const uint64_t x, int k)
 	return (x << k) | (x >> (64 - k));
 }
 
+// splitmix64 finaliser
+static inline uint64_t mix(uint64_t z)
+{
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
 uint64_t RNG::next()
 {
+	if (counterBased)
+		return mix(streamKey + (++streamCounter) * 0x9E3779B97F4A7C15ULL);
+
 	const uint64_t s0 = s[0];
 	uint64_t s1 = s[1];
 	const uint64_t result = s0 + s1;
@@ -50,7 +61,10 @@ float RNG::uniform01()
 	return static_cast<float>(next()&0xFFFFFFFF)/(float)0xFFFFFFFF;
 }
 
-RNG::RNG()
+RNG::RNG():
+	counterBased(false),
+	streamKey(0),
+	streamCounter(0)
 {
 	s[0] = time(NULL);
 	s[1] = 614;
@@ -60,6 +74,16 @@ void RNG::seed(unsigned int sd)
 {
 	s[0] = sd;
 	s[1] = sd;
+	counterBased = false;
 }
 
+void RNG::SetStream(uint64_t seed, uint64_t tick, uint64_t id)
+{
+	counterBased = true;
+	streamKey = mix(mix(mix(seed) ^ tick) ^ id);
+	streamCounter = 0;
+}
+
+thread_local RNG *RNG::threadRNG = nullptr;
+
 RNG random_gen;
@@ -8,8 +8,23 @@ class RNG : public Singleton<RNG>
 {
 private:
 	uint64_t s[2];
+	bool counterBased;
+	uint64_t streamKey, streamCounter;
 	uint64_t next();
+
+	static thread_local RNG *threadRNG;
 public:
+	// Threads that need a reproducible sequence of their own (such as simulation update strips)
+	// can point Ref() at a private generator for the duration of their work
+	static RNG &Ref()
+	{
+		if (threadRNG)
+			return *threadRNG;
+		return Singleton<RNG>::Ref();
+	}
+	static void SetThreadRNG(RNG *rng) { threadRNG = rng; }
+	static RNG *GetThreadRNG() { return threadRNG; }
+
 	unsigned int operator()();
 	unsigned int gen();
 	int between(int lower, int upper);
@@ -18,6 +33,9 @@ public:
 
 	RNG();
 	void seed(unsigned int sd);
+	// Switches to a counter based sequence: the nth number after this call is a hash of the key and n, so it
+	// doesn't depend on how many numbers were drawn before. seed() switches back to the normal generator
+	void SetStream(uint64_t seed, uint64_t tick, uint64_t id);
 };
 
 extern RNG random_gen;
@@ -0,0 +1,44 @@
+#include "ActiveBlocks.h"
+
+#include "gui/interface/Engine.h"
+
+#include "simulation/Simulation.h"
+
+#include "graphics/Graphics.h"
+
+ActiveBlocksDebug::ActiveBlocksDebug(unsigned int id, Simulation * sim):
+	DebugInfo(id),
+	sim(sim)
+{
+
+}
+
+void ActiveBlocksDebug::Draw()
+{
+	Graphics * g = ui::Engine::Ref().g;
+
+	for (int by = 0; by < YRES/CELL; by++)
+	{
+		for (int bx = 0; bx < XRES/CELL; bx++)
+		{
+			if (sim->activeBlocks.Get(bx, by))
+				g->fillrect(bx*CELL, by*CELL, CELL, CELL, 0, 255, 0, 50);
+			if (sim->emapBlocks.Get(bx, by))
+				g->fillrect(bx*CELL, by*CELL, CELL, CELL, 255, 255, 0, 70);
+			if (sim->lifeBlocks.Get(bx, by) || sim->wireBlocks.Get(bx, by))
+				g->fillrect(bx*CELL, by*CELL, CELL, CELL, 0, 128, 255, 70);
+			if (sim->stackBlocks.Get(bx, by))
+				g->fillrect(bx*CELL, by*CELL, CELL, CELL, 255, 0, 0, 100);
+		}
+	}
+
+	String info = String::Build("Active blocks: ", sim->activeBlocks.Count(), " / ", (XRES/CELL)*(YRES/CELL),
+	                            ", electrode: ", sim->emapBlocks.Count(), ", LIFE/WIRE: ", sim->lifeBlocks.Count()+sim->wireBlocks.Count(),
+	                            ", stacked: ", sim->stackBlocks.Count());
+	g->drawtext(10, YRES-20, info, 255, 255, 255, 200);
+}
+
+ActiveBlocksDebug::~ActiveBlocksDebug()
+{
+
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "DebugInfo.h"
+
+class Simulation;
+class ActiveBlocksDebug : public DebugInfo
+{
+	Simulation * sim;
+public:
+	ActiveBlocksDebug(unsigned int id, Simulation * sim);
+	void Draw() override;
+	virtual ~ActiveBlocksDebug();
+};
@@ -9,6 +9,8 @@ public:
 	virtual ~DebugInfo() { }
 	unsigned int debugID;
 	virtual void Draw() {}
+	// Called when the overlay is turned on or off
+	virtual void Shown(bool shown) {}
 	// currentMouse doesn't belong but I don't want to create more hooks at the moment
 	virtual bool KeyPress(int key, int scan, bool shift, bool ctrl, bool alt, ui::Point currentMouse) { return true; }
 };
@@ -0,0 +1,118 @@
+#include "ElementProfile.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "gui/interface/Engine.h"
+
+#include "simulation/Simulation.h"
+
+#include "graphics/Graphics.h"
+
+namespace
+{
+	const int sortColumnCount = 5;
+	const char *const sortColumnNames[sortColumnCount] = { "total time", "update time", "Lua time", "graphics time", "update calls" };
+	const int shownRows = 20;
+
+	struct ProfileRow
+	{
+		int type;
+		float updateCalls, updateTime, luaTime, graphicsTime; // per frame, times in microseconds
+	};
+
+	float sortValue(const ProfileRow &row, int column)
+	{
+		switch (column)
+		{
+		case 1: return row.updateTime;
+		case 2: return row.luaTime;
+		case 3: return row.graphicsTime;
+		case 4: return row.updateCalls;
+		default: return row.updateTime + row.luaTime + row.graphicsTime;
+		}
+	}
+}
+
+ElementProfileDebug::ElementProfileDebug(unsigned int id, Simulation * sim):
+	DebugInfo(id),
+	sim(sim),
+	sortColumn(0)
+{
+
+}
+
+void ElementProfileDebug::Shown(bool shown)
+{
+	sim->profiler.SetEnabled(shown);
+}
+
+void ElementProfileDebug::Draw()
+{
+	Graphics * g = ui::Engine::Ref().g;
+	ElementProfiler &profiler = sim->profiler;
+
+	float simFrames = std::max(uint64_t(1), uint64_t(profiler.simFrames));
+	float renderFrames = std::max(uint64_t(1), uint64_t(profiler.renderFrames));
+	std::vector<ProfileRow> rows;
+	for (int t = 0; t < PT_NUM; t++)
+	{
+		ProfileRow row;
+		row.type = t;
+		row.updateCalls = profiler.Calls(t, ElementProfiler::UPDATE) / simFrames;
+		row.updateTime = profiler.Nanoseconds(t, ElementProfiler::UPDATE) / simFrames / 1000.0f;
+		row.luaTime = profiler.Nanoseconds(t, ElementProfiler::LUA) / simFrames / 1000.0f;
+		row.graphicsTime = profiler.Nanoseconds(t, ElementProfiler::GRAPHICS) / renderFrames / 1000.0f;
+		if (profiler.Calls(t, ElementProfiler::UPDATE) || profiler.Calls(t, ElementProfiler::LUA) || profiler.Calls(t, ElementProfiler::GRAPHICS))
+			rows.push_back(row);
+	}
+	int column = sortColumn;
+	std::stable_sort(rows.begin(), rows.end(), [column](const ProfileRow &a, const ProfileRow &b) {
+		return sortValue(a, column) > sortValue(b, column);
+	});
+	if (rows.size() > shownRows)
+		rows.resize(shownRows);
+
+	const int columnX[] = { 0, 60, 120, 180, 240 };
+	const int width = 300;
+	int xStart = XRES-width-10;
+	int y = 10;
+
+	g->fillrect(xStart-5, y-5, width+10, 40 + 12*shownRows, 0, 0, 0, 180);
+	g->drawtext(xStart, y, String::Build("Element profile, sorted by ", ByteString(sortColumnNames[sortColumn]).FromAscii(), " (o to change)"), 255, 255, 255, 255);
+	y += 14;
+	g->drawtext(xStart + columnX[0], y, "Element", 200, 200, 200, 255);
+	g->drawtext(xStart + columnX[1], y, "Calls", 200, 200, 200, 255);
+	g->drawtext(xStart + columnX[2], y, "Update us", 200, 200, 200, 255);
+	g->drawtext(xStart + columnX[3], y, "Lua us", 200, 200, 200, 255);
+	g->drawtext(xStart + columnX[4], y, "Gfx us", 200, 200, 200, 255);
+	y += 12;
+	for (auto &row : rows)
+	{
+		auto &element = sim->elements[row.type];
+		g->drawtext(xStart + columnX[0], y, element.Name, PIXR(element.Colour), PIXG(element.Colour), PIXB(element.Colour), 255);
+		g->drawtext(xStart + columnX[1], y, String::Build(int(row.updateCalls)), 255, 255, 255, 255);
+		g->drawtext(xStart + columnX[2], y, String::Build(Format::Precision(row.updateTime, 1)), 255, 255, 255, 255);
+		g->drawtext(xStart + columnX[3], y, String::Build(Format::Precision(row.luaTime, 1)), 255, 255, 255, 255);
+		g->drawtext(xStart + columnX[4], y, String::Build(Format::Precision(row.graphicsTime, 1)), 255, 255, 255, 255);
+		y += 12;
+	}
+}
+
+bool ElementProfileDebug::KeyPress(int key, int scan, bool shift, bool ctrl, bool alt, ui::Point currentMouse)
+{
+	if (key == 'o' && !ctrl && !alt)
+	{
+		if (shift)
+			sim->profiler.Reset();
+		else
+			sortColumn = (sortColumn + 1) % sortColumnCount;
+		return false;
+	}
+	return true;
+}
+
+ElementProfileDebug::~ElementProfileDebug()
+{
+
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "DebugInfo.h"
+
+class Simulation;
+class ElementProfileDebug : public DebugInfo
+{
+	Simulation * sim;
+	int sortColumn;
+public:
+	ElementProfileDebug(unsigned int id, Simulation * sim);
+	void Shown(bool shown) override;
+	void Draw() override;
+	bool KeyPress(int key, int scan, bool shift, bool ctrl, bool alt, ui::Point currentMouse) override;
+	virtual ~ElementProfileDebug();
+};
@@ -0,0 +1,44 @@
+#include "GravityTiming.h"
+
+#include "gui/interface/Engine.h"
+
+#include "simulation/Simulation.h"
+#include "simulation/Gravity.h"
+
+#include "graphics/Graphics.h"
+
+GravityTimingDebug::GravityTimingDebug(unsigned int id, Simulation * sim):
+	DebugInfo(id),
+	sim(sim)
+{
+
+}
+
+void GravityTimingDebug::Draw()
+{
+	Graphics * g = ui::Engine::Ref().g;
+
+	StringBuilder info;
+	info << Format::Precision(2);
+	if (!sim->grav->IsEnabled())
+		info << "Newtonian gravity is off";
+	else
+	{
+#ifdef GRAVFFT
+		info << "Gravity FFT plans: " << sim->grav->planTime.load() << " ms";
+		if (sim->grav->wisdomLoaded)
+			info << " (from wisdom)";
+		else
+			info << " (measured)";
+#else
+		info << "Gravity FFT setup: " << sim->grav->planTime.load() << " ms (built in)";
+#endif
+		info << ", update: " << sim->grav->updateTime.load() << " ms on " << sim->grav->fftThreads.load() << " thread(s)";
+	}
+	g->drawtext(10, YRES-32, info.Build(), 255, 255, 255, 200);
+}
+
+GravityTimingDebug::~GravityTimingDebug()
+{
+
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "DebugInfo.h"
+
+class Simulation;
+class GravityTimingDebug : public DebugInfo
+{
+	Simulation * sim;
+public:
+	GravityTimingDebug(unsigned int id, Simulation * sim);
+	void Draw() override;
+	virtual ~GravityTimingDebug();
+};
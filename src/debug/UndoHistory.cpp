@@ -0,0 +1,56 @@
+#include "UndoHistory.h"
+
+#include <deque>
+
+#include "gui/game/GameModel.h"
+#include "gui/interface/Engine.h"
+
+#include "simulation/Snapshot.h"
+
+#include "graphics/Graphics.h"
+
+UndoHistoryDebug::UndoHistoryDebug(unsigned int id, GameModel * model):
+	DebugInfo(id),
+	model(model)
+{
+
+}
+
+void UndoHistoryDebug::Draw()
+{
+	Graphics * g = ui::Engine::Ref().g;
+
+	std::deque<HistoryEntry*> history = model->GetHistory();
+	size_t total = 0, fullSize = 0;
+	int full = 0;
+	for (auto entry : history)
+	{
+		total += entry->Size();
+		if (entry->snap)
+		{
+			full++;
+			fullSize = entry->Size();
+		}
+	}
+	Snapshot * redo = model->GetRedoHistory();
+	if (redo)
+		total += redo->Size();
+
+	String lines[] = {
+		String::Build("Undo history: ", history.size(), " steps, at ", model->GetHistoryPosition(), ", ", full, " in full"),
+		String::Build("Memory: ", total/1024, " KB, ", history.size() ? total/1024/history.size() : 0, " KB per step, ", fullSize/1024, " KB for a full snapshot"),
+		String::Build("Last snapshot: ", Format::Precision(model->GetHistorySnapshotTime(), 2), " ms, last undo/redo: ", Format::Precision(model->GetHistoryRestoreTime(), 2), " ms"),
+	};
+	int y = YRES-50;
+	g->fillrect(5, y-5, 320, 43, 0, 0, 0, 180);
+	for (auto &line : lines)
+	{
+		g->drawtext(10, y, line, 255, 255, 255, 255);
+		y += 12;
+	}
+}
+
+UndoHistoryDebug::~UndoHistoryDebug()
+{
+
+}
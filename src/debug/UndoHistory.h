@@ -0,0 +1,13 @@
+#pragma once
+
+#include "DebugInfo.h"
+
+class GameModel;
+class UndoHistoryDebug : public DebugInfo
+{
+	GameModel * model;
+public:
+	UndoHistoryDebug(unsigned int id, GameModel * model);
+	void Draw() override;
+	virtual ~UndoHistoryDebug();
+};
@@ -0,0 +1,169 @@
+#include "PixelSpans.h"
+
+#include <algorithm>
+#if defined(X86_SSE2) && !defined(PIX16)
+#include <emmintrin.h>
+#define PIXELSPANS_SSE2
+#endif
+
+namespace PixelSpans
+{
+#ifdef PIXELSPANS_SSE2
+	// Four pixels are worked on at once, two in each half, with every channel widened to 16 bits. All the sums
+	// fit in 16 bits as long as the channels and alphas are from 0 to 255, except for adding, which saturates
+	// exactly where the per pixel version would clamp anyway
+	static inline bool inRange(int r, int g, int b, int a)
+	{
+		return !((r | g | b | a) & ~0xFF);
+	}
+
+	// Drops whatever ended up in the unused byte and sets it the way PIXRGB does
+	static inline __m128i finish(__m128i lo, __m128i hi)
+	{
+		__m128i packed = _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+		packed = _mm_and_si128(packed, _mm_set1_epi32((int)PIXRGB(255, 255, 255)));
+		return _mm_or_si128(packed, _mm_set1_epi32((int)PIXRGB(0, 0, 0)));
+	}
+
+	static inline __m128i widenColour(int r, int g, int b)
+	{
+		return _mm_unpacklo_epi8(_mm_set1_epi32((int)PIXRGB(r, g, b)), _mm_setzero_si128());
+	}
+#endif
+
+	void BlendScalar(pixel *dst, int count, int r, int g, int b, int a)
+	{
+		if (a == 255)
+		{
+			std::fill(dst, dst+count, (pixel)PIXRGB(r, g, b));
+			return;
+		}
+		for (int i = 0; i < count; i++)
+		{
+			pixel t = dst[i];
+			dst[i] = PIXRGB((a*r + (255-a)*PIXR(t)) >> 8, (a*g + (255-a)*PIXG(t)) >> 8, (a*b + (255-a)*PIXB(t)) >> 8);
+		}
+	}
+
+	void AddScalar(pixel *dst, int count, int r, int g, int b, int a)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			pixel t = dst[i];
+			int nr = (a*r + 255*PIXR(t)) >> 8;
+			int ng = (a*g + 255*PIXG(t)) >> 8;
+			int nb = (a*b + 255*PIXB(t)) >> 8;
+			dst[i] = PIXRGB(std::min(nr, 255), std::min(ng, 255), std::min(nb, 255));
+		}
+	}
+
+	void AddAlphasScalar(pixel *dst, int count, int r, int g, int b, const int *alphas)
+	{
+		for (int i = 0; i < count; i++)
+			AddScalar(dst+i, 1, r, g, b, alphas[i]);
+	}
+
+	void BlendImageScalar(pixel *dst, const pixel *src, int count, int a)
+	{
+		for (int i = 0; i < count; i++)
+			BlendScalar(dst+i, 1, PIXR(src[i]), PIXG(src[i]), PIXB(src[i]), a);
+	}
+
+	void Blend(pixel *dst, int count, int r, int g, int b, int a)
+	{
+		int i = 0;
+#ifdef PIXELSPANS_SSE2
+		if (a != 255 && inRange(r, g, b, a))
+		{
+			const __m128i zero = _mm_setzero_si128();
+			__m128i colour = _mm_mullo_epi16(widenColour(r, g, b), _mm_set1_epi16(a));
+			__m128i inverse = _mm_set1_epi16(255-a);
+			for (; i+4 <= count; i += 4)
+			{
+				__m128i d = _mm_loadu_si128((const __m128i *)(dst+i));
+				__m128i lo = _mm_add_epi16(colour, _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), inverse));
+				__m128i hi = _mm_add_epi16(colour, _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), inverse));
+				_mm_storeu_si128((__m128i *)(dst+i), finish(lo, hi));
+			}
+		}
+#endif
+		BlendScalar(dst+i, count-i, r, g, b, a);
+	}
+
+	void Add(pixel *dst, int count, int r, int g, int b, int a)
+	{
+		int i = 0;
+#ifdef PIXELSPANS_SSE2
+		if (inRange(r, g, b, a))
+		{
+			const __m128i zero = _mm_setzero_si128();
+			__m128i colour = _mm_mullo_epi16(widenColour(r, g, b), _mm_set1_epi16(a));
+			__m128i full = _mm_set1_epi16(255);
+			for (; i+4 <= count; i += 4)
+			{
+				__m128i d = _mm_loadu_si128((const __m128i *)(dst+i));
+				__m128i lo = _mm_adds_epu16(colour, _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), full));
+				__m128i hi = _mm_adds_epu16(colour, _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), full));
+				_mm_storeu_si128((__m128i *)(dst+i), finish(lo, hi));
+			}
+		}
+#endif
+		AddScalar(dst+i, count-i, r, g, b, a);
+	}
+
+	void AddAlphas(pixel *dst, int count, int r, int g, int b, const int *alphas)
+	{
+		int i = 0;
+#ifdef PIXELSPANS_SSE2
+		if (inRange(r, g, b, 0))
+		{
+			const __m128i zero = _mm_setzero_si128();
+			__m128i colour = widenColour(r, g, b);
+			__m128i full = _mm_set1_epi16(255);
+			for (; i+4 <= count; i += 4)
+			{
+				// Spread each pixel's alpha over its four channels
+				__m128i a = _mm_loadu_si128((const __m128i *)(alphas+i));
+				a = _mm_packs_epi32(a, a);
+				a = _mm_unpacklo_epi16(a, a);
+				__m128i d = _mm_loadu_si128((const __m128i *)(dst+i));
+				__m128i lo = _mm_adds_epu16(_mm_mullo_epi16(colour, _mm_unpacklo_epi32(a, a)), _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), full));
+				__m128i hi = _mm_adds_epu16(_mm_mullo_epi16(colour, _mm_unpackhi_epi32(a, a)), _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), full));
+				_mm_storeu_si128((__m128i *)(dst+i), finish(lo, hi));
+			}
+		}
+#endif
+		AddAlphasScalar(dst+i, count-i, r, g, b, alphas+i);
+	}
+
+	void BlendImage(pixel *dst, const pixel *src, int count, int a)
+	{
+		int i = 0;
+#ifdef PIXELSPANS_SSE2
+		if (a != 255 && inRange(0, 0, 0, a))
+		{
+			const __m128i zero = _mm_setzero_si128();
+			__m128i alpha = _mm_set1_epi16(a);
+			__m128i inverse = _mm_set1_epi16(255-a);
+			for (; i+4 <= count; i += 4)
+			{
+				__m128i s = _mm_loadu_si128((const __m128i *)(src+i));
+				__m128i d = _mm_loadu_si128((const __m128i *)(dst+i));
+				__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), alpha), _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), inverse));
+				__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), alpha), _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), inverse));
+				_mm_storeu_si128((__m128i *)(dst+i), finish(lo, hi));
+			}
+		}
+#endif
+		BlendImageScalar(dst+i, src+i, count-i, a);
+	}
+
+	bool Vectorised()
+	{
+#ifdef PIXELSPANS_SSE2
+		return true;
+#else
+		return false;
+#endif
+	}
+}
@@ -0,0 +1,30 @@
+#ifndef PIXELSPANS_H
+#define PIXELSPANS_H
+
+#include "Pixel.h"
+
+// Blending for runs of neighbouring pixels in a row, with the same results as blendpixel and addpixel but several
+// pixels at a time where SSE2 is available. Values outside 0 to 255 are handled by the scalar versions, which
+// give what the per pixel functions would have given for them
+namespace PixelSpans
+{
+	// Blends a colour over count pixels, at an alpha of 255 they are set to the colour
+	void Blend(pixel *dst, int count, int r, int g, int b, int a);
+	// Adds a colour to count pixels, channels stop at 255
+	void Add(pixel *dst, int count, int r, int g, int b, int a);
+	// Adds a colour to count pixels with an alpha for each of them, the alphas must be from 0 to 255
+	void AddAlphas(pixel *dst, int count, int r, int g, int b, const int *alphas);
+	// Blends count pixels of an image over dst with the same alpha
+	void BlendImage(pixel *dst, const pixel *src, int count, int a);
+
+	// One pixel at a time, for comparing against the above
+	void BlendScalar(pixel *dst, int count, int r, int g, int b, int a);
+	void AddScalar(pixel *dst, int count, int r, int g, int b, int a);
+	void AddAlphasScalar(pixel *dst, int count, int r, int g, int b, const int *alphas);
+	void BlendImageScalar(pixel *dst, const pixel *src, int count, int a);
+
+	// Whether the functions above have a vectorised path in this build
+	bool Vectorised();
+}
+
+#endif // PIXELSPANS_H
@@ -1,5 +1,19 @@
+#include <algorithm>
 #include <cmath>
+#include <vector>
 #include "FontReader.h"
+#include "PixelSpans.h"
+
+// Blends a colour over w pixels of a row, skipping the ones outside the buffer
+static void blend_row(pixel *vid, int x, int y, int w, int r, int g, int b, int a)
+{
+	if (y<0 || y>=VIDYRES)
+		return;
+	int x1 = std::min(x+w, VIDXRES);
+	x = std::max(x, 0);
+	if (x < x1)
+		PixelSpans::Blend(vid+y*(VIDXRES)+x, x1-x, r, g, b, a);
+}
 
 int PIXELMETHODS_CLASS::drawtext_outline(int x, int y, String s, int r, int g, int b, int a)
 {
@@ -288,11 +302,8 @@ void PIXELMETHODS_CLASS::drawrect(int x, int y, int w, int h, int r, int g, int
 	int i;
 	w--;
 	h--;
-	for (i=0; i<=w; i++)
-	{
-		blendpixel(x+i, y, r, g, b, a);
-		blendpixel(x+i, y+h, r, g, b, a);
-	}
+	blend_row(vid, x, y, w+1, r, g, b, a);
+	blend_row(vid, x, y+h, w+1, r, g, b, a);
 	for (i=1; i<h; i++)
 	{
 		blendpixel(x, y+i, r, g, b, a);
@@ -302,10 +313,8 @@ void PIXELMETHODS_CLASS::drawrect(int x, int y, int w, int h, int r, int g, int
 
 void PIXELMETHODS_CLASS::fillrect(int x, int y, int w, int h, int r, int g, int b, int a)
 {
-	int i,j;
-	for (j=0; j<h; j++)
-		for (i=0; i<w; i++)
-			blendpixel(x+i, y+j, r, g, b, a);
+	for (int j=0; j<h; j++)
+		blend_row(vid, x, y+j, w, r, g, b, a);
 }
 
 void PIXELMETHODS_CLASS::drawcircle(int x, int y, int rx, int ry, int r, int g, int b, int a)
@@ -363,7 +372,29 @@ void PIXELMETHODS_CLASS::fillcircle(int x, int y, int rx, int ry, int r, int g,
 
 void PIXELMETHODS_CLASS::gradientrect(int x, int y, int width, int height, int r, int g, int b, int a, int r2, int g2, int b2, int a2)
 {
-
+	if (width <= 0 || height <= 0)
+		return;
+	// Goes from the first colour on the left edge to the second on the right edge, the same in every row
+	std::vector<pixel> row(width);
+	std::vector<int> alphas(width);
+	int steps = std::max(width-1, 1);
+	for (int i = 0; i < width; i++)
+	{
+		row[i] = PIXRGB((r*(steps-i) + r2*i)/steps, (g*(steps-i) + g2*i)/steps, (b*(steps-i) + b2*i)/steps);
+		alphas[i] = (a*(steps-i) + a2*i)/steps;
+	}
+	int first = std::max(-x, 0), last = std::min(width, VIDXRES-x);
+	for (int j = std::max(-y, 0); j < height && y+j < VIDYRES; j++)
+	{
+		if (a == a2)
+		{
+			if (first < last)
+				PixelSpans::BlendImage(vid+(y+j)*(VIDXRES)+x+first, &row[first], last-first, a);
+		}
+		else
+			for (int i = first; i < last; i++)
+				blendpixel(x+i, y+j, PIXR(row[i]), PIXG(row[i]), PIXB(row[i]), alphas[i]);
+	}
 }
 
 void PIXELMETHODS_CLASS::clearrect(int x, int y, int w, int h)
@@ -434,18 +465,12 @@ void PIXELMETHODS_CLASS::draw_image(pixel *img, int x, int y, int w, int h, int
 		}
 	else
 	{
-		int r, g, b;
+		int first = std::max(startX, -x);
 		for (int j = 0; j < h; j++)
 		{
-			img += startX;
-			for (int i = startX; i < w; i++)
-			{
-				r = PIXR(*img);
-				g = PIXG(*img);
-				b = PIXB(*img);
-				blendpixel(x+i, y+j, r, g, b, a);
-				img++;
-			}
+			if (first < w)
+				PixelSpans::BlendImage(vid+(y+j)*(VIDXRES)+x+first, img+first, w-first, a);
+			img += w;
 		}
 	}
 }
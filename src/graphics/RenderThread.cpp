@@ -0,0 +1,98 @@
+#include "RenderThread.h"
+#include <algorithm>
+#include "Graphics.h"
+#include "Renderer.h"
+#include "simulation/Simulation.h"
+
+RenderThread::RenderThread(Renderer &front):
+	front(front)
+{
+	view = new Simulation();
+	buffer = new Graphics();
+	back = new Renderer(buffer, view);
+	back->backgroundOnly = true;
+	copySettings();
+	thread = std::thread(&RenderThread::run, this);
+}
+
+RenderThread::~RenderThread()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	startCv.notify_all();
+	thread.join();
+	delete back;
+	delete buffer;
+	delete view;
+}
+
+void RenderThread::run()
+{
+	RNG::SetThreadRNG(&rng);
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true)
+	{
+		startCv.wait(lock, [this] { return stopping || drawing; });
+		if (stopping)
+			return;
+		lock.unlock();
+		back->clearScreen(1.0f);
+		back->RenderBegin();
+		lock.lock();
+		drawing = false;
+		doneCv.notify_all();
+	}
+}
+
+void RenderThread::copySettings()
+{
+	if (back->GetRenderMode() != front.GetRenderMode())
+		back->SetRenderMode(front.GetRenderMode());
+	if (back->GetDisplayMode() != front.GetDisplayMode())
+		back->SetDisplayMode(front.GetDisplayMode());
+	back->SetColourMode(front.GetColourMode());
+	back->gravityZonesEnabled = front.gravityZonesEnabled;
+	back->gravityFieldEnabled = front.gravityFieldEnabled;
+	back->decorations_enable = front.decorations_enable;
+	back->blackDecorations = front.blackDecorations;
+	back->debugLines = front.debugLines;
+	back->findingElement = front.findingElement;
+	back->mousePos = front.mousePos;
+	back->SetGridSize(front.GetGridSize());
+	back->SetRenderThreads(front.GetRenderThreads());
+	if (clearAccumulation)
+		back->ClearAccumulation();
+	if (clearGraphicsCache)
+		back->ClearGraphicsCache();
+	clearAccumulation = false;
+	clearGraphicsCache = false;
+}
+
+bool RenderThread::TakeFrame(bool use)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCv.wait(lock, [this] { return !drawing; });
+	bool taken = use && haveFrame;
+	if (taken)
+	{
+		std::copy(back->vid, back->vid+(WINDOWW*WINDOWH), front.vid);
+		front.foundElements = back->foundElements;
+	}
+	haveFrame = false;
+	return taken;
+}
+
+void RenderThread::StartFrame()
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		doneCv.wait(lock, [this] { return !drawing; });
+		view->CopyRenderState(*front.sim);
+		copySettings();
+		drawing = true;
+		haveFrame = true;
+	}
+	startCv.notify_one();
+}
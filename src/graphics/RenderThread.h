@@ -0,0 +1,53 @@
+#ifndef RENDERTHREAD_H_
+#define RENDERTHREAD_H_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "common/tpt-rand.h"
+
+class Graphics;
+class Renderer;
+class Simulation;
+
+// Draws a renderer's simulation on a thread of its own while the next frame is simulated. At the start of a frame
+// everything the renderer reads is copied from the simulation into a second one that is only used for drawing, and
+// a second renderer with the same settings draws it into a buffer of its own. The picture is taken at the start of
+// the next frame, so what is shown is one frame behind the simulation. Not used by the OpenGL renderers
+class RenderThread
+{
+	Renderer &front;
+	Simulation *view;
+	Graphics *buffer;
+	Renderer *back;
+	RNG rng; // for graphics functions that draw random numbers, the simulation's own sequence is left alone
+
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable startCv;
+	std::condition_variable doneCv;
+	bool drawing = false;
+	bool haveFrame = false; // a frame was started and hasn't been taken yet
+	bool stopping = false;
+	bool clearAccumulation = false;
+	bool clearGraphicsCache = false;
+
+	void run();
+	void copySettings();
+
+public:
+	RenderThread(Renderer &front);
+	~RenderThread();
+
+	// Waits for the frame being drawn and, if use is set, puts it on the front renderer's screen. Returns whether
+	// there was a frame to put there, a frame that isn't used is thrown away
+	bool TakeFrame(bool use);
+	// Copies the simulation and the front renderer's settings and starts drawing them
+	void StartFrame();
+
+	// The front renderer cleared these, the drawing renderer clears them too before the next frame
+	void ClearAccumulation() { clearAccumulation = true; }
+	void ClearGraphicsCache() { clearGraphicsCache = true; }
+};
+
+#endif /* RENDERTHREAD_H_ */
@@ -1,16 +1,21 @@
 #include "Renderer.h"
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <iomanip>
 #include <vector>
 #include <cstdio>
 #include <cstdlib>
+#ifdef X86_SSE2
+#include <emmintrin.h>
+#endif
 #include "Config.h"
 #include "Misc.h"
 
 #include "common/tpt-rand.h"
 #include "common/tpt-compat.h"
+#include "common/ThreadPool.h"
 
 #include "gui/game/RenderPreset.h"
 
@@ -26,6 +31,8 @@
 #include "lua/LuaSmartRef.h"
 #endif
 #include "hmap.h"
+#include "PixelSpans.h"
+#include "RenderThread.h"
 #ifdef OGLR
 #include "Shaders.h"
 #endif
@@ -41,6 +48,14 @@
 
 void Renderer::RenderBegin()
 {
+#ifndef OGLI
+	bool background = renderThread && canDrawInBackground();
+	if (renderThread && renderThread->TakeFrame(background))
+	{
+		renderThread->StartFrame();
+		return;
+	}
+#endif
 #ifdef OGLI
 #ifdef OGLR
 	draw_air();
@@ -145,6 +160,9 @@ void Renderer::RenderBegin()
 	}
 
 	FinaliseParts();
+	// This frame was drawn here, the thread starts on the next one straight away
+	if (background)
+		renderThread->StartFrame();
 #endif
 }
 
@@ -1064,49 +1082,145 @@ void Renderer::render_gravlensing(pixel * source)
 #endif
 }
 
+#ifndef OGLR
+// Finds the first and last cell in a row of the fire arrays with any fire in it, last is -1 if there is none
+static void fireRowSpan(const unsigned char *r, const unsigned char *g, const unsigned char *b, int &first, int &last)
+{
+	int i = 0;
+	first = XRES/CELL;
+	last = -1;
+	auto check = [&](int i) {
+		if (r[i] | g[i] | b[i])
+		{
+			first = std::min(first, i);
+			last = i;
+		}
+	};
+#ifdef X86_SSE2
+	// Skips sixteen empty cells at a time
+	const __m128i zero = _mm_setzero_si128();
+	for (; i+16 <= XRES/CELL; i += 16)
+	{
+		__m128i any = _mm_or_si128(_mm_or_si128(_mm_loadu_si128((const __m128i *)(r+i)), _mm_loadu_si128((const __m128i *)(g+i))), _mm_loadu_si128((const __m128i *)(b+i)));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xFFFF)
+			for (int k = i; k < i+16; k++)
+				check(k);
+	}
+#endif
+	for (; i < XRES/CELL; i++)
+		check(i);
+}
+
+// Adds up what decaying the cells lo to hi of a row of a fire array takes from everything except the cell on the
+// left, which has to be decayed first: eight times the cell itself plus the cell on its right and the three cells
+// above and below it. The row above has already been decayed
+static void fireRowSums(const unsigned char *above, const unsigned char *row, const unsigned char *below, int lo, int hi, unsigned short *sums)
+{
+	auto sum = [&](int i) {
+		int total = 8*row[i];
+		for (int x = std::max(i-1, 0); x <= std::min(i+1, XRES/CELL-1); x++)
+			total += above[x] + below[x];
+		if (i+1 < XRES/CELL)
+			total += row[i+1];
+		return (unsigned short)total;
+	};
+	int i = lo;
+#ifdef X86_SSE2
+	// Eight cells at a time, as long as the cells on either side of them are in the row
+	const __m128i zero = _mm_setzero_si128();
+	auto load = [&zero](const unsigned char *p) {
+		return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)p), zero);
+	};
+	if (i == 0 && i <= hi)
+		sums[i++] = sum(0);
+	for (; i <= hi && i+8 < XRES/CELL; i += 8)
+	{
+		__m128i total = _mm_add_epi16(_mm_slli_epi16(load(row+i), 3), load(row+i+1));
+		total = _mm_add_epi16(total, _mm_add_epi16(_mm_add_epi16(load(above+i-1), load(above+i)), load(above+i+1)));
+		total = _mm_add_epi16(total, _mm_add_epi16(_mm_add_epi16(load(below+i-1), load(below+i)), load(below+i+1)));
+		_mm_storeu_si128((__m128i *)(sums+i), total);
+	}
+#endif
+	for (; i <= hi; i++)
+		sums[i] = sum(i);
+}
+#endif
+
 void Renderer::render_fire()
 {
 #ifndef OGLR
 	if(!(render_mode & FIREMODE))
 		return;
-	int i,j,x,y,r,g,b,a;
+	int i,j,x,y,r,g,b;
+	int alphas[CELL*3][CELL*3];
+	for (y=0; y<CELL*3; y++)
+		for (x=0; x<CELL*3; x++)
+			alphas[y][x] = findingElement ? fire_alpha[y][x]/2 : fire_alpha[y][x];
+	// Only the parts of rows between the first and last cell with fire are stamped and decayed
+	int first[YRES/CELL], last[YRES/CELL];
 	for (j=0; j<YRES/CELL; j++)
-		for (i=0; i<XRES/CELL; i++)
+	{
+		fireRowSpan(fire_r[j], fire_g[j], fire_b[j], first[j], last[j]);
+		for (i=first[j]; i<=last[j]; i++)
 		{
 			r = fire_r[j][i];
 			g = fire_g[j][i];
 			b = fire_b[j][i];
 			if (r || g || b)
-				for (y=-CELL; y<2*CELL; y++)
-					for (x=-CELL; x<2*CELL; x++)
-					{
-						a = fire_alpha[y+CELL][x+CELL];
-						if (findingElement)
-							a /= 2;
-						addpixel(i*CELL+x, j*CELL+y, r, g, b, a);
-					}
-			r *= 8;
-			g *= 8;
-			b *= 8;
-			for (y=-1; y<2; y++)
-				for (x=-1; x<2; x++)
-					if ((x || y) && i+x>=0 && j+y>=0 && i+x<XRES/CELL && j+y<YRES/CELL)
-					{
-						r += fire_r[j+y][i+x];
-						g += fire_g[j+y][i+x];
-						b += fire_b[j+y][i+x];
-					}
-			r /= 16;
-			g /= 16;
-			b /= 16;
-			fire_r[j][i] = r>4 ? r-4 : 0;
-			fire_g[j][i] = g>4 ? g-4 : 0;
-			fire_b[j][i] = b>4 ? b-4 : 0;
+			{
+				// The stamp reaches into the cells around this one, it is cut off at the edges of the buffer
+				int x0 = std::max(i*CELL-CELL, 0), x1 = std::min(i*CELL+2*CELL, VIDXRES);
+				int y0 = std::max(j*CELL-CELL, 0), y1 = std::min(j*CELL+2*CELL, VIDYRES);
+				for (y=y0; y<y1; y++)
+					PixelSpans::AddAlphas(vid+y*(VIDXRES)+x0, x1-x0, r, g, b, &alphas[y-j*CELL+CELL][x0-i*CELL+CELL]);
+			}
 		}
+	}
+
+	// Each cell becomes (8 * itself + its neighbours) / 16 - 4, worked out in place from the top left, so the cells
+	// above and on the left have already been decayed. A cell only changes if it or a neighbour has fire, except
+	// that fire carried along a row by the cell on the left can reach a little past that
+	static const unsigned char noFire[XRES/CELL] = {};
+	unsigned char (*fire[3])[XRES/CELL] = { fire_r, fire_g, fire_b };
+	unsigned short sums[3][XRES/CELL];
+	int aboveFirst = XRES/CELL, aboveLast = -1;
+	for (j=0; j<YRES/CELL; j++)
+	{
+		int lo = std::min(first[j], aboveFirst), hi = std::max(last[j], aboveLast);
+		if (j+1 < YRES/CELL)
+		{
+			lo = std::min(lo, first[j+1]);
+			hi = std::max(hi, last[j+1]);
+		}
+		aboveFirst = XRES/CELL;
+		aboveLast = -1;
+		if (lo > hi)
+			continue;
+		lo = std::max(lo-1, 0);
+		hi = std::min(hi+1, XRES/CELL-1);
+		for (int c = 0; c < 3; c++)
+			fireRowSums(j > 0 ? fire[c][j-1] : noFire, fire[c][j], j+1 < YRES/CELL ? fire[c][j+1] : noFire, lo, hi, sums[c]);
+		int left[3] = { 0, 0, 0 };
+		for (i=lo; i<XRES/CELL; i++)
+		{
+			if (i > hi && !(left[0] | left[1] | left[2]))
+				break;
+			for (int c = 0; c < 3; c++)
+			{
+				int v = ((i <= hi ? sums[c][i] : 0) + left[c]) / 16;
+				left[c] = v>4 ? v-4 : 0;
+				fire[c][j][i] = left[c];
+			}
+			if (left[0] | left[1] | left[2])
+			{
+				aboveFirst = std::min(aboveFirst, i);
+				aboveLast = i;
+			}
+		}
+	}
 #endif
 }
 
-float temp[CELL*3][CELL*3];
 float fire_alphaf[CELL*3][CELL*3];
 float glow_alphaf[11][11];
 float blur_alphaf[7][7];
@@ -1115,6 +1229,8 @@ void Renderer::prepare_alpha(int size, float intensity)
 	//TODO: implement size
 	int x,y,i,j;
 	float multiplier = 255.0f*intensity;
+	// Local so that renderers constructed on several threads at once don't add into each other's tables
+	float temp[CELL*3][CELL*3];
 
 	memset(temp, 0, sizeof(temp));
 	for (x=0; x<CELL; x++)
@@ -1191,18 +1307,513 @@ void Renderer::prepare_alpha(int size, float intensity)
 #endif
 }
 
-void Renderer::render_parts()
+#ifndef OGLR
+// Calls f(x, y) for each pixel of a line, in the same order and with the same pixels as draw_line
+template<class F>
+static void forLinePixels(int x1, int y1, int x2, int y2, F f)
 {
-	int deca, decr, decg, decb, cola, colr, colg, colb, firea, firer, fireg, fireb, pixel_mode, q, i, t, nx, ny, x, y, caddress;
+	bool cp = abs(y2-y1) > abs(x2-x1);
+	if (cp)
+	{
+		std::swap(x1, y1);
+		std::swap(x2, y2);
+	}
+	if (x1 > x2)
+	{
+		std::swap(x1, x2);
+		std::swap(y1, y2);
+	}
+	int dx = x2 - x1, dy = abs(y2 - y1);
+	float e = 0.0f, de = dx ? dy/(float)dx : 0.0f;
+	int y = y1, sy = (y1<y2) ? 1 : -1;
+	for (int x = x1; x <= x2; x++)
+	{
+		if (cp)
+			f(y, x);
+		else
+			f(x, y);
+		e += de;
+		if (e >= 0.5f)
+		{
+			y += sy;
+			e -= 1.0f;
+		}
+	}
+}
+
+// Number of pixels the sparks and flares reach out to, gradv is divided by divisor until it is no longer visible
+static int trailLength(float gradv, float divisor)
+{
+	int length = 0;
+	for (; gradv>0.5; length++)
+		gradv = gradv/divisor;
+	return length;
+}
+
+playerst *Renderer::partDrawPlayer(const PartDraw &draw)
+{
+	if (draw.t == PT_STKM)
+		return &sim->player;
+	if (draw.t == PT_STKM2)
+		return &sim->player2;
+	int tmp = sim->parts[draw.i].tmp;
+	if (draw.t == PT_FIGH && tmp >= 0 && tmp < MAX_FIGHTERS)
+		return &sim->fighters[(unsigned char)tmp];
+	return NULL;
+}
+
+void Renderer::partDrawBounds(const PartDraw &draw, int &x0, int &y0, int &x1, int &y1)
+{
+	Particle &part = sim->parts[draw.i];
+	int nx = draw.nx, ny = draw.ny, pixel_mode = draw.pixel_mode, reach = 0;
+	if (pixel_mode & PMODE_BLOB)
+		reach = std::max(reach, 1);
+	if (pixel_mode & PMODE_BLUR)
+		reach = std::max(reach, 3);
+	if (pixel_mode & PMODE_GLOW)
+		reach = std::max(reach, 5);
+	if (pixel_mode & (EFFECT_GRAVIN | EFFECT_GRAVOUT))
+		reach = std::max(reach, 16);
+	if (pixel_mode & PMODE_SPARK)
+		reach = std::max(reach, trailLength(4*part.life + draw.sparkFlicker, 1.5f));
+	if (pixel_mode & PMODE_FLARE)
+	{
+		float gradv = draw.flareFlicker + fabs(part.vx)*17 + fabs(part.vy)*17;
+		reach = std::max(reach, 1 + trailLength(std::min(gradv, 255.0f), 1.2f));
+	}
+	if (pixel_mode & PMODE_LFLARE)
+	{
+		float gradv = draw.lflareFlicker + fabs(part.vx)*17 + fabs(part.vy)*17;
+		reach = std::max(reach, 1 + trailLength(std::min(gradv, 255.0f), 1.01f));
+	}
+	x0 = nx - reach;
+	y0 = ny - reach;
+	x1 = nx + reach;
+	y1 = ny + reach;
+	auto include = [&](int x, int y) {
+		x0 = std::min(x0, x);
+		y0 = std::min(y0, y);
+		x1 = std::max(x1, x);
+		y1 = std::max(y1, y);
+	};
+	if ((pixel_mode & EFFECT_LINES) && draw.t == PT_SOAP && (part.ctype&3) == 3 && part.tmp >= 0 && part.tmp < NPART)
+		include((int)(sim->parts[part.tmp].x+0.5f), (int)(sim->parts[part.tmp].y+0.5f));
+	if (pixel_mode & PSPEC_STICKMAN)
+	{
+		include(nx-3, ny-3);
+		include(nx+3, ny+3);
+		if (playerst *cplayer = partDrawPlayer(draw))
+			for (int leg = 0; leg < 2; leg++)
+			{
+				include((int)cplayer->legs[leg*8]-1, (int)cplayer->legs[leg*8+1]-1);
+				include((int)cplayer->legs[leg*8]+1, (int)cplayer->legs[leg*8+1]+1);
+				include((int)cplayer->legs[leg*8+4]-1, (int)cplayer->legs[leg*8+5]-1);
+				include((int)cplayer->legs[leg*8+4]+1, (int)cplayer->legs[leg*8+5]+1);
+			}
+	}
+}
+
+template<bool clipped>
+void Renderer::drawPart(const PartDraw &draw, int clipX0, int clipY0, int clipX1, int clipY1)
+{
+	Particle *parts = sim->parts;
+	Element *elements = sim->elements.data();
+	int i = draw.i, t = draw.t, nx = draw.nx, ny = draw.ny, pixel_mode = draw.pixel_mode;
+	int cola = draw.cola, colr = draw.colr, colg = draw.colg, colb = draw.colb;
+	int firea = draw.firea, firer = draw.firer, fireg = draw.fireg, fireb = draw.fireb;
 	int orbd[4] = {0, 0, 0, 0}, orbl[4] = {0, 0, 0, 0};
+	int x, y;
 	float gradv, flicker;
+	auto inClip = [&](int x, int y) {
+		return !clipped || (x >= clipX0 && y >= clipY0 && x < clipX1 && y < clipY1);
+	};
+	auto blend = [&](int x, int y, int r, int g, int b, int a) {
+		if (inClip(x, y))
+			blendpixel(x, y, r, g, b, a);
+	};
+	auto add = [&](int x, int y, int r, int g, int b, int a) {
+		if (inClip(x, y))
+			addpixel(x, y, r, g, b, a);
+	};
+	// Pixels x0 to x1 of a row, clipped the same way
+	auto clipRow = [&](int &x0, int &x1, int y) {
+		if (clipped)
+		{
+			x0 = std::max(x0, clipX0);
+			x1 = std::min(x1, clipX1-1);
+			if (y < clipY0 || y >= clipY1)
+				return false;
+		}
+		x0 = std::max(x0, 0);
+		x1 = std::min(x1, VIDXRES-1);
+		return y >= 0 && y < VIDYRES && x0 <= x1;
+	};
+	auto blendRow = [&](int x0, int x1, int y, int r, int g, int b, int a) {
+		if (clipRow(x0, x1, y))
+			PixelSpans::Blend(vid+y*(VIDXRES)+x0, x1-x0+1, r, g, b, a);
+	};
+	auto addRow = [&](int x0, int x1, int y, int r, int g, int b, int a) {
+		if (clipRow(x0, x1, y))
+			PixelSpans::Add(vid+y*(VIDXRES)+x0, x1-x0+1, r, g, b, a);
+	};
+	auto line = [&](int x1, int y1, int x2, int y2, int r, int g, int b, int a) {
+		forLinePixels(x1, y1, x2, y2, [&](int x, int y) {
+			blend(x, y, r, g, b, a);
+		});
+	};
+
+	if (pixel_mode & EFFECT_LINES)
+	{
+		if (t==PT_SOAP)
+		{
+			if ((parts[i].ctype&3) == 3 && parts[i].tmp >= 0 && parts[i].tmp < NPART)
+				line(nx, ny, (int)(parts[parts[i].tmp].x+0.5f), (int)(parts[parts[i].tmp].y+0.5f), colr, colg, colb, cola);
+		}
+	}
+	if(pixel_mode & PSPEC_STICKMAN)
+	{
+		int legr, legg, legb;
+		playerst *cplayer = partDrawPlayer(draw);
+		if (!cplayer)
+			return;
+
+		if (draw.stickmanHealth) //If mouse is in the head
+		{
+			String hp = String::Build(Format::Width(parts[i].life, 3));
+			drawtext(mousePos.X-8-2*(parts[i].life<100)-2*(parts[i].life<10), mousePos.Y-12, hp, 255, 255, 255, 255);
+		}
+
+		if (findingElement == t)
+		{
+			colr = 255;
+			colg = colb = 0;
+		}
+		else if (colour_mode != COLOUR_HEAT)
+		{
+			if (cplayer->fan)
+			{
+				colr = PIXR(0x8080FF);
+				colg = PIXG(0x8080FF);
+				colb = PIXB(0x8080FF);
+			}
+			else if (cplayer->elem < PT_NUM && cplayer->elem > 0)
+			{
+				colr = PIXR(elements[cplayer->elem].Colour);
+				colg = PIXG(elements[cplayer->elem].Colour);
+				colb = PIXB(elements[cplayer->elem].Colour);
+			}
+			else
+			{
+				colr = 0x80;
+				colg = 0x80;
+				colb = 0xFF;
+			}
+		}
+
+		if (findingElement && findingElement == t)
+		{
+			legr = 255;
+			legg = legb = 0;
+		}
+		else if (colour_mode==COLOUR_HEAT)
+		{
+			legr = colr;
+			legg = colg;
+			legb = colb;
+		}
+		else if (t==PT_STKM2)
+		{
+			legr = 100;
+			legg = 100;
+			legb = 255;
+		}
+		else
+		{
+			legr = 255;
+			legg = 255;
+			legb = 255;
+		}
+
+		if (findingElement && findingElement != t)
+		{
+			colr /= 10;
+			colg /= 10;
+			colb /= 10;
+			legr /= 10;
+			legg /= 10;
+			legb /= 10;
+		}
+
+		//head
+		if(t==PT_FIGH)
+		{
+			line(nx, ny+2, nx+2, ny, colr, colg, colb, 255);
+			line(nx+2, ny, nx, ny-2, colr, colg, colb, 255);
+			line(nx, ny-2, nx-2, ny, colr, colg, colb, 255);
+			line(nx-2, ny, nx, ny+2, colr, colg, colb, 255);
+		}
+		else
+		{
+			line(nx-2, ny+2, nx+2, ny+2, colr, colg, colb, 255);
+			line(nx-2, ny-2, nx+2, ny-2, colr, colg, colb, 255);
+			line(nx-2, ny-2, nx-2, ny+2, colr, colg, colb, 255);
+			line(nx+2, ny-2, nx+2, ny+2, colr, colg, colb, 255);
+		}
+		//legs
+		line(nx, ny+3, cplayer->legs[0], cplayer->legs[1], legr, legg, legb, 255);
+		line(cplayer->legs[0], cplayer->legs[1], cplayer->legs[4], cplayer->legs[5], legr, legg, legb, 255);
+		line(nx, ny+3, cplayer->legs[8], cplayer->legs[9], legr, legg, legb, 255);
+		line(cplayer->legs[8], cplayer->legs[9], cplayer->legs[12], cplayer->legs[13], legr, legg, legb, 255);
+		if (cplayer->rocketBoots)
+		{
+			for (int leg=0; leg<2; leg++)
+			{
+				int nx = cplayer->legs[leg*8+4], ny = cplayer->legs[leg*8+5];
+				int colr = 255, colg = 0, colb = 255;
+				if (((int)(cplayer->comm)&0x04) == 0x04 || (((int)(cplayer->comm)&0x01) == 0x01 && leg==0) || (((int)(cplayer->comm)&0x02) == 0x02 && leg==1))
+					blend(nx, ny, 0, 255, 0, 255);
+				else
+					blend(nx, ny, 255, 0, 0, 255);
+				blend(nx+1, ny, colr, colg, colb, 223);
+				blend(nx-1, ny, colr, colg, colb, 223);
+				blend(nx, ny+1, colr, colg, colb, 223);
+				blend(nx, ny-1, colr, colg, colb, 223);
+
+				blend(nx+1, ny-1, colr, colg, colb, 112);
+				blend(nx-1, ny-1, colr, colg, colb, 112);
+				blend(nx+1, ny+1, colr, colg, colb, 112);
+				blend(nx-1, ny+1, colr, colg, colb, 112);
+			}
+		}
+	}
+	if(pixel_mode & PMODE_FLAT)
+	{
+		if (inClip(nx, ny))
+			vid[ny*(VIDXRES)+nx] = PIXRGB(colr,colg,colb);
+	}
+	if(pixel_mode & PMODE_BLEND)
+	{
+		blend(nx, ny, colr, colg, colb, cola);
+	}
+	if(pixel_mode & PMODE_ADD)
+	{
+		add(nx, ny, colr, colg, colb, cola);
+	}
+	if(pixel_mode & PMODE_BLOB)
+	{
+		if (inClip(nx, ny))
+			vid[ny*(VIDXRES)+nx] = PIXRGB(colr,colg,colb);
+
+		blend(nx+1, ny, colr, colg, colb, 223);
+		blend(nx-1, ny, colr, colg, colb, 223);
+		blend(nx, ny+1, colr, colg, colb, 223);
+		blend(nx, ny-1, colr, colg, colb, 223);
+
+		blend(nx+1, ny-1, colr, colg, colb, 112);
+		blend(nx-1, ny-1, colr, colg, colb, 112);
+		blend(nx+1, ny+1, colr, colg, colb, 112);
+		blend(nx-1, ny+1, colr, colg, colb, 112);
+	}
+	if(pixel_mode & PMODE_GLOW)
+	{
+		int cola1 = (5*cola)/255;
+		add(nx, ny, colr, colg, colb, (192*cola)/255);
+		add(nx+1, ny, colr, colg, colb, (96*cola)/255);
+		add(nx-1, ny, colr, colg, colb, (96*cola)/255);
+		add(nx, ny+1, colr, colg, colb, (96*cola)/255);
+		add(nx, ny-1, colr, colg, colb, (96*cola)/255);
+
+		// Everything within five pixels across and seven diagonally gets cola1 once more, except the middle
+		addRow(nx-5, nx-1, ny, colr, colg, colb, cola1);
+		addRow(nx+1, nx+5, ny, colr, colg, colb, cola1);
+		for (y = 1; y < 6; y++) {
+			int reach = std::min(5, 7-y);
+			addRow(nx-reach, nx+reach, ny-y, colr, colg, colb, cola1);
+			addRow(nx-reach, nx+reach, ny+y, colr, colg, colb, cola1);
+		}
+	}
+	if(pixel_mode & PMODE_BLUR)
+	{
+		// A diamond of 30 in the middle, then 20 on the three rings around the middle and 10 on the second one,
+		// each pixel gets them in that order
+		blendRow(nx-1, nx+1, ny, colr, colg, colb, 30);
+		blend(nx, ny-1, colr, colg, colb, 30);
+		blend(nx, ny+1, colr, colg, colb, 30);
+		blendRow(nx-3, nx-1, ny, colr, colg, colb, 20);
+		blendRow(nx+1, nx+3, ny, colr, colg, colb, 20);
+		for (y = 1; y < 4; y++) {
+			blendRow(nx-3+y, nx+3-y, ny-y, colr, colg, colb, 20);
+			blendRow(nx-3+y, nx+3-y, ny+y, colr, colg, colb, 20);
+		}
+		for (y = -2; y < 3; y++) {
+			x = 2-abs(y);
+			blend(nx-x, ny+y, colr, colg, colb, 10);
+			if (x)
+				blend(nx+x, ny+y, colr, colg, colb, 10);
+		}
+	}
+	if(pixel_mode & PMODE_SPARK)
+	{
+		flicker = draw.sparkFlicker;
+		gradv = 4*parts[i].life + flicker;
+		for (x = 0; gradv>0.5; x++) {
+			add(nx+x, ny, colr, colg, colb, gradv);
+			add(nx-x, ny, colr, colg, colb, gradv);
+
+			add(nx, ny+x, colr, colg, colb, gradv);
+			add(nx, ny-x, colr, colg, colb, gradv);
+			gradv = gradv/1.5f;
+		}
+	}
+	if(pixel_mode & PMODE_FLARE)
+	{
+		flicker = draw.flareFlicker;
+		gradv = flicker + fabs(parts[i].vx)*17 + fabs(parts[i].vy)*17;
+		blend(nx, ny, colr, colg, colb, (gradv*4)>255?255:(gradv*4) );
+		blend(nx+1, ny, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
+		blend(nx-1, ny, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
+		blend(nx, ny+1, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
+		blend(nx, ny-1, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
+		if (gradv>255) gradv=255;
+		blend(nx+1, ny-1, colr, colg, colb, gradv);
+		blend(nx-1, ny-1, colr, colg, colb, gradv);
+		blend(nx+1, ny+1, colr, colg, colb, gradv);
+		blend(nx-1, ny+1, colr, colg, colb, gradv);
+		for (x = 1; gradv>0.5; x++) {
+			add(nx+x, ny, colr, colg, colb, gradv);
+			add(nx-x, ny, colr, colg, colb, gradv);
+			add(nx, ny+x, colr, colg, colb, gradv);
+			add(nx, ny-x, colr, colg, colb, gradv);
+			gradv = gradv/1.2f;
+		}
+	}
+	if(pixel_mode & PMODE_LFLARE)
+	{
+		flicker = draw.lflareFlicker;
+		gradv = flicker + fabs(parts[i].vx)*17 + fabs(parts[i].vy)*17;
+		blend(nx, ny, colr, colg, colb, (gradv*4)>255?255:(gradv*4) );
+		blend(nx+1, ny, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
+		blend(nx-1, ny, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
+		blend(nx, ny+1, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
+		blend(nx, ny-1, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
+		if (gradv>255) gradv=255;
+		blend(nx+1, ny-1, colr, colg, colb, gradv);
+		blend(nx-1, ny-1, colr, colg, colb, gradv);
+		blend(nx+1, ny+1, colr, colg, colb, gradv);
+		blend(nx-1, ny+1, colr, colg, colb, gradv);
+		for (x = 1; gradv>0.5; x++) {
+			add(nx+x, ny, colr, colg, colb, gradv);
+			add(nx-x, ny, colr, colg, colb, gradv);
+			add(nx, ny+x, colr, colg, colb, gradv);
+			add(nx, ny-x, colr, colg, colb, gradv);
+			gradv = gradv/1.01f;
+		}
+	}
+	if (pixel_mode & EFFECT_GRAVIN)
+	{
+		int nxo = 0;
+		int nyo = 0;
+		int r;
+		float drad = 0.0f;
+		float ddist = 0.0f;
+		sim->orbitalparts_get(parts[i].life, parts[i].ctype, orbd, orbl);
+		for (r = 0; r < 4; r++) {
+			ddist = ((float)orbd[r])/16.0f;
+			drad = (M_PI * ((float)orbl[r]) / 180.0f)*1.41f;
+			nxo = (int)(ddist*cos(drad));
+			nyo = (int)(ddist*sin(drad));
+			if (ny+nyo>0 && ny+nyo<YRES && nx+nxo>0 && nx+nxo<XRES && TYP(sim->pmap[ny+nyo][nx+nxo]) != PT_PRTI)
+				add(nx+nxo, ny+nyo, colr, colg, colb, 255-orbd[r]);
+		}
+	}
+	if (pixel_mode & EFFECT_GRAVOUT)
+	{
+		int nxo = 0;
+		int nyo = 0;
+		int r;
+		float drad = 0.0f;
+		float ddist = 0.0f;
+		sim->orbitalparts_get(parts[i].life, parts[i].ctype, orbd, orbl);
+		for (r = 0; r < 4; r++) {
+			ddist = ((float)orbd[r])/16.0f;
+			drad = (M_PI * ((float)orbl[r]) / 180.0f)*1.41f;
+			nxo = (int)(ddist*cos(drad));
+			nyo = (int)(ddist*sin(drad));
+			if (ny+nyo>0 && ny+nyo<YRES && nx+nxo>0 && nx+nxo<XRES && TYP(sim->pmap[ny+nyo][nx+nxo]) != PT_PRTO)
+				add(nx+nxo, ny+nyo, colr, colg, colb, 255-orbd[r]);
+		}
+	}
+	if (draw.debugLines)
+	{
+		// draw lines connecting wifi/portal channels
+		int type = parts[i].type, tmp = (int)((parts[i].temp-73.15f)/100+1), othertmp;
+		if (type == PT_PRTI)
+			type = PT_PRTO;
+		else if (type == PT_PRTO)
+			type = PT_PRTI;
+		for (int z = 0; z <= sim->parts_lastActiveIndex; z++)
+		{
+			if (parts[z].type == type)
+			{
+				othertmp = (int)((parts[z].temp-73.15f)/100+1);
+				if (tmp == othertmp)
+					xor_line(nx,ny,(int)(parts[z].x+0.5f),(int)(parts[z].y+0.5f));
+			}
+		}
+	}
+	// Fire effects, only drawn by the tile the particle's cell is in, tiles are whole cells
+	if (!inClip(nx, ny))
+		return;
+	if(firea && (pixel_mode & FIRE_BLEND))
+	{
+		firea /= 2;
+		fire_r[ny/CELL][nx/CELL] = (firea*firer + (255-firea)*fire_r[ny/CELL][nx/CELL]) >> 8;
+		fire_g[ny/CELL][nx/CELL] = (firea*fireg + (255-firea)*fire_g[ny/CELL][nx/CELL]) >> 8;
+		fire_b[ny/CELL][nx/CELL] = (firea*fireb + (255-firea)*fire_b[ny/CELL][nx/CELL]) >> 8;
+	}
+	if(firea && (pixel_mode & FIRE_ADD))
+	{
+		firea /= 8;
+		firer = ((firea*firer) >> 8) + fire_r[ny/CELL][nx/CELL];
+		fireg = ((firea*fireg) >> 8) + fire_g[ny/CELL][nx/CELL];
+		fireb = ((firea*fireb) >> 8) + fire_b[ny/CELL][nx/CELL];
+
+		if(firer>255)
+			firer = 255;
+		if(fireg>255)
+			fireg = 255;
+		if(fireb>255)
+			fireb = 255;
+
+		fire_r[ny/CELL][nx/CELL] = firer;
+		fire_g[ny/CELL][nx/CELL] = fireg;
+		fire_b[ny/CELL][nx/CELL] = fireb;
+	}
+	if(firea && (pixel_mode & FIRE_SPARK))
+	{
+		firea /= 4;
+		fire_r[ny/CELL][nx/CELL] = (firea*firer + (255-firea)*fire_r[ny/CELL][nx/CELL]) >> 8;
+		fire_g[ny/CELL][nx/CELL] = (firea*fireg + (255-firea)*fire_g[ny/CELL][nx/CELL]) >> 8;
+		fire_b[ny/CELL][nx/CELL] = (firea*fireb + (255-firea)*fire_b[ny/CELL][nx/CELL]) >> 8;
+	}
+}
+#endif
+
+void Renderer::render_parts()
+{
+	int deca, decr, decg, decb, cola, colr, colg, colb, firea, firer, fireg, fireb, pixel_mode, q, i, t, nx, ny, caddress;
+	float gradv;
 	Particle * parts;
 	Element *elements;
 	if(!sim)
 		return;
 	parts = sim->parts;
 	elements = sim->elements.data();
+	if (sim->profiler.enabled)
+		sim->profiler.renderFrames++;
 #ifdef OGLR
+	int orbd[4] = {0, 0, 0, 0}, orbl[4] = {0, 0, 0, 0};
+	float flicker;
 	float fnx, fny;
 	int cfireV = 0, cfireC = 0, cfire = 0;
 	int csmokeV = 0, csmokeC = 0, csmoke = 0;
@@ -1234,6 +1845,10 @@ void Renderer::render_parts()
 	}
 #endif
 	foundElements = 0;
+#ifndef OGLR
+	partDraws.clear();
+	bool drawAllAtOnce = false;
+#endif
 	for(i = 0; i<=sim->parts_lastActiveIndex; i++) {
 		if (sim->parts[i].type && sim->parts[i].type >= 0 && sim->parts[i].type < PT_NUM) {
 			t = sim->parts[i].type;
@@ -1291,27 +1906,17 @@ void Renderer::render_parts()
 				{
 					if (elements[t].Graphics)
 					{
-#if !defined(RENDERER) && defined(LUACONSOLE)
-						if (lua_gr_func[t])
+						int cacheable;
 						{
-							if (luacon_graphicsReplacement(this, &(sim->parts[i]), nx, ny, &pixel_mode, &cola, &colr, &colg, &colb, &firea, &firer, &fireg, &fireb, i))
-							{
-								graphicscache[t].isready = 1;
-								graphicscache[t].pixel_mode = pixel_mode;
-								graphicscache[t].cola = cola;
-								graphicscache[t].colr = colr;
-								graphicscache[t].colg = colg;
-								graphicscache[t].colb = colb;
-								graphicscache[t].firea = firea;
-								graphicscache[t].firer = firer;
-								graphicscache[t].fireg = fireg;
-								graphicscache[t].fireb = fireb;
-							}
-						}
-						else if ((*(elements[t].Graphics))(this, &(sim->parts[i]), nx, ny, &pixel_mode, &cola, &colr, &colg, &colb, &firea, &firer, &fireg, &fireb)) //That's a lot of args, a struct might be better
-#else
-						if ((*(elements[t].Graphics))(this, &(sim->parts[i]), nx, ny, &pixel_mode, &cola, &colr, &colg, &colb, &firea, &firer, &fireg, &fireb)) //That's a lot of args, a struct might be better
+							ElementProfiler::Timer timer(sim->profiler, t, ElementProfiler::GRAPHICS);
+#if !defined(RENDERER) && defined(LUACONSOLE)
+							if (lua_gr_func[t] && !backgroundOnly)
+								cacheable = luacon_graphicsReplacement(this, &(sim->parts[i]), nx, ny, &pixel_mode, &cola, &colr, &colg, &colb, &firea, &firer, &fireg, &fireb, i);
+							else
 #endif
+								cacheable = (*(elements[t].Graphics))(this, &(sim->parts[i]), nx, ny, &pixel_mode, &cola, &colr, &colg, &colb, &firea, &firer, &fireg, &fireb); //That's a lot of args, a struct might be better
+						}
+						if (cacheable)
 						{
 							graphicscache[t].isready = 1;
 							graphicscache[t].pixel_mode = pixel_mode;
@@ -1471,6 +2076,7 @@ void Renderer::render_parts()
 				else if(firea<0) firea = 0;
 	#endif
 
+#ifdef OGLR
 				//Pixel rendering
 				if (pixel_mode & EFFECT_LINES)
 				{
@@ -1526,7 +2132,6 @@ void Renderer::render_parts()
 						}
 					}
 
-#ifdef OGLR
 					glColor4f(((float)colr)/255.0f, ((float)colg)/255.0f, ((float)colb)/255.0f, 1.0f);
 					glBegin(GL_LINE_STRIP);
 					if(t==PT_FIGH)
@@ -1568,87 +2173,9 @@ void Renderer::render_parts()
 					glVertex2f(cplayer->legs[8], cplayer->legs[9]);
 					glVertex2f(cplayer->legs[12], cplayer->legs[13]);
 					glEnd();
-#else
-					if (findingElement && findingElement == t)
-					{
-						legr = 255;
-						legg = legb = 0;
-					}
-					else if (colour_mode==COLOUR_HEAT)
-					{
-						legr = colr;
-						legg = colg;
-						legb = colb;
-					}
-					else if (t==PT_STKM2)
-					{
-						legr = 100;
-						legg = 100;
-						legb = 255;
-					}
-					else
-					{
-						legr = 255;
-						legg = 255;
-						legb = 255;
-					}
-
-					if (findingElement && findingElement != t)
-					{
-						colr /= 10;
-						colg /= 10;
-						colb /= 10;
-						legr /= 10;
-						legg /= 10;
-						legb /= 10;
-					}
-
-					//head
-					if(t==PT_FIGH)
-					{
-						draw_line(nx, ny+2, nx+2, ny, colr, colg, colb, 255);
-						draw_line(nx+2, ny, nx, ny-2, colr, colg, colb, 255);
-						draw_line(nx, ny-2, nx-2, ny, colr, colg, colb, 255);
-						draw_line(nx-2, ny, nx, ny+2, colr, colg, colb, 255);
-					}
-					else
-					{
-						draw_line(nx-2, ny+2, nx+2, ny+2, colr, colg, colb, 255);
-						draw_line(nx-2, ny-2, nx+2, ny-2, colr, colg, colb, 255);
-						draw_line(nx-2, ny-2, nx-2, ny+2, colr, colg, colb, 255);
-						draw_line(nx+2, ny-2, nx+2, ny+2, colr, colg, colb, 255);
-					}
-					//legs
-					draw_line(nx, ny+3, cplayer->legs[0], cplayer->legs[1], legr, legg, legb, 255);
-					draw_line(cplayer->legs[0], cplayer->legs[1], cplayer->legs[4], cplayer->legs[5], legr, legg, legb, 255);
-					draw_line(nx, ny+3, cplayer->legs[8], cplayer->legs[9], legr, legg, legb, 255);
-					draw_line(cplayer->legs[8], cplayer->legs[9], cplayer->legs[12], cplayer->legs[13], legr, legg, legb, 255);
-					if (cplayer->rocketBoots)
-					{
-						for (int leg=0; leg<2; leg++)
-						{
-							int nx = cplayer->legs[leg*8+4], ny = cplayer->legs[leg*8+5];
-							int colr = 255, colg = 0, colb = 255;
-							if (((int)(cplayer->comm)&0x04) == 0x04 || (((int)(cplayer->comm)&0x01) == 0x01 && leg==0) || (((int)(cplayer->comm)&0x02) == 0x02 && leg==1))
-								blendpixel(nx, ny, 0, 255, 0, 255);
-							else
-								blendpixel(nx, ny, 255, 0, 0, 255);
-							blendpixel(nx+1, ny, colr, colg, colb, 223);
-							blendpixel(nx-1, ny, colr, colg, colb, 223);
-							blendpixel(nx, ny+1, colr, colg, colb, 223);
-							blendpixel(nx, ny-1, colr, colg, colb, 223);
-
-							blendpixel(nx+1, ny-1, colr, colg, colb, 112);
-							blendpixel(nx-1, ny-1, colr, colg, colb, 112);
-							blendpixel(nx+1, ny+1, colr, colg, colb, 112);
-							blendpixel(nx-1, ny+1, colr, colg, colb, 112);
-						}
-					}
-#endif
 				}
 				if(pixel_mode & PMODE_FLAT)
 				{
-#ifdef OGLR
 					flatV[cflatV++] = nx;
 					flatV[cflatV++] = ny;
 					flatC[cflatC++] = ((float)colr)/255.0f;
@@ -1656,13 +2183,9 @@ void Renderer::render_parts()
 					flatC[cflatC++] = ((float)colb)/255.0f;
 					flatC[cflatC++] = 1.0f;
 					cflat++;
-#else
-					vid[ny*(VIDXRES)+nx] = PIXRGB(colr,colg,colb);
-#endif
 				}
 				if(pixel_mode & PMODE_BLEND)
 				{
-#ifdef OGLR
 					flatV[cflatV++] = nx;
 					flatV[cflatV++] = ny;
 					flatC[cflatC++] = ((float)colr)/255.0f;
@@ -1670,13 +2193,9 @@ void Renderer::render_parts()
 					flatC[cflatC++] = ((float)colb)/255.0f;
 					flatC[cflatC++] = ((float)cola)/255.0f;
 					cflat++;
-#else
-					blendpixel(nx, ny, colr, colg, colb, cola);
-#endif
 				}
 				if(pixel_mode & PMODE_ADD)
 				{
-#ifdef OGLR
 					addV[caddV++] = nx;
 					addV[caddV++] = ny;
 					addC[caddC++] = ((float)colr)/255.0f;
@@ -1684,13 +2203,9 @@ void Renderer::render_parts()
 					addC[caddC++] = ((float)colb)/255.0f;
 					addC[caddC++] = ((float)cola)/255.0f;
 					cadd++;
-#else
-					addpixel(nx, ny, colr, colg, colb, cola);
-#endif
 				}
 				if(pixel_mode & PMODE_BLOB)
 				{
-#ifdef OGLR
 					blobV[cblobV++] = nx;
 					blobV[cblobV++] = ny;
 					blobC[cblobC++] = ((float)colr)/255.0f;
@@ -1698,24 +2213,10 @@ void Renderer::render_parts()
 					blobC[cblobC++] = ((float)colb)/255.0f;
 					blobC[cblobC++] = 1.0f;
 					cblob++;
-#else
-					vid[ny*(VIDXRES)+nx] = PIXRGB(colr,colg,colb);
-
-					blendpixel(nx+1, ny, colr, colg, colb, 223);
-					blendpixel(nx-1, ny, colr, colg, colb, 223);
-					blendpixel(nx, ny+1, colr, colg, colb, 223);
-					blendpixel(nx, ny-1, colr, colg, colb, 223);
-
-					blendpixel(nx+1, ny-1, colr, colg, colb, 112);
-					blendpixel(nx-1, ny-1, colr, colg, colb, 112);
-					blendpixel(nx+1, ny+1, colr, colg, colb, 112);
-					blendpixel(nx-1, ny+1, colr, colg, colb, 112);
-#endif
 				}
 				if(pixel_mode & PMODE_GLOW)
 				{
 					int cola1 = (5*cola)/255;
-#ifdef OGLR
 					glowV[cglowV++] = nx;
 					glowV[cglowV++] = ny;
 					glowC[cglowC++] = ((float)colr)/255.0f;
@@ -1723,32 +2224,9 @@ void Renderer::render_parts()
 					glowC[cglowC++] = ((float)colb)/255.0f;
 					glowC[cglowC++] = 1.0f;
 					cglow++;
-#else
-					addpixel(nx, ny, colr, colg, colb, (192*cola)/255);
-					addpixel(nx+1, ny, colr, colg, colb, (96*cola)/255);
-					addpixel(nx-1, ny, colr, colg, colb, (96*cola)/255);
-					addpixel(nx, ny+1, colr, colg, colb, (96*cola)/255);
-					addpixel(nx, ny-1, colr, colg, colb, (96*cola)/255);
-
-					for (x = 1; x < 6; x++) {
-						addpixel(nx, ny-x, colr, colg, colb, cola1);
-						addpixel(nx, ny+x, colr, colg, colb, cola1);
-						addpixel(nx-x, ny, colr, colg, colb, cola1);
-						addpixel(nx+x, ny, colr, colg, colb, cola1);
-						for (y = 1; y < 6; y++) {
-							if(x + y > 7)
-								continue;
-							addpixel(nx+x, ny-y, colr, colg, colb, cola1);
-							addpixel(nx-x, ny+y, colr, colg, colb, cola1);
-							addpixel(nx+x, ny+y, colr, colg, colb, cola1);
-							addpixel(nx-x, ny-y, colr, colg, colb, cola1);
-						}
-					}
-#endif
 				}
 				if(pixel_mode & PMODE_BLUR)
 				{
-#ifdef OGLR
 					blurV[cblurV++] = nx;
 					blurV[cblurV++] = ny;
 					blurC[cblurC++] = ((float)colr)/255.0f;
@@ -1756,25 +2234,10 @@ void Renderer::render_parts()
 					blurC[cblurC++] = ((float)colb)/255.0f;
 					blurC[cblurC++] = 1.0f;
 					cblur++;
-#else
-					for (x=-3; x<4; x++)
-					{
-						for (y=-3; y<4; y++)
-						{
-							if (abs(x)+abs(y) <2 && !(abs(x)==2||abs(y)==2))
-								blendpixel(x+nx, y+ny, colr, colg, colb, 30);
-							if (abs(x)+abs(y) <=3 && abs(x)+abs(y))
-								blendpixel(x+nx, y+ny, colr, colg, colb, 20);
-							if (abs(x)+abs(y) == 2)
-								blendpixel(x+nx, y+ny, colr, colg, colb, 10);
-						}
-					}
-#endif
 				}
 				if(pixel_mode & PMODE_SPARK)
 				{
 					flicker = random_gen()%20;
-#ifdef OGLR
 					//Oh god, this is awful
 					lineC[clineC++] = ((float)colr)/255.0f;
 					lineC[clineC++] = ((float)colg)/255.0f;
@@ -1823,22 +2286,10 @@ void Renderer::render_parts()
 					lineV[clineV++] = fnx;
 					lineV[clineV++] = fny+5;
 					cline++;
-#else
-					gradv = 4*sim->parts[i].life + flicker;
-					for (x = 0; gradv>0.5; x++) {
-						addpixel(nx+x, ny, colr, colg, colb, gradv);
-						addpixel(nx-x, ny, colr, colg, colb, gradv);
-
-						addpixel(nx, ny+x, colr, colg, colb, gradv);
-						addpixel(nx, ny-x, colr, colg, colb, gradv);
-						gradv = gradv/1.5f;
-					}
-#endif
 				}
 				if(pixel_mode & PMODE_FLARE)
 				{
 					flicker = random_gen()%20;
-#ifdef OGLR
 					//Oh god, this is awful
 					lineC[clineC++] = ((float)colr)/255.0f;
 					lineC[clineC++] = ((float)colg)/255.0f;
@@ -1887,31 +2338,10 @@ void Renderer::render_parts()
 					lineV[clineV++] = fnx;
 					lineV[clineV++] = fny+10;
 					cline++;
-#else
-					gradv = flicker + fabs(parts[i].vx)*17 + fabs(sim->parts[i].vy)*17;
-					blendpixel(nx, ny, colr, colg, colb, (gradv*4)>255?255:(gradv*4) );
-					blendpixel(nx+1, ny, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
-					blendpixel(nx-1, ny, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
-					blendpixel(nx, ny+1, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
-					blendpixel(nx, ny-1, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
-					if (gradv>255) gradv=255;
-					blendpixel(nx+1, ny-1, colr, colg, colb, gradv);
-					blendpixel(nx-1, ny-1, colr, colg, colb, gradv);
-					blendpixel(nx+1, ny+1, colr, colg, colb, gradv);
-					blendpixel(nx-1, ny+1, colr, colg, colb, gradv);
-					for (x = 1; gradv>0.5; x++) {
-						addpixel(nx+x, ny, colr, colg, colb, gradv);
-						addpixel(nx-x, ny, colr, colg, colb, gradv);
-						addpixel(nx, ny+x, colr, colg, colb, gradv);
-						addpixel(nx, ny-x, colr, colg, colb, gradv);
-						gradv = gradv/1.2f;
-					}
-#endif
 				}
 				if(pixel_mode & PMODE_LFLARE)
 				{
 					flicker = random_gen()%20;
-#ifdef OGLR
 					//Oh god, this is awful
 					lineC[clineC++] = ((float)colr)/255.0f;
 					lineC[clineC++] = ((float)colg)/255.0f;
@@ -1960,26 +2390,6 @@ void Renderer::render_parts()
 					lineV[clineV++] = fnx;
 					lineV[clineV++] = fny+70;
 					cline++;
-#else
-					gradv = flicker + fabs(parts[i].vx)*17 + fabs(parts[i].vy)*17;
-					blendpixel(nx, ny, colr, colg, colb, (gradv*4)>255?255:(gradv*4) );
-					blendpixel(nx+1, ny, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
-					blendpixel(nx-1, ny, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
-					blendpixel(nx, ny+1, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
-					blendpixel(nx, ny-1, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
-					if (gradv>255) gradv=255;
-					blendpixel(nx+1, ny-1, colr, colg, colb, gradv);
-					blendpixel(nx-1, ny-1, colr, colg, colb, gradv);
-					blendpixel(nx+1, ny+1, colr, colg, colb, gradv);
-					blendpixel(nx-1, ny+1, colr, colg, colb, gradv);
-					for (x = 1; gradv>0.5; x++) {
-						addpixel(nx+x, ny, colr, colg, colb, gradv);
-						addpixel(nx-x, ny, colr, colg, colb, gradv);
-						addpixel(nx, ny+x, colr, colg, colb, gradv);
-						addpixel(nx, ny-x, colr, colg, colb, gradv);
-						gradv = gradv/1.01f;
-					}
-#endif
 				}
 				if (pixel_mode & EFFECT_GRAVIN)
 				{
@@ -2039,7 +2449,6 @@ void Renderer::render_parts()
 				//Fire effects
 				if(firea && (pixel_mode & FIRE_BLEND))
 				{
-#ifdef OGLR
 					smokeV[csmokeV++] = nx;
 					smokeV[csmokeV++] = ny;
 					smokeC[csmokeC++] = ((float)firer)/255.0f;
@@ -2047,16 +2456,9 @@ void Renderer::render_parts()
 					smokeC[csmokeC++] = ((float)fireb)/255.0f;
 					smokeC[csmokeC++] = ((float)firea)/255.0f;
 					csmoke++;
-#else
-					firea /= 2;
-					fire_r[ny/CELL][nx/CELL] = (firea*firer + (255-firea)*fire_r[ny/CELL][nx/CELL]) >> 8;
-					fire_g[ny/CELL][nx/CELL] = (firea*fireg + (255-firea)*fire_g[ny/CELL][nx/CELL]) >> 8;
-					fire_b[ny/CELL][nx/CELL] = (firea*fireb + (255-firea)*fire_b[ny/CELL][nx/CELL]) >> 8;
-#endif
 				}
 				if(firea && (pixel_mode & FIRE_ADD))
 				{
-#ifdef OGLR
 					fireV[cfireV++] = nx;
 					fireV[cfireV++] = ny;
 					fireC[cfireC++] = ((float)firer)/255.0f;
@@ -2064,27 +2466,9 @@ void Renderer::render_parts()
 					fireC[cfireC++] = ((float)fireb)/255.0f;
 					fireC[cfireC++] = ((float)firea)/255.0f;
 					cfire++;
-#else
-					firea /= 8;
-					firer = ((firea*firer) >> 8) + fire_r[ny/CELL][nx/CELL];
-					fireg = ((firea*fireg) >> 8) + fire_g[ny/CELL][nx/CELL];
-					fireb = ((firea*fireb) >> 8) + fire_b[ny/CELL][nx/CELL];
-
-					if(firer>255)
-						firer = 255;
-					if(fireg>255)
-						fireg = 255;
-					if(fireb>255)
-						fireb = 255;
-
-					fire_r[ny/CELL][nx/CELL] = firer;
-					fire_g[ny/CELL][nx/CELL] = fireg;
-					fire_b[ny/CELL][nx/CELL] = fireb;
-#endif
 				}
 				if(firea && (pixel_mode & FIRE_SPARK))
 				{
-#ifdef OGLR
 					smokeV[csmokeV++] = nx;
 					smokeV[csmokeV++] = ny;
 					smokeC[csmokeC++] = ((float)firer)/255.0f;
@@ -2092,16 +2476,78 @@ void Renderer::render_parts()
 					smokeC[csmokeC++] = ((float)fireb)/255.0f;
 					smokeC[csmokeC++] = ((float)firea)/255.0f;
 					csmoke++;
+				}
 #else
-					firea /= 4;
-					fire_r[ny/CELL][nx/CELL] = (firea*firer + (255-firea)*fire_r[ny/CELL][nx/CELL]) >> 8;
-					fire_g[ny/CELL][nx/CELL] = (firea*fireg + (255-firea)*fire_g[ny/CELL][nx/CELL]) >> 8;
-					fire_b[ny/CELL][nx/CELL] = (firea*fireb + (255-firea)*fire_b[ny/CELL][nx/CELL]) >> 8;
-#endif
+				PartDraw draw;
+				draw.i = i;
+				draw.t = t;
+				draw.nx = nx;
+				draw.ny = ny;
+				draw.pixel_mode = pixel_mode;
+				draw.cola = cola;
+				draw.colr = colr;
+				draw.colg = colg;
+				draw.colb = colb;
+				draw.firea = firea;
+				draw.firer = firer;
+				draw.fireg = fireg;
+				draw.fireb = fireb;
+				// Picked here rather than when the particle is drawn so random_gen is called in the same order as it always was
+				draw.sparkFlicker = (pixel_mode & PMODE_SPARK) ? random_gen()%20 : 0;
+				draw.flareFlicker = (pixel_mode & PMODE_FLARE) ? random_gen()%20 : 0;
+				draw.lflareFlicker = (pixel_mode & PMODE_LFLARE) ? random_gen()%20 : 0;
+				draw.stickmanHealth = (pixel_mode & PSPEC_STICKMAN) && mousePos.X>(nx-3) && mousePos.X<(nx+3) && mousePos.Y<(ny+3) && mousePos.Y>(ny-3);
+				draw.debugLines = (pixel_mode & EFFECT_DBGLINES) && !(display_mode&DISPLAY_PERS) && mousePos.X == nx && mousePos.Y == ny && i == ID(sim->pmap[ny][nx]) && debugLines;
+				if (!renderPool)
+					drawPart<false>(draw, 0, 0, VIDXRES, VIDYRES);
+				else
+				{
+					// Text and xor lines aren't cut up into tiles
+					if (draw.stickmanHealth || draw.debugLines)
+						drawAllAtOnce = true;
+					partDraws.push_back(draw);
 				}
+#endif
 			}
 		}
 	}
+#ifndef OGLR
+	// Each tile draws the particles that reach into it, clipped to the tile, in the order they were coloured in,
+	// so every pixel still sees the same particles in the same order as when they are drawn one by one
+	if (!renderPool)
+		;
+	else if (drawAllAtOnce)
+	{
+		for (auto &draw : partDraws)
+			drawPart<false>(draw, 0, 0, VIDXRES, VIDYRES);
+	}
+	else
+	{
+		const int tilesX = (VIDXRES+partTileSize-1)/partTileSize;
+		const int tilesY = (VIDYRES+partTileSize-1)/partTileSize;
+		tileDraws.resize(tilesX*tilesY);
+		for (auto &tile : tileDraws)
+			tile.clear();
+		for (int d = 0; d < int(partDraws.size()); d++)
+		{
+			int x0, y0, x1, y1;
+			partDrawBounds(partDraws[d], x0, y0, x1, y1);
+			if (x1 < 0 || y1 < 0 || x0 >= VIDXRES || y0 >= VIDYRES)
+				continue;
+			int tx0 = std::max(x0, 0)/partTileSize, tx1 = std::min(x1, VIDXRES-1)/partTileSize;
+			int ty0 = std::max(y0, 0)/partTileSize, ty1 = std::min(y1, VIDYRES-1)/partTileSize;
+			for (int ty = ty0; ty <= ty1; ty++)
+				for (int tx = tx0; tx <= tx1; tx++)
+					tileDraws[ty*tilesX+tx].push_back(d);
+		}
+		renderPool->ParallelFor(tilesX*tilesY, [this, tilesX](int tile) {
+			int x0 = (tile%tilesX)*partTileSize, y0 = (tile/tilesX)*partTileSize;
+			int x1 = std::min(x0+partTileSize, VIDXRES), y1 = std::min(y0+partTileSize, VIDYRES);
+			for (int d : tileDraws[tile])
+				drawPart<true>(partDraws[d], x0, y0, x1, y1);
+		});
+	}
+#endif
 #ifdef OGLR
 
 		//Go into array mode
@@ -2564,7 +3010,11 @@ Renderer::Renderer(Graphics * g, Simulation * sim):
 	zoomScopeSize(32),
 	zoomEnabled(false),
 	ZFACTOR(8),
-	gridSize(0)
+	gridSize(0),
+	renderThreads(1),
+	renderPool(NULL),
+	renderThread(NULL),
+	backgroundOnly(false)
 {
 	this->g = g;
 	this->sim = sim;
@@ -2836,6 +3286,28 @@ void Renderer::ClearAccumulation()
 #ifndef OGLR
 	std::fill(persistentVid, persistentVid+(VIDXRES*YRES), 0);
 #endif
+#ifndef OGLI
+	if (renderThread)
+		renderThread->ClearAccumulation();
+#endif
+}
+
+void Renderer::ClearGraphicsCache()
+{
+	std::fill(graphicscache, graphicscache+PT_NUM, gcache_item());
+#ifndef OGLI
+	if (renderThread)
+		renderThread->ClearGraphicsCache();
+#endif
+}
+
+void Renderer::ClearGraphicsCache(int type)
+{
+	graphicscache[type].isready = 0;
+#ifndef OGLI
+	if (renderThread)
+		renderThread->ClearGraphicsCache();
+#endif
 }
 
 void Renderer::AddRenderMode(unsigned int mode)
@@ -2964,6 +3436,9 @@ VideoBuffer Renderer::DumpFrame()
 
 Renderer::~Renderer()
 {
+#ifndef OGLI
+	delete renderThread;
+#endif
 #if !defined(OGLR)
 #if defined(OGLI)
 	delete[] vid;
@@ -2974,6 +3449,45 @@ Renderer::~Renderer()
 	delete[] graphicscache;
 	free(flm_data);
 	free(plasma_data);
+	delete renderPool;
+}
+
+void Renderer::SetRenderThreads(int threads)
+{
+	if (threads < 1)
+		threads = 1;
+	if (threads == renderThreads)
+		return;
+	renderThreads = threads;
+	delete renderPool;
+	renderPool = NULL;
+#ifndef OGLR
+	if (threads > 1)
+		renderPool = new ThreadPool(threads);
+#endif
+}
+
+void Renderer::SetDrawInBackground(bool background)
+{
+#ifndef OGLI
+	if (background == (renderThread != NULL))
+		return;
+	delete renderThread;
+	renderThread = background ? new RenderThread(*this) : NULL;
+#endif
+}
+
+bool Renderer::canDrawInBackground()
+{
+	// The profiler times graphics functions as part of the frame they were called for
+	if (sim->profiler.enabled)
+		return false;
+#if !defined(RENDERER) && defined(LUACONSOLE)
+	for (int t = 0; t < PT_NUM; t++)
+		if (lua_gr_func[t])
+			return false;
+#endif
+	return true;
 }
 
 #define PIXELMETHODS_CLASS Renderer
@@ -11,7 +11,10 @@
 #include "gui/interface/Point.h"
 
 class RenderPreset;
+class RenderThread;
 class Simulation;
+class ThreadPool;
+struct playerst;
 
 struct gcache_item
 {
@@ -94,6 +97,9 @@ public:
 	void FinaliseParts();
 
 	void ClearAccumulation();
+	// Makes every element's graphics be worked out again, for when an element's properties or graphics function change
+	void ClearGraphicsCache();
+	void ClearGraphicsCache(int type);
 	void clearScreen(float alpha);
 	void SetSample(int x, int y);
 
@@ -159,6 +165,16 @@ public:
 	int GetGridSize() { return gridSize; }
 	void SetGridSize(int value) { gridSize = value; }
 
+	// Number of threads render_parts draws particles on, each taking tiles of the screen. Not used by the OpenGL renderer
+	void SetRenderThreads(int threads);
+	int GetRenderThreads() { return renderThreads; }
+
+	// Draws the simulation on a thread of its own while the next frame is simulated, shown a frame late. Frames are
+	// still drawn the usual way while Lua graphics functions are set or the element profiler is on. Not used by the
+	// OpenGL renderers
+	void SetDrawInBackground(bool background);
+	bool GetDrawInBackground() { return renderThread != NULL; }
+
 	static VideoBuffer * WallIcon(int wallID, int width, int height);
 
 	Renderer(Graphics * g, Simulation * sim);
@@ -166,6 +182,35 @@ public:
 
 private:
 	int gridSize;
+	int renderThreads;
+	ThreadPool *renderPool;
+	RenderThread *renderThread;
+	bool backgroundOnly; // draws for a RenderThread, which can't call Lua as that only runs on the main thread
+	bool canDrawInBackground();
+	friend class RenderThread;
+#ifndef OGLR
+	// How render_parts decided to draw a particle, the particles are drawn once all of them have been coloured
+	struct PartDraw
+	{
+		int i, t, nx, ny;
+		int pixel_mode;
+		int cola, colr, colg, colb;
+		int firea, firer, fireg, fireb;
+		int sparkFlicker, flareFlicker, lflareFlicker;
+		bool stickmanHealth; // mouse is over the stickman's head
+		bool debugLines;
+	};
+	static const int partTileSize = 64; // a whole number of cells, so fire is only drawn by one tile
+	std::vector<PartDraw> partDraws;
+	std::vector<std::vector<int> > tileDraws; // indices into partDraws of the particles that reach into each tile
+
+	// Draws a particle, leaving everything outside the clip rectangle alone if clipped
+	template<bool clipped>
+	void drawPart(const PartDraw &draw, int clipX0, int clipY0, int clipX1, int clipY1);
+	// The rectangle a particle can draw in, inclusive
+	void partDrawBounds(const PartDraw &draw, int &x0, int &y0, int &x1, int &y1);
+	playerst *partDrawPlayer(const PartDraw &draw);
+#endif
 #ifdef OGLR
 	GLuint zoomTex, airBuf, fireAlpha, glowAlpha, blurAlpha, partsFboTex, partsFbo, partsTFX, partsTFY, airPV, airVY, airVX;
 	GLuint fireProg, airProg_Pressure, airProg_Velocity, airProg_Cracker, lensProg;
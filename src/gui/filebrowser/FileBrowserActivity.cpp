@@ -11,9 +11,10 @@
 #include "client/Client.h"
 #include "client/SaveFile.h"
 #include "client/GameSave.h"
+#include "client/ThumbnailCache.h"
 
 #include "gui/Style.h"
-#include "tasks/Task.h"
+#include "tasks/AbandonableTask.h"
 
 #include "gui/dialogues/TextPrompt.h"
 #include "gui/dialogues/ConfirmPrompt.h"
@@ -22,54 +23,58 @@
 #include "graphics/Graphics.h"
 
 //Currently, reading is done on another thread, we can't render outside the main thread due to some bullshit with OpenGL
-class LoadFilesTask: public Task
+//Saves are only read far enough to know their size, the rest is read when they are rendered or opened. They are
+//handed over as they are found, so the list fills up while the directory is being scanned
+class LoadFilesTask: public AbandonableTask
 {
 	ByteString directory;
 	ByteString search;
-	std::vector<SaveFile*> saveFiles;
-
-	void before() override
-	{
-
-	}
-
-	void after() override
-	{
-
-	}
+	std::vector<SaveFile*> saveFiles; // found but not taken yet, guarded by taskMutex
 
 	bool doWork() override
 	{
 		std::vector<ByteString> files = Client::Ref().DirectorySearch(directory, search, ".cps");
-		std::sort(files.rbegin(), files.rend(), [](ByteString a, ByteString b) { return a.ToLower() < b.ToLower(); });
+		std::sort(files.begin(), files.end(), [](ByteString a, ByteString b) { return a.ToLower() < b.ToLower(); });
 
-		notifyProgress(-1);
-		for(std::vector<ByteString>::iterator iter = files.begin(), end = files.end(); iter != end; ++iter)
+		for (size_t i = 0; i < files.size(); i++)
 		{
-			SaveFile * saveFile = new SaveFile(*iter);
+			{
+				std::lock_guard<std::mutex> g(taskMutex);
+				if (thAbandoned)
+					break;
+			}
+			SaveFile * saveFile = new SaveFile(files[i]);
 			try
 			{
-				std::vector<unsigned char> data = Client::Ref().ReadFile(*iter);
-				GameSave * tempSave = new GameSave(data);
+				std::vector<unsigned char> data = Client::Ref().ReadFile(files[i]);
+				saveFile->SetDataHash(ThumbnailCache::DataHash(data));
+				GameSave * tempSave = new GameSave(data, true);
 				saveFile->SetGameSave(tempSave);
-				saveFiles.push_back(saveFile);
 
-				ByteString filename = (*iter).SplitFromEndBy(PATH_SEP).After();
+				ByteString filename = files[i].SplitFromEndBy(PATH_SEP).After();
 				filename = filename.SplitFromEndBy('.').Before();
 				saveFile->SetDisplayName(filename.FromUtf8());
+
+				std::lock_guard<std::mutex> g(taskMutex);
+				saveFiles.push_back(saveFile);
 			}
 			catch(std::exception & e)
 			{
 				//:(
+				delete saveFile;
 			}
+			notifyProgress((i+1)*100/files.size());
 		}
 		return true;
 	}
 
 public:
-	std::vector<SaveFile*> GetSaveFiles()
+	std::vector<SaveFile*> TakeSaveFiles()
 	{
-		return saveFiles;
+		std::lock_guard<std::mutex> g(taskMutex);
+		std::vector<SaveFile*> taken;
+		std::swap(taken, saveFiles);
+		return taken;
 	}
 
 	LoadFilesTask(ByteString directory, ByteString search):
@@ -78,13 +83,19 @@ public:
 	{
 
 	}
+
+	virtual ~LoadFilesTask()
+	{
+		for (auto saveFile : saveFiles)
+			delete saveFile;
+	}
 };
 
 FileBrowserActivity::FileBrowserActivity(ByteString directory, OnSelected onSelected_):
 	WindowActivity(ui::Point(-1, -1), ui::Point(500, 350)),
+	loadFiles(NULL),
 	onSelected(onSelected_),
-	directory(directory),
-	totalFiles(0)
+	directory(directory)
 {
 
 	ui::Label * titleLabel = new ui::Label(ui::Point(4, 5), ui::Point(Size.X-8, 18), "Save Browser");
@@ -169,11 +180,11 @@ void FileBrowserActivity::RenameSave(SaveFile * file)
 
 void FileBrowserActivity::cleanup()
 {
-	for (auto comp : componentsQueue)
+	for (auto comp : removedComponents)
 	{
 		delete comp;
 	}
-	componentsQueue.clear();
+	removedComponents.clear();
 
 	for (auto file : files)
 	{
@@ -184,14 +195,27 @@ void FileBrowserActivity::cleanup()
 
 void FileBrowserActivity::loadDirectory(ByteString directory, ByteString search)
 {
+	// The buttons can't be deleted yet, this may have been called by one of them
 	for (size_t i = 0; i < components.size(); i++)
 	{
 		RemoveComponent(components[i]);
 		itemList->RemoveChild(components[i]);
+		removedComponents.push_back(components[i]);
+	}
+	components.clear();
+	for (auto file : files)
+	{
+		delete file;
+	}
+	files.clear();
+	if (loadFiles)
+	{
+		loadFiles->Abandon();
 	}
 
-	cleanup();
-
+	fileX = 0;
+	fileY = 0;
+	itemList->InnerSize.Y = 0;
 	infoText->Visible = false;
 	itemList->Visible = false;
 	progressBar->Visible = true;
@@ -204,24 +228,7 @@ void FileBrowserActivity::loadDirectory(ByteString directory, ByteString search)
 
 void FileBrowserActivity::NotifyDone(Task * task)
 {
-	fileX = 0;
-	fileY = 0;
-	files = ((LoadFilesTask*)task)->GetSaveFiles();
-	totalFiles = files.size();
-	delete loadFiles;
-	loadFiles = NULL;
-	if (!files.size())
-	{
-		progressBar->Visible = false;
-		infoText->Visible = true;
-	}
-	else
-		itemList->Visible = true;
-	for (size_t i = 0; i < components.size(); i++)
-	{
-		delete components[i];
-	}
-	components.clear();
+
 }
 
 void FileBrowserActivity::OnMouseDown(int x, int y, unsigned button)
@@ -252,14 +259,31 @@ void FileBrowserActivity::NotifyStatus(Task * task)
 
 void FileBrowserActivity::OnTick(float dt)
 {
-	if(loadFiles)
-		loadFiles->Poll();
+	for (auto comp : removedComponents)
+	{
+		delete comp;
+	}
+	removedComponents.clear();
 
-	if(files.size())
+	if (loadFiles)
 	{
-		SaveFile * saveFile = files.back();
-		files.pop_back();
+		loadFiles->Poll();
+		std::vector<SaveFile*> found = loadFiles->TakeSaveFiles();
+		files.insert(files.end(), found.begin(), found.end());
+		if (loadFiles->GetDone())
+		{
+			loadFiles->Finish();
+			loadFiles = NULL;
+			progressBar->Visible = false;
+			if (!components.size() && !files.size())
+				infoText->Visible = true;
+		}
+	}
 
+	// Add up to a page of buttons at a time, thumbnails are only rendered once a button is scrolled into view
+	size_t added = 0;
+	for (; added < files.size() && added < size_t(filesX*filesY); added++)
+	{
 		if(fileX == filesX)
 		{
 			fileX = 0;
@@ -271,31 +295,23 @@ void FileBrowserActivity::OnTick(float dt)
 							buttonYOffset + buttonPadding + fileY*(buttonHeight+buttonPadding*2)
 							),
 						ui::Point(buttonWidth, buttonHeight),
-						saveFile);
+						files[added]);
 		saveButton->AddContextMenu(1);
-		saveButton->Tick(dt);
 		saveButton->SetActionCallback({
 			[this, saveButton] { SelectSave(saveButton->GetSaveFile()); },
 			[this, saveButton] { RenameSave(saveButton->GetSaveFile()); },
 			[this, saveButton] { DeleteSave(saveButton->GetSaveFile()); }
 		});
-
-		progressBar->SetStatus("Rendering thumbnails");
-		progressBar->SetProgress((float(totalFiles-files.size())/float(totalFiles))*100.0f);
-		componentsQueue.push_back(saveButton);
+		components.push_back(saveButton);
+		itemList->AddChild(saveButton);
 		fileX++;
 	}
-	else if(componentsQueue.size())
+	if (added)
 	{
-		for(std::vector<ui::Component*>::iterator iter = componentsQueue.begin(), end = componentsQueue.end(); iter != end; ++iter)
-		{
-			components.push_back(*iter);
-			itemList->AddChild(*iter);
-		}
-		componentsQueue.clear();
+		files.erase(files.begin(), files.begin()+added);
 		itemList->InnerSize.Y = (buttonHeight+(buttonPadding*2))*(fileY+1);
-		if(!componentsQueue.size())
-			progressBar->Visible = false;
+		itemList->Visible = true;
+		progressBar->Visible = false;
 	}
 }
 
@@ -310,5 +326,9 @@ void FileBrowserActivity::OnDraw()
 
 FileBrowserActivity::~FileBrowserActivity()
 {
+	if (loadFiles)
+	{
+		loadFiles->Abandon();
+	}
 	cleanup();
 }
@@ -26,14 +26,13 @@ class FileBrowserActivity: public TaskListener, public WindowActivity
 	OnSelected onSelected;
 	ui::ScrollPanel * itemList;
 	ui::Label * infoText;
-	std::vector<SaveFile*> files;
+	std::vector<SaveFile*> files; // found, but not given a button yet
 	std::vector<ui::Component*> components;
-	std::vector<ui::Component*> componentsQueue;
+	std::vector<ui::Component*> removedComponents;
 	ByteString directory;
 
 	ui::ProgressBar * progressBar;
 
-	int totalFiles;
 	int filesX, filesY, buttonPadding;
 	int fileX, fileY;
 	int buttonWidth, buttonHeight, buttonAreaWidth, buttonAreaHeight, buttonXOffset, buttonYOffset;
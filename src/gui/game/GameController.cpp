@@ -18,6 +18,7 @@
 
 #include "client/GameSave.h"
 #include "client/Client.h"
+#include "client/SaveWriterTask.h"
 
 #include "gui/search/SearchController.h"
 #include "gui/render/RenderController.h"
@@ -58,6 +59,10 @@
 #include "debug/ElementPopulation.h"
 #include "debug/DebugLines.h"
 #include "debug/ParticleDebug.h"
+#include "debug/ActiveBlocks.h"
+#include "debug/ElementProfile.h"
+#include "debug/UndoHistory.h"
+#include "debug/GravityTiming.h"
 
 #ifdef LUACONSOLE
 #include "lua/LuaScriptInterface.h"
@@ -72,8 +77,11 @@
 #include "simulation/SimulationData.h"
 #include "simulation/Air.h"
 #include "simulation/Snapshot.h"
+#include "simulation/SnapshotDelta.h"
 #include "simulation/ElementClasses.h"
 
+#include <chrono>
+
 #ifdef GetUserName
 # undef GetUserName // dammit windows
 #endif
@@ -90,6 +98,13 @@ GameController::GameController():
 	localBrowser(NULL),
 	options(NULL),
 	debugFlags(0),
+	autosaveTask(NULL),
+	lastAutosave(Platform::GetTime()),
+	turboTicks(1),
+	turboBudget(0),
+	tickCount(0),
+	tickCountStart(Platform::GetTime()),
+	ticksPerSecond(0),
 	HasDone(false)
 {
 	gameView = new GameView();
@@ -113,10 +128,22 @@ GameController::GameController():
 	debugInfo.push_back(new ElementPopulationDebug(0x2, gameModel->GetSimulation()));
 	debugInfo.push_back(new DebugLines(0x4, gameView, this));
 	debugInfo.push_back(new ParticleDebug(0x8, gameModel->GetSimulation(), gameModel));
+	debugInfo.push_back(new ActiveBlocksDebug(0x10, gameModel->GetSimulation()));
+	debugInfo.push_back(new ElementProfileDebug(0x20, gameModel->GetSimulation()));
+	debugInfo.push_back(new UndoHistoryDebug(0x40, gameModel));
+	debugInfo.push_back(new GravityTimingDebug(0x80, gameModel->GetSimulation()));
 }
 
 GameController::~GameController()
 {
+	// Let saves that are still being written finish, rather than leaving half written files behind
+	for (auto task : saveTasks)
+		task->Finish();
+	for (auto task : queuedSaveTasks)
+	{
+		task->Start();
+		task->Finish();
+	}
 	if(search)
 	{
 		delete search;
@@ -154,8 +181,8 @@ GameController::~GameController()
 		delete *iter;
 	}
 	//deleted here because it refuses to be deleted when deleted from gameModel even with the same code
-	std::deque<Snapshot*> history = gameModel->GetHistory();
-	for(std::deque<Snapshot*>::iterator iter = history.begin(), end = history.end(); iter != end; ++iter)
+	std::deque<HistoryEntry*> history = gameModel->GetHistory();
+	for(std::deque<HistoryEntry*>::iterator iter = history.begin(), end = history.end(); iter != end; ++iter)
 	{
 		delete *iter;
 	}
@@ -176,13 +203,55 @@ GameController::~GameController()
 	}
 }
 
+// Entries are rebuilt from the closest full snapshot after them, the newest entry always has one.
+// They are kept in full until the next compressHistory, so going back and forth doesn't rebuild them again.
+// Returns NULL if an entry on the way couldn't be rebuilt
+Snapshot * GameController::historyEntrySnapshot(std::deque<HistoryEntry*> &history, unsigned int index)
+{
+	unsigned int full = index;
+	while (!history[full]->snap)
+		full++;
+	for (unsigned int i = full; i > index; i--)
+	{
+		HistoryEntry *entry = history[i-1];
+		Snapshot *snap = entry->delta->Restore(*history[i]->snap);
+		if (!snap)
+			return NULL;
+		entry->snap = snap;
+		delete entry->delta;
+		entry->delta = NULL;
+	}
+	return history[index]->snap;
+}
+
+void GameController::compressHistory(std::deque<HistoryEntry*> &history)
+{
+	// Full snapshots are always at the end, so the entry after each one being compressed is still full
+	for (size_t i = 0; i + 1 < history.size(); i++)
+	{
+		HistoryEntry *entry = history[i];
+		if (!entry->snap)
+			continue;
+		entry->delta = SnapshotDelta::FromSnapshots(*entry->snap, *history[i+1]->snap);
+		delete entry->snap;
+		entry->snap = NULL;
+	}
+}
+
 void GameController::HistoryRestore()
 {
-	std::deque<Snapshot*> history = gameModel->GetHistory();
+	std::deque<HistoryEntry*> history = gameModel->GetHistory();
 	if (!history.size())
 		return;
+	auto start = std::chrono::steady_clock::now();
 	unsigned int historyPosition = gameModel->GetHistoryPosition();
 	unsigned int newHistoryPosition = std::max((int)historyPosition-1, 0);
+	Snapshot * snap = historyEntrySnapshot(history, newHistoryPosition);
+	if (!snap)
+	{
+		new ErrorMessage("Error", "Unable to restore the undo history entry.");
+		return;
+	}
 	// When undoing, save the current state as a final redo
 	// This way ctrl+y will always bring you back to the point right before your last ctrl+z
 	if (historyPosition == history.size())
@@ -193,60 +262,80 @@ void GameController::HistoryRestore()
 		delete gameModel->GetRedoHistory();
 		gameModel->SetRedoHistory(newSnap);
 	}
-	Snapshot * snap = history[newHistoryPosition];
 	gameModel->GetSimulation()->Restore(*snap);
 	Client::Ref().OverwriteAuthorInfo(snap->Authors);
 	gameModel->SetHistory(history);
 	gameModel->SetHistoryPosition(newHistoryPosition);
+	gameModel->SetHistoryRestoreTime(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count());
 }
 
 void GameController::HistorySnapshot()
 {
-	std::deque<Snapshot*> history = gameModel->GetHistory();
+	std::deque<HistoryEntry*> history = gameModel->GetHistory();
+	auto start = std::chrono::steady_clock::now();
 	unsigned int historyPosition = gameModel->GetHistoryPosition();
 	Snapshot * newSnap = gameModel->GetSimulation()->CreateSnapshot();
 	if (newSnap)
 	{
 		newSnap->Authors = Client::Ref().GetAuthorInfo();
+		// The entries that are about to be dropped might be needed to rebuild the one before them. If it can't be
+		// rebuilt, neither can anything before it, so those go too
+		if (historyPosition > 0 && historyPosition < history.size() && !historyEntrySnapshot(history, historyPosition-1))
+		{
+			while (historyPosition > 0)
+			{
+				delete history.front();
+				history.pop_front();
+				historyPosition--;
+			}
+		}
 		while (historyPosition < history.size())
 		{
-			Snapshot * snap = history.back();
+			HistoryEntry * entry = history.back();
 			history.pop_back();
-			delete snap;
+			delete entry;
 		}
 		if (history.size() >= gameModel->GetUndoHistoryLimit())
 		{
-			Snapshot * snap = history.front();
+			HistoryEntry * entry = history.front();
 			history.pop_front();
-			delete snap;
+			delete entry;
 			if (historyPosition > history.size())
 				historyPosition--;
 		}
-		history.push_back(newSnap);
+		history.push_back(new HistoryEntry(newSnap));
+		compressHistory(history);
 		gameModel->SetHistory(history);
 		gameModel->SetHistoryPosition(std::min((size_t)historyPosition+1, history.size()));
 		delete gameModel->GetRedoHistory();
 		gameModel->SetRedoHistory(NULL);
 	}
+	gameModel->SetHistorySnapshotTime(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count());
 }
 
 void GameController::HistoryForward()
 {
-	std::deque<Snapshot*> history = gameModel->GetHistory();
+	std::deque<HistoryEntry*> history = gameModel->GetHistory();
 	if (!history.size())
 		return;
+	auto start = std::chrono::steady_clock::now();
 	unsigned int historyPosition = gameModel->GetHistoryPosition();
 	unsigned int newHistoryPosition = std::min((size_t)historyPosition+1, history.size());
 	Snapshot *snap;
 	if (newHistoryPosition == history.size())
 		snap = gameModel->GetRedoHistory();
 	else
-		snap = history[newHistoryPosition];
+	{
+		snap = historyEntrySnapshot(history, newHistoryPosition);
+		if (!snap)
+			new ErrorMessage("Error", "Unable to restore the undo history entry.");
+	}
 	if (!snap)
 		return;
 	gameModel->GetSimulation()->Restore(*snap);
 	Client::Ref().OverwriteAuthorInfo(snap->Authors);
 	gameModel->SetHistoryPosition(newHistoryPosition);
+	gameModel->SetHistoryRestoreTime(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count());
 }
 
 GameView * GameController::GetView()
@@ -510,10 +599,17 @@ void GameController::ToolClick(int toolSelection, ui::Point point)
 	activeTool->Click(sim, cBrush, point);
 }
 
-ByteString GameController::StampRegion(ui::Point point1, ui::Point point2)
+ByteString GameController::StampRegion(ui::Point point1, ui::Point point2, bool async)
 {
 	GameSave * newSave = gameModel->GetSimulation()->Save(gameModel->GetIncludePressure() != gameView->ShiftBehaviour(), point1.X, point1.Y, point2.X, point2.Y);
-	if(newSave)
+	if(newSave && async)
+	{
+		newSave->paused = gameModel->GetPaused();
+		SaveWriterTask *task = Client::Ref().AddStampAsync(newSave);
+		startSaveTask(task);
+		return "";
+	}
+	else if(newSave)
 	{
 		newSave->paused = gameModel->GetPaused();
 		ByteString stampName = Client::Ref().AddStamp(newSave);
@@ -764,6 +860,16 @@ bool GameController::KeyRelease(int key, int scan, bool repeat, bool shift, bool
 	return ret;
 }
 
+void GameController::SetDebugFlags(unsigned int flags)
+{
+	for(std::vector<DebugInfo*>::iterator iter = debugInfo.begin(), end = debugInfo.end(); iter != end; iter++)
+	{
+		if (((*iter)->debugID & flags) != ((*iter)->debugID & debugFlags))
+			(*iter)->Shown((*iter)->debugID & flags);
+	}
+	debugFlags = flags;
+}
+
 void GameController::Tick()
 {
 	if(firstTick)
@@ -785,6 +891,81 @@ void GameController::Tick()
 			(*iter)->Draw();
 	}
 	commandInterface->OnTick();
+
+	std::vector<ByteString> writtenFiles;
+	for (auto iter = saveTasks.begin(); iter != saveTasks.end();)
+	{
+		SaveWriterTask *task = *iter;
+		task->Poll();
+		if (task->GetDone())
+		{
+			if (!task->GetSuccess())
+				new ErrorMessage("Error", task->GetError());
+			if (task == autosaveTask)
+				autosaveTask = NULL;
+			writtenFiles.push_back(task->GetFilename());
+			task->Finish();
+			iter = saveTasks.erase(iter);
+		}
+		else
+			++iter;
+	}
+	for (auto &filename : writtenFiles)
+	{
+		for (auto iter = queuedSaveTasks.begin(); iter != queuedSaveTasks.end(); ++iter)
+		{
+			if ((*iter)->GetFilename() == filename)
+			{
+				SaveWriterTask *task = *iter;
+				queuedSaveTasks.erase(iter);
+				startSaveTask(task);
+				break;
+			}
+		}
+	}
+	autosave();
+}
+
+void GameController::startSaveTask(SaveWriterTask *task)
+{
+	// Two tasks writing the same file at once would mix up their writes, so a save to a file that is still being
+	// written waits for it. Only the newest save waiting for a file is kept, older ones would be overwritten anyway
+	for (auto running : saveTasks)
+	{
+		if (running->GetFilename() == task->GetFilename())
+		{
+			for (auto &queued : queuedSaveTasks)
+			{
+				if (queued->GetFilename() == task->GetFilename())
+				{
+					delete queued;
+					queued = task;
+					return;
+				}
+			}
+			queuedSaveTasks.push_back(task);
+			return;
+		}
+	}
+	task->Start();
+	saveTasks.push_back(task);
+}
+
+void GameController::autosave()
+{
+	int interval = Client::Ref().GetPrefInteger("AutoSaveInterval", 0);
+	unsigned long now = Platform::GetTime();
+	if (interval <= 0 || autosaveTask || now - lastAutosave < (unsigned long)interval * 1000)
+		return;
+	lastAutosave = now;
+	// Only the copy is taken here, serialising and compressing it happens on the task's thread
+	GameSave * gameSave = gameModel->GetSimulation()->Save(true);
+	if (!gameSave)
+		return;
+	gameSave->paused = gameModel->GetPaused();
+	Client::Ref().MakeDirectory(LOCAL_SAVE_DIR);
+	autosaveTask = new SaveWriterTask(gameSave, LOCAL_SAVE_DIR PATH_SEP "autosave.cps", true);
+	startSaveTask(autosaveTask);
 }
 
 void GameController::Blur()
@@ -914,12 +1095,31 @@ void GameController::Update()
 	else
 		gameView->SetSample(gameModel->GetSimulation()->GetSample(pos.X, pos.Y));
 
+	// In turbo mode the extra ticks are run back to back here, nothing is drawn and no events are handled between them
 	Simulation * sim = gameModel->GetSimulation();
+	auto start = std::chrono::steady_clock::now();
+	int ticks = 0;
 	sim->BeforeSim();
-	if (!sim->sys_pause || sim->framerender)
+	while (!sim->sys_pause || sim->framerender)
 	{
 		sim->UpdateParticles(0, NPART);
 		sim->AfterSim();
+		ticks++;
+		if (ticks >= turboTicks)
+			break;
+		if (turboBudget > 0 && std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count() >= turboBudget)
+			break;
+		if (sim->sys_pause && !sim->framerender)
+			break;
+		sim->BeforeSim();
+	}
+	tickCount += ticks;
+	unsigned long now = Platform::GetTime();
+	if (now - tickCountStart >= 500)
+	{
+		ticksPerSecond = tickCount * 1000.0f / (now - tickCountStart);
+		tickCount = 0;
+		tickCountStart = now;
 	}
 
 	//if either STKM or STK2 isn't out, reset it's selected element. Defaults to PT_DUST unless right selected is something else
@@ -1002,6 +1202,12 @@ void GameController::SetZoomPosition(ui::Point position)
 	gameModel->SetZoomWindowPosition(zoomWindowPosition);
 }
 
+void GameController::SetTurbo(int ticks, float budget)
+{
+	turboTicks = std::max(ticks, 1);
+	turboBudget = std::max(budget, 0.0f);
+}
+
 void GameController::SetPaused(bool pauseState)
 {
 	gameModel->SetPaused(pauseState);
@@ -1216,13 +1422,12 @@ void GameController::OpenLocalSaveWindow(bool asCurrent)
 
 			gameModel->SetSaveFile(&tempSave, gameView->ShiftBehaviour());
 			Client::Ref().MakeDirectory(LOCAL_SAVE_DIR);
-			std::vector<char> saveData = gameSave->Serialise();
-			if (saveData.size() == 0)
-				new ErrorMessage("Error", "Unable to serialize game data.");
-			else if (Client::Ref().WriteFile(saveData, gameModel->GetSaveFile()->GetName()))
-				new ErrorMessage("Error", "Unable to write save file.");
-			else
-				gameModel->SetInfoTip("Saved Successfully");
+			gameModel->SetInfoTip("Saving...");
+			SaveWriterTask *task = new SaveWriterTask(new GameSave(*gameSave), gameModel->GetSaveFile()->GetName(), false, [this](bool success) {
+				if (success)
+					gameModel->SetInfoTip("Saved Successfully");
+			});
+			startSaveTask(task);
 		}
 	}
 }
@@ -2,6 +2,7 @@
 #define GAMECONTROLLER_H
 
 #include <vector>
+#include <deque>
 #include <utility>
 
 #include "client/ClientListener.h"
@@ -29,9 +30,12 @@ class Tool;
 class Menu;
 class SaveInfo;
 class GameSave;
+class Snapshot;
+class HistoryEntry;
 class LoginController;
 class TagsController;
 class ConsoleController;
+class SaveWriterTask;
 class GameController: public ClientListener
 {
 private:
@@ -51,8 +55,21 @@ private:
 	CommandInterface * commandInterface;
 	std::vector<DebugInfo*> debugInfo;
 	unsigned int debugFlags;
+	std::vector<SaveWriterTask*> saveTasks;
+	std::vector<SaveWriterTask*> queuedSaveTasks; // waiting for a task writing the same file to finish
+	SaveWriterTask * autosaveTask;
+	unsigned long lastAutosave;
+	int turboTicks;
+	float turboBudget;
+	int tickCount;
+	unsigned long tickCountStart;
+	float ticksPerSecond;
 	
 	void OpenSaveDone();
+	void startSaveTask(SaveWriterTask *task);
+	void autosave();
+	Snapshot * historyEntrySnapshot(std::deque<HistoryEntry*> &history, unsigned int index);
+	void compressHistory(std::deque<HistoryEntry*> &history);
 public:
 	bool HasDone;
 	GameController();
@@ -92,10 +109,18 @@ public:
 	void DrawRect(int toolSelection, ui::Point point1, ui::Point point2);
 	void DrawLine(int toolSelection, ui::Point point1, ui::Point point2);
 	void DrawFill(int toolSelection, ui::Point point);
-	ByteString StampRegion(ui::Point point1, ui::Point point2);
+	// Async stamps are written in the background and don't return the stamp ID
+	ByteString StampRegion(ui::Point point1, ui::Point point2, bool async = false);
 	void CopyRegion(ui::Point point1, ui::Point point2);
 	void CutRegion(ui::Point point1, ui::Point point2);
 	void Update();
+	// Turbo mode runs up to ticks simulation ticks for every frame that is drawn, stopping early once budget
+	// milliseconds have been spent on them unless budget is 0. One tick per frame is the usual speed
+	void SetTurbo(int ticks, float budget);
+	int GetTurboTicks() { return turboTicks; }
+	float GetTurboBudget() { return turboBudget; }
+	// Simulation ticks run per second, counted over the last half second
+	float GetTicksPerSecond() { return ticksPerSecond; }
 	void SetPaused(bool pauseState);
 	void SetPaused();
 	void SetDecoration(bool decorationState);
@@ -105,7 +130,7 @@ public:
 	bool GetHudEnable();
 	void SetDebugHUD(bool hudState);
 	bool GetDebugHUD();
-	void SetDebugFlags(unsigned int flags) { debugFlags = flags; }
+	void SetDebugFlags(unsigned int flags);
 	void SetActiveMenu(int menuID);
 	std::vector<Menu*> GetMenuList();
 	int GetNumMenus(bool onlyEnabled);
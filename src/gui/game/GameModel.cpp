@@ -24,6 +24,7 @@
 #include "simulation/Air.h"
 #include "simulation/Simulation.h"
 #include "simulation/Snapshot.h"
+#include "simulation/SnapshotDelta.h"
 #include "simulation/Gravity.h"
 #include "simulation/ElementGraphics.h"
 #include "simulation/ElementClasses.h"
@@ -33,6 +34,23 @@
 
 #include <iostream>
 
+HistoryEntry::HistoryEntry(Snapshot *snap):
+	snap(snap),
+	delta(NULL)
+{
+}
+
+HistoryEntry::~HistoryEntry()
+{
+	delete snap;
+	delete delta;
+}
+
+size_t HistoryEntry::Size() const
+{
+	return snap ? snap->Size() : delta->Size();
+}
+
 GameModel::GameModel():
 	clipboard(NULL),
 	placeSave(NULL),
@@ -44,6 +62,8 @@ GameModel::GameModel():
 	toolStrength(1.0f),
 	redoHistory(NULL),
 	historyPosition(0),
+	historySnapshotTime(0),
+	historyRestoreTime(0),
 	activeColourPreset(0),
 	colourSelector(false),
 	colour(255, 0, 0, 255),
@@ -89,6 +109,8 @@ GameModel::GameModel():
 
 	ren->gravityFieldEnabled = Client::Ref().GetPrefBool("Renderer.GravityField", false);
 	ren->decorations_enable = Client::Ref().GetPrefBool("Renderer.Decorations", true);
+	ren->SetRenderThreads(Client::Ref().GetPrefInteger("Renderer.Threads", 1));
+	ren->SetDrawInBackground(Client::Ref().GetPrefBool("Renderer.Background", false));
 
 	//Load config into simulation
 	edgeMode = Client::Ref().GetPrefInteger("Simulation.EdgeMode", 0);
@@ -100,6 +122,9 @@ GameModel::GameModel():
 		sim->grav->start_grav_async();
 	sim->aheat_enable =  Client::Ref().GetPrefInteger("Simulation.AmbientHeat", 0);
 	sim->pretty_powder =  Client::Ref().GetPrefInteger("Simulation.PrettyPowder", 0);
+	sim->SetUpdateThreads(Client::Ref().GetPrefInteger("Simulation.Threads", 1));
+	sim->deterministic = Client::Ref().GetPrefBool("Simulation.Deterministic", false);
+	sim->air->SetPipelined(Client::Ref().GetPrefBool("Simulation.AirPipeline", false));
 
 	Favorite::Ref().LoadFavoritesFromPrefs();
 
@@ -153,6 +178,8 @@ GameModel::~GameModel()
 
 	Client::Ref().SetPref("Renderer.GravityField", (bool)ren->gravityFieldEnabled);
 	Client::Ref().SetPref("Renderer.Decorations", (bool)ren->decorations_enable);
+	Client::Ref().SetPref("Renderer.Threads", ren->GetRenderThreads());
+	Client::Ref().SetPref("Renderer.Background", ren->GetDrawInBackground());
 	Client::Ref().SetPref("Renderer.DebugMode", ren->debugLines); //These two should always be equivalent, even though they are different things
 
 	Client::Ref().SetPref("Simulation.EdgeMode", edgeMode);
@@ -160,6 +187,9 @@ GameModel::~GameModel()
 	Client::Ref().SetPref("Simulation.AmbientHeat", sim->aheat_enable);
 	Client::Ref().SetPref("Simulation.PrettyPowder", sim->pretty_powder);
 	Client::Ref().SetPref("Simulation.DecoSpace", sim->deco_space);
+	Client::Ref().SetPref("Simulation.Threads", sim->GetUpdateThreads());
+	Client::Ref().SetPref("Simulation.Deterministic", sim->deterministic);
+	Client::Ref().SetPref("Simulation.AirPipeline", sim->air->IsPipelined());
 
 	Client::Ref().SetPref("Decoration.Red", (int)colour.Red);
 	Client::Ref().SetPref("Decoration.Green", (int)colour.Green);
@@ -490,7 +520,7 @@ int GameModel::GetDecoSpace()
 	return this->decoSpace;
 }
 
-std::deque<Snapshot*> GameModel::GetHistory()
+std::deque<HistoryEntry*> GameModel::GetHistory()
 {
 	return history;
 }
@@ -500,7 +530,7 @@ unsigned int GameModel::GetHistoryPosition()
 	return historyPosition;
 }
 
-void GameModel::SetHistory(std::deque<Snapshot*> newHistory)
+void GameModel::SetHistory(std::deque<HistoryEntry*> newHistory)
 {
 	history = newHistory;
 }
@@ -525,6 +555,26 @@ unsigned int GameModel::GetUndoHistoryLimit()
 	return undoHistoryLimit;
 }
 
+float GameModel::GetHistorySnapshotTime()
+{
+	return historySnapshotTime;
+}
+
+void GameModel::SetHistorySnapshotTime(float time)
+{
+	historySnapshotTime = time;
+}
+
+float GameModel::GetHistoryRestoreTime()
+{
+	return historyRestoreTime;
+}
+
+void GameModel::SetHistoryRestoreTime(float time)
+{
+	historyRestoreTime = time;
+}
+
 void GameModel::SetUndoHistoryLimit(unsigned int undoHistoryLimit_)
 {
 	undoHistoryLimit = undoHistoryLimit_;
@@ -695,6 +745,7 @@ void GameModel::SetSave(SaveInfo * newSave, bool invertIncludePressure)
 		sim->gravityMode = saveData->gravityMode;
 		sim->air->airMode = saveData->airMode;
 		sim->edgeMode = saveData->edgeMode;
+		sim->randomSeed = saveData->rngSeed;
 		sim->legacy_enable = saveData->legacyEnable;
 		sim->water_equal_test = saveData->waterEEnabled;
 		sim->aheat_enable = saveData->aheatEnable;
@@ -749,13 +800,27 @@ void GameModel::SetSaveFile(SaveFile * newSave, bool invertIncludePressure)
 	delete currentSave;
 	currentSave = NULL;
 
-	if(newSave && newSave->GetGameSave())
+	GameSave * saveData = newSave ? newSave->GetGameSave() : NULL;
+	if (saveData && saveData->Collapsed())
+	{
+		// Saves from the file browser are only read in full once they are opened
+		try
+		{
+			saveData->Expand();
+		}
+		catch (ParseException & e)
+		{
+			std::cerr << "GameModel: Invalid save file '" << newSave->GetName() << "': " << e.what() << std::endl;
+			saveData = NULL;
+		}
+	}
+	if(saveData)
 	{
-		GameSave * saveData = newSave->GetGameSave();
 		SetPaused(saveData->paused | GetPaused());
 		sim->gravityMode = saveData->gravityMode;
 		sim->air->airMode = saveData->airMode;
 		sim->edgeMode = saveData->edgeMode;
+		sim->randomSeed = saveData->rngSeed;
 		sim->legacy_enable = saveData->legacyEnable;
 		sim->water_equal_test = saveData->waterEEnabled;
 		sim->aheat_enable = saveData->aheatEnable;
@@ -20,6 +20,7 @@ class SaveFile;
 class Simulation;
 class Renderer;
 class Snapshot;
+class SnapshotDelta;
 class GameSave;
 
 class ToolSelection
@@ -31,6 +32,19 @@ public:
 	};
 };
 
+// An undo history entry. Only the newest entries keep a full snapshot, older ones keep
+// how they differ from the entry after them, and are rebuilt when they are needed
+class HistoryEntry
+{
+public:
+	Snapshot *snap;
+	SnapshotDelta *delta;
+
+	HistoryEntry(Snapshot *snap);
+	~HistoryEntry();
+	size_t Size() const;
+};
+
 class GameModel
 {
 private:
@@ -63,10 +77,12 @@ private:
 	Tool * regularToolset[4];
 	User currentUser;
 	float toolStrength;
-	std::deque<Snapshot*> history;
+	std::deque<HistoryEntry*> history;
 	Snapshot *redoHistory;
 	unsigned int historyPosition;
 	unsigned int undoHistoryLimit;
+	float historySnapshotTime;
+	float historyRestoreTime;
 	bool mouseClickRequired;
 	bool includePressure;
 	bool perfectCircle = true;
@@ -137,14 +153,19 @@ public:
 	void BuildBrushList();
 	void BuildQuickOptionMenu(GameController * controller);
 
-	std::deque<Snapshot*> GetHistory();
+	std::deque<HistoryEntry*> GetHistory();
 	unsigned int GetHistoryPosition();
-	void SetHistory(std::deque<Snapshot*> newHistory);
+	void SetHistory(std::deque<HistoryEntry*> newHistory);
 	void SetHistoryPosition(unsigned int newHistoryPosition);
 	Snapshot * GetRedoHistory();
 	void SetRedoHistory(Snapshot * redo);
 	unsigned int GetUndoHistoryLimit();
 	void SetUndoHistoryLimit(unsigned int undoHistoryLimit_);
+	// Milliseconds taken by the last snapshot and the last undo or redo
+	float GetHistorySnapshotTime();
+	void SetHistorySnapshotTime(float time);
+	float GetHistoryRestoreTime();
+	void SetHistoryRestoreTime(float time);
 
 	void UpdateQuickOptions();
 
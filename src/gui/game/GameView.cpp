@@ -1098,7 +1098,7 @@ void GameView::OnMouseUp(int x, int y, unsigned button)
 					else if (selectMode == SelectCut)
 						c->CutRegion(ui::Point(x1, y1), ui::Point(x2, y2));
 					else if (selectMode == SelectStamp)
-						c->StampRegion(ui::Point(x1, y1), ui::Point(x2, y2));
+						c->StampRegion(ui::Point(x1, y1), ui::Point(x2, y2), true);
 				}
 			}
 			selectMode = SelectNone;
@@ -2272,6 +2272,8 @@ void GameView::OnDraw()
 		//FPS and some version info
 		StringBuilder fpsInfo;
 		fpsInfo << Format::Precision(2) << "FPS: " << ui::Engine::Ref().GetFps();
+		if (c->GetTurboTicks() > 1)
+			fpsInfo << " TPS: " << c->GetTicksPerSecond();
 
 		if (showDebug)
 		{
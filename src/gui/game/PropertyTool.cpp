@@ -227,6 +227,7 @@ void PropertyTool::SetProperty(Simulation *sim, ui::Point position)
 		i = sim->photons[position.Y][position.X];
 	if(!i)
 		return;
+	sim->NotifyUnloggedChange();
 
 	if (changeType)
 	{
@@ -341,5 +342,6 @@ void PropertyTool::DrawRect(Simulation *sim, Brush *cBrush, ui::Point position,
 
 void PropertyTool::DrawFill(Simulation *sim, Brush *cBrush, ui::Point position)
 {
+	sim->NotifyUnloggedChange();
 	sim->flood_prop(position.X, position.Y, propOffset, propValue, propType);
 }
@@ -73,6 +73,7 @@ SignWindow::SignWindow(SignTool * tool_, Simulation * sim_, int signID_, ui::Poi
 	okayButton->Appearance.BorderInactive = (ui::Colour(200, 200, 200));
 	okayButton->SetActionCallback({ [this] {
 		CloseActiveWindow();
+		sim->NotifyUnloggedChange();
 		if(signID==-1 && textField->GetText().length())
 		{
 			sim->signs.push_back(sign(textField->GetText(), signPosition.X, signPosition.Y, (sign::Justification)justification->GetOption().second));
@@ -107,6 +108,7 @@ SignWindow::SignWindow(SignTool * tool_, Simulation * sim_, int signID_, ui::Poi
 	textField->SetActionCallback({ [this] {
 		if (signID!=-1)
 		{
+			sim->NotifyUnloggedChange();
 			sim->signs[signID].text = textField->GetText();
 			sim->signs[signID].ju = (sign::Justification)justification->GetOption().second;
 		}
@@ -140,6 +142,7 @@ SignWindow::SignWindow(SignTool * tool_, Simulation * sim_, int signID_, ui::Poi
 			CloseActiveWindow();
 			if (signID!=-1)
 			{
+				sim->NotifyUnloggedChange();
 				sim->signs.erase(sim->signs.begin() + signID);
 			}
 			SelfDestruct();
@@ -208,6 +211,7 @@ void SignWindow::DoMouseMove(int x, int y, int dx, int dy) {
 		ui::Point pos = tool->gameModel->AdjustZoomCoords(ui::Point(x, y));
 		if(pos.X < XRES && pos.Y < YRES)
 		{
+			sim->NotifyUnloggedChange();
 			movingSign->x = pos.X;
 			movingSign->y = pos.Y;
 			signPosition.X = pos.X;
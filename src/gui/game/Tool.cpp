@@ -87,6 +87,7 @@ void WallTool::DrawLine(Simulation * sim, Brush * brush, ui::Point position1, ui
 		newFanVelX *= strength;
 		float newFanVelY = (position2.Y-position1.Y)*0.005f;
 		newFanVelY *= strength;
+		sim->NotifyUnloggedChange();
 		sim->FloodWalls(position1.X, position1.Y, WL_FLOODHELPER, WL_FAN);
 		for (int j = 0; j < YRES/CELL; j++)
 			for (int i = 0; i < XRES/CELL; i++)
@@ -130,6 +131,7 @@ void WindTool::DrawLine(Simulation * sim, Brush * brush, ui::Point position1, ui
 
 	unsigned char *bitmap = brush->GetBitmap();
 
+	sim->NotifyUnloggedChange();
 	for(int y = 0; y < sizeY; y++)
 	{
 		for(int x = 0; x < sizeX; x++)
@@ -163,5 +165,6 @@ void Element_TESC_Tool::DrawFill(Simulation * sim, Brush * brush, ui::Point posi
 
 void PlopTool::Click(Simulation * sim, Brush * brush, ui::Point position)
 {
+	sim->NotifyUnloggedChange();
 	sim->create_part(-2, position.X, position.Y, TYP(toolID), ID(toolID));
 }
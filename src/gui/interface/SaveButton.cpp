@@ -6,6 +6,7 @@
 #include "Mouse.h"
 
 #include "client/Client.h"
+#include "client/ThumbnailCache.h"
 #include "client/ThumbnailRendererTask.h"
 #include "client/SaveFile.h"
 #include "client/SaveInfo.h"
@@ -126,7 +127,8 @@ void SaveButton::Tick(float dt)
 {
 	if (!thumbnail)
 	{
-		if (!triedThumbnail)
+		// Wait until the button is first drawn, so long lists don't render thumbnails that nobody looks at
+		if (!triedThumbnail && wantsDraw)
 		{
 			float scaleFactor = (Size.Y-25)/((float)YRES);
 			ui::Point thumbBoxSize = ui::Point(((float)XRES)*scaleFactor, ((float)YRES)*scaleFactor);
@@ -147,8 +149,18 @@ void SaveButton::Tick(float dt)
 			}
 			else if (file && file->GetGameSave())
 			{
-				thumbnailRenderer = new ThumbnailRendererTask(file->GetGameSave(), thumbBoxSize.X, thumbBoxSize.Y, true, true, false);
-				thumbnailRenderer->Start();
+				ByteString cacheKey;
+				if (file->GetDataHash().length())
+				{
+					cacheKey = ThumbnailCache::Key(file->GetDataHash(), thumbBoxSize.X, thumbBoxSize.Y, true, true, false);
+					thumbnail = std::unique_ptr<VideoBuffer>(ThumbnailCache::Ref().Get(cacheKey));
+				}
+				if (!thumbnail)
+				{
+					thumbnailRenderer = new ThumbnailRendererTask(file->GetGameSave(), thumbBoxSize.X, thumbBoxSize.Y, true, true, false);
+					thumbnailRenderer->SetCacheKey(cacheKey);
+					thumbnailRenderer->Start();
+				}
 				triedThumbnail = true;
 			}
 		}
@@ -162,6 +174,9 @@ void SaveButton::Tick(float dt)
 			{
 				thumbnail = thumbnailRenderer->Finish();
 				thumbnailRenderer = nullptr;
+				// Local saves may only be read in full when they are rendered
+				if (!thumbnail && file)
+					file->SetLoadingError("Error loading save");
 			}
 		}
 
@@ -193,7 +208,7 @@ void SaveButton::Draw(const Point& screenPos)
 		else
 			g->draw_image(thumbnail.get(), screenPos.X+(Size.X-thumbSize.X)/2, screenPos.Y+(Size.Y-21-thumbSize.Y)/2, 255);
 	}
-	else if (file && !file->GetGameSave())
+	else if (file && (!file->GetGameSave() || file->GetError().length()))
 		g->drawtext(screenPos.X+(Size.X-Graphics::textwidth("Error loading save"))/2, screenPos.Y+(Size.Y-28)/2, "Error loading save", 180, 180, 180, 255);
 	if(save)
 	{
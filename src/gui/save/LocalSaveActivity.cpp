@@ -5,6 +5,7 @@
 #include "client/Client.h"
 #include "client/GameSave.h"
 #include "client/ThumbnailRendererTask.h"
+#include "client/SaveWriterTask.h"
 
 #include "graphics/Graphics.h"
 
@@ -20,6 +21,7 @@ LocalSaveActivity::LocalSaveActivity(SaveFile save, OnSaved onSaved_) :
 	WindowActivity(ui::Point(-1, -1), ui::Point(220, 200)),
 	save(save),
 	thumbnailRenderer(nullptr),
+	saveWriter(nullptr),
 	onSaved(onSaved_)
 {
 	ui::Label * titleLabel = new ui::Label(ui::Point(4, 5), ui::Point(Size.X-8, 16), "Save to computer:");
@@ -72,6 +74,27 @@ void LocalSaveActivity::OnTick(float dt)
 			thumbnailRenderer = nullptr;
 		}
 	}
+	if (saveWriter)
+	{
+		saveWriter->Poll();
+		if (saveWriter->GetDone())
+		{
+			bool success = saveWriter->GetSuccess();
+			String error = saveWriter->GetError();
+			saveWriter->Finish();
+			saveWriter = nullptr;
+			if (!success)
+				new ErrorMessage("Error", error);
+			else
+			{
+				if (onSaved)
+				{
+					onSaved(&save);
+				}
+				Exit();
+			}
+		}
+	}
 }
 
 void LocalSaveActivity::Save()
@@ -104,6 +127,8 @@ void LocalSaveActivity::Save()
 
 void LocalSaveActivity::saveWrite(ByteString finalFilename)
 {
+	if (saveWriter)
+		return;
 	Client::Ref().MakeDirectory(LOCAL_SAVE_DIR);
 	GameSave *gameSave = save.GetGameSave();
 	Json::Value localSaveInfo;
@@ -113,19 +138,9 @@ void LocalSaveActivity::saveWrite(ByteString finalFilename)
 	localSaveInfo["date"] = (Json::Value::UInt64)time(NULL);
 	Client::Ref().SaveAuthorInfo(&localSaveInfo);
 	gameSave->authors = localSaveInfo;
-	std::vector<char> saveData = gameSave->Serialise();
-	if (saveData.size() == 0)
-		new ErrorMessage("Error", "Unable to serialize game data.");
-	else if (Client::Ref().WriteFile(saveData, finalFilename))
-		new ErrorMessage("Error", "Unable to write save file.");
-	else
-	{
-		if (onSaved)
-		{
-			onSaved(&save);
-		}
-		Exit();
-	}
+	// Finished in OnTick
+	saveWriter = new SaveWriterTask(new GameSave(*gameSave), finalFilename, false);
+	saveWriter->Start();
 }
 
 void LocalSaveActivity::OnDraw()
@@ -148,4 +163,8 @@ LocalSaveActivity::~LocalSaveActivity()
 	{
 		thumbnailRenderer->Abandon();
 	}
+	if (saveWriter)
+	{
+		saveWriter->Abandon();
+	}
 }
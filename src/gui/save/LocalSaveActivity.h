@@ -13,6 +13,7 @@ namespace ui
 class VideoBuffer;
 
 class ThumbnailRendererTask;
+class SaveWriterTask;
 
 class LocalSaveActivity: public WindowActivity
 {
@@ -20,6 +21,7 @@ class LocalSaveActivity: public WindowActivity
 
 	SaveFile save;
 	ThumbnailRendererTask *thumbnailRenderer;
+	SaveWriterTask *saveWriter;
 	std::unique_ptr<VideoBuffer> thumbnail;
 	ui::Textbox * filenameField;
 	OnSaved onSaved;
@@ -265,7 +265,7 @@ int luacon_elementwrite(lua_State* l)
 
 	luacon_model->BuildMenus();
 	luacon_sim->init_can_move();
-	std::fill(&luacon_ren->graphicscache[0], &luacon_ren->graphicscache[PT_NUM], gcache_item());
+	luacon_ren->ClearGraphicsCache();
 
 	return 0;
 }
@@ -429,7 +429,7 @@ int luatpt_graphics_func(lua_State *l)
 		if (luacon_sim->IsValidElement(element))
 		{
 			lua_gr_func[element].Assign(1);
-			luacon_ren->graphicscache[element].isready = 0;
+			luacon_ren->ClearGraphicsCache(element);
 			return 0;
 		}
 		else
@@ -443,7 +443,7 @@ int luatpt_graphics_func(lua_State *l)
 		if (luacon_sim->IsValidElement(element))
 		{
 			lua_gr_func[element].Clear();
-			luacon_ren->graphicscache[element].isready = 0;
+			luacon_ren->ClearGraphicsCache(element);
 			return 0;
 		}
 		else
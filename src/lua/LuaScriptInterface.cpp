@@ -36,6 +36,7 @@
 #include "simulation/ElementGraphics.h"
 #include "simulation/ElementCommon.h"
 #include "simulation/Air.h"
+#include "simulation/InputLog.h"
 
 #include "simulation/ToolClasses.h"
 #include "simulation/ElementClasses.h"
@@ -801,7 +802,19 @@ void LuaScriptInterface::initSimulationAPI()
 		{"neighbors", simulation_neighbours},
 		{"framerender", simulation_framerender},
 		{"gspeed", simulation_gspeed},
+		{"threads", simulation_threads},
+		{"airPipeline", simulation_airPipeline},
+		{"deterministic", simulation_deterministic},
+		{"randomSeed", simulation_randomSeed},
+		{"profile", simulation_profile},
 		{"takeSnapshot", simulation_takeSnapshot},
+		{"recordInput", simulation_recordInput},
+		{"replayInput", simulation_replayInput},
+		{"inputLogInfo", simulation_inputLogInfo},
+		{"saveInputLog", simulation_saveInputLog},
+		{"loadInputLog", simulation_loadInputLog},
+		{"turbo", simulation_turbo},
+		{"ticksPerSecond", simulation_ticksPerSecond},
 		{NULL, NULL}
 	};
 	luaL_register(l, "simulation", simulationAPIMethods);
@@ -2139,12 +2152,195 @@ int LuaScriptInterface::simulation_gspeed(lua_State * l)
 	return 0;
 }
 
+int LuaScriptInterface::simulation_threads(lua_State * l)
+{
+	if (lua_gettop(l) == 0)
+	{
+		lua_pushinteger(l, luacon_sim->GetUpdateThreads());
+		return 1;
+	}
+	int threads = luaL_checkinteger(l, 1);
+	if (threads < 1)
+		return luaL_error(l, "Thread count must be at least 1");
+	luacon_sim->SetUpdateThreads(threads);
+	return 0;
+}
+
+int LuaScriptInterface::simulation_airPipeline(lua_State * l)
+{
+	if (lua_gettop(l) == 0)
+	{
+		lua_pushboolean(l, luacon_sim->air->IsPipelined());
+		return 1;
+	}
+	luacon_sim->air->SetPipelined(lua_toboolean(l, 1));
+	return 0;
+}
+
+int LuaScriptInterface::simulation_deterministic(lua_State * l)
+{
+	if (lua_gettop(l) == 0)
+	{
+		lua_pushboolean(l, luacon_sim->deterministic);
+		return 1;
+	}
+	luacon_sim->deterministic = lua_toboolean(l, 1);
+	return 0;
+}
+
+int LuaScriptInterface::simulation_randomSeed(lua_State * l)
+{
+	if (lua_gettop(l) == 0)
+	{
+		lua_pushinteger(l, luacon_sim->randomSeed);
+		return 1;
+	}
+	luacon_sim->randomSeed = (unsigned int)luaL_checkinteger(l, 1);
+	return 0;
+}
+
+int LuaScriptInterface::simulation_profile(lua_State * l)
+{
+	ElementProfiler &profiler = luacon_sim->profiler;
+	if (lua_gettop(l) > 0)
+	{
+		profiler.SetEnabled(lua_toboolean(l, 1));
+		return 0;
+	}
+	static const char *const kindNames[ElementProfiler::KIND_COUNT] = { "update", "lua", "graphics" };
+	lua_newtable(l);
+	for (int t = 0; t < PT_NUM; t++)
+	{
+		bool called = false;
+		for (int k = 0; k < ElementProfiler::KIND_COUNT; k++)
+			if (profiler.Calls(t, ElementProfiler::Kind(k)))
+				called = true;
+		if (!called)
+			continue;
+		lua_newtable(l);
+		for (int k = 0; k < ElementProfiler::KIND_COUNT; k++)
+		{
+			lua_pushnumber(l, double(profiler.Calls(t, ElementProfiler::Kind(k))));
+			lua_setfield(l, -2, (ByteString(kindNames[k]) + "Calls").c_str());
+			lua_pushnumber(l, profiler.Nanoseconds(t, ElementProfiler::Kind(k)) / 1e9);
+			lua_setfield(l, -2, (ByteString(kindNames[k]) + "Time").c_str());
+		}
+		lua_rawseti(l, -2, t);
+	}
+	lua_pushinteger(l, int(profiler.simFrames));
+	lua_pushinteger(l, int(profiler.renderFrames));
+	return 3;
+}
+
 int LuaScriptInterface::simulation_takeSnapshot(lua_State * l)
 {
 	luacon_controller->HistorySnapshot();
 	return 0;
 }
 
+int LuaScriptInterface::simulation_recordInput(lua_State * l)
+{
+	InputLog *log = luacon_sim->inputLog;
+	if (lua_gettop(l) == 0)
+	{
+		lua_pushboolean(l, log && log->GetMode() == InputLog::RECORDING);
+		return 1;
+	}
+	if (lua_toboolean(l, 1))
+	{
+		int interval = luaL_optint(l, 2, 300);
+		if (interval < 1)
+			return luaL_error(l, "Keyframe interval must be at least 1");
+		if (!log)
+			log = luacon_sim->inputLog = new InputLog();
+		log->Record(*luacon_sim, interval);
+	}
+	else if (log)
+		log->Stop();
+	return 0;
+}
+
+int LuaScriptInterface::simulation_replayInput(lua_State * l)
+{
+	int tick = luaL_checkinteger(l, 1);
+	InputLog *log = luacon_sim->inputLog;
+	if (!log)
+		return luaL_error(l, "Nothing has been recorded");
+	if (tick < 0)
+		return luaL_error(l, "Invalid tick");
+	if (!log->Seek(*luacon_sim, tick))
+		return luaL_error(l, "Nothing has been recorded");
+	luacon_ren->ClearAccumulation();
+	luacon_model->UpdateQuickOptions();
+	return 0;
+}
+
+int LuaScriptInterface::simulation_inputLogInfo(lua_State * l)
+{
+	InputLog *log = luacon_sim->inputLog;
+	if (!log)
+		return 0;
+	const char *modes[] = { "stopped", "recording", "playing" };
+	lua_pushstring(l, modes[log->GetMode()]);
+	lua_pushinteger(l, log->GetTick());
+	lua_pushinteger(l, log->GetEndTick());
+	lua_pushinteger(l, int(log->GetActionCount()));
+	lua_pushinteger(l, int(log->GetKeyframeCount()));
+	return 5;
+}
+
+int LuaScriptInterface::simulation_saveInputLog(lua_State * l)
+{
+	ByteString filename = luaL_checkstring(l, 1);
+	InputLog *log = luacon_sim->inputLog;
+	if (!log)
+		return luaL_error(l, "Nothing has been recorded");
+	std::vector<unsigned char> data = log->Serialise();
+	lua_pushboolean(l, data.size() && !Client::Ref().WriteFile(data, filename));
+	return 1;
+}
+
+int LuaScriptInterface::simulation_loadInputLog(lua_State * l)
+{
+	ByteString filename = luaL_checkstring(l, 1);
+	std::vector<unsigned char> data = Client::Ref().ReadFile(filename);
+	if (!data.size())
+		return luaL_error(l, "Could not read %s", filename.c_str());
+	InputLog *log = InputLog::Deserialise(*luacon_sim, data);
+	if (!log)
+		return luaL_error(l, "%s is not a valid input log", filename.c_str());
+	delete luacon_sim->inputLog;
+	luacon_sim->inputLog = log;
+	log->Seek(*luacon_sim, 0);
+	luacon_ren->ClearAccumulation();
+	luacon_model->UpdateQuickOptions();
+	return 0;
+}
+
+int LuaScriptInterface::simulation_turbo(lua_State * l)
+{
+	if (lua_gettop(l) == 0)
+	{
+		lua_pushinteger(l, luacon_controller->GetTurboTicks());
+		lua_pushnumber(l, luacon_controller->GetTurboBudget());
+		return 2;
+	}
+	int ticks = luaL_checkinteger(l, 1);
+	float budget = luaL_optnumber(l, 2, 0.0f);
+	if (ticks < 1)
+		return luaL_error(l, "Must run at least 1 tick per frame");
+	if (budget < 0)
+		return luaL_error(l, "Time budget can't be negative");
+	luacon_controller->SetTurbo(ticks, budget);
+	return 0;
+}
+
+int LuaScriptInterface::simulation_ticksPerSecond(lua_State * l)
+{
+	lua_pushnumber(l, luacon_controller->GetTicksPerSecond());
+	return 1;
+}
+
 //// Begin Renderer API
 
 void LuaScriptInterface::initRendererAPI()
@@ -2162,6 +2358,8 @@ void LuaScriptInterface::initRendererAPI()
 		{"zoomEnabled", renderer_zoomEnabled},
 		{"zoomWindow", renderer_zoomWindowInfo},
 		{"zoomScope", renderer_zoomScopeInfo},
+		{"threads", renderer_threads},
+		{"background", renderer_background},
 		{NULL, NULL}
 	};
 	luaL_register(l, "renderer", rendererAPIMethods);
@@ -2416,6 +2614,31 @@ int LuaScriptInterface::renderer_zoomScopeInfo(lua_State * l)
 	return 0;
 }
 
+int LuaScriptInterface::renderer_threads(lua_State * l)
+{
+	if (lua_gettop(l) == 0)
+	{
+		lua_pushinteger(l, luacon_ren->GetRenderThreads());
+		return 1;
+	}
+	int threads = luaL_checkinteger(l, 1);
+	if (threads < 1)
+		return luaL_error(l, "Thread count must be at least 1");
+	luacon_ren->SetRenderThreads(threads);
+	return 0;
+}
+
+int LuaScriptInterface::renderer_background(lua_State * l)
+{
+	if (lua_gettop(l) == 0)
+	{
+		lua_pushboolean(l, luacon_ren->GetDrawInBackground());
+		return 1;
+	}
+	luacon_ren->SetDrawInBackground(lua_toboolean(l, 1));
+	return 0;
+}
+
 void LuaScriptInterface::initElementsAPI()
 {
 	//Methods
@@ -2635,7 +2858,7 @@ int LuaScriptInterface::elements_loadDefault(lua_State * l)
 
 	luacon_model->BuildMenus();
 	luacon_sim->init_can_move();
-	std::fill(luacon_ren->graphicscache, luacon_ren->graphicscache+PT_NUM, gcache_item());
+	luacon_ren->ClearGraphicsCache();
 	return 0;
 }
 
@@ -2911,7 +3134,7 @@ int LuaScriptInterface::elements_element(lua_State * l)
 
 		luacon_model->BuildMenus();
 		luacon_sim->init_can_move();
-		luacon_ren->graphicscache[id].isready = 0;
+		luacon_ren->ClearGraphicsCache(id);
 
 		return 0;
 	}
@@ -2978,7 +3201,7 @@ int LuaScriptInterface::elements_property(lua_State * l)
 
 			luacon_model->BuildMenus();
 			luacon_sim->init_can_move();
-			luacon_ren->graphicscache[id].isready = 0;
+			luacon_ren->ClearGraphicsCache(id);
 		}
 		else if (propertyName == "Update")
 		{
@@ -3018,7 +3241,7 @@ int LuaScriptInterface::elements_property(lua_State * l)
 				lua_gr_func[id].Clear();
 				luacon_sim->elements[id].Graphics = NULL;
 			}
-			luacon_ren->graphicscache[id].isready = 0;
+			luacon_ren->ClearGraphicsCache(id);
 		}
 		else if (propertyName == "Create")
 		{
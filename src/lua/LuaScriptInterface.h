@@ -113,7 +113,19 @@ class LuaScriptInterface: public CommandInterface
 	static int simulation_neighbours(lua_State * l);
 	static int simulation_framerender(lua_State * l);
 	static int simulation_gspeed(lua_State * l);
+	static int simulation_threads(lua_State * l);
+	static int simulation_airPipeline(lua_State * l);
+	static int simulation_deterministic(lua_State * l);
+	static int simulation_randomSeed(lua_State * l);
+	static int simulation_profile(lua_State * l);
 	static int simulation_takeSnapshot(lua_State *l);
+	static int simulation_recordInput(lua_State * l);
+	static int simulation_replayInput(lua_State * l);
+	static int simulation_inputLogInfo(lua_State * l);
+	static int simulation_saveInputLog(lua_State * l);
+	static int simulation_loadInputLog(lua_State * l);
+	static int simulation_turbo(lua_State * l);
+	static int simulation_ticksPerSecond(lua_State * l);
 
 	//Renderer
 	void initRendererAPI();
@@ -127,6 +139,8 @@ class LuaScriptInterface: public CommandInterface
 	static int renderer_zoomEnabled(lua_State *l);
 	static int renderer_zoomWindowInfo(lua_State *l);
 	static int renderer_zoomScopeInfo(lua_State *l);
+	static int renderer_threads(lua_State * l);
+	static int renderer_background(lua_State * l);
 
 	//Elements
 	void initElementsAPI();
@@ -0,0 +1,132 @@
+#ifndef ACTIVITYMAP_H
+#define ACTIVITYMAP_H
+
+#include <cstdint>
+#include <cstring>
+#include "Config.h"
+
+// One bit per CELL*CELL block of the simulation, used to skip parts of the screen that have nothing to do
+class ActivityMap
+{
+public:
+	static const int width = XRES/CELL;
+	static const int height = YRES/CELL;
+	static const int words = (width+63)/64;
+
+	uint64_t bits[height][words];
+
+	ActivityMap()
+	{
+		Clear();
+	}
+
+	void Clear()
+	{
+		memset(bits, 0, sizeof(bits));
+	}
+
+	void Fill()
+	{
+		for (int by = 0; by < height; by++)
+			for (int w = 0; w < words; w++)
+				bits[by][w] = (w == words-1 && width%64) ? ((uint64_t(1) << (width%64)) - 1) : ~uint64_t(0);
+	}
+
+	void Set(int bx, int by)
+	{
+		bits[by][bx/64] |= uint64_t(1) << (bx%64);
+	}
+
+	void Unset(int bx, int by)
+	{
+		bits[by][bx/64] &= ~(uint64_t(1) << (bx%64));
+	}
+
+	bool Get(int bx, int by) const
+	{
+		return (bits[by][bx/64] >> (bx%64)) & 1;
+	}
+
+	// Marks the block containing pixel x, y
+	void SetPixel(int x, int y)
+	{
+		if (x >= 0 && y >= 0 && x < XRES && y < YRES)
+			Set(x/CELL, y/CELL);
+	}
+
+	bool RowEmpty(int by) const
+	{
+		for (int w = 0; w < words; w++)
+			if (bits[by][w])
+				return false;
+		return true;
+	}
+
+	void Merge(const ActivityMap &other)
+	{
+		for (int by = 0; by < height; by++)
+			for (int w = 0; w < words; w++)
+				bits[by][w] |= other.bits[by][w];
+	}
+
+	int Count() const
+	{
+		int count = 0;
+		for (int by = 0; by < height; by++)
+			for (int bx = 0; bx < width; bx++)
+				count += Get(bx, by);
+		return count;
+	}
+
+	// Calls f(bx) for each set block in a row, in increasing order
+	template<typename F>
+	void ForEachInRow(int by, F f) const
+	{
+		for (int w = 0; w < words; w++)
+		{
+			uint64_t word = bits[by][w];
+			for (int bx = w*64; word; bx++, word >>= 1)
+				if (word & 1)
+					f(bx);
+		}
+	}
+
+	// Calls f(start, end) for each run of consecutive set blocks in a row, end being one past the last block of the run
+	template<typename F>
+	void ForEachRunInRow(int by, F f) const
+	{
+		int start = -1;
+		for (int w = 0; w < words; w++)
+		{
+			uint64_t word = bits[by][w];
+			int bx = w*64;
+			int wordEnd = (bx+64 < width) ? bx+64 : width;
+			uint64_t full = (wordEnd-bx == 64) ? ~uint64_t(0) : ((uint64_t(1) << (wordEnd-bx)) - 1);
+			if (word == full)
+			{
+				if (start < 0)
+					start = bx;
+				continue;
+			}
+			for (; bx < wordEnd; bx++, word >>= 1)
+			{
+				if (word & 1)
+				{
+					if (start < 0)
+						start = bx;
+				}
+				else if (start >= 0)
+				{
+					f(start, bx);
+					start = -1;
+				}
+				if (!word && start < 0)
+					break;
+			}
+		}
+		if (start >= 0)
+			f(start, width);
+	}
+};
+
+#endif /* ACTIVITYMAP_H */
@@ -1,11 +1,19 @@
 #include "Air.h"
 
 #include <cmath>
+#include <cstring>
 #include <algorithm>
+#ifdef X86_SSE2
+#include <emmintrin.h>
+#endif
 
 #include "Simulation.h"
 #include "ElementClasses.h"
 #include "common/tpt-rand.h"
+#include "common/ThreadPool.h"
+
+// Height of the row tiles the air update is split into when it runs on a thread pool
+#define AIR_TILE_ROWS 8
 
 /*float kernel[9];
 
@@ -39,6 +47,84 @@ void Air::make_kernel(void) //used for velocity
 			kernel[(i+1)+3*(j+1)] *= s;
 }
 
+// Points the nine taps of a 3x3 blur at the rows of field around row y. Rows outside the grid are
+// replaced by row y itself, the open map makes sure they are never used
+static void rowTaps(const float *taps[9], float (*field)[XRES/CELL], int y)
+{
+	for (int j = 0; j < 3; j++)
+	{
+		const float *row = (y+j-1 >= 0 && y+j-1 < YRES/CELL) ? field[y+j-1] : field[y];
+		taps[j*3] = taps[j*3+1] = taps[j*3+2] = row;
+	}
+}
+
+static inline void blurCell(float *const out[3], const float *const taps[3][9], const float *const centre[3], const int *const open[3], const float *kernel, int x)
+{
+	for (int n = 0; n < 3; n++)
+	{
+		float sum = 0.0f;
+		for (int k = 0; k < 9; k++)
+			sum += (open[k/3][x+k%3-1] ? taps[n][k][x+k%3-1] : centre[n][x])*kernel[k];
+		out[n][x] = sum;
+	}
+}
+
+// Weighted 3x3 average of one row of cells for three fields at once, out[x] = sum of kernel * (open ? tap : centre)
+// over the taps around x. open holds the open map rows above, at and below the row, offset so that column -1 is valid.
+// Without vectorised every cell is done on its own, the results are the same
+static void blurRow(float *const out[3], const float *const taps[3][9], const float *const centre[3], const int *const open[3], const float *kernel, bool vectorised)
+{
+	int x = 0;
+#ifdef X86_SSE2
+	if (!vectorised)
+	{
+		for (; x < XRES/CELL; x++)
+			blurCell(out, taps, centre, open, kernel, x);
+		return;
+	}
+	// The first and last columns need values from outside the row, which are never used but can't be loaded either
+	blurCell(out, taps, centre, open, kernel, x++);
+	__m128 weight[9];
+	for (int k = 0; k < 9; k++)
+		weight[k] = _mm_set1_ps(kernel[k]);
+	for (; x+4 <= XRES/CELL-1; x += 4)
+	{
+		__m128 c[3], sum[3];
+		for (int n = 0; n < 3; n++)
+		{
+			c[n] = _mm_loadu_ps(centre[n]+x);
+			sum[n] = _mm_setzero_ps();
+		}
+		for (int j = 0; j < 3; j++)
+		{
+			for (int i = -1; i < 2; i++)
+			{
+				__m128 mask = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(open[j]+x+i)));
+				for (int n = 0; n < 3; n++)
+				{
+					__m128 v = _mm_loadu_ps(taps[n][j*3+i+1]+x+i);
+					v = _mm_or_ps(_mm_and_ps(mask, v), _mm_andnot_ps(mask, c[n]));
+					sum[n] = _mm_add_ps(sum[n], _mm_mul_ps(v, weight[j*3+i+1]));
+				}
+			}
+		}
+		for (int n = 0; n < 3; n++)
+			_mm_storeu_ps(out[n]+x, sum[n]);
+	}
+#endif
+	for (; x < XRES/CELL; x++)
+		blurCell(out, taps, centre, open, kernel, x);
+}
+
+bool Air::BlurVectorised()
+{
+#ifdef X86_SSE2
+	return true;
+#else
+	return false;
+#endif
+}
+
 void Air::Clear()
 {
 	std::fill(&pv[0][0], &pv[0][0]+((XRES/CELL)*(YRES/CELL)), 0.0f);
@@ -51,11 +137,41 @@ void Air::ClearAirH()
 	std::fill(&hv[0][0], &hv[0][0]+((XRES/CELL)*(YRES/CELL)), ambientAirTemp);
 }
 
+// Runs fn(first row, end row) on tiles of AIR_TILE_ROWS rows, spread over pool if there is one. Each stage of the update
+// only writes to its own rows, so the result is the same however the tiles are run
+static void forEachTile(ThreadPool *pool, std::function<void (int, int)> fn)
+{
+	int tiles = (YRES/CELL+AIR_TILE_ROWS-1)/AIR_TILE_ROWS;
+	auto tile = [&fn](int t) {
+		fn(t*AIR_TILE_ROWS, std::min((t+1)*AIR_TILE_ROWS, YRES/CELL));
+	};
+	if (pool)
+		pool->ParallelFor(tiles, tile);
+	else
+		for (int t = 0; t < tiles; t++)
+			tile(t);
+}
+
 void Air::update_airh(void)
 {
-	int x, y, i, j;
-	float odh, dh, dx, dy, f, tx, ty;
-	for (i=0; i<YRES/CELL; i++) //reduces pressure/velocity on the edges every frame
+	updateAirh(*this, pool);
+}
+
+void Air::update_air(void)
+{
+	updateAir(*this, pool, bmap, fvx, fvy);
+}
+
+void Air::updateAirh(AirState &s, ThreadPool *pool)
+{
+	auto &hv = s.hv;
+	auto &ohv = s.ohv;
+	auto &vx = s.vx;
+	auto &vy = s.vy;
+	auto &gvy = s.gvy;
+	auto &bmap_blockairh = s.bmap_blockairh;
+	auto &blurOpen = s.blurOpen;
+	for (int i=0; i<YRES/CELL; i++) //reduces pressure/velocity on the edges every frame
 	{
 		hv[i][0] = ambientAirTemp;
 		hv[i][1] = ambientAirTemp;
@@ -63,7 +179,7 @@ void Air::update_airh(void)
 		hv[i][XRES/CELL-2] = ambientAirTemp;
 		hv[i][XRES/CELL-1] = ambientAirTemp;
 	}
-	for (i=0; i<XRES/CELL; i++) //reduces pressure/velocity on the edges every frame
+	for (int i=0; i<XRES/CELL; i++) //reduces pressure/velocity on the edges every frame
 	{
 		hv[0][i] = ambientAirTemp;
 		hv[1][i] = ambientAirTemp;
@@ -71,73 +187,90 @@ void Air::update_airh(void)
 		hv[YRES/CELL-2][i] = ambientAirTemp;
 		hv[YRES/CELL-1][i] = ambientAirTemp;
 	}
-	for (y=0; y<YRES/CELL; y++) //update velocity and pressure
-	{
-		for (x=0; x<XRES/CELL; x++)
+	bool verticalGravity = !sim.gravityMode; //Vertical gravity only for the time being
+	forEachTile(pool, [&](int y0, int y1) {
+		if (y0 == 0)
+			memset(blurOpen[0], 0, sizeof(blurOpen[0]));
+		if (y1 == YRES/CELL)
+			memset(blurOpen[YRES/CELL+1], 0, sizeof(blurOpen[YRES/CELL+1]));
+		for (int y=y0; y<y1; y++)
 		{
-			dh = 0.0f;
-			dx = 0.0f;
-			dy = 0.0f;
-			for (j=-1; j<2; j++)
+			for (int x=-1; x<=XRES/CELL; x++)
+				blurOpen[y+1][x+1] = (y>0 && y<YRES/CELL-2 && x>0 && x<XRES/CELL-2 && !(bmap_blockairh[y][x]&0x8)) ? -1 : 0;
+			memcpy(gvy[y], vy[y], sizeof(gvy[y]));
+			if (verticalGravity)
 			{
-				for (i=-1; i<2; i++)
+				for (int x=0; x<XRES/CELL; x++)
 				{
-					if (y+j>0 && y+j<YRES/CELL-2 &&
-					        x+i>0 && x+i<XRES/CELL-2 &&
-					        !(bmap_blockairh[y+j][x+i]&0x8))
-						{
-						f = kernel[i+1+(j+1)*3];
-						dh += hv[y+j][x+i]*f;
-						dx += vx[y+j][x+i]*f;
-						dy += vy[y+j][x+i]*f;
-					}
-					else
-					{
-						f = kernel[i+1+(j+1)*3];
-						dh += hv[y][x]*f;
-						dx += vx[y][x]*f;
-						dy += vy[y][x]*f;
-					}
+					float airdiff = hv[y-1][x]-hv[y][x];
+					if(airdiff>0 && !(bmap_blockairh[y-1][x]&0x8))
+						gvy[y][x] -= airdiff/5000.0f;
 				}
 			}
-			tx = x - dx*0.7f;
-			ty = y - dy*0.7f;
-			i = (int)tx;
-			j = (int)ty;
-			tx -= i;
-			ty -= j;
-			if (i>=2 && i<XRES/CELL-3 && j>=2 && j<YRES/CELL-3)
+		}
+	});
+	forEachTile(pool, [&](int y0, int y1) {
+		for (int y=y0; y<y1; y++) //update velocity and pressure
+		{
+			int i, j;
+			float odh, dh, dx, dy, tx, ty;
+			// The gravity used to be applied to vy as the cells were updated, so the neighbours above and to
+			// the left are taken from the changed vy and the rest from the old one
+			float rowDx[XRES/CELL], rowDy[XRES/CELL];
+			const int *open[3] = { &blurOpen[y][1], &blurOpen[y+1][1], &blurOpen[y+2][1] };
+			const float *taps[3][9];
+			rowTaps(taps[0], hv, y);
+			rowTaps(taps[1], vx, y);
+			rowTaps(taps[2], vy, y);
+			if (y > 0)
+				taps[2][0] = taps[2][1] = taps[2][2] = gvy[y-1];
+			taps[2][3] = gvy[y];
+			float *const out[3] = { ohv[y], rowDx, rowDy };
+			const float *const centre[3] = { hv[y], vx[y], vy[y] };
+			blurRow(out, taps, centre, open, kernel, !scalarBlur);
+			for (int x=0; x<XRES/CELL; x++)
 			{
-				odh = dh;
-				dh *= 1.0f - AIR_VADV;
-				dh += AIR_VADV*(1.0f-tx)*(1.0f-ty)*((bmap_blockairh[j][i]&0x8) ? odh : hv[j][i]);
-				dh += AIR_VADV*tx*(1.0f-ty)*((bmap_blockairh[j][i+1]&0x8) ? odh : hv[j][i+1]);
-				dh += AIR_VADV*(1.0f-tx)*ty*((bmap_blockairh[j+1][i]&0x8) ? odh : hv[j+1][i]);
-				dh += AIR_VADV*tx*ty*((bmap_blockairh[j+1][i+1]&0x8) ? odh : hv[j+1][i+1]);
-			}
-			if(!sim.gravityMode)
-			{ //Vertical gravity only for the time being
-				float airdiff = hv[y-1][x]-hv[y][x];
-				if(airdiff>0 && !(bmap_blockairh[y-1][x]&0x8))
-					vy[y][x] -= airdiff/5000.0f;
+				dh = ohv[y][x];
+				dx = rowDx[x];
+				dy = rowDy[x];
+				tx = x - dx*0.7f;
+				ty = y - dy*0.7f;
+				i = (int)tx;
+				j = (int)ty;
+				tx -= i;
+				ty -= j;
+				if (i>=2 && i<XRES/CELL-3 && j>=2 && j<YRES/CELL-3)
+				{
+					odh = dh;
+					dh *= 1.0f - AIR_VADV;
+					dh += AIR_VADV*(1.0f-tx)*(1.0f-ty)*((bmap_blockairh[j][i]&0x8) ? odh : hv[j][i]);
+					dh += AIR_VADV*tx*(1.0f-ty)*((bmap_blockairh[j][i+1]&0x8) ? odh : hv[j][i+1]);
+					dh += AIR_VADV*(1.0f-tx)*ty*((bmap_blockairh[j+1][i]&0x8) ? odh : hv[j+1][i]);
+					dh += AIR_VADV*tx*ty*((bmap_blockairh[j+1][i+1]&0x8) ? odh : hv[j+1][i+1]);
+				}
+				ohv[y][x] = dh;
 			}
-			ohv[y][x] = dh;
 		}
-	}
+	});
 	memcpy(hv, ohv, sizeof(hv));
+	memcpy(vy, gvy, sizeof(vy));
 }
 
-void Air::update_air(void)
+void Air::updateAir(AirState &s, ThreadPool *pool, unsigned char (*bmap)[XRES/CELL], float (*fvx)[XRES/CELL], float (*fvy)[XRES/CELL])
 {
-	int x = 0, y = 0, i = 0, j = 0;
-	float dp = 0.0f, dx = 0.0f, dy = 0.0f, f = 0.0f, tx = 0.0f, ty = 0.0f;
+	auto &vx = s.vx;
+	auto &ovx = s.ovx;
+	auto &vy = s.vy;
+	auto &ovy = s.ovy;
+	auto &pv = s.pv;
+	auto &opv = s.opv;
+	auto &bmap_blockair = s.bmap_blockair;
+	auto &blurOpen = s.blurOpen;
 	const float advDistanceMult = 0.7f;
-	float stepX, stepY;
-	int stepLimit, step;
 
 	if (airMode != 4) { //airMode 4 is no air/pressure update
 
-		for (i=0; i<YRES/CELL; i++) //reduces pressure/velocity on the edges every frame
+		for (int i=0; i<YRES/CELL; i++) //reduces pressure/velocity on the edges every frame
 		{
 			pv[i][0] = pv[i][0]*0.8f;
 			pv[i][1] = pv[i][1]*0.8f;
@@ -153,7 +286,7 @@ void Air::update_air(void)
 			vy[i][XRES/CELL-2] = vy[i][XRES/CELL-2]*0.9f;
 			vy[i][XRES/CELL-1] = vy[i][XRES/CELL-1]*0.9f;
 		}
-		for (i=0; i<XRES/CELL; i++) //reduces pressure/velocity on the edges every frame
+		for (int i=0; i<XRES/CELL; i++) //reduces pressure/velocity on the edges every frame
 		{
 			pv[0][i] = pv[0][i]*0.8f;
 			pv[1][i] = pv[1][i]*0.8f;
@@ -170,170 +303,186 @@ void Air::update_air(void)
 			vy[YRES/CELL-1][i] = vy[YRES/CELL-1][i]*0.9f;
 		}
 
-		for (j=1; j<YRES/CELL; j++) //clear some velocities near walls
-		{
-			for (i=1; i<XRES/CELL; i++)
+		forEachTile(pool, [&](int y0, int y1) {
+			for (int y=std::max(y0, 1); y<y1; y++) //clear some velocities near walls
 			{
-				if (bmap_blockair[j][i])
+				// a wall at y, x clears vx at x-1 and x and vy at y-1 and y
+				for (int x=0; x<XRES/CELL; x++)
 				{
-					vx[j][i] = 0.0f;
-					vx[j][i-1] = 0.0f;
-					vy[j][i] = 0.0f;
-					vy[j-1][i] = 0.0f;
+					if ((x>=1 && bmap_blockair[y][x]) || (x+1<XRES/CELL && bmap_blockair[y][x+1]))
+						vx[y][x] = 0.0f;
 				}
 			}
-		}
-
-		for (y=1; y<YRES/CELL; y++) //pressure adjustments from velocity
-			for (x=1; x<XRES/CELL; x++)
+			for (int y=y0; y<y1; y++)
 			{
-				dp = 0.0f;
-				dp += vx[y][x-1] - vx[y][x];
-				dp += vy[y-1][x] - vy[y][x];
-				pv[y][x] *= AIR_PLOSS;
-				pv[y][x] += dp*AIR_TSTEPP;
+				for (int x=1; x<XRES/CELL; x++)
+				{
+					if ((y>=1 && bmap_blockair[y][x]) || (y+1<YRES/CELL && bmap_blockair[y+1][x]))
+						vy[y][x] = 0.0f;
+				}
 			}
+		});
 
-		for (y=0; y<YRES/CELL-1; y++) //velocity adjustments from pressure
-			for (x=0; x<XRES/CELL-1; x++)
-			{
-				dx = dy = 0.0f;
-				dx += pv[y][x] - pv[y][x+1];
-				dy += pv[y][x] - pv[y+1][x];
-				vx[y][x] *= AIR_VLOSS;
-				vy[y][x] *= AIR_VLOSS;
-				vx[y][x] += dx*AIR_TSTEPV;
-				vy[y][x] += dy*AIR_TSTEPV;
-				if (bmap_blockair[y][x] || bmap_blockair[y][x+1])
-					vx[y][x] = 0;
-				if (bmap_blockair[y][x] || bmap_blockair[y+1][x])
-					vy[y][x] = 0;
-			}
+		forEachTile(pool, [&](int y0, int y1) {
+			for (int y=std::max(y0, 1); y<y1; y++) //pressure adjustments from velocity
+				for (int x=1; x<XRES/CELL; x++)
+				{
+					float dp = 0.0f;
+					dp += vx[y][x-1] - vx[y][x];
+					dp += vy[y-1][x] - vy[y][x];
+					pv[y][x] *= AIR_PLOSS;
+					pv[y][x] += dp*AIR_TSTEPP;
+				}
+			if (y0 == 0)
+				memset(blurOpen[0], 0, sizeof(blurOpen[0]));
+			if (y1 == YRES/CELL)
+				memset(blurOpen[YRES/CELL+1], 0, sizeof(blurOpen[YRES/CELL+1]));
+			for (int y=y0; y<y1; y++)
+				for (int x=-1; x<=XRES/CELL; x++)
+					blurOpen[y+1][x+1] = (y>0 && y<YRES/CELL-1 && x>0 && x<XRES/CELL-1 && !bmap_blockair[y][x]) ? -1 : 0;
+		});
+
+		forEachTile(pool, [&](int y0, int y1) {
+			for (int y=y0; y<std::min(y1, YRES/CELL-1); y++) //velocity adjustments from pressure
+				for (int x=0; x<XRES/CELL-1; x++)
+				{
+					float dx, dy;
+					dx = dy = 0.0f;
+					dx += pv[y][x] - pv[y][x+1];
+					dy += pv[y][x] - pv[y+1][x];
+					vx[y][x] *= AIR_VLOSS;
+					vy[y][x] *= AIR_VLOSS;
+					vx[y][x] += dx*AIR_TSTEPV;
+					vy[y][x] += dy*AIR_TSTEPV;
+					if (bmap_blockair[y][x] || bmap_blockair[y][x+1])
+						vx[y][x] = 0;
+					if (bmap_blockair[y][x] || bmap_blockair[y+1][x])
+						vy[y][x] = 0;
+				}
+		});
 
-		for (y=0; y<YRES/CELL; y++) //update velocity and pressure
-			for (x=0; x<XRES/CELL; x++)
+		forEachTile(pool, [&](int y0, int y1) {
+			for (int y=y0; y<y1; y++) //update velocity and pressure
 			{
-				dx = 0.0f;
-				dy = 0.0f;
-				dp = 0.0f;
-				for (j=-1; j<2; j++)
-					for (i=-1; i<2; i++)
-						if (y+j>0 && y+j<YRES/CELL-1 &&
-						        x+i>0 && x+i<XRES/CELL-1 &&
-						        !bmap_blockair[y+j][x+i])
+				int i, j;
+				float dp, dx, dy, tx, ty;
+				float stepX, stepY;
+				int stepLimit, step;
+				const int *open[3] = { &blurOpen[y][1], &blurOpen[y+1][1], &blurOpen[y+2][1] };
+				const float *taps[3][9];
+				rowTaps(taps[0], vx, y);
+				rowTaps(taps[1], vy, y);
+				rowTaps(taps[2], pv, y);
+				float *const out[3] = { ovx[y], ovy[y], opv[y] };
+				const float *const centre[3] = { vx[y], vy[y], pv[y] };
+				blurRow(out, taps, centre, open, kernel, !scalarBlur);
+				for (int x=0; x<XRES/CELL; x++)
+				{
+					dx = ovx[y][x];
+					dy = ovy[y][x];
+					dp = opv[y][x];
+
+					tx = x - dx*advDistanceMult;
+					ty = y - dy*advDistanceMult;
+					if ((dx*advDistanceMult>1.0f || dy*advDistanceMult>1.0f) && (tx>=2 && tx<XRES/CELL-2 && ty>=2 && ty<YRES/CELL-2))
+					{
+						// Trying to take velocity from far away, check whether there is an intervening wall. Step from current position to desired source location, looking for walls, with either the x or y step size being 1 cell
+						if (std::abs(dx)>std::abs(dy))
 						{
-							f = kernel[i+1+(j+1)*3];
-							dx += vx[y+j][x+i]*f;
-							dy += vy[y+j][x+i]*f;
-							dp += pv[y+j][x+i]*f;
+							stepX = (dx<0.0f) ? 1 : -1;
+							stepY = -dy/fabsf(dx);
+							stepLimit = (int)(fabsf(dx*advDistanceMult));
 						}
 						else
 						{
-							f = kernel[i+1+(j+1)*3];
-							dx += vx[y][x]*f;
-							dy += vy[y][x]*f;
-							dp += pv[y][x]*f;
+							stepY = (dy<0.0f) ? 1 : -1;
+							stepX = -dx/fabsf(dy);
+							stepLimit = (int)(fabsf(dy*advDistanceMult));
 						}
-
-				tx = x - dx*advDistanceMult;
-				ty = y - dy*advDistanceMult;
-				if ((dx*advDistanceMult>1.0f || dy*advDistanceMult>1.0f) && (tx>=2 && tx<XRES/CELL-2 && ty>=2 && ty<YRES/CELL-2))
-				{
-					// Trying to take velocity from far away, check whether there is an intervening wall. Step from current position to desired source location, looking for walls, with either the x or y step size being 1 cell
-					if (std::abs(dx)>std::abs(dy))
-					{
-						stepX = (dx<0.0f) ? 1 : -1;
-						stepY = -dy/fabsf(dx);
-						stepLimit = (int)(fabsf(dx*advDistanceMult));
-					}
-					else
-					{
-						stepY = (dy<0.0f) ? 1 : -1;
-						stepX = -dx/fabsf(dy);
-						stepLimit = (int)(fabsf(dy*advDistanceMult));
-					}
-					tx = x;
-					ty = y;
-					for (step=0; step<stepLimit; ++step)
-					{
-						tx += stepX;
-						ty += stepY;
-						if (bmap_blockair[(int)(ty+0.5f)][(int)(tx+0.5f)])
+						tx = x;
+						ty = y;
+						for (step=0; step<stepLimit; ++step)
+						{
+							tx += stepX;
+							ty += stepY;
+							if (bmap_blockair[(int)(ty+0.5f)][(int)(tx+0.5f)])
+							{
+								tx -= stepX;
+								ty -= stepY;
+								break;
+							}
+						}
+						if (step==stepLimit)
 						{
-							tx -= stepX;
-							ty -= stepY;
-							break;
+							// No wall found
+							tx = x - dx*advDistanceMult;
+							ty = y - dy*advDistanceMult;
 						}
 					}
-					if (step==stepLimit)
+					i = (int)tx;
+					j = (int)ty;
+					tx -= i;
+					ty -= j;
+					if (!bmap_blockair[y][x] && i>=2 && i<=XRES/CELL-3 &&
+					        j>=2 && j<=YRES/CELL-3)
 					{
-						// No wall found
-						tx = x - dx*advDistanceMult;
-						ty = y - dy*advDistanceMult;
-					}
-				}
-				i = (int)tx;
-				j = (int)ty;
-				tx -= i;
-				ty -= j;
-				if (!bmap_blockair[y][x] && i>=2 && i<=XRES/CELL-3 &&
-				        j>=2 && j<=YRES/CELL-3)
-				{
-					dx *= 1.0f - AIR_VADV;
-					dy *= 1.0f - AIR_VADV;
+						dx *= 1.0f - AIR_VADV;
+						dy *= 1.0f - AIR_VADV;
 
-					dx += AIR_VADV*(1.0f-tx)*(1.0f-ty)*vx[j][i];
-					dy += AIR_VADV*(1.0f-tx)*(1.0f-ty)*vy[j][i];
+						dx += AIR_VADV*(1.0f-tx)*(1.0f-ty)*vx[j][i];
+						dy += AIR_VADV*(1.0f-tx)*(1.0f-ty)*vy[j][i];
 
-					dx += AIR_VADV*tx*(1.0f-ty)*vx[j][i+1];
-					dy += AIR_VADV*tx*(1.0f-ty)*vy[j][i+1];
+						dx += AIR_VADV*tx*(1.0f-ty)*vx[j][i+1];
+						dy += AIR_VADV*tx*(1.0f-ty)*vy[j][i+1];
 
-					dx += AIR_VADV*(1.0f-tx)*ty*vx[j+1][i];
-					dy += AIR_VADV*(1.0f-tx)*ty*vy[j+1][i];
+						dx += AIR_VADV*(1.0f-tx)*ty*vx[j+1][i];
+						dy += AIR_VADV*(1.0f-tx)*ty*vy[j+1][i];
 
-					dx += AIR_VADV*tx*ty*vx[j+1][i+1];
-					dy += AIR_VADV*tx*ty*vy[j+1][i+1];
-				}
+						dx += AIR_VADV*tx*ty*vx[j+1][i+1];
+						dy += AIR_VADV*tx*ty*vy[j+1][i+1];
+					}
 
-				if (bmap[y][x] == WL_FAN)
-				{
-					dx += fvx[y][x];
-					dy += fvy[y][x];
-				}
-				// pressure/velocity caps
-				if (dp > 256.0f) dp = 256.0f;
-				if (dp < -256.0f) dp = -256.0f;
-				if (dx > 256.0f) dx = 256.0f;
-				if (dx < -256.0f) dx = -256.0f;
-				if (dy > 256.0f) dy = 256.0f;
-				if (dy < -256.0f) dy = -256.0f;
+					if (bmap[y][x] == WL_FAN)
+					{
+						dx += fvx[y][x];
+						dy += fvy[y][x];
+					}
+					// pressure/velocity caps
+					if (dp > 256.0f) dp = 256.0f;
+					if (dp < -256.0f) dp = -256.0f;
+					if (dx > 256.0f) dx = 256.0f;
+					if (dx < -256.0f) dx = -256.0f;
+					if (dy > 256.0f) dy = 256.0f;
+					if (dy < -256.0f) dy = -256.0f;
 
 
-				switch (airMode)
-				{
-				default:
-				case 0:  //Default
-					break;
-				case 1:  //0 Pressure
-					dp = 0.0f;
-					break;
-				case 2:  //0 Velocity
-					dx = 0.0f;
-					dy = 0.0f;
-					break;
-				case 3: //0 Air
-					dx = 0.0f;
-					dy = 0.0f;
-					dp = 0.0f;
-					break;
-				case 4: //No Update
-					break;
-				}
+					switch (airMode)
+					{
+					default:
+					case 0:  //Default
+						break;
+					case 1:  //0 Pressure
+						dp = 0.0f;
+						break;
+					case 2:  //0 Velocity
+						dx = 0.0f;
+						dy = 0.0f;
+						break;
+					case 3: //0 Air
+						dx = 0.0f;
+						dy = 0.0f;
+						dp = 0.0f;
+						break;
+					case 4: //No Update
+						break;
+					}
 
-				ovx[y][x] = dx;
-				ovy[y][x] = dy;
-				opv[y][x] = dp;
+					ovx[y][x] = dx;
+					ovy[y][x] = dy;
+					opv[y][x] = dp;
+				}
 			}
+		});
 		memcpy(vx, ovx, sizeof(vx));
 		memcpy(vy, ovy, sizeof(vy));
 		memcpy(pv, opv, sizeof(pv));
@@ -373,7 +522,7 @@ void Air::RecalculateBlockAirMaps()
 			}
 		}
 		// mostly accurate insulator blocking, besides checking GEL
-		else if ((type == PT_HSWC && sim.parts[i].life != 10) || sim.elements[type].HeatConduct <= (random_gen()%250))
+		else if ((type == PT_HSWC && sim.parts[i].life != 10) || sim.elements[type].HeatConduct <= (RNG::Ref().gen()%250))
 		{
 			int x = ((int)(sim.parts[i].x+0.5f))/CELL, y = ((int)(sim.parts[i].y+0.5f))/CELL;
 			if (sim.InBounds(x, y) && !(bmap_blockairh[y][x]&0x8))
@@ -400,3 +549,103 @@ Air::Air(Simulation & simulation):
 	std::fill(&pv[0][0], &pv[0][0]+((XRES/CELL)*(YRES/CELL)), 0.0f);
 	std::fill(&opv[0][0], &opv[0][0]+((XRES/CELL)*(YRES/CELL)), 0.0f);
 }
+
+Air::~Air()
+{
+	SetPipelined(false);
+}
+
+void Air::SetPipelined(bool pipelined)
+{
+	if (pipelined == IsPipelined())
+		return;
+	if (pipelined)
+	{
+		pipeline = new AirPipeline();
+		pipeline->thread = std::thread([this]() { pipelineLoop(); });
+	}
+	else
+	{
+		EndPipelinedUpdate();
+		{
+			std::lock_guard<std::mutex> l(pipeline->mutex);
+			pipeline->stopping = true;
+		}
+		pipeline->cv.notify_all();
+		pipeline->thread.join();
+		delete pipeline;
+		pipeline = nullptr;
+	}
+}
+
+void Air::pipelineLoop()
+{
+	std::unique_lock<std::mutex> l(pipeline->mutex);
+	while (true)
+	{
+		pipeline->cv.wait(l, [this]() { return pipeline->stopping || pipeline->pending; });
+		if (pipeline->stopping)
+			return;
+		l.unlock();
+		// Particles are using the thread pool, this runs alongside them instead
+		updateAir(pipeline->state, nullptr, pipeline->bmap, pipeline->fvx, pipeline->fvy);
+		if (pipeline->updateHeat)
+			updateAirh(pipeline->state, nullptr);
+		l.lock();
+		pipeline->pending = false;
+		pipeline->cv.notify_all();
+	}
+}
+
+void Air::BeginPipelinedUpdate(bool updateHeat)
+{
+	if (!pipeline)
+		return;
+	EndPipelinedUpdate();
+	AirState &state = pipeline->state;
+	memcpy(state.vx, vx, sizeof(vx));
+	memcpy(state.vy, vy, sizeof(vy));
+	memcpy(state.pv, pv, sizeof(pv));
+	memcpy(state.hv, hv, sizeof(hv));
+	memcpy(state.bmap_blockair, bmap_blockair, sizeof(bmap_blockair));
+	memcpy(state.bmap_blockairh, bmap_blockairh, sizeof(bmap_blockairh));
+	memcpy(pipeline->base.vx, vx, sizeof(vx));
+	memcpy(pipeline->base.vy, vy, sizeof(vy));
+	memcpy(pipeline->base.pv, pv, sizeof(pv));
+	memcpy(pipeline->base.hv, hv, sizeof(hv));
+	memcpy(pipeline->bmap, bmap, sizeof(pipeline->bmap));
+	memcpy(pipeline->fvx, fvx, sizeof(pipeline->fvx));
+	memcpy(pipeline->fvy, fvy, sizeof(pipeline->fvy));
+	{
+		std::lock_guard<std::mutex> l(pipeline->mutex);
+		pipeline->updateHeat = updateHeat;
+		pipeline->pending = true;
+	}
+	pipeline->started = true;
+	pipeline->cv.notify_all();
+}
+
+// Waits for a pipelined update and merges it with the live air: each cell gets the new value plus whatever
+// the particles added to the old one since the update started
+void Air::EndPipelinedUpdate()
+{
+	if (!pipeline || !pipeline->started)
+		return;
+	{
+		std::unique_lock<std::mutex> l(pipeline->mutex);
+		pipeline->cv.wait(l, [this]() { return !pipeline->pending; });
+	}
+	pipeline->started = false;
+	AirState &state = pipeline->state, &base = pipeline->base;
+	for (int y = 0; y < YRES/CELL; y++)
+		for (int x = 0; x < XRES/CELL; x++)
+		{
+			vx[y][x] = state.vx[y][x] + (vx[y][x] - base.vx[y][x]);
+			vy[y][x] = state.vy[y][x] + (vy[y][x] - base.vy[y][x]);
+			pv[y][x] = state.pv[y][x] + (pv[y][x] - base.pv[y][x]);
+		}
+	if (pipeline->updateHeat)
+		for (int y = 0; y < YRES/CELL; y++)
+			for (int x = 0; x < XRES/CELL; x++)
+				hv[y][x] = state.hv[y][x] + (hv[y][x] - base.hv[y][x]);
+}
@@ -1,21 +1,17 @@
 #ifndef AIR_H
 #define AIR_H
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "Config.h"
 
 class Simulation;
+class ThreadPool;
 
-class Air
+// Everything the air and ambient heat update works on. Air holds the copy that particles use,
+// pipelined updates run on a second one
+struct AirState
 {
-public:
-	Simulation & sim;
-	int airMode;
-	float ambientAirTemp;
-	//Arrays from the simulation
-	unsigned char (*bmap)[XRES/CELL];
-	unsigned char (*emap)[XRES/CELL];
-	float (*fvx)[XRES/CELL];
-	float (*fvy)[XRES/CELL];
-	//
 	float vx[YRES/CELL][XRES/CELL];
 	float ovx[YRES/CELL][XRES/CELL];
 	float vy[YRES/CELL][XRES/CELL];
@@ -26,6 +22,48 @@ public:
 	float ohv[YRES/CELL][XRES/CELL]; // Ambient Heat
 	unsigned char bmap_blockair[YRES/CELL][XRES/CELL];
 	unsigned char bmap_blockairh[YRES/CELL][XRES/CELL];
+	float gvy[YRES/CELL][XRES/CELL]; // vy with the vertical gravity from ambient heat applied
+	int blurOpen[YRES/CELL+2][XRES/CELL+2]; // -1 for cells that can be used by the blur in update_air(h), with a border of closed (0) cells
+};
+
+// Copies used by a pipelined update, which runs on its own thread while particles are updated
+struct AirPipeline
+{
+	AirState state; // updated by the air thread
+	AirState base; // the air as it was when the update started, to find what particles changed
+	unsigned char bmap[YRES/CELL][XRES/CELL];
+	float fvx[YRES/CELL][XRES/CELL];
+	float fvy[YRES/CELL][XRES/CELL];
+	bool updateHeat = false;
+
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool pending = false; // set while the air thread is busy
+	bool stopping = false;
+	bool started = false; // only used by the main thread, set until the result is merged
+};
+
+class Air : public AirState
+{
+	AirPipeline *pipeline = nullptr;
+
+	void updateAir(AirState &s, ThreadPool *pool, unsigned char (*bmap)[XRES/CELL], float (*fvx)[XRES/CELL], float (*fvy)[XRES/CELL]);
+	void updateAirh(AirState &s, ThreadPool *pool);
+	void pipelineLoop();
+
+public:
+	Simulation & sim;
+	int airMode;
+	float ambientAirTemp;
+	//Arrays from the simulation
+	unsigned char (*bmap)[XRES/CELL];
+	unsigned char (*emap)[XRES/CELL];
+	float (*fvx)[XRES/CELL];
+	float (*fvy)[XRES/CELL];
+	//
+	ThreadPool *pool = nullptr; // row tiles of the update are spread over this if set
+	bool scalarBlur = false; // blur one cell at a time even where SSE2 is available, for comparing the two
 	float kernel[9];
 	void make_kernel(void);
 	void update_airh(void);
@@ -34,7 +72,18 @@ public:
 	void ClearAirH();
 	void Invert();
 	void RecalculateBlockAirMaps();
+	// Whether the blur in update_air(h) has a vectorised path in this build
+	static bool BlurVectorised();
+
+	// A pipelined update solves the air from a copy taken at the start of the frame while particles update,
+	// then adds whatever the particles changed in the meantime on top. It isn't frame-exact, so it's off by default
+	void SetPipelined(bool pipelined);
+	bool IsPipelined() { return pipeline != nullptr; }
+	void BeginPipelinedUpdate(bool updateHeat);
+	void EndPipelinedUpdate();
+
 	Air(Simulation & sim);
+	~Air();
 };
 
 #endif
@@ -0,0 +1,92 @@
+#ifndef ELEMENTPROFILER_H
+#define ELEMENTPROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "ElementDefs.h"
+
+// Counts calls to and time spent in each element's update and graphics functions
+// Does nothing but check a flag while disabled, counters are atomic since particles can be updated from several threads
+class ElementProfiler
+{
+public:
+	enum Kind
+	{
+		UPDATE,
+		LUA, // Lua update functions, the ones replacing or running alongside Update
+		GRAPHICS, // Graphics, or the Lua function replacing it
+		KIND_COUNT
+	};
+
+	struct Counter
+	{
+		std::atomic<uint64_t> calls;
+		std::atomic<uint64_t> nanoseconds;
+	};
+
+	bool enabled = false;
+	Counter counters[PT_NUM][KIND_COUNT];
+	std::atomic<uint64_t> simFrames; // frames simulated while enabled
+	std::atomic<uint64_t> renderFrames; // frames rendered while enabled
+
+	ElementProfiler()
+	{
+		Reset();
+	}
+
+	void Reset()
+	{
+		for (int t = 0; t < PT_NUM; t++)
+			for (int k = 0; k < KIND_COUNT; k++)
+			{
+				counters[t][k].calls = 0;
+				counters[t][k].nanoseconds = 0;
+			}
+		simFrames = 0;
+		renderFrames = 0;
+	}
+
+	void SetEnabled(bool newEnabled)
+	{
+		if (newEnabled && !enabled)
+			Reset();
+		enabled = newEnabled;
+	}
+
+	uint64_t Calls(int t, Kind kind) const
+	{
+		return counters[t][kind].calls.load(std::memory_order_relaxed);
+	}
+
+	uint64_t Nanoseconds(int t, Kind kind) const
+	{
+		return counters[t][kind].nanoseconds.load(std::memory_order_relaxed);
+	}
+
+	// Times its own lifetime and adds it to the element's counter
+	class Timer
+	{
+		Counter *counter;
+		std::chrono::steady_clock::time_point start;
+	public:
+		Timer(ElementProfiler &profiler, int t, Kind kind):
+			counter(profiler.enabled ? &profiler.counters[t][kind] : nullptr)
+		{
+			if (counter)
+				start = std::chrono::steady_clock::now();
+		}
+
+		~Timer()
+		{
+			if (counter)
+			{
+				auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+				counter->calls.fetch_add(1, std::memory_order_relaxed);
+				counter->nanoseconds.fetch_add(elapsed, std::memory_order_relaxed);
+			}
+		}
+	};
+};
+
+#endif /* ELEMENTPROFILER_H */
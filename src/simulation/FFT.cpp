@@ -0,0 +1,183 @@
+#include "FFT.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include "Config.h"
+
+static const int columnBatch = 8;
+
+static std::vector<int> bitReverse(int n)
+{
+	std::vector<int> reverse(n);
+	int bits = 0;
+	while ((1 << bits) < n)
+		bits++;
+	for (int i = 0; i < n; i++)
+	{
+		int r = 0;
+		for (int b = 0; b < bits; b++)
+			if (i & (1 << b))
+				r |= 1 << (bits - 1 - b);
+		reverse[i] = r;
+	}
+	return reverse;
+}
+
+FFT2D::FFT2D(int width, int height):
+	width(width),
+	height(height),
+	rowReverse(bitReverse(width)),
+	columnReverse(bitReverse(height)),
+	columnRe(height * columnBatch),
+	columnIm(height * columnBatch)
+{
+	int n = std::max(width, height);
+	twiddleRe.resize(n / 2);
+	twiddleIm.resize(n / 2);
+	for (int i = 0; i < n / 2; i++)
+	{
+		double angle = -2.0 * M_PI * i / n;
+		twiddleRe[i] = float(cos(angle));
+		twiddleIm[i] = float(sin(angle));
+	}
+}
+
+void FFT2D::transform(float *re, float *im, int n, const std::vector<int> &reverse, bool inverse)
+{
+	for (int i = 0; i < n; i++)
+	{
+		int r = reverse[i];
+		if (r > i)
+		{
+			std::swap(re[i], re[r]);
+			std::swap(im[i], im[r]);
+		}
+	}
+	int tableSize = int(twiddleRe.size()) * 2;
+	float sign = inverse ? -1.0f : 1.0f;
+	for (int size = 2; size <= n; size *= 2)
+	{
+		int half = size / 2;
+		int step = tableSize / size;
+		for (int start = 0; start < n; start += size)
+		{
+			for (int k = 0; k < half; k++)
+			{
+				float wr = twiddleRe[k * step];
+				float wi = sign * twiddleIm[k * step];
+				int a = start + k, b = a + half;
+				float tr = re[b] * wr - im[b] * wi;
+				float ti = re[b] * wi + im[b] * wr;
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+}
+
+void FFT2D::transformColumns(float *re, float *im, bool inverse)
+{
+	for (int x = 0; x < width; x += columnBatch)
+	{
+		int count = std::min(columnBatch, width - x);
+		for (int y = 0; y < height; y++)
+			for (int c = 0; c < count; c++)
+			{
+				columnRe[c * height + y] = re[y * width + x + c];
+				columnIm[c * height + y] = im[y * width + x + c];
+			}
+		for (int c = 0; c < count; c++)
+			transform(&columnRe[c * height], &columnIm[c * height], height, columnReverse, inverse);
+		for (int y = 0; y < height; y++)
+			for (int c = 0; c < count; c++)
+			{
+				re[y * width + x + c] = columnRe[c * height + y];
+				im[y * width + x + c] = columnIm[c * height + y];
+			}
+	}
+}
+
+void FFT2D::Forward(float *re, float *im, int rows)
+{
+	for (int y = 0; y < rows; y++)
+		transform(&re[y * width], &im[y * width], width, rowReverse, false);
+	transformColumns(re, im, false);
+}
+
+void FFT2D::Inverse(float *re, float *im, int rows)
+{
+	transformColumns(re, im, true);
+	for (int y = 0; y < rows; y++)
+		transform(&re[y * width], &im[y * width], width, rowReverse, true);
+}
+
+static int nextPowerOfTwo(int n)
+{
+	int p = 1;
+	while (p < n)
+		p *= 2;
+	return p;
+}
+
+// Large enough that the convolution doesn't wrap around, offsets between cells go from -(size-1) to size-1
+GravityConvolution::GravityConvolution():
+	fft(nextPowerOfTwo(XRES/CELL*2-1), nextPowerOfTwo(YRES/CELL*2-1))
+{
+	int xblock2 = fft.Width(), yblock2 = fft.Height();
+	pointRe.resize(xblock2 * yblock2);
+	pointIm.resize(xblock2 * yblock2);
+	bigRe.resize(xblock2 * yblock2);
+	bigIm.resize(xblock2 * yblock2);
+
+	//field caused by a point mass, x in the real part and y in the imaginary part, with negative offsets wrapped around
+	//scaling needed because the inverse transform isn't normalized
+	float scaleFactor = -M_GRAV/(xblock2*yblock2);
+	for (int y = -(YRES/CELL-1); y < YRES/CELL; y++)
+	{
+		for (int x = -(XRES/CELL-1); x < XRES/CELL; x++)
+		{
+			if (x == 0 && y == 0)
+				continue;
+			float distance = sqrtf(float(x*x + y*y));
+			int i = ((y + yblock2) % yblock2) * xblock2 + (x + xblock2) % xblock2;
+			pointRe[i] = scaleFactor * x / (distance * distance * distance);
+			pointIm[i] = scaleFactor * y / (distance * distance * distance);
+		}
+	}
+	fft.Forward(&pointRe[0], &pointIm[0], yblock2);
+}
+
+void GravityConvolution::Calculate(const float *masses, float *fieldX, float *fieldY)
+{
+	int xblock2 = fft.Width(), yblock2 = fft.Height();
+	float mr, mc, pr, pc;
+	//copy the masses into the corner of the padded array
+	std::fill(bigRe.begin(), bigRe.end(), 0.0f);
+	std::fill(bigIm.begin(), bigIm.end(), 0.0f);
+	for (int y = 0; y < YRES / CELL; y++)
+	{
+		std::copy(&masses[y*(XRES/CELL)], &masses[(y+1)*(XRES/CELL)], &bigRe[y*xblock2]);
+	}
+	//transform the masses, rows below the map are all zero
+	fft.Forward(&bigRe[0], &bigIm[0], YRES / CELL);
+	//do convolution (multiply the complex numbers)
+	for (int i = 0; i < xblock2 * yblock2; i++)
+	{
+		mr = bigRe[i];
+		mc = bigIm[i];
+		pr = pointRe[i];
+		pc = pointIm[i];
+		bigRe[i] = mr*pr-mc*pc;
+		bigIm[i] = mr*pc+mc*pr;
+	}
+	//inverse transform, only the rows covering the map are needed
+	fft.Inverse(&bigRe[0], &bigIm[0], YRES / CELL);
+	for (int y = 0; y < YRES / CELL; y++)
+	{
+		std::copy(&bigRe[y*xblock2], &bigRe[y*xblock2+XRES/CELL], &fieldX[y*(XRES/CELL)]);
+		std::copy(&bigIm[y*xblock2], &bigIm[y*xblock2+XRES/CELL], &fieldY[y*(XRES/CELL)]);
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <vector>
+
+// Radix-2 complex FFT over the rows and columns of a 2D array, used for gravity in builds without FFTW.
+// Real and imaginary parts are kept in separate arrays of width*height floats, both sizes must be powers of two.
+// Neither direction is normalized, so a round trip scales everything by width*height
+class FFT2D
+{
+	int width, height;
+	std::vector<float> twiddleRe, twiddleIm; // for the larger of the two sizes
+	std::vector<int> rowReverse, columnReverse;
+	std::vector<float> columnRe, columnIm; // a few columns at a time, copied out to be contiguous
+
+	void transform(float *re, float *im, int n, const std::vector<int> &reverse, bool inverse);
+	void transformColumns(float *re, float *im, bool inverse);
+
+public:
+	FFT2D(int width, int height);
+
+	// Only the first rows rows are transformed along x, the rest of the input must be zero
+	void Forward(float *re, float *im, int rows);
+	// Only the first rows rows are transformed back along x, the rest of the output is left unfinished
+	void Inverse(float *re, float *im, int rows);
+
+	int Width() const { return width; }
+	int Height() const { return height; }
+};
+
+// The gravity field of a (XRES/CELL)*(YRES/CELL) map of masses, found by convolving the map with the field of a
+// single point mass using FFT2D. The x and y fields are found together, as the real and imaginary parts of one
+// complex convolution. This is how gravity is calculated in builds without FFTW
+class GravityConvolution
+{
+	FFT2D fft;
+	std::vector<float> pointRe, pointIm; // transformed field of a point mass
+	std::vector<float> bigRe, bigIm;
+
+public:
+	GravityConvolution();
+
+	// All three are (XRES/CELL)*(YRES/CELL) maps
+	void Calculate(const float *masses, float *fieldX, float *fieldY);
+};
+
+#endif /* FFT_H */
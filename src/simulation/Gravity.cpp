@@ -1,5 +1,6 @@
 #include "Gravity.h"
 
+#include <chrono>
 #include <cmath>
 #include <iostream>
 #include <sys/types.h>
@@ -10,7 +11,16 @@
 #include "SimulationData.h"
 
 
-Gravity::Gravity()
+#ifdef GRAVFFT
+// Saved next to powder.pref, so that plans only have to be measured on the first launch
+static const char *wisdomFile = "fftw.wisdom";
+#endif
+
+Gravity::Gravity():
+	planTime(0),
+	updateTime(0),
+	fftThreads(1),
+	wisdomLoaded(false)
 {
 	// Allocate full size Gravmaps
 	unsigned int size = (XRES / CELL) * (YRES / CELL);
@@ -29,9 +39,7 @@ Gravity::Gravity()
 Gravity::~Gravity()
 {
 	stop_grav_async();
-#ifdef GRAVFFT
 	grav_fft_cleanup();
-#endif
 
 	delete[] th_ogravmap;
 	delete[] th_gravmap;
@@ -67,6 +75,21 @@ void Gravity::grav_fft_init()
 	fftwf_plan plan_ptgravx, plan_ptgravy;
 	if (grav_fft_status) return;
 
+#ifdef GRAVFFT_THREADS
+	// Bigger grids gain from a few threads, more than that mostly adds synchronization
+	static bool threadsInitialized = false;
+	if (!threadsInitialized)
+		threadsInitialized = fftwf_init_threads() != 0;
+	int threads = std::min(std::max(int(std::thread::hardware_concurrency()), 1), 4);
+	if (threadsInitialized)
+	{
+		fftwf_plan_with_nthreads(threads);
+		fftThreads = threads;
+	}
+#endif
+	// Plans for the same sizes and thread count are then created without measuring
+	wisdomLoaded = fftwf_import_wisdom_from_filename(wisdomFile) != 0;
+
 	//use fftw malloc function to ensure arrays are aligned, to get better performance
 	th_ptgravx = reinterpret_cast<float*>(fftwf_malloc(xblock2 * yblock2 * sizeof(float)));
 	th_ptgravy = reinterpret_cast<float*>(fftwf_malloc(xblock2 * yblock2 * sizeof(float)));
@@ -85,6 +108,7 @@ void Gravity::grav_fft_init()
 	plan_gravmap = fftwf_plan_dft_r2c_2d(yblock2, xblock2, th_gravmapbig, th_gravmapbigt, FFTW_MEASURE);
 	plan_gravx_inverse = fftwf_plan_dft_c2r_2d(yblock2, xblock2, th_gravxbigt, th_gravxbig, FFTW_MEASURE);
 	plan_gravy_inverse = fftwf_plan_dft_c2r_2d(yblock2, xblock2, th_gravybigt, th_gravybig, FFTW_MEASURE);
+	fftwf_export_wisdom_to_filename(wisdomFile);
 
 	//(XRES/CELL)*(YRES/CELL)*4 is size of data array, scaling needed because FFTW calculates an unnormalized DFT
 	scaleFactor = -M_GRAV/((XRES/CELL)*(YRES/CELL)*4);
@@ -133,6 +157,20 @@ void Gravity::grav_fft_cleanup()
 	fftwf_destroy_plan(plan_gravy_inverse);
 	grav_fft_status = false;
 }
+#else
+void Gravity::grav_fft_init()
+{
+	if (grav_fft_status) return;
+	grav_fft = new GravityConvolution();
+	grav_fft_status = true;
+}
+
+void Gravity::grav_fft_cleanup()
+{
+	if (!grav_fft_status) return;
+	delete grav_fft;
+	grav_fft_status = false;
+}
 #endif
 
 void Gravity::gravity_update_async()
@@ -152,16 +190,10 @@ void Gravity::gravity_update_async()
 			{
 				if (th_gravchanged && !ignoreNextResult)
 				{
-#if !defined(GRAVFFT) && defined(GRAV_DIFF)
-					memcpy(gravy, th_gravy, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-					memcpy(gravx, th_gravx, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-					memcpy(gravp, th_gravp, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-#else
 					// Copy thread gravity maps into this one
 					std::swap(gravy, th_gravy);
 					std::swap(gravx, th_gravx);
 					std::swap(gravp, th_gravp);
-#endif
 				}
 				ignoreNextResult = false;
 
@@ -194,10 +226,12 @@ void Gravity::update_grav_async()
 	std::fill(&th_gravx[0], &th_gravx[size], 0.0f);
 	std::fill(&th_gravp[0], &th_gravp[size], 0.0f);
 
-#ifdef GRAVFFT
 	if (!grav_fft_status)
+	{
+		auto start = std::chrono::steady_clock::now();
 		grav_fft_init();
-#endif
+		planTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
 
 	std::unique_lock<std::mutex> l(gravmutex);
 	while (!thread_done)
@@ -205,7 +239,10 @@ void Gravity::update_grav_async()
 		if (!done)
 		{
 			// run gravity update
+			auto start = std::chrono::steady_clock::now();
 			update_grav();
+			if (th_gravchanged)
+				updateTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
 			done = 1;
 			grav_ready = 1;
 			thread_done = gravthread_done;
@@ -319,63 +356,27 @@ void Gravity::update_grav()
 }
 
 #else
-// gravity without fast Fourier transforms
-
-void Gravity::update_grav(void)
+// gravity without FFTW, using the built in FFT
+void Gravity::update_grav()
 {
-	int x, y, i, j, changed = 0;
-	float val, distance;
-	th_gravchanged = 0;
-#ifndef GRAV_DIFF
-	//Find any changed cells
-	for (i=0; i<YRES/CELL; i++)
+	if (memcmp(th_ogravmap, th_gravmap, sizeof(float)*(XRES/CELL)*(YRES/CELL)) != 0)
 	{
-		if(changed)
-			break;
-		for (j=0; j<XRES/CELL; j++)
+		th_gravchanged = 1;
+
+		membwand(th_gravmap, gravmask, (XRES/CELL)*(YRES/CELL)*sizeof(float), (XRES/CELL)*(YRES/CELL)*sizeof(unsigned));
+		grav_fft->Calculate(th_gravmap, th_gravx, th_gravy);
+		for (int i = 0; i < (XRES/CELL)*(YRES/CELL); i++)
 		{
-			if(th_ogravmap[i*(XRES/CELL)+j]!=th_gravmap[i*(XRES/CELL)+j]){
-				changed = 1;
-				break;
-			}
+			th_gravp[i] = sqrtf(th_gravx[i]*th_gravx[i] + th_gravy[i]*th_gravy[i]);
 		}
 	}
-	if(!changed)
-		goto fin;
-	memset(th_gravy, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-	memset(th_gravx, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-#endif
-	th_gravchanged = 1;
-	membwand(th_gravmap, gravmask, (XRES/CELL)*(YRES/CELL)*sizeof(float), (XRES/CELL)*(YRES/CELL)*sizeof(unsigned));
-	for (i = 0; i < YRES / CELL; i++) {
-		for (j = 0; j < XRES / CELL; j++) {
-#ifdef GRAV_DIFF
-			if (th_ogravmap[i*(XRES/CELL)+j] != th_gravmap[i*(XRES/CELL)+j])
-			{
-#else
-			if (th_gravmap[i*(XRES/CELL)+j] > 0.0001f || th_gravmap[i*(XRES/CELL)+j]<-0.0001f) //Only calculate with populated or changed cells.
-			{
-#endif
-				for (y = 0; y < YRES / CELL; y++) {
-					for (x = 0; x < XRES / CELL; x++) {
-						if (x == j && y == i)//Ensure it doesn't calculate with itself
-							continue;
-						distance = sqrt(pow(j - x, 2.0f) + pow(i - y, 2.0f));
-#ifdef GRAV_DIFF
-						val = th_gravmap[i*(XRES/CELL)+j] - th_ogravmap[i*(XRES/CELL)+j];
-#else
-						val = th_gravmap[i*(XRES/CELL)+j];
-#endif
-						th_gravx[y*(XRES/CELL)+x] += M_GRAV * val * (j - x) / pow(distance, 3.0f);
-						th_gravy[y*(XRES/CELL)+x] += M_GRAV * val * (i - y) / pow(distance, 3.0f);
-						th_gravp[y*(XRES/CELL)+x] += M_GRAV * val / pow(distance, 2.0f);
-					}
-				}
-			}
-		}
+	else
+	{
+		th_gravchanged = 0;
 	}
-fin:
-	memcpy(th_ogravmap, th_gravmap, (XRES/CELL)*(YRES/CELL)*sizeof(float));
+
+	// Copy th_ogravmap into th_gravmap (doesn't matter what th_ogravmap is afterwards)
+	std::swap(th_gravmap, th_ogravmap);
 }
 #endif
 
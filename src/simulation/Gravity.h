@@ -1,6 +1,7 @@
 #ifndef GRAVITY_H
 #define GRAVITY_H
 
+#include <atomic>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
@@ -8,6 +9,8 @@
 
 #ifdef GRAVFFT
 #include <fftw3.h>
+#else
+#include "FFT.h"
 #endif
 
 class Simulation;
@@ -34,8 +37,8 @@ private:
 	int gravthread_done = 0;
 	bool ignoreNextResult = false;
 
-#ifdef GRAVFFT
 	bool grav_fft_status = false;
+#ifdef GRAVFFT
 	float *th_ptgravx = nullptr;
 	float *th_ptgravy = nullptr;
 	float *th_gravmapbig = nullptr;
@@ -44,6 +47,8 @@ private:
 
 	fftwf_complex *th_ptgravxt, *th_ptgravyt, *th_gravmapbigt, *th_gravxbigt, *th_gravybigt;
 	fftwf_plan plan_gravmap, plan_gravx_inverse, plan_gravy_inverse;
+#else
+	GravityConvolution *grav_fft = nullptr;
 #endif
 
 	struct mask_el {
@@ -59,11 +64,8 @@ private:
 	void update_grav();
 	void update_grav_async();
 
-
-#ifdef GRAVFFT
 	void grav_fft_init();
 	void grav_fft_cleanup();
-#endif
 
 public:
 	//Maps to be used by the main thread
@@ -75,6 +77,12 @@ public:
 
 	unsigned char (*bmap)[XRES/CELL];
 
+	// Written by the gravity thread, for the debug overlay
+	std::atomic<float> planTime; // ms spent setting up the transforms when gravity was last turned on
+	std::atomic<float> updateTime; // ms taken by the last update that recalculated the field
+	std::atomic<int> fftThreads; // threads used by each transform
+	std::atomic<bool> wisdomLoaded; // FFTW plans came from saved wisdom rather than being measured
+
 	bool IsEnabled() { return enabled; }
 
 	void Clear();
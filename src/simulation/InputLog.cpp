@@ -0,0 +1,773 @@
+#include "InputLog.h"
+
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+
+#include "Simulation.h"
+#include "Snapshot.h"
+#include "Air.h"
+#include "Gravity.h"
+#include "gui/game/BitmapBrush.h"
+
+// Serialised logs are "TPTInLog", the format version and the size of the zlib compressed data that follows
+static const char logMagic[] = "TPTInLog";
+static const unsigned int logVersion = 1;
+// Largest uncompressed log that is written or read, the size in a log's header isn't trusted beyond this
+static const size_t maxLogSize = 1024*1024*1024;
+// Deflate can't expand data by more than this, a larger size in the header means the log is broken
+static const size_t maxCompressionRatio = 1032;
+static const size_t blockMapSize = (XRES/CELL)*(YRES/CELL);
+
+InputLog::Scope::Scope(InputLog *log, int type, std::initializer_list<int> args, Brush *brush, float strength):
+	log(log)
+{
+	if (!log)
+		return;
+	if (log->mode == RECORDING && !log->depth)
+		log->record(type, args, brush, strength);
+	log->depth++;
+}
+
+InputLog::Scope::Scope(InputLog *log):
+	log(log)
+{
+	if (log)
+		log->depth++;
+}
+
+InputLog::Scope::~Scope()
+{
+	if (log)
+		log->depth--;
+}
+
+InputLog::InputLog():
+	mode(STOPPED),
+	tick(0),
+	keyframeInterval(300),
+	changed(false),
+	pending(false),
+	depth(0),
+	sim(nullptr)
+{
+	std::fill(settings, settings+SETTING_COUNT, 0);
+}
+
+InputLog::~InputLog()
+{
+	clear();
+}
+
+void InputLog::clear()
+{
+	for (auto &keyframe : keyframes)
+		delete keyframe.second.snap;
+	keyframes.clear();
+	for (auto brush : brushObjects)
+		delete brush;
+	brushObjects.clear();
+	brushes.clear();
+	actions.clear();
+}
+
+unsigned int InputLog::GetEndTick()
+{
+	unsigned int end = 0;
+	if (actions.size())
+		end = actions.back().tick;
+	if (keyframes.size())
+		end = std::max(end, keyframes.rbegin()->first);
+	return end;
+}
+
+void InputLog::Record(Simulation &newSim, unsigned int newKeyframeInterval)
+{
+	clear();
+	sim = &newSim;
+	mode = RECORDING;
+	tick = 0;
+	keyframeInterval = std::max(newKeyframeInterval, 1U);
+	changed = false;
+	pending = false;
+	sim->deterministic = true;
+	takeKeyframe(true);
+}
+
+void InputLog::Stop()
+{
+	mode = STOPPED;
+	changed = false;
+	pending = false;
+}
+
+bool InputLog::Seek(Simulation &newSim, unsigned int newTick)
+{
+	if (keyframes.empty())
+		return false;
+	sim = &newSim;
+	auto keyframe = --keyframes.upper_bound(newTick);
+
+	depth++;
+	int sysPause = sim->sys_pause, frameRender = sim->framerender;
+	sim->sys_pause = 0;
+	sim->framerender = 0;
+	restoreKeyframe(keyframe->second);
+	tick = keyframe->first;
+	applyActions(tick, keyframe->second.actionIndex);
+	while (tick < newTick)
+	{
+		simulateTick();
+		tick++;
+		applyTick(tick);
+	}
+	sim->sys_pause = sysPause;
+	sim->framerender = frameRender;
+	depth--;
+
+	changed = false;
+	pending = false;
+	if (mode == RECORDING)
+	{
+		truncate(tick);
+		for (int s = 0; s < SETTING_COUNT; s++)
+			settings[s] = getSetting(*sim, s);
+	}
+	else
+		mode = PLAYING;
+	return true;
+}
+
+void InputLog::BeforeStep(Simulation &stepSim)
+{
+	if (depth || &stepSim != sim)
+		return;
+	if (mode == RECORDING)
+	{
+		recordSettings();
+		if (changed)
+			takeKeyframe(true);
+		else if (!(tick%keyframeInterval))
+			takeKeyframe(false);
+		changed = false;
+		tick++;
+	}
+	else if (mode == PLAYING)
+	{
+		if (pending)
+		{
+			depth++;
+			applyTick(tick);
+			depth--;
+		}
+		if (tick >= GetEndTick())
+		{
+			Stop();
+			return;
+		}
+		tick++;
+		pending = true;
+	}
+}
+
+void InputLog::Changed()
+{
+	if (mode == RECORDING && !depth)
+		changed = true;
+}
+
+int InputLog::addBrush(Brush *brush)
+{
+	if (!brush)
+		return -1;
+	BrushData data;
+	data.radiusX = brush->GetRadius().X;
+	data.radiusY = brush->GetRadius().Y;
+	unsigned char *bitmap = brush->GetBitmap();
+	data.bitmap.assign(bitmap, bitmap+brush->GetSize().X*brush->GetSize().Y);
+	// The same few brushes are used over and over, most likely the one used last
+	for (int i = int(brushes.size())-1; i >= 0; i--)
+		if (brushes[i].radiusX == data.radiusX && brushes[i].radiusY == data.radiusY && brushes[i].bitmap == data.bitmap)
+			return i;
+	brushes.push_back(data);
+	return int(brushes.size())-1;
+}
+
+Brush *InputLog::getBrush(int index)
+{
+	if (index < 0)
+		return nullptr;
+	if (brushObjects.size() < brushes.size())
+		brushObjects.resize(brushes.size(), nullptr);
+	if (!brushObjects[index])
+	{
+		BrushData &data = brushes[index];
+		brushObjects[index] = new BitmapBrush(data.bitmap, ui::Point(data.radiusX*2+1, data.radiusY*2+1));
+	}
+	return brushObjects[index];
+}
+
+void InputLog::recordSettings()
+{
+	for (int s = 0; s < SETTING_COUNT; s++)
+	{
+		int value = getSetting(*sim, s);
+		if (value != settings[s])
+		{
+			Action action = {};
+			action.tick = tick;
+			action.type = SETTING;
+			action.args[0] = s;
+			action.args[1] = value;
+			action.brush = -1;
+			actions.push_back(action);
+			settings[s] = value;
+		}
+	}
+}
+
+void InputLog::record(int type, std::initializer_list<int> args, Brush *brush, float strength)
+{
+	recordSettings();
+	Action action = {};
+	action.tick = tick;
+	action.type = type;
+	std::copy(args.begin(), args.begin()+std::min(int(args.size()), maxArgs), action.args);
+	action.strength = strength;
+	action.brush = addBrush(brush);
+	actions.push_back(action);
+}
+
+void InputLog::takeKeyframe(bool forced)
+{
+	depth++;
+	Keyframe keyframe;
+	keyframe.snap = sim->CreateSnapshot();
+	keyframe.forced = forced;
+	keyframe.actionIndex = actions.size();
+	keyframe.currentTick = sim->currentTick;
+	keyframe.empDecor = sim->emp_decor;
+	keyframe.lightningRecreate = sim->lightningRecreate;
+	keyframe.sandcolour = sim->sandcolour;
+	keyframe.sandcolourFrame = sim->sandcolour_frame;
+	keyframe.blockAir.assign(&sim->air->bmap_blockair[0][0], &sim->air->bmap_blockair[0][0]+blockMapSize);
+	keyframe.blockAirH.assign(&sim->air->bmap_blockairh[0][0], &sim->air->bmap_blockairh[0][0]+blockMapSize);
+	for (int s = 0; s < SETTING_COUNT; s++)
+		settings[s] = keyframe.settings[s] = getSetting(*sim, s);
+	// Restoring a snapshot rebuilds the free particle list and some of the maps, which a run that starts from the
+	// keyframe will have done, so this one does it too
+	sim->Restore(*keyframe.snap);
+	depth--;
+
+	auto existing = keyframes.find(tick);
+	if (existing != keyframes.end())
+	{
+		keyframe.forced |= existing->second.forced;
+		delete existing->second.snap;
+		existing->second = keyframe;
+	}
+	else
+		keyframes[tick] = keyframe;
+}
+
+void InputLog::restoreKeyframe(const Keyframe &keyframe)
+{
+	// Settings first, Newtonian gravity has to be running for its maps to be restored
+	for (int s = 0; s < SETTING_COUNT; s++)
+		setSetting(*sim, s, keyframe.settings[s], true);
+	sim->deterministic = true;
+	sim->Restore(*keyframe.snap);
+	sim->currentTick = keyframe.currentTick;
+	sim->emp_decor = keyframe.empDecor;
+	sim->lightningRecreate = keyframe.lightningRecreate;
+	sim->sandcolour = keyframe.sandcolour;
+	sim->sandcolour_frame = keyframe.sandcolourFrame;
+	std::copy(keyframe.blockAir.begin(), keyframe.blockAir.end(), &sim->air->bmap_blockair[0][0]);
+	std::copy(keyframe.blockAirH.begin(), keyframe.blockAirH.end(), &sim->air->bmap_blockairh[0][0]);
+}
+
+static bool actionTickLess(const InputLog::Action &a, const InputLog::Action &b)
+{
+	return a.tick < b.tick;
+}
+
+void InputLog::applyActions(unsigned int actionTick, size_t from)
+{
+	Action key = {};
+	key.tick = actionTick;
+	auto range = std::equal_range(actions.begin()+std::min(from, actions.size()), actions.end(), key, actionTickLess);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		const Action &action = *it;
+		const int *a = action.args;
+		Brush *brush = getBrush(action.brush);
+		switch (action.type)
+		{
+		case CREATE_PARTS:
+			sim->CreateParts(a[0], a[1], a[2], brush, a[3]);
+			break;
+		case CREATE_PARTS_RADIUS:
+			sim->CreateParts(a[0], a[1], a[2], a[3], a[4], a[5]);
+			break;
+		case CREATE_LINE:
+			sim->CreateLine(a[0], a[1], a[2], a[3], a[4], brush, a[5]);
+			break;
+		case CREATE_BOX:
+			sim->CreateBox(a[0], a[1], a[2], a[3], a[4], a[5]);
+			break;
+		case FLOOD_PARTS:
+			sim->FloodParts(a[0], a[1], a[2], a[3], a[4]);
+			break;
+		case CREATE_WALLS:
+			sim->CreateWalls(a[0], a[1], a[2], a[3], a[4], brush);
+			break;
+		case CREATE_WALL_LINE:
+			sim->CreateWallLine(a[0], a[1], a[2], a[3], a[4], a[5], a[6], brush);
+			break;
+		case CREATE_WALL_BOX:
+			sim->CreateWallBox(a[0], a[1], a[2], a[3], a[4]);
+			break;
+		case FLOOD_WALLS:
+			sim->FloodWalls(a[0], a[1], a[2], a[3]);
+			break;
+		case TOOL_BRUSH:
+			sim->ToolBrush(a[0], a[1], a[2], brush, action.strength);
+			break;
+		case TOOL_LINE:
+			sim->ToolLine(a[0], a[1], a[2], a[3], a[4], brush, action.strength);
+			break;
+		case TOOL_BOX:
+			sim->ToolBox(a[0], a[1], a[2], a[3], a[4], action.strength);
+			break;
+		case DECO_POINT:
+			sim->ApplyDecorationPoint(a[0], a[1], a[2], a[3], a[4], a[5], a[6], brush);
+			break;
+		case DECO_LINE:
+			sim->ApplyDecorationLine(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8], brush);
+			break;
+		case DECO_BOX:
+			sim->ApplyDecorationBox(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8]);
+			break;
+		case SETTING:
+			setSetting(*sim, a[0], a[1], false);
+			break;
+		}
+	}
+}
+
+// Brings the simulation up to date with what was recorded after the step that led to this tick, in the same order
+// it happened while recording
+void InputLog::applyTick(unsigned int applyTick)
+{
+	auto keyframe = keyframes.find(applyTick);
+	if (keyframe != keyframes.end() && keyframe->second.forced)
+	{
+		restoreKeyframe(keyframe->second);
+		applyActions(applyTick, keyframe->second.actionIndex);
+		return;
+	}
+
+	applyActions(applyTick, 0);
+	if (!(applyTick%keyframeInterval))
+	{
+		if (keyframe != keyframes.end())
+			restoreKeyframe(keyframe->second);
+		else
+			takeKeyframe(false);
+	}
+}
+
+void InputLog::simulateTick()
+{
+	sim->BeforeSim();
+	sim->UpdateParticles(0, NPART);
+	sim->AfterSim();
+}
+
+void InputLog::truncate(unsigned int endTick)
+{
+	Action key = {};
+	key.tick = endTick;
+	actions.erase(std::upper_bound(actions.begin(), actions.end(), key, actionTickLess), actions.end());
+	for (auto it = keyframes.upper_bound(endTick); it != keyframes.end(); )
+	{
+		delete it->second.snap;
+		it = keyframes.erase(it);
+	}
+}
+
+int InputLog::getSetting(Simulation &sim, int setting)
+{
+	switch (setting)
+	{
+	case GRAVITY_MODE:
+		return sim.gravityMode;
+	case AIR_MODE:
+		return sim.air->airMode;
+	case EDGE_MODE:
+		return sim.edgeMode;
+	case LEGACY_ENABLE:
+		return sim.legacy_enable;
+	case AHEAT_ENABLE:
+		return sim.aheat_enable;
+	case WATER_EQUAL:
+		return sim.water_equal_test;
+	case NEWTONIAN_GRAVITY:
+		return sim.grav->IsEnabled();
+	case AMBIENT_AIR_TEMP:
+	{
+		int bits;
+		memcpy(&bits, &sim.air->ambientAirTemp, sizeof(bits));
+		return bits;
+	}
+	case REPLACE_MODE_SELECTED:
+		return sim.replaceModeSelected;
+	case REPLACE_MODE_FLAGS:
+		return sim.replaceModeFlags;
+	case RANDOM_SEED:
+		return int(sim.randomSeed);
+	case PRETTY_POWDER:
+		return sim.pretty_powder;
+	case GSPEED:
+		return sim.GSPEED;
+	case DECO_SPACE:
+		return sim.deco_space;
+	}
+	return 0;
+}
+
+void InputLog::setSetting(Simulation &sim, int setting, int value, bool restoring)
+{
+	switch (setting)
+	{
+	case GRAVITY_MODE:
+		sim.gravityMode = value;
+		break;
+	case AIR_MODE:
+		sim.air->airMode = value;
+		break;
+	case EDGE_MODE:
+		if (restoring)
+			sim.edgeMode = value;
+		else
+			sim.SetEdgeMode(value);
+		break;
+	case LEGACY_ENABLE:
+		sim.legacy_enable = value;
+		break;
+	case AHEAT_ENABLE:
+		sim.aheat_enable = value;
+		break;
+	case WATER_EQUAL:
+		sim.water_equal_test = value;
+		break;
+	case NEWTONIAN_GRAVITY:
+		if (value && !sim.grav->IsEnabled())
+			sim.grav->start_grav_async();
+		else if (!value && sim.grav->IsEnabled())
+			sim.grav->stop_grav_async();
+		break;
+	case AMBIENT_AIR_TEMP:
+		memcpy(&sim.air->ambientAirTemp, &value, sizeof(value));
+		break;
+	case REPLACE_MODE_SELECTED:
+		sim.replaceModeSelected = value;
+		break;
+	case REPLACE_MODE_FLAGS:
+		sim.replaceModeFlags = value;
+		break;
+	case RANDOM_SEED:
+		sim.randomSeed = (unsigned int)value;
+		break;
+	case PRETTY_POWDER:
+		sim.pretty_powder = value;
+		break;
+	case GSPEED:
+		sim.GSPEED = value;
+		break;
+	case DECO_SPACE:
+		sim.SetDecoSpace(value);
+		break;
+	}
+}
+
+namespace
+{
+	class Writer
+	{
+	public:
+		std::vector<unsigned char> data;
+
+		template<class T>
+		void Put(const T &value)
+		{
+			const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&value);
+			data.insert(data.end(), bytes, bytes+sizeof(T));
+		}
+
+		// Arrays of plain structs are stored as they are in memory, so a log is only meant to be read by the same build
+		template<class T>
+		void PutVector(const std::vector<T> &values)
+		{
+			Put(uint32_t(values.size()));
+			const unsigned char *bytes = reinterpret_cast<const unsigned char *>(values.data());
+			data.insert(data.end(), bytes, bytes+values.size()*sizeof(T));
+		}
+
+		void PutString(const ByteString &value)
+		{
+			Put(uint32_t(value.size()));
+			data.insert(data.end(), value.begin(), value.end());
+		}
+	};
+
+	class Reader
+	{
+		const unsigned char *data;
+		size_t size;
+		size_t pos;
+	public:
+		bool ok;
+
+		Reader(const std::vector<unsigned char> &data):
+			data(data.data()),
+			size(data.size()),
+			pos(0),
+			ok(true)
+		{
+		}
+
+		template<class T>
+		T Get()
+		{
+			T value = T();
+			if (!ok || size-pos < sizeof(T))
+			{
+				ok = false;
+				return value;
+			}
+			memcpy(&value, data+pos, sizeof(T));
+			pos += sizeof(T);
+			return value;
+		}
+
+		template<class T>
+		void GetVector(std::vector<T> &values, size_t maxSize)
+		{
+			uint32_t count = Get<uint32_t>();
+			if (!ok || count > maxSize || (size-pos)/sizeof(T) < count)
+			{
+				ok = false;
+				return;
+			}
+			values.resize(count);
+			if (count)
+				memcpy(&values[0], data+pos, count*sizeof(T));
+			pos += count*sizeof(T);
+		}
+
+		ByteString GetString()
+		{
+			uint32_t length = Get<uint32_t>();
+			if (!ok || size-pos < length)
+			{
+				ok = false;
+				return ByteString();
+			}
+			ByteString value(data+pos, data+pos+length);
+			pos += length;
+			return value;
+		}
+	};
+}
+
+std::vector<unsigned char> InputLog::Serialise()
+{
+	Writer w;
+	w.Put(uint32_t(keyframeInterval));
+	w.Put(uint32_t(brushes.size()));
+	for (auto &brush : brushes)
+	{
+		w.Put(int32_t(brush.radiusX));
+		w.Put(int32_t(brush.radiusY));
+		w.PutVector(brush.bitmap);
+	}
+	w.PutVector(actions);
+
+	uint32_t forcedCount = 0;
+	for (auto &keyframe : keyframes)
+		forcedCount += keyframe.second.forced;
+	w.Put(forcedCount);
+	for (auto &entry : keyframes)
+	{
+		Keyframe &keyframe = entry.second;
+		if (!keyframe.forced)
+			continue;
+		Snapshot &snap = *keyframe.snap;
+		w.Put(uint32_t(entry.first));
+		w.Put(uint32_t(keyframe.actionIndex));
+		w.Put(int32_t(keyframe.currentTick));
+		w.Put(int32_t(keyframe.empDecor));
+		w.Put(int32_t(keyframe.lightningRecreate));
+		w.Put(int32_t(keyframe.sandcolour));
+		w.Put(int32_t(keyframe.sandcolourFrame));
+		w.PutVector(keyframe.blockAir);
+		w.PutVector(keyframe.blockAirH);
+		for (int s = 0; s < SETTING_COUNT; s++)
+			w.Put(int32_t(keyframe.settings[s]));
+		w.PutVector(snap.AirPressure);
+		w.PutVector(snap.AirVelocityX);
+		w.PutVector(snap.AirVelocityY);
+		w.PutVector(snap.AmbientHeat);
+		w.PutVector(snap.Particles);
+		w.PutVector(snap.GravVelocityX);
+		w.PutVector(snap.GravVelocityY);
+		w.PutVector(snap.GravValue);
+		w.PutVector(snap.GravMap);
+		w.PutVector(snap.BlockMap);
+		w.PutVector(snap.ElecMap);
+		w.PutVector(snap.FanVelocityX);
+		w.PutVector(snap.FanVelocityY);
+		w.PutVector(snap.PortalParticles);
+		w.PutVector(snap.WirelessData);
+		w.PutVector(snap.stickmen);
+		w.Put(uint32_t(snap.signs.size()));
+		for (auto &sign : snap.signs)
+		{
+			w.Put(int32_t(sign.x));
+			w.Put(int32_t(sign.y));
+			w.Put(int32_t(sign.ju));
+			w.PutString(sign.text.ToUtf8());
+		}
+	}
+
+	if (w.data.size() > maxLogSize)
+		return std::vector<unsigned char>();
+	uLongf compressedSize = compressBound(w.data.size());
+	std::vector<unsigned char> output(sizeof(logMagic)-1+2*sizeof(uint32_t)+compressedSize);
+	unsigned char *header = &output[0];
+	memcpy(header, logMagic, sizeof(logMagic)-1);
+	uint32_t version = logVersion, size = w.data.size();
+	memcpy(header+sizeof(logMagic)-1, &version, sizeof(version));
+	memcpy(header+sizeof(logMagic)-1+sizeof(version), &size, sizeof(size));
+	unsigned char *compressed = header+sizeof(logMagic)-1+2*sizeof(uint32_t);
+	if (compress2(compressed, &compressedSize, w.data.data(), w.data.size(), Z_BEST_SPEED) != Z_OK)
+		return std::vector<unsigned char>();
+	output.resize(compressed-header+compressedSize);
+	return output;
+}
+
+InputLog *InputLog::Deserialise(Simulation &sim, const std::vector<unsigned char> &data)
+{
+	size_t headerSize = sizeof(logMagic)-1+2*sizeof(uint32_t);
+	if (data.size() < headerSize || memcmp(&data[0], logMagic, sizeof(logMagic)-1))
+		return nullptr;
+	uint32_t version, size;
+	memcpy(&version, &data[sizeof(logMagic)-1], sizeof(version));
+	memcpy(&size, &data[sizeof(logMagic)-1+sizeof(version)], sizeof(size));
+	if (version != logVersion)
+		return nullptr;
+	if (size > maxLogSize || size > (data.size()-headerSize)*maxCompressionRatio)
+		return nullptr;
+	std::vector<unsigned char> payload(size);
+	uLongf payloadSize = size;
+	if (uncompress(payload.data(), &payloadSize, &data[headerSize], data.size()-headerSize) != Z_OK || payloadSize != size)
+		return nullptr;
+
+	// Keyframes are copied straight into the simulation's arrays, so they have to be the same size as its own
+	Snapshot *reference = sim.CreateSnapshot();
+	InputLog *log = new InputLog();
+	Reader r(payload);
+	log->keyframeInterval = std::max(r.Get<uint32_t>(), 1U);
+	uint32_t brushCount = r.Get<uint32_t>();
+	for (uint32_t i = 0; i < brushCount && r.ok; i++)
+	{
+		BrushData brush;
+		brush.radiusX = r.Get<int32_t>();
+		brush.radiusY = r.Get<int32_t>();
+		if (brush.radiusX < 0 || brush.radiusY < 0 || brush.radiusX > XRES || brush.radiusY > YRES)
+			r.ok = false;
+		r.GetVector(brush.bitmap, size_t(brush.radiusX*2+1)*(brush.radiusY*2+1));
+		if (brush.bitmap.size() != size_t(brush.radiusX*2+1)*(brush.radiusY*2+1))
+			r.ok = false;
+		log->brushes.push_back(brush);
+	}
+	r.GetVector(log->actions, payload.size());
+	for (size_t i = 0; i < log->actions.size() && r.ok; i++)
+	{
+		Action &action = log->actions[i];
+		if (action.type < 0 || action.type >= ACTION_COUNT || action.brush < -1 || action.brush >= int(log->brushes.size()) ||
+		    (action.type == SETTING && (action.args[0] < 0 || action.args[0] >= SETTING_COUNT)) ||
+		    (i && action.tick < log->actions[i-1].tick))
+			r.ok = false;
+	}
+
+	uint32_t keyframeCount = r.Get<uint32_t>();
+	for (uint32_t i = 0; i < keyframeCount && r.ok; i++)
+	{
+		unsigned int keyframeTick = r.Get<uint32_t>();
+		Keyframe keyframe;
+		keyframe.forced = true;
+		keyframe.actionIndex = r.Get<uint32_t>();
+		keyframe.currentTick = r.Get<int32_t>();
+		keyframe.empDecor = r.Get<int32_t>();
+		keyframe.lightningRecreate = r.Get<int32_t>();
+		keyframe.sandcolour = r.Get<int32_t>();
+		keyframe.sandcolourFrame = r.Get<int32_t>();
+		r.GetVector(keyframe.blockAir, blockMapSize);
+		r.GetVector(keyframe.blockAirH, blockMapSize);
+		for (int s = 0; s < SETTING_COUNT; s++)
+			keyframe.settings[s] = r.Get<int32_t>();
+		Snapshot *snap = keyframe.snap = new Snapshot();
+		r.GetVector(snap->AirPressure, reference->AirPressure.size());
+		r.GetVector(snap->AirVelocityX, reference->AirVelocityX.size());
+		r.GetVector(snap->AirVelocityY, reference->AirVelocityY.size());
+		r.GetVector(snap->AmbientHeat, reference->AmbientHeat.size());
+		r.GetVector(snap->Particles, NPART);
+		r.GetVector(snap->GravVelocityX, reference->GravVelocityX.size());
+		r.GetVector(snap->GravVelocityY, reference->GravVelocityY.size());
+		r.GetVector(snap->GravValue, reference->GravValue.size());
+		r.GetVector(snap->GravMap, reference->GravMap.size());
+		r.GetVector(snap->BlockMap, reference->BlockMap.size());
+		r.GetVector(snap->ElecMap, reference->ElecMap.size());
+		r.GetVector(snap->FanVelocityX, reference->FanVelocityX.size());
+		r.GetVector(snap->FanVelocityY, reference->FanVelocityY.size());
+		r.GetVector(snap->PortalParticles, reference->PortalParticles.size());
+		r.GetVector(snap->WirelessData, reference->WirelessData.size());
+		r.GetVector(snap->stickmen, reference->stickmen.size());
+		uint32_t signCount = r.Get<uint32_t>();
+		for (uint32_t j = 0; j < signCount && j < MAXSIGNS && r.ok; j++)
+		{
+			int x = r.Get<int32_t>();
+			int y = r.Get<int32_t>();
+			int ju = r.Get<int32_t>();
+			ByteString text = r.GetString();
+			if (ju < sign::Left || ju > sign::None)
+				r.ok = false;
+			snap->signs.push_back(sign(text.FromUtf8(), x, y, sign::Justification(ju)));
+		}
+		if (keyframe.blockAir.size() != blockMapSize || keyframe.blockAirH.size() != blockMapSize ||
+		    snap->AirPressure.size() != reference->AirPressure.size() || snap->stickmen.size() != reference->stickmen.size() ||
+		    snap->PortalParticles.size() != reference->PortalParticles.size() || snap->WirelessData.size() != reference->WirelessData.size())
+			r.ok = false;
+		for (auto &part : snap->Particles)
+			if (part.type < 0 || part.type >= PT_NUM)
+				r.ok = false;
+		if (!r.ok || keyframe.actionIndex > log->actions.size() || log->keyframes.count(keyframeTick))
+		{
+			delete snap;
+			r.ok = false;
+			break;
+		}
+		log->keyframes[keyframeTick] = keyframe;
+	}
+	delete reference;
+
+	// Playing back starts from the first keyframe, there has to be one before any of the actions
+	if (!r.ok || log->keyframes.empty() || (log->actions.size() && log->actions.front().tick < log->keyframes.begin()->first))
+	{
+		delete log;
+		return nullptr;
+	}
+	return log;
+}
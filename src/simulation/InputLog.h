@@ -0,0 +1,173 @@
+#ifndef INPUTLOG_H
+#define INPUTLOG_H
+
+#include <initializer_list>
+#include <map>
+#include <vector>
+#include "common/String.h"
+
+class Simulation;
+class Snapshot;
+class Brush;
+
+// Records what is done to a simulation as a list of brush, wall and tool actions and settings changes, tagged with
+// the tick they happened on, plus a full snapshot every so often (a keyframe). Any tick can then be reproduced by
+// restoring the nearest keyframe before it and simulating forward, applying the recorded actions as it goes.
+// Recording turns on the simulation's deterministic mode, without it simulating forward wouldn't repeat itself.
+// Changes the log can't describe (loading saves and stamps, undo, and tools that edit the simulation directly)
+// are picked up by taking an extra keyframe before the next tick. Lua scripts that write to particles directly
+// aren't seen at all, and neither is Newtonian gravity, which is updated on its own thread whenever it's ready.
+class InputLog
+{
+public:
+	enum ActionType
+	{
+		CREATE_PARTS, // x, y, c, flags, brush
+		CREATE_PARTS_RADIUS, // x, y, rx, ry, c, flags
+		CREATE_LINE, // x1, y1, x2, y2, c, flags, brush
+		CREATE_BOX, // x1, y1, x2, y2, c, flags
+		FLOOD_PARTS, // x, y, c, cm, flags
+		CREATE_WALLS, // x, y, rx, ry, wall, brush
+		CREATE_WALL_LINE, // x1, y1, x2, y2, rx, ry, wall, brush
+		CREATE_WALL_BOX, // x1, y1, x2, y2, wall
+		FLOOD_WALLS, // x, y, wall, bm
+		TOOL_BRUSH, // x, y, tool, brush, strength
+		TOOL_LINE, // x1, y1, x2, y2, tool, brush, strength
+		TOOL_BOX, // x1, y1, x2, y2, tool, strength
+		DECO_POINT, // x, y, r, g, b, a, mode, brush
+		DECO_LINE, // x1, y1, x2, y2, r, g, b, a, mode, brush
+		DECO_BOX, // x1, y1, x2, y2, r, g, b, a, mode
+		SETTING, // setting, value
+		ACTION_COUNT
+	};
+
+	enum Setting
+	{
+		GRAVITY_MODE,
+		AIR_MODE,
+		EDGE_MODE,
+		LEGACY_ENABLE,
+		AHEAT_ENABLE,
+		WATER_EQUAL,
+		NEWTONIAN_GRAVITY,
+		AMBIENT_AIR_TEMP, // bits of the float
+		REPLACE_MODE_SELECTED,
+		REPLACE_MODE_FLAGS,
+		RANDOM_SEED,
+		PRETTY_POWDER,
+		GSPEED,
+		DECO_SPACE,
+		SETTING_COUNT
+	};
+
+	static const int maxArgs = 9;
+
+	struct Action
+	{
+		unsigned int tick;
+		int type;
+		int args[maxArgs];
+		float strength;
+		int brush; // index into brushes, -1 for none
+	};
+
+	enum Mode
+	{
+		STOPPED,
+		RECORDING,
+		PLAYING // recorded actions are applied as the simulation reaches their tick
+	};
+
+	// Put at the top of the simulation functions that can be recorded. Records the call if it isn't made from
+	// inside another one being recorded or played back, so a line is recorded but not the points it is made of
+	class Scope
+	{
+		InputLog *log;
+	public:
+		Scope(InputLog *log, int type, std::initializer_list<int> args, Brush *brush = nullptr, float strength = 1.0f);
+		// Records nothing, for the simulation's own update, which may call the same functions
+		explicit Scope(InputLog *log);
+		~Scope();
+	};
+
+	InputLog();
+	~InputLog();
+
+	Mode GetMode() { return mode; }
+	unsigned int GetTick() { return tick; }
+	// Last tick anything was recorded on
+	unsigned int GetEndTick();
+	unsigned int GetKeyframeInterval() { return keyframeInterval; }
+	size_t GetActionCount() { return actions.size(); }
+	size_t GetKeyframeCount() { return keyframes.size(); }
+
+	// Starts a new log from the current state of the simulation, throwing away anything recorded before
+	void Record(Simulation &sim, unsigned int newKeyframeInterval);
+	void Stop();
+	// Puts the simulation in the state it was in on a tick and starts playing from there. Seeking while recording
+	// throws away everything recorded after that tick and carries on recording from it
+	bool Seek(Simulation &sim, unsigned int newTick);
+
+	// Called by the simulation at the start of every tick it simulates
+	void BeforeStep(Simulation &sim);
+	// Something the log can't describe changed the simulation, take a keyframe before the next tick
+	void Changed();
+
+	// Keyframes that can be rebuilt by playing the log back are left out
+	std::vector<unsigned char> Serialise();
+	// Returns nullptr if the data isn't a valid log, the simulation is used to check the size of the keyframes
+	static InputLog *Deserialise(Simulation &sim, const std::vector<unsigned char> &data);
+
+private:
+	struct BrushData
+	{
+		int radiusX, radiusY;
+		std::vector<unsigned char> bitmap;
+	};
+
+	struct Keyframe
+	{
+		Snapshot *snap;
+		bool forced; // taken because of a change that isn't in the log, can't be rebuilt
+		size_t actionIndex; // actions from here on, on the same tick, were recorded after the keyframe was taken
+		int currentTick;
+		int empDecor;
+		int lightningRecreate;
+		int sandcolour, sandcolourFrame;
+		// Which cells block air and ambient heat, the heat one also counts insulators, neither is in a snapshot
+		std::vector<unsigned char> blockAir, blockAirH;
+		int settings[SETTING_COUNT];
+	};
+
+	Mode mode;
+	unsigned int tick;
+	unsigned int keyframeInterval;
+	bool changed;
+	bool pending; // actions on the current tick haven't been applied yet, while playing
+	int depth; // calls being recorded or actions being applied, nested calls aren't recorded
+	Simulation *sim;
+	std::vector<Action> actions;
+	std::vector<BrushData> brushes;
+	std::vector<Brush*> brushObjects; // built from brushes when played back
+	std::map<unsigned int, Keyframe> keyframes;
+	int settings[SETTING_COUNT]; // values as of the last recorded action
+
+	int addBrush(Brush *brush);
+	Brush *getBrush(int index);
+	void recordSettings();
+	void record(int type, std::initializer_list<int> args, Brush *brush, float strength);
+	void takeKeyframe(bool forced);
+	void restoreKeyframe(const Keyframe &keyframe);
+	void applyActions(unsigned int actionTick, size_t from);
+	void applyTick(unsigned int applyTick);
+	void simulateTick();
+	void truncate(unsigned int endTick);
+	void clear();
+
+	static int getSetting(Simulation &sim, int setting);
+	// Settings are applied as they would be by the interface, except when restoring a keyframe, which already has
+	// the walls that changing the edge mode adds
+	static void setSetting(Simulation &sim, int setting, int value, bool restoring);
+};
+
+#endif /* INPUTLOG_H */
@@ -5,14 +5,20 @@
 #include "graphics/Graphics.h"
 #include "graphics/Renderer.h"
 
+#include "common/tpt-rand.h"
+
 #include "Simulation.h"
 
+#include <algorithm>
+#include <thread>
+
 SaveRenderer::SaveRenderer(){
-	g = new Graphics();
-	sim = new Simulation();
-	ren = new Renderer(g, sim);
-	ren->decorations_enable = true;
-	ren->blackDecorations = true;
+#if defined(OGLR) || defined(OGLI)
+	// Everything is rendered through the one FBO, on whichever thread has the GL context
+	maxContexts = 1;
+#else
+	maxContexts = std::min(std::max(std::thread::hardware_concurrency(), 1U), 4U);
+#endif
 
 #if defined(OGLR) || defined(OGLI)
 	glEnable(GL_TEXTURE_2D);
@@ -33,9 +39,99 @@ SaveRenderer::SaveRenderer(){
 #endif
 }
 
+SaveRenderer::Context * SaveRenderer::acquireContext()
+{
+	std::unique_lock<std::mutex> l(poolMutex);
+	while (true)
+	{
+		if (idleContexts.size())
+		{
+			Context * context = idleContexts.back();
+			idleContexts.pop_back();
+			return context;
+		}
+		if (contexts.size() < maxContexts)
+			break;
+		poolCv.wait(l);
+	}
+	Context * context = new Context();
+	contexts.push_back(context);
+	l.unlock();
+
+	// Creating a Simulation takes a while, so it's done outside the lock
+	context->g = new Graphics();
+	context->sim = new Simulation();
+	context->ren = new Renderer(context->g, context->sim);
+	context->ren->decorations_enable = true;
+	context->ren->blackDecorations = true;
+	context->rng = new RNG();
+	return context;
+}
+
+void SaveRenderer::releaseContext(Context * context)
+{
+	{
+		std::lock_guard<std::mutex> g(poolMutex);
+		if (contexts.size() <= maxContexts)
+		{
+			idleContexts.push_back(context);
+			context = NULL;
+		}
+		else
+			contexts.erase(std::find(contexts.begin(), contexts.end(), context));
+	}
+	poolCv.notify_one();
+	if (context)
+	{
+		delete context->ren;
+		delete context->sim;
+		delete context->g;
+		delete context->rng;
+		delete context;
+	}
+}
+
+void SaveRenderer::SetMaxContexts(unsigned int newMaxContexts)
+{
+#if !defined(OGLR) && !defined(OGLI)
+	std::vector<Context *> unused;
+	{
+		std::lock_guard<std::mutex> g(poolMutex);
+		maxContexts = std::max(newMaxContexts, 1U);
+		while (contexts.size() > maxContexts && idleContexts.size())
+		{
+			unused.push_back(idleContexts.back());
+			idleContexts.pop_back();
+			contexts.erase(std::find(contexts.begin(), contexts.end(), unused.back()));
+		}
+	}
+	poolCv.notify_all();
+	for (auto context : unused)
+	{
+		delete context->ren;
+		delete context->sim;
+		delete context->g;
+		delete context->rng;
+		delete context;
+	}
+#endif
+}
+
 VideoBuffer * SaveRenderer::Render(GameSave * save, bool decorations, bool fire, Renderer *renderModeSource)
 {
-	std::lock_guard<std::mutex> gx(renderMutex);
+	Context * context = acquireContext();
+	RNG::SetThreadRNG(context->rng);
+	VideoBuffer * thumb = render(context, save, decorations, fire, renderModeSource);
+	RNG::SetThreadRNG(nullptr);
+	releaseContext(context);
+	return thumb;
+}
+
+VideoBuffer * SaveRenderer::render(Context * context, GameSave * save, bool decorations, bool fire, Renderer *renderModeSource)
+{
+	Graphics * g = context->g;
+	Simulation * sim = context->sim;
+	Renderer * ren = context->ren;
 
 	ren->ResetModes();
 	if (renderModeSource)
@@ -161,8 +257,6 @@ VideoBuffer * SaveRenderer::Render(GameSave * save, bool decorations, bool fire,
 
 VideoBuffer * SaveRenderer::Render(unsigned char * saveData, int dataSize, bool decorations, bool fire)
 {
-	std::lock_guard<std::mutex> g(renderMutex);
-
 	GameSave * tempSave;
 	try {
 		tempSave = new GameSave((char*)saveData, dataSize);
@@ -182,4 +276,12 @@ VideoBuffer * SaveRenderer::Render(unsigned char * saveData, int dataSize, bool
 
 SaveRenderer::~SaveRenderer()
 {
+	for (auto context : contexts)
+	{
+		delete context->ren;
+		delete context->sim;
+		delete context->g;
+		delete context->rng;
+		delete context;
+	}
 }
@@ -4,23 +4,44 @@
 #include "graphics/OpenGLHeaders.h"
 #endif
 #include "common/Singleton.h"
+#include <condition_variable>
 #include <mutex>
+#include <vector>
 
 class GameSave;
 class VideoBuffer;
 class Graphics;
 class Simulation;
 class Renderer;
+class RNG;
 
+// Renders saves into thumbnails. Each render needs a Simulation and Renderer of its own, these are kept in a pool
+// that grows up to maxContexts, so thumbnails rendered by several threads at once don't wait for each other
 class SaveRenderer: public Singleton<SaveRenderer> {
-	Graphics * g;
-	Simulation * sim;
-	Renderer * ren;
-	std::mutex renderMutex;
+	struct Context
+	{
+		Graphics * g;
+		Simulation * sim;
+		Renderer * ren;
+		RNG * rng; // used by the rendering thread instead of the shared generator
+	};
+	std::vector<Context *> contexts;
+	std::vector<Context *> idleContexts;
+	unsigned int maxContexts;
+	std::mutex poolMutex;
+	std::condition_variable poolCv;
+
+	Context * acquireContext();
+	void releaseContext(Context * context);
+	VideoBuffer * render(Context * context, GameSave * save, bool decorations, bool fire, Renderer *renderModeSource);
+
 public:
 	SaveRenderer();
 	VideoBuffer * Render(GameSave * save, bool decorations = true, bool fire = true, Renderer *renderModeSource = nullptr);
 	VideoBuffer * Render(unsigned char * saveData, int saveDataSize, bool decorations = true, bool fire = true);
+	// Contexts beyond the new limit are freed once they are no longer in use
+	void SetMaxContexts(unsigned int newMaxContexts);
+	unsigned int GetMaxContexts() { return maxContexts; }
 	virtual ~SaveRenderer();
 
 private:
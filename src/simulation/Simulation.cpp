@@ -3,6 +3,8 @@
 #include <iostream>
 #include <cmath>
 #include <set>
+#include <algorithm>
+#include <iterator>
 #ifdef _MSC_VER
 #include <intrin.h>
 #else
@@ -16,6 +18,7 @@
 #include "Gravity.h"
 #include "Sample.h"
 #include "Snapshot.h"
+#include "InputLog.h"
 
 #include "Misc.h"
 #include "ToolClasses.h"
@@ -25,6 +28,7 @@
 #include "graphics/Renderer.h"
 
 #include "client/GameSave.h"
+#include "common/ThreadPool.h"
 #include "common/tpt-compat.h"
 #include "common/tpt-minmax.h"
 #include "common/tpt-rand.h"
@@ -41,6 +45,43 @@ extern int Element_LOLZ_lolz[XRES/9][YRES/9];
 extern int Element_LOVE_RuleTable[9][9];
 extern int Element_LOVE_love[XRES/9][YRES/9];
 
+// Strip being updated by the current thread, see UpdateParticlesParallel
+static thread_local UpdateStrip *currentStrip = nullptr;
+
+// Stream IDs for the parts of a deterministic update that aren't a single particle's, particles use their own ID
+enum
+{
+	STREAM_DEFERRED_MOVE = NPART, // + particle ID
+	STREAM_BEFORE_SIM = 2*NPART,
+	STREAM_AFTER_SIM,
+	STREAM_STRIP_SETUP,
+	STREAM_LOAD,
+};
+
+// Points RNG::Ref() at a stream of the step generator for as long as it exists, if the simulation is deterministic
+class StepRNGScope
+{
+	bool active;
+	RNG *previous;
+public:
+	StepRNGScope(Simulation &sim, RNG &stepRNG, uint64_t stream):
+		active(sim.deterministic),
+		previous(RNG::GetThreadRNG())
+	{
+		if (active)
+		{
+			stepRNG.SetStream(sim.randomSeed, sim.currentTick, stream);
+			RNG::SetThreadRNG(&stepRNG);
+		}
+	}
+
+	~StepRNGScope()
+	{
+		if (active)
+			RNG::SetThreadRNG(previous);
+	}
+};
+
 int Simulation::Load(GameSave * save, bool includePressure)
 {
 	return Load(save, includePressure, 0, 0);
@@ -52,6 +93,7 @@ int Simulation::Load(GameSave * save, bool includePressure, int fullX, int fullY
 
 	if (!save)
 		return 1;
+	NotifyUnloggedChange();
 	try
 	{
 		save->Expand();
@@ -332,7 +374,12 @@ int Simulation::Load(GameSave * save, bool includePressure, int fullX, int fullY
 	}
 
 	gravWallChanged = true;
-	air->RecalculateBlockAirMaps();
+	{
+		// Insulators let heat through at random, a deterministic run loaded from the same save has to start the same
+		StepRNGScope rngScope(*this, stepRNG, STREAM_LOAD);
+		air->RecalculateBlockAirMaps();
+	}
+	activeBlocks.Fill();
 
 	return 0;
 }
@@ -504,6 +551,7 @@ void Simulation::SaveSimOptions(GameSave * gameSave)
 	gameSave->gravityMode = gravityMode;
 	gameSave->airMode = air->airMode;
 	gameSave->edgeMode = edgeMode;
+	gameSave->rngSeed = randomSeed;
 	gameSave->legacyEnable = legacy_enable;
 	gameSave->waterEEnabled = water_equal_test;
 	gameSave->gravityEnable = grav->IsEnabled();
@@ -537,7 +585,10 @@ Snapshot * Simulation::CreateSnapshot()
 
 void Simulation::Restore(const Snapshot & snap)
 {
+	NotifyUnloggedChange();
 	parts_lastActiveIndex = NPART-1;
+	// Counted again from the restored particles by RecalcFreeParticles
+	std::fill(elementCount, elementCount+PT_NUM, 0);
 	elementRecount = true;
 	force_stacking_check = true;
 
@@ -569,6 +620,38 @@ void Simulation::Restore(const Snapshot & snap)
 	player = snap.stickmen[snap.stickmen.size()-1];
 	player2 = snap.stickmen[snap.stickmen.size()-2];
 	signs = snap.signs;
+	activeBlocks.Fill();
+}
+
+void Simulation::CopyRenderState(const Simulation & from)
+{
+	const int cells = (XRES/CELL)*(YRES/CELL);
+	parts_lastActiveIndex = from.parts_lastActiveIndex;
+	std::copy(from.parts, from.parts+from.parts_lastActiveIndex+1, parts);
+	std::copy(&from.pmap[0][0], &from.pmap[0][0]+XRES*YRES, &pmap[0][0]);
+	std::copy(&from.photons[0][0], &from.photons[0][0]+XRES*YRES, &photons[0][0]);
+	std::copy(&from.bmap[0][0], &from.bmap[0][0]+cells, &bmap[0][0]);
+	std::copy(&from.emap[0][0], &from.emap[0][0]+cells, &emap[0][0]);
+	std::copy(&from.pv[0][0], &from.pv[0][0]+cells, &pv[0][0]);
+	std::copy(&from.vx[0][0], &from.vx[0][0]+cells, &vx[0][0]);
+	std::copy(&from.vy[0][0], &from.vy[0][0]+cells, &vy[0][0]);
+	std::copy(&from.hv[0][0], &from.hv[0][0]+cells, &hv[0][0]);
+	std::copy(from.gravx, from.gravx+cells, gravx);
+	std::copy(from.gravy, from.gravy+cells, gravy);
+	std::copy(from.gravp, from.gravp+cells, gravp);
+	std::copy(from.gravmap, from.gravmap+cells, gravmap);
+	std::copy(from.grav->gravmask, from.grav->gravmask+cells, grav->gravmask);
+	signs = from.signs;
+	elements = from.elements;
+	wtypes = from.wtypes;
+	player = from.player;
+	player2 = from.player2;
+	std::copy(from.fighters, from.fighters+MAX_FIGHTERS, fighters);
+	fighcount = from.fighcount;
+	currentTick = from.currentTick;
+	sys_pause = from.sys_pause;
+	emp_decor = from.emp_decor;
+	aheat_enable = from.aheat_enable;
 }
 
 void Simulation::clear_area(int area_x, int area_y, int area_w, int area_h)
@@ -899,6 +982,7 @@ bool Simulation::flood_water(int x, int y, int i)
 					int oldy = (int)(parts[i].y + 0.5f);
 					pmap[y - 1][x] = pmap[oldy][oldx];
 					pmap[oldy][oldx] = 0;
+					pmapBlocks.SetPixel(x, y - 1);
 					parts[i].x = x;
 					parts[i].y = y - 1;
 					return true;
@@ -1156,6 +1240,7 @@ void Simulation::ApplyDecoration(int x, int y, int colR_, int colG_, int colB_,
 
 void Simulation::ApplyDecorationPoint(int positionX, int positionY, int colR, int colG, int colB, int colA, int mode, Brush * cBrush)
 {
+	InputLog::Scope logScope(inputLog, InputLog::DECO_POINT, { positionX, positionY, colR, colG, colB, colA, mode }, cBrush);
 	if(cBrush)
 	{
 		int radiusX = cBrush->GetRadius().X, radiusY = cBrush->GetRadius().Y, sizeX = cBrush->GetSize().X, sizeY = cBrush->GetSize().Y;
@@ -1176,6 +1261,7 @@ void Simulation::ApplyDecorationPoint(int positionX, int positionY, int colR, in
 
 void Simulation::ApplyDecorationLine(int x1, int y1, int x2, int y2, int colR, int colG, int colB, int colA, int mode, Brush * cBrush)
 {
+	InputLog::Scope logScope(inputLog, InputLog::DECO_LINE, { x1, y1, x2, y2, colR, colG, colB, colA, mode }, cBrush);
 	bool reverseXY = abs(y2-y1) > abs(x2-x1);
 	int x, y, dx, dy, sy, rx = 0, ry = 0;
 	float e = 0.0f, de;
@@ -1236,6 +1322,7 @@ void Simulation::ApplyDecorationLine(int x1, int y1, int x2, int y2, int colR, i
 
 void Simulation::ApplyDecorationBox(int x1, int y1, int x2, int y2, int colR, int colG, int colB, int colA, int mode)
 {
+	InputLog::Scope logScope(inputLog, InputLog::DECO_BOX, { x1, y1, x2, y2, colR, colG, colB, colA, mode });
 	int i, j;
 
 	if (x1>x2)
@@ -1267,6 +1354,8 @@ bool Simulation::ColorCompare(Renderer *ren, int x, int y, int replaceR, int rep
 
 void Simulation::ApplyDecorationFill(Renderer *ren, int x, int y, int colR, int colG, int colB, int colA, int replaceR, int replaceG, int replaceB)
 {
+	// What gets filled depends on what was rendered, which the input log doesn't have
+	NotifyUnloggedChange();
 	int x1, x2;
 	char *bitmap = (char*)malloc(XRES*YRES); //Bitmap for checking
 	if (!bitmap)
@@ -1346,6 +1435,7 @@ int Simulation::Tool(int x, int y, int tool, int brushX, int brushY, float stren
 
 int Simulation::ToolBrush(int positionX, int positionY, int tool, Brush * cBrush, float strength)
 {
+	InputLog::Scope logScope(inputLog, InputLog::TOOL_BRUSH, { positionX, positionY, tool }, cBrush, strength);
 	if(cBrush)
 	{
 		int radiusX = cBrush->GetRadius().X, radiusY = cBrush->GetRadius().Y, sizeX = cBrush->GetSize().X, sizeY = cBrush->GetSize().Y;
@@ -1360,6 +1450,7 @@ int Simulation::ToolBrush(int positionX, int positionY, int tool, Brush * cBrush
 
 void Simulation::ToolLine(int x1, int y1, int x2, int y2, int tool, Brush * cBrush, float strength)
 {
+	InputLog::Scope logScope(inputLog, InputLog::TOOL_LINE, { x1, y1, x2, y2, tool }, cBrush, strength);
 	bool reverseXY = abs(y2-y1) > abs(x2-x1);
 	int x, y, dx, dy, sy, rx = cBrush->GetRadius().X, ry = cBrush->GetRadius().Y;
 	float e = 0.0f, de;
@@ -1412,6 +1503,7 @@ void Simulation::ToolLine(int x1, int y1, int x2, int y2, int tool, Brush * cBru
 }
 void Simulation::ToolBox(int x1, int y1, int x2, int y2, int tool, float strength)
 {
+	InputLog::Scope logScope(inputLog, InputLog::TOOL_BOX, { x1, y1, x2, y2, tool }, nullptr, strength);
 	int brushX, brushY;
 	brushX = ((x1 + x2) / 2);
 	brushY = ((y1 + y2) / 2);
@@ -1435,6 +1527,7 @@ void Simulation::ToolBox(int x1, int y1, int x2, int y2, int tool, float strengt
 
 int Simulation::CreateWalls(int x, int y, int rx, int ry, int wall, Brush * cBrush)
 {
+	InputLog::Scope logScope(inputLog, InputLog::CREATE_WALLS, { x, y, rx, ry, wall }, cBrush);
 	if(cBrush)
 	{
 		rx = cBrush->GetRadius().X;
@@ -1495,6 +1588,7 @@ int Simulation::CreateWalls(int x, int y, int rx, int ry, int wall, Brush * cBru
 
 void Simulation::CreateWallLine(int x1, int y1, int x2, int y2, int rx, int ry, int wall, Brush * cBrush)
 {
+	InputLog::Scope logScope(inputLog, InputLog::CREATE_WALL_LINE, { x1, y1, x2, y2, rx, ry, wall }, cBrush);
 	int x, y, dx, dy, sy;
 	bool reverseXY = abs(y2-y1) > abs(x2-x1);
 	float e = 0.0f, de;
@@ -1548,6 +1642,7 @@ void Simulation::CreateWallLine(int x1, int y1, int x2, int y2, int rx, int ry,
 
 void Simulation::CreateWallBox(int x1, int y1, int x2, int y2, int wall)
 {
+	InputLog::Scope logScope(inputLog, InputLog::CREATE_WALL_BOX, { x1, y1, x2, y2, wall });
 	int i, j;
 	if (x1>x2)
 	{
@@ -1568,6 +1663,7 @@ void Simulation::CreateWallBox(int x1, int y1, int x2, int y2, int wall)
 
 int Simulation::FloodWalls(int x, int y, int wall, int bm)
 {
+	InputLog::Scope logScope(inputLog, InputLog::FLOOD_WALLS, { x, y, wall, bm });
 	int x1, x2, dy = CELL;
 	if (bm==-1)
 	{
@@ -1625,6 +1721,7 @@ int Simulation::FloodWalls(int x, int y, int wall, int bm)
 
 int Simulation::CreateParts(int positionX, int positionY, int c, Brush * cBrush, int flags)
 {
+	InputLog::Scope logScope(inputLog, InputLog::CREATE_PARTS, { positionX, positionY, c, flags }, cBrush);
 	if (flags == -1)
 		flags = replaceModeFlags;
 	if (cBrush)
@@ -1668,6 +1765,7 @@ int Simulation::CreateParts(int positionX, int positionY, int c, Brush * cBrush,
 
 int Simulation::CreateParts(int x, int y, int rx, int ry, int c, int flags)
 {
+	InputLog::Scope logScope(inputLog, InputLog::CREATE_PARTS_RADIUS, { x, y, rx, ry, c, flags });
 	bool created = false;
 
 	if (flags == -1)
@@ -1702,6 +1800,7 @@ int Simulation::CreateParts(int x, int y, int rx, int ry, int c, int flags)
 
 void Simulation::CreateLine(int x1, int y1, int x2, int y2, int c, Brush * cBrush, int flags)
 {
+	InputLog::Scope logScope(inputLog, InputLog::CREATE_LINE, { x1, y1, x2, y2, c, flags }, cBrush);
 	int x, y, dx, dy, sy, rx = cBrush->GetRadius().X, ry = cBrush->GetRadius().Y;
 	bool reverseXY = abs(y2-y1) > abs(x2-x1);
 	float e = 0.0f, de;
@@ -1866,6 +1965,7 @@ void Simulation::CreateLine(int x1, int y1, int x2, int y2, int c)
 
 void Simulation::CreateBox(int x1, int y1, int x2, int y2, int c, int flags)
 {
+	InputLog::Scope logScope(inputLog, InputLog::CREATE_BOX, { x1, y1, x2, y2, c, flags });
 	int i, j;
 	if (x1>x2)
 	{
@@ -1886,6 +1986,7 @@ void Simulation::CreateBox(int x1, int y1, int x2, int y2, int c, int flags)
 
 int Simulation::FloodParts(int x, int y, int fullc, int cm, int flags)
 {
+	InputLog::Scope logScope(inputLog, InputLog::FLOOD_PARTS, { x, y, fullc, cm, flags });
 	int c = TYP(fullc);
 	int x1, x2, dy = (c<PT_NUM)?1:CELL;
 	int coord_stack_limit = XRES*YRES;
@@ -2118,6 +2219,13 @@ void Simulation::set_emap(int x, int y)
 {
 	int x1, x2;
 
+	if (currentStrip)
+	{
+		// the electrode map can span the whole screen, so it is changed after the strips are done
+		currentStrip->emapQueue.push_back(std::make_pair(x, y));
+		return;
+	}
+
 	if (!is_wire_off(x, y))
 		return;
 
@@ -2233,6 +2341,13 @@ void Simulation::create_arc(int sx, int sy, int dx, int dy, int midpoints, int v
 
 void Simulation::clear_sim(void)
 {
+	NotifyUnloggedChange();
+	// A deterministic run counts ticks from when it was started
+	if (deterministic)
+	{
+		currentTick = 0;
+		lightningRecreate = 0;
+	}
 	debug_currentParticle = 0;
 	emp_decor = 0;
 	emp_trigger_count = 0;
@@ -2255,6 +2370,7 @@ void Simulation::clear_sim(void)
 	memset(fighters, 0, sizeof(fighters));
 	std::fill(elementCount, elementCount+PT_NUM, 0);
 	elementRecount = true;
+	activeBlocks.Fill();
 	fighcount = 0;
 	player.spwn = 0;
 	player.spawnID = -1;
@@ -2800,12 +2916,14 @@ int Simulation::try_move(int i, int x, int y, int nx, int ny)
 				pmap[ny][nx] = (s&~PMAPMASK)|parts[ID(s)].type;
 				parts[ID(s)].x = nx;
 				parts[ID(s)].y = ny;
+				MarkActive(nx, ny, parts[ID(s)].type);
 			}
 			else
 				pmap[ny][nx] = 0;
 			parts[ri].x = x;
 			parts[ri].y = y;
 			pmap[y][x] = PMAP(ri, parts[ri].type);
+			MarkActive(x, y, parts[ri].type);
 			return 1;
 		}
 
@@ -2814,6 +2932,7 @@ int Simulation::try_move(int i, int x, int y, int nx, int ny)
 		parts[ri].x += x-nx;
 		parts[ri].y += y-ny;
 		pmap[(int)(parts[ri].y+0.5f)][(int)(parts[ri].x+0.5f)] = PMAP(ri, parts[ri].type);
+		MarkActive((int)(parts[ri].x+0.5f), (int)(parts[ri].y+0.5f), parts[ri].type);
 	}
 	return 1;
 }
@@ -2851,6 +2970,8 @@ int Simulation::do_move(int i, int x, int y, float nxf, float nyf)
 		parts[i].y = nyf;
 		if (ny!=y || nx!=x)
 		{
+			MarkActive(x, y, t);
+			MarkActive(nx, ny, t);
 			if (ID(pmap[y][x]) == i)
 				pmap[y][x] = 0;
 			if (ID(photons[y][x]) == i)
@@ -3036,6 +3157,17 @@ int Simulation::get_normal_interp(int pt, float x0, float y0, float dx, float dy
 	return get_normal(pt, x, y, dx, dy, nx, ny);
 }
 
+void Simulation::MarkActive(int x, int y, int t)
+{
+	if (x < 0 || y < 0 || x >= XRES || y >= YRES)
+		return;
+	activeBlocks.Set(x/CELL, y/CELL);
+	if (t == PT_LIFE)
+		lifeBlocks.Set(x/CELL, y/CELL);
+	else if (t == PT_WIRE)
+		wireBlocks.Set(x/CELL, y/CELL);
+}
+
 void Simulation::kill_part(int i)//kills particle number i
 {
 	if (i < 0 || i >= NPART)
@@ -3062,9 +3194,17 @@ void Simulation::kill_part(int i)//kills particle number i
 	if (t == PT_NONE)
 		return;
 
-	elementCount[t]--;
+	MarkActive(x, y, t);
+
+	ChangeElementCount(t, -1);
 
 	parts[i].type = PT_NONE;
+	if (currentStrip)
+	{
+		// linked into the free list once all strips are done
+		currentStrip->killed.push_back(i);
+		return;
+	}
 	parts[i].life = pfree;
 	pfree = i;
 }
@@ -3092,10 +3232,11 @@ bool Simulation::part_change_type(int i, int x, int y, int t)
 		(*(elements[t].ChangeType))(this, i, x, y, parts[i].type, t);
 
 	if (parts[i].type > 0 && parts[i].type < PT_NUM && elementCount[parts[i].type])
-		elementCount[parts[i].type]--;
-	elementCount[t]++;
+		ChangeElementCount(parts[i].type, -1);
+	ChangeElementCount(t, 1);
 
 	parts[i].type = t;
+	MarkActive(x, y, t);
 	if (elements[t].Properties & TYPE_ENERGY)
 	{
 		photons[y][x] = PMAP(i, t);
@@ -3178,24 +3319,21 @@ int Simulation::create_part(int p, int x, int y, int t, int v)
 		{
 			return -1;
 		}
-		if (pfree == -1)
+		i = AllocateParticle();
+		if (i == -1)
 			return -1;
-		i = pfree;
-		pfree = parts[i].life;
 	}
 	else if (p == -2)//creating from brush
 	{
-		if (pfree == -1)
+		i = AllocateParticle();
+		if (i == -1)
 			return -1;
-		i = pfree;
-		pfree = parts[i].life;
 	}
 	else if (p == -3)//skip pmap checks, e.g. for sing explosion
 	{
-		if (pfree == -1)
+		i = AllocateParticle();
+		if (i == -1)
 			return -1;
-		i = pfree;
-		pfree = parts[i].life;
 	}
 	else
 	{
@@ -3211,17 +3349,22 @@ int Simulation::create_part(int p, int x, int y, int t, int v)
 		if (elements[oldType].ChangeType)
 			(*(elements[oldType].ChangeType))(this, p, oldX, oldY, oldType, t);
 		if (oldType)
-			elementCount[oldType]--;
+			ChangeElementCount(oldType, -1);
 
 		i = p;
 	}
 
-	if (i>parts_lastActiveIndex) parts_lastActiveIndex = i;
+	if (currentStrip)
+	{
+		if (i>currentStrip->lastActiveIndex) currentStrip->lastActiveIndex = i;
+	}
+	else if (i>parts_lastActiveIndex) parts_lastActiveIndex = i;
 
 	parts[i] = elements[t].DefaultProperties;
 	parts[i].type = t;
 	parts[i].x = (float)x;
 	parts[i].y = (float)y;
+	MarkActive(x, y, t);
 
 	//and finally set the pmap/photon maps to the newly created particle
 	if (elements[t].Properties & TYPE_ENERGY)
@@ -3249,7 +3392,7 @@ int Simulation::create_part(int p, int x, int y, int t, int v)
 	if (elements[t].ChangeType)
 		(*(elements[t].ChangeType))(this, i, x, y, oldType, t);
 
-	elementCount[t]++;
+	ChangeElementCount(t, 1);
 	return i;
 }
 
@@ -3386,13 +3529,11 @@ void Simulation::delete_part(int x, int y)//calls kill_part with the particle lo
 	kill_part(ID(i));
 }
 
-void Simulation::UpdateParticles(int start, int end)
+void Simulation::UpdateParticle(int i)
 {
-	int i, j, x, y, t, nx, ny, r, surround_space, s, rt, nt;
-	float mv, dx, dy, nrx, nry, dp, ctemph, ctempl, gravtot;
-	int fin_x, fin_y, clear_x, clear_y, stagnant;
-	float fin_xf, fin_yf, clear_xf, clear_yf;
-	float nn, ct1, ct2, swappage;
+	int j, x, y, t, nx, ny, r, surround_space, s, rt, nt;
+	float ctemph, ctempl, gravtot;
+	float swappage;
 	float pt = R_TEMP;
 	float c_heat = 0.0f;
 	int h_count = 0;
@@ -3401,1242 +3542,1538 @@ void Simulation::UpdateParticles(int start, int end)
 	float pGravX, pGravY, pGravD;
 	bool transitionOccurred;
 
-	//the main particle loop function, goes over all particles.
-	for (i = start; i <= end && i <= parts_lastActiveIndex; i++)
-		if (parts[i].type)
-		{
-			t = parts[i].type;
+	t = parts[i].type;
 
-			x = (int)(parts[i].x+0.5f);
-			y = (int)(parts[i].y+0.5f);
+	x = (int)(parts[i].x+0.5f);
+	y = (int)(parts[i].y+0.5f);
 
-			//this kills any particle out of the screen, or in a wall where it isn't supposed to go
-			if (x<CELL || y<CELL || x>=XRES-CELL || y>=YRES-CELL ||
-			        (bmap[y/CELL][x/CELL] &&
-			         (bmap[y/CELL][x/CELL]==WL_WALL ||
-			          bmap[y/CELL][x/CELL]==WL_WALLELEC ||
-			          bmap[y/CELL][x/CELL]==WL_ALLOWAIR ||
-			          (bmap[y/CELL][x/CELL]==WL_DESTROYALL) ||
-			          (bmap[y/CELL][x/CELL]==WL_ALLOWLIQUID && !(elements[t].Properties&TYPE_LIQUID)) ||
-			          (bmap[y/CELL][x/CELL]==WL_ALLOWPOWDER && !(elements[t].Properties&TYPE_PART)) ||
-			          (bmap[y/CELL][x/CELL]==WL_ALLOWGAS && !(elements[t].Properties&TYPE_GAS)) || //&& elements[t].Falldown!=0 && parts[i].type!=PT_FIRE && parts[i].type!=PT_SMKE && parts[i].type!=PT_CFLM) ||
-					  (bmap[y/CELL][x/CELL]==WL_ALLOWENERGY && !(elements[t].Properties&TYPE_ENERGY)) ||
-			          (bmap[y/CELL][x/CELL]==WL_EWALL && !emap[y/CELL][x/CELL])) && (t!=PT_STKM) && (t!=PT_STKM2) && (t!=PT_FIGH)))
-			{
-				kill_part(i);
-				continue;
-			}
+	//this kills any particle out of the screen, or in a wall where it isn't supposed to go
+	if (x<CELL || y<CELL || x>=XRES-CELL || y>=YRES-CELL ||
+	        (bmap[y/CELL][x/CELL] &&
+	         (bmap[y/CELL][x/CELL]==WL_WALL ||
+	          bmap[y/CELL][x/CELL]==WL_WALLELEC ||
+	          bmap[y/CELL][x/CELL]==WL_ALLOWAIR ||
+	          (bmap[y/CELL][x/CELL]==WL_DESTROYALL) ||
+	          (bmap[y/CELL][x/CELL]==WL_ALLOWLIQUID && !(elements[t].Properties&TYPE_LIQUID)) ||
+	          (bmap[y/CELL][x/CELL]==WL_ALLOWPOWDER && !(elements[t].Properties&TYPE_PART)) ||
+	          (bmap[y/CELL][x/CELL]==WL_ALLOWGAS && !(elements[t].Properties&TYPE_GAS)) || //&& elements[t].Falldown!=0 && parts[i].type!=PT_FIRE && parts[i].type!=PT_SMKE && parts[i].type!=PT_CFLM) ||
+			  (bmap[y/CELL][x/CELL]==WL_ALLOWENERGY && !(elements[t].Properties&TYPE_ENERGY)) ||
+	          (bmap[y/CELL][x/CELL]==WL_EWALL && !emap[y/CELL][x/CELL])) && (t!=PT_STKM) && (t!=PT_STKM2) && (t!=PT_FIGH)))
+	{
+		kill_part(i);
+		return;
+	}
 
-			// Make sure that STASIS'd particles don't tick.
-			if (bmap[y/CELL][x/CELL] == WL_STASIS && emap[y/CELL][x/CELL]<8) {
-				continue;
-			}
+	// the update can change the air blocking maps for this block, which are reset in BeforeSim
+	activeBlocks.Set(x/CELL, y/CELL);
+
+	// Make sure that STASIS'd particles don't tick.
+	if (bmap[y/CELL][x/CELL] == WL_STASIS && emap[y/CELL][x/CELL]<8) {
+		return;
+	}
 
-			if (bmap[y/CELL][x/CELL]==WL_DETECT && emap[y/CELL][x/CELL]<8)
-				set_emap(x/CELL, y/CELL);
+	if (bmap[y/CELL][x/CELL]==WL_DETECT && emap[y/CELL][x/CELL]<8)
+		set_emap(x/CELL, y/CELL);
 
-			//adding to velocity from the particle's velocity
-			vx[y/CELL][x/CELL] = vx[y/CELL][x/CELL]*elements[t].AirLoss + elements[t].AirDrag*parts[i].vx;
-			vy[y/CELL][x/CELL] = vy[y/CELL][x/CELL]*elements[t].AirLoss + elements[t].AirDrag*parts[i].vy;
+	//adding to velocity from the particle's velocity
+	vx[y/CELL][x/CELL] = vx[y/CELL][x/CELL]*elements[t].AirLoss + elements[t].AirDrag*parts[i].vx;
+	vy[y/CELL][x/CELL] = vy[y/CELL][x/CELL]*elements[t].AirLoss + elements[t].AirDrag*parts[i].vy;
 
-			if (elements[t].HotAir)
+	if (elements[t].HotAir)
+	{
+		if (t==PT_GAS||t==PT_NBLE)
+		{
+			if (pv[y/CELL][x/CELL]<3.5f)
+				pv[y/CELL][x/CELL] += elements[t].HotAir*(3.5f-pv[y/CELL][x/CELL]);
+			if (y+CELL<YRES && pv[y/CELL+1][x/CELL]<3.5f)
+				pv[y/CELL+1][x/CELL] += elements[t].HotAir*(3.5f-pv[y/CELL+1][x/CELL]);
+			if (x+CELL<XRES)
 			{
-				if (t==PT_GAS||t==PT_NBLE)
-				{
-					if (pv[y/CELL][x/CELL]<3.5f)
-						pv[y/CELL][x/CELL] += elements[t].HotAir*(3.5f-pv[y/CELL][x/CELL]);
-					if (y+CELL<YRES && pv[y/CELL+1][x/CELL]<3.5f)
-						pv[y/CELL+1][x/CELL] += elements[t].HotAir*(3.5f-pv[y/CELL+1][x/CELL]);
-					if (x+CELL<XRES)
-					{
-						if (pv[y/CELL][x/CELL+1]<3.5f)
-							pv[y/CELL][x/CELL+1] += elements[t].HotAir*(3.5f-pv[y/CELL][x/CELL+1]);
-						if (y+CELL<YRES && pv[y/CELL+1][x/CELL+1]<3.5f)
-							pv[y/CELL+1][x/CELL+1] += elements[t].HotAir*(3.5f-pv[y/CELL+1][x/CELL+1]);
-					}
-				}
-				else//add the hotair variable to the pressure map, like black hole, or white hole.
-				{
-					pv[y/CELL][x/CELL] += elements[t].HotAir;
-					if (y+CELL<YRES)
-						pv[y/CELL+1][x/CELL] += elements[t].HotAir;
-					if (x+CELL<XRES)
-					{
-						pv[y/CELL][x/CELL+1] += elements[t].HotAir;
-						if (y+CELL<YRES)
-							pv[y/CELL+1][x/CELL+1] += elements[t].HotAir;
-					}
-				}
+				if (pv[y/CELL][x/CELL+1]<3.5f)
+					pv[y/CELL][x/CELL+1] += elements[t].HotAir*(3.5f-pv[y/CELL][x/CELL+1]);
+				if (y+CELL<YRES && pv[y/CELL+1][x/CELL+1]<3.5f)
+					pv[y/CELL+1][x/CELL+1] += elements[t].HotAir*(3.5f-pv[y/CELL+1][x/CELL+1]);
 			}
-
-			pGravX = pGravY = 0;
-			if (!(elements[t].Properties & TYPE_SOLID))
+		}
+		else//add the hotair variable to the pressure map, like black hole, or white hole.
+		{
+			pv[y/CELL][x/CELL] += elements[t].HotAir;
+			if (y+CELL<YRES)
+				pv[y/CELL+1][x/CELL] += elements[t].HotAir;
+			if (x+CELL<XRES)
 			{
-				if (elements[t].Gravity)
-				{
-					//Gravity mode by Moach
-					switch (gravityMode)
-					{
-					default:
-					case 0:
-						pGravX = 0.0f;
-						pGravY = elements[t].Gravity;
-						break;
-					case 1:
-						pGravX = pGravY = 0.0f;
-						break;
-					case 2:
-						pGravD = 0.01f - hypotf((x - XCNTR), (y - YCNTR));
-						pGravX = elements[t].Gravity * ((float)(x - XCNTR) / pGravD);
-						pGravY = elements[t].Gravity * ((float)(y - YCNTR) / pGravD);
-						break;
-					}
-				}
-				if (elements[t].NewtonianGravity)
-				{
-					//Get some gravity from the gravity map
-					pGravX += elements[t].NewtonianGravity * gravx[(y/CELL)*(XRES/CELL)+(x/CELL)];
-					pGravY += elements[t].NewtonianGravity * gravy[(y/CELL)*(XRES/CELL)+(x/CELL)];
-				}
+				pv[y/CELL][x/CELL+1] += elements[t].HotAir;
+				if (y+CELL<YRES)
+					pv[y/CELL+1][x/CELL+1] += elements[t].HotAir;
 			}
+		}
+	}
 
-			//velocity updates for the particle
-			if (t != PT_SPNG || !(parts[i].flags&FLAG_MOVABLE))
+	pGravX = pGravY = 0;
+	if (!(elements[t].Properties & TYPE_SOLID))
+	{
+		if (elements[t].Gravity)
+		{
+			//Gravity mode by Moach
+			switch (gravityMode)
 			{
-				parts[i].vx *= elements[t].Loss;
-				parts[i].vy *= elements[t].Loss;
+			default:
+			case 0:
+				pGravX = 0.0f;
+				pGravY = elements[t].Gravity;
+				break;
+			case 1:
+				pGravX = pGravY = 0.0f;
+				break;
+			case 2:
+				pGravD = 0.01f - hypotf((x - XCNTR), (y - YCNTR));
+				pGravX = elements[t].Gravity * ((float)(x - XCNTR) / pGravD);
+				pGravY = elements[t].Gravity * ((float)(y - YCNTR) / pGravD);
+				break;
 			}
-			//particle gets velocity from the vx and vy maps
-			parts[i].vx += elements[t].Advection*vx[y/CELL][x/CELL] + pGravX;
-			parts[i].vy += elements[t].Advection*vy[y/CELL][x/CELL] + pGravY;
+		}
+		if (elements[t].NewtonianGravity)
+		{
+			//Get some gravity from the gravity map
+			pGravX += elements[t].NewtonianGravity * gravx[(y/CELL)*(XRES/CELL)+(x/CELL)];
+			pGravY += elements[t].NewtonianGravity * gravy[(y/CELL)*(XRES/CELL)+(x/CELL)];
+		}
+	}
+
+	//velocity updates for the particle
+	if (t != PT_SPNG || !(parts[i].flags&FLAG_MOVABLE))
+	{
+		parts[i].vx *= elements[t].Loss;
+		parts[i].vy *= elements[t].Loss;
+	}
+	//particle gets velocity from the vx and vy maps
+	parts[i].vx += elements[t].Advection*vx[y/CELL][x/CELL] + pGravX;
+	parts[i].vy += elements[t].Advection*vy[y/CELL][x/CELL] + pGravY;
 
 
-			if (elements[t].Diffusion)//the random diffusion that gasses have
-			{
+	if (elements[t].Diffusion)//the random diffusion that gasses have
+	{
 #ifdef REALISTIC
-				//The magic number controls diffusion speed
-				parts[i].vx += 0.05*sqrtf(parts[i].temp)*elements[t].Diffusion*(2.0f*RNG::Ref().uniform01()-1.0f);
-				parts[i].vy += 0.05*sqrtf(parts[i].temp)*elements[t].Diffusion*(2.0f*RNG::Ref().uniform01()-1.0f);
+		//The magic number controls diffusion speed
+		parts[i].vx += 0.05*sqrtf(parts[i].temp)*elements[t].Diffusion*(2.0f*RNG::Ref().uniform01()-1.0f);
+		parts[i].vy += 0.05*sqrtf(parts[i].temp)*elements[t].Diffusion*(2.0f*RNG::Ref().uniform01()-1.0f);
 #else
-				parts[i].vx += elements[t].Diffusion*(2.0f*RNG::Ref().uniform01()-1.0f);
-				parts[i].vy += elements[t].Diffusion*(2.0f*RNG::Ref().uniform01()-1.0f);
+		parts[i].vx += elements[t].Diffusion*(2.0f*RNG::Ref().uniform01()-1.0f);
+		parts[i].vy += elements[t].Diffusion*(2.0f*RNG::Ref().uniform01()-1.0f);
 #endif
-			}
+	}
 
-			transitionOccurred = false;
-
-			j = surround_space = nt = 0;//if nt is greater than 1 after this, then there is a particle around the current particle, that is NOT the current particle's type, for water movement.
-			for (nx=-1; nx<2; nx++)
-				for (ny=-1; ny<2; ny++) {
-					if (nx||ny) {
-						surround[j] = r = pmap[y+ny][x+nx];
-						j++;
-						if (!TYP(r))
-							surround_space++;//there is empty space
-						if (TYP(r)!=t)
-							nt++;//there is nothing or a different particle
-					}
-				}
+	transitionOccurred = false;
 
-			float gel_scale = 1.0f;
-			if (t==PT_GEL)
-				gel_scale = parts[i].tmp*2.55f;
+	j = surround_space = nt = 0;//if nt is greater than 1 after this, then there is a particle around the current particle, that is NOT the current particle's type, for water movement.
+	for (nx=-1; nx<2; nx++)
+		for (ny=-1; ny<2; ny++) {
+			if (nx||ny) {
+				surround[j] = r = pmap[y+ny][x+nx];
+				j++;
+				if (!TYP(r))
+					surround_space++;//there is empty space
+				if (TYP(r)!=t)
+					nt++;//there is nothing or a different particle
+			}
+		}
 
-			if (!legacy_enable)
-			{
-				if (y-2 >= 0 && y-2 < YRES && (elements[t].Properties&TYPE_LIQUID) && (t!=PT_GEL || gel_scale > (1 + RNG::Ref().between(0, 254)))) {//some heat convection for liquids
-					r = pmap[y-2][x];
-					if (!(!r || parts[i].type != TYP(r))) {
-						if (parts[i].temp>parts[ID(r)].temp) {
-							swappage = parts[i].temp;
-							parts[i].temp = parts[ID(r)].temp;
-							parts[ID(r)].temp = swappage;
-						}
-					}
+	float gel_scale = 1.0f;
+	if (t==PT_GEL)
+		gel_scale = parts[i].tmp*2.55f;
+
+	if (!legacy_enable)
+	{
+		if (y-2 >= 0 && y-2 < YRES && (elements[t].Properties&TYPE_LIQUID) && (t!=PT_GEL || gel_scale > (1 + RNG::Ref().between(0, 254)))) {//some heat convection for liquids
+			r = pmap[y-2][x];
+			if (!(!r || parts[i].type != TYP(r))) {
+				if (parts[i].temp>parts[ID(r)].temp) {
+					swappage = parts[i].temp;
+					parts[i].temp = parts[ID(r)].temp;
+					parts[ID(r)].temp = swappage;
 				}
+			}
+		}
 
-				//heat transfer code
-				h_count = 0;
+		//heat transfer code
+		h_count = 0;
 #ifdef REALISTIC
-				if (t&&(t!=PT_HSWC||parts[i].life==10)&&(elements[t].HeatConduct*gel_scale))
+		if (t&&(t!=PT_HSWC||parts[i].life==10)&&(elements[t].HeatConduct*gel_scale))
 #else
-				if (t && (t!=PT_HSWC||parts[i].life==10) && RNG::Ref().chance(elements[t].HeatConduct*gel_scale, 250))
+		if (t && (t!=PT_HSWC||parts[i].life==10) && RNG::Ref().chance(elements[t].HeatConduct*gel_scale, 250))
 #endif
-				{
-					if (aheat_enable && !(elements[t].Properties&PROP_NOAMBHEAT))
-					{
+		{
+			if (aheat_enable && !(elements[t].Properties&PROP_NOAMBHEAT))
+			{
 #ifdef REALISTIC
-						c_heat = parts[i].temp*96.645/elements[t].HeatConduct*gel_scale*fabs(elements[t].Weight) + hv[y/CELL][x/CELL]*100*(pv[y/CELL][x/CELL]+273.15f)/256;
-						float c_Cm = 96.645/elements[t].HeatConduct*gel_scale*fabs(elements[t].Weight)  + 100*(pv[y/CELL][x/CELL]+273.15f)/256;
-						pt = c_heat/c_Cm;
-						pt = restrict_flt(pt, -MAX_TEMP+MIN_TEMP, MAX_TEMP-MIN_TEMP);
-						parts[i].temp = pt;
-						//Pressure increase from heat (temporary)
-						pv[y/CELL][x/CELL] += (pt-hv[y/CELL][x/CELL])*0.004;
-						hv[y/CELL][x/CELL] = pt;
+				c_heat = parts[i].temp*96.645/elements[t].HeatConduct*gel_scale*fabs(elements[t].Weight) + hv[y/CELL][x/CELL]*100*(pv[y/CELL][x/CELL]+273.15f)/256;
+				float c_Cm = 96.645/elements[t].HeatConduct*gel_scale*fabs(elements[t].Weight)  + 100*(pv[y/CELL][x/CELL]+273.15f)/256;
+				pt = c_heat/c_Cm;
+				pt = restrict_flt(pt, -MAX_TEMP+MIN_TEMP, MAX_TEMP-MIN_TEMP);
+				parts[i].temp = pt;
+				//Pressure increase from heat (temporary)
+				pv[y/CELL][x/CELL] += (pt-hv[y/CELL][x/CELL])*0.004;
+				hv[y/CELL][x/CELL] = pt;
 #else
-						c_heat = (hv[y/CELL][x/CELL]-parts[i].temp)*0.04;
-						c_heat = restrict_flt(c_heat, -MAX_TEMP+MIN_TEMP, MAX_TEMP-MIN_TEMP);
-						parts[i].temp += c_heat;
-						hv[y/CELL][x/CELL] -= c_heat;
+				c_heat = (hv[y/CELL][x/CELL]-parts[i].temp)*0.04;
+				c_heat = restrict_flt(c_heat, -MAX_TEMP+MIN_TEMP, MAX_TEMP-MIN_TEMP);
+				parts[i].temp += c_heat;
+				hv[y/CELL][x/CELL] -= c_heat;
 #endif
-					}
-					c_heat = 0.0f;
+			}
+			c_heat = 0.0f;
 #ifdef REALISTIC
-					float c_Cm = 0.0f;
+			float c_Cm = 0.0f;
 #endif
-					for (j=0; j<8; j++)
-					{
-						surround_hconduct[j] = i;
-						r = surround[j];
-						if (!r)
-							continue;
-						rt = TYP(r);
-						if (rt && elements[rt].HeatConduct && (rt!=PT_HSWC||parts[ID(r)].life==10)
-						        && (t!=PT_FILT||(rt!=PT_BRAY&&rt!=PT_BIZR&&rt!=PT_BIZRG))
-						        && (rt!=PT_FILT||(t!=PT_BRAY&&t!=PT_PHOT&&t!=PT_BIZR&&t!=PT_BIZRG))
-						        && (t!=PT_ELEC||rt!=PT_DEUT)
-						        && (t!=PT_DEUT||rt!=PT_ELEC)
-						        && (t!=PT_HSWC || rt!=PT_FILT || parts[i].tmp != 1)
-						        && (t!=PT_FILT || rt!=PT_HSWC || parts[ID(r)].tmp != 1))
-						{
-							surround_hconduct[j] = ID(r);
+			for (j=0; j<8; j++)
+			{
+				surround_hconduct[j] = i;
+				r = surround[j];
+				if (!r)
+					continue;
+				rt = TYP(r);
+				if (rt && elements[rt].HeatConduct && (rt!=PT_HSWC||parts[ID(r)].life==10)
+				        && (t!=PT_FILT||(rt!=PT_BRAY&&rt!=PT_BIZR&&rt!=PT_BIZRG))
+				        && (rt!=PT_FILT||(t!=PT_BRAY&&t!=PT_PHOT&&t!=PT_BIZR&&t!=PT_BIZRG))
+				        && (t!=PT_ELEC||rt!=PT_DEUT)
+				        && (t!=PT_DEUT||rt!=PT_ELEC)
+				        && (t!=PT_HSWC || rt!=PT_FILT || parts[i].tmp != 1)
+				        && (t!=PT_FILT || rt!=PT_HSWC || parts[ID(r)].tmp != 1))
+				{
+					surround_hconduct[j] = ID(r);
 #ifdef REALISTIC
-							if (rt==PT_GEL)
-								gel_scale = parts[ID(r)].tmp*2.55f;
-							else gel_scale = 1.0f;
+					if (rt==PT_GEL)
+						gel_scale = parts[ID(r)].tmp*2.55f;
+					else gel_scale = 1.0f;
 
-							c_heat += parts[ID(r)].temp*96.645/elements[rt].HeatConduct*gel_scale*fabs(elements[rt].Weight);
-							c_Cm += 96.645/elements[rt].HeatConduct*gel_scale*fabs(elements[rt].Weight);
+					c_heat += parts[ID(r)].temp*96.645/elements[rt].HeatConduct*gel_scale*fabs(elements[rt].Weight);
+					c_Cm += 96.645/elements[rt].HeatConduct*gel_scale*fabs(elements[rt].Weight);
 #else
-							c_heat += parts[ID(r)].temp;
+					c_heat += parts[ID(r)].temp;
 #endif
-							h_count++;
-						}
-					}
+					h_count++;
+				}
+			}
 #ifdef REALISTIC
-					if (t==PT_GEL)
-						gel_scale = parts[i].tmp*2.55f;
-					else gel_scale = 1.0f;
+			if (t==PT_GEL)
+				gel_scale = parts[i].tmp*2.55f;
+			else gel_scale = 1.0f;
 
-					if (t == PT_PHOT)
-						pt = (c_heat+parts[i].temp*96.645)/(c_Cm+96.645);
-					else
-						pt = (c_heat+parts[i].temp*96.645/elements[t].HeatConduct*gel_scale*fabs(elements[t].Weight))/(c_Cm+96.645/elements[t].HeatConduct*gel_scale*fabs(elements[t].Weight));
+			if (t == PT_PHOT)
+				pt = (c_heat+parts[i].temp*96.645)/(c_Cm+96.645);
+			else
+				pt = (c_heat+parts[i].temp*96.645/elements[t].HeatConduct*gel_scale*fabs(elements[t].Weight))/(c_Cm+96.645/elements[t].HeatConduct*gel_scale*fabs(elements[t].Weight));
 
-					c_heat += parts[i].temp*96.645/elements[t].HeatConduct*gel_scale*fabs(elements[t].Weight);
-					c_Cm += 96.645/elements[t].HeatConduct*gel_scale*fabs(elements[t].Weight);
-					parts[i].temp = restrict_flt(pt, MIN_TEMP, MAX_TEMP);
+			c_heat += parts[i].temp*96.645/elements[t].HeatConduct*gel_scale*fabs(elements[t].Weight);
+			c_Cm += 96.645/elements[t].HeatConduct*gel_scale*fabs(elements[t].Weight);
+			parts[i].temp = restrict_flt(pt, MIN_TEMP, MAX_TEMP);
 #else
-					pt = (c_heat+parts[i].temp)/(h_count+1);
-					pt = parts[i].temp = restrict_flt(pt, MIN_TEMP, MAX_TEMP);
-					for (j=0; j<8; j++)
-					{
-						parts[surround_hconduct[j]].temp = pt;
-					}
+			pt = (c_heat+parts[i].temp)/(h_count+1);
+			pt = parts[i].temp = restrict_flt(pt, MIN_TEMP, MAX_TEMP);
+			for (j=0; j<8; j++)
+			{
+				parts[surround_hconduct[j]].temp = pt;
+			}
 #endif
 
-					ctemph = ctempl = pt;
-					// change boiling point with pressure
-					if (((elements[t].Properties&TYPE_LIQUID) && IsValidElement(elements[t].HighTemperatureTransition) && (elements[elements[t].HighTemperatureTransition].Properties&TYPE_GAS))
-					        || t==PT_LNTG || t==PT_SLTW)
-						ctemph -= 2.0f*pv[y/CELL][x/CELL];
-					else if (((elements[t].Properties&TYPE_GAS) && IsValidElement(elements[t].LowTemperatureTransition) && (elements[elements[t].LowTemperatureTransition].Properties&TYPE_LIQUID))
-					         || t==PT_WTRV)
-						ctempl -= 2.0f*pv[y/CELL][x/CELL];
-					s = 1;
-
-					//A fix for ice with ctype = 0
-					if ((t==PT_ICEI || t==PT_SNOW) && (!parts[i].ctype || !IsValidElement(parts[i].ctype) || parts[i].ctype==PT_ICEI || parts[i].ctype==PT_SNOW))
-						parts[i].ctype = PT_WATR;
-
-					if (elements[t].HighTemperatureTransition>-1 && ctemph>=elements[t].HighTemperature)
-					{
-						// particle type change due to high temperature
-#ifdef REALISTIC
-						float dbt = ctempl - pt;
-						if (elements[t].HighTemperatureTransition != PT_NUM)
-						{
-							if (platent[t] <= (c_heat - (elements[t].HighTemperature - dbt)*c_Cm))
-							{
-								pt = (c_heat - platent[t])/c_Cm;
-								t = elements[t].HighTemperatureTransition;
-							}
-							else
-							{
-								parts[i].temp = restrict_flt(elements[t].HighTemperature - dbt, MIN_TEMP, MAX_TEMP);
-								s = 0;
-							}
-						}
-#else
-						if (elements[t].HighTemperatureTransition != PT_NUM)
-							t = elements[t].HighTemperatureTransition;
-#endif
-						else if (t == PT_ICEI || t == PT_SNOW)
-						{
-							if (parts[i].ctype > 0 && parts[i].ctype < PT_NUM && parts[i].ctype != t)
-							{
-								if (elements[parts[i].ctype].LowTemperatureTransition==PT_ICEI || elements[parts[i].ctype].LowTemperatureTransition==PT_SNOW)
-								{
-									if (pt<elements[parts[i].ctype].LowTemperature)
-										s = 0;
-								}
-								else if (pt<273.15f)
-									s = 0;
+			ctemph = ctempl = pt;
+			// change boiling point with pressure
+			if (((elements[t].Properties&TYPE_LIQUID) && IsValidElement(elements[t].HighTemperatureTransition) && (elements[elements[t].HighTemperatureTransition].Properties&TYPE_GAS))
+			        || t==PT_LNTG || t==PT_SLTW)
+				ctemph -= 2.0f*pv[y/CELL][x/CELL];
+			else if (((elements[t].Properties&TYPE_GAS) && IsValidElement(elements[t].LowTemperatureTransition) && (elements[elements[t].LowTemperatureTransition].Properties&TYPE_LIQUID))
+			         || t==PT_WTRV)
+				ctempl -= 2.0f*pv[y/CELL][x/CELL];
+			s = 1;
 
-								if (s)
-								{
+			//A fix for ice with ctype = 0
+			if ((t==PT_ICEI || t==PT_SNOW) && (!parts[i].ctype || !IsValidElement(parts[i].ctype) || parts[i].ctype==PT_ICEI || parts[i].ctype==PT_SNOW))
+				parts[i].ctype = PT_WATR;
+
+			if (elements[t].HighTemperatureTransition>-1 && ctemph>=elements[t].HighTemperature)
+			{
+				// particle type change due to high temperature
 #ifdef REALISTIC
-									//One ice table value for all it's kinds
-									if (platent[t] <= (c_heat - (elements[parts[i].ctype].LowTemperature - dbt)*c_Cm))
-									{
-										pt = (c_heat - platent[t])/c_Cm;
-										t = parts[i].ctype;
-										parts[i].ctype = PT_NONE;
-										parts[i].life = 0;
-									}
-									else
-									{
-										parts[i].temp = restrict_flt(elements[parts[i].ctype].LowTemperature - dbt, MIN_TEMP, MAX_TEMP);
-										s = 0;
-									}
+				float dbt = ctempl - pt;
+				if (elements[t].HighTemperatureTransition != PT_NUM)
+				{
+					if (platent[t] <= (c_heat - (elements[t].HighTemperature - dbt)*c_Cm))
+					{
+						pt = (c_heat - platent[t])/c_Cm;
+						t = elements[t].HighTemperatureTransition;
+					}
+					else
+					{
+						parts[i].temp = restrict_flt(elements[t].HighTemperature - dbt, MIN_TEMP, MAX_TEMP);
+						s = 0;
+					}
+				}
 #else
-									t = parts[i].ctype;
-									parts[i].ctype = PT_NONE;
-									parts[i].life = 0;
+				if (elements[t].HighTemperatureTransition != PT_NUM)
+					t = elements[t].HighTemperatureTransition;
 #endif
-								}
-							}
-							else
+				else if (t == PT_ICEI || t == PT_SNOW)
+				{
+					if (parts[i].ctype > 0 && parts[i].ctype < PT_NUM && parts[i].ctype != t)
+					{
+						if (elements[parts[i].ctype].LowTemperatureTransition==PT_ICEI || elements[parts[i].ctype].LowTemperatureTransition==PT_SNOW)
+						{
+							if (pt<elements[parts[i].ctype].LowTemperature)
 								s = 0;
 						}
-						else if (t == PT_SLTW)
+						else if (pt<273.15f)
+							s = 0;
+
+						if (s)
 						{
 #ifdef REALISTIC
-							if (platent[t] <= (c_heat - (elements[t].HighTemperature - dbt)*c_Cm))
+							//One ice table value for all it's kinds
+							if (platent[t] <= (c_heat - (elements[parts[i].ctype].LowTemperature - dbt)*c_Cm))
 							{
 								pt = (c_heat - platent[t])/c_Cm;
-
-								if (RNG::Ref().chance(1, 4))
-									t = PT_SALT;
-								else
-									t = PT_WTRV;
+								t = parts[i].ctype;
+								parts[i].ctype = PT_NONE;
+								parts[i].life = 0;
 							}
 							else
 							{
-								parts[i].temp = restrict_flt(elements[t].HighTemperature - dbt, MIN_TEMP, MAX_TEMP);
+								parts[i].temp = restrict_flt(elements[parts[i].ctype].LowTemperature - dbt, MIN_TEMP, MAX_TEMP);
 								s = 0;
 							}
 #else
-							if (RNG::Ref().chance(1, 4))
-								t = PT_SALT;
-							else
-								t = PT_WTRV;
+							t = parts[i].ctype;
+							parts[i].ctype = PT_NONE;
+							parts[i].life = 0;
 #endif
 						}
-						else if (t == PT_BRMT)
-						{
-							if (parts[i].ctype == PT_TUNG)
-							{
-								if (ctemph < elements[parts[i].ctype].HighTemperature)
-									s = 0;
-								else
-								{
-									t = PT_LAVA;
-									parts[i].type = PT_TUNG;
-								}
-							}
-							else if (ctemph >= elements[t].HighTemperature)
-								t = PT_LAVA;
-							else
-								s = 0;
-						}
-						else if (t == PT_CRMC)
-						{
-							float pres = std::max((pv[y/CELL][x/CELL]+pv[(y-2)/CELL][x/CELL]+pv[(y+2)/CELL][x/CELL]+pv[y/CELL][(x-2)/CELL]+pv[y/CELL][(x+2)/CELL])*2.0f, 0.0f);
-							if (ctemph < pres+elements[PT_CRMC].HighTemperature)
-								s = 0;
-							else
-								t = PT_LAVA;
-						}
+					}
+					else
+						s = 0;
+				}
+				else if (t == PT_SLTW)
+				{
+#ifdef REALISTIC
+					if (platent[t] <= (c_heat - (elements[t].HighTemperature - dbt)*c_Cm))
+					{
+						pt = (c_heat - platent[t])/c_Cm;
+
+						if (RNG::Ref().chance(1, 4))
+							t = PT_SALT;
 						else
-							s = 0;
+							t = PT_WTRV;
 					}
-					else if (elements[t].LowTemperatureTransition > -1 && ctempl<elements[t].LowTemperature)
+					else
 					{
-						// particle type change due to low temperature
-#ifdef REALISTIC
-						float dbt = ctempl - pt;
-						if (elements[t].LowTemperatureTransition != PT_NUM)
-						{
-							if (platent[elements[t].LowTemperatureTransition] >= (c_heat - (elements[t].LowTemperature - dbt)*c_Cm))
-							{
-								pt = (c_heat + platent[elements[t].LowTemperatureTransition])/c_Cm;
-								t = elements[t].LowTemperatureTransition;
-							}
-							else
-							{
-								parts[i].temp = restrict_flt(elements[t].LowTemperature - dbt, MIN_TEMP, MAX_TEMP);
-								s = 0;
-							}
-						}
+						parts[i].temp = restrict_flt(elements[t].HighTemperature - dbt, MIN_TEMP, MAX_TEMP);
+						s = 0;
+					}
 #else
-						if (elements[t].LowTemperatureTransition != PT_NUM)
-							t = elements[t].LowTemperatureTransition;
+					if (RNG::Ref().chance(1, 4))
+						t = PT_SALT;
+					else
+						t = PT_WTRV;
 #endif
-						else if (t == PT_WTRV)
-						{
-							if (pt < 273.0f)
-								t = PT_RIME;
-							else
-								t = PT_DSTW;
-						}
-						else if (t == PT_LAVA)
+				}
+				else if (t == PT_BRMT)
+				{
+					if (parts[i].ctype == PT_TUNG)
+					{
+						if (ctemph < elements[parts[i].ctype].HighTemperature)
+							s = 0;
+						else
 						{
-							if (parts[i].ctype>0 && parts[i].ctype<PT_NUM && parts[i].ctype!=PT_LAVA && parts[i].ctype!=PT_LAVA && elements[parts[i].ctype].Enabled)
-							{
-								if (parts[i].ctype==PT_THRM&&pt>=elements[PT_BMTL].HighTemperature)
-									s = 0;
-								else if ((parts[i].ctype==PT_VIBR || parts[i].ctype==PT_BVBR) && pt>=273.15f)
-									s = 0;
-								else if (parts[i].ctype==PT_TUNG)
-								{
-									// TUNG does its own melting in its update function, so HighTemperatureTransition is not LAVA so it won't be handled by the code for HighTemperatureTransition==PT_LAVA below
-									// However, the threshold is stored in HighTemperature to allow it to be changed from Lua
-									if (pt>=elements[parts[i].ctype].HighTemperature)
-										s = 0;
-								}
-								else if (parts[i].ctype == PT_CRMC)
-								{
-									float pres = std::max((pv[y/CELL][x/CELL]+pv[(y-2)/CELL][x/CELL]+pv[(y+2)/CELL][x/CELL]+pv[y/CELL][(x-2)/CELL]+pv[y/CELL][(x+2)/CELL])*2.0f, 0.0f);
-									if (ctemph >= pres+elements[PT_CRMC].HighTemperature)
-										s = 0;
-								}
-								else if (elements[parts[i].ctype].HighTemperatureTransition == PT_LAVA || parts[i].ctype == PT_HEAC)
-								{
-									if (pt >= elements[parts[i].ctype].HighTemperature)
-										s = 0;
-								}
-								else if (pt>=973.0f)
-									s = 0; // freezing point for lava with any other (not listed in ptransitions as turning into lava) ctype
-								if (s)
-								{
-									t = parts[i].ctype;
-									parts[i].ctype = PT_NONE;
-									if (t == PT_THRM)
-									{
-										parts[i].tmp = 0;
-										t = PT_BMTL;
-									}
-									if (t == PT_PLUT)
-									{
-										parts[i].tmp = 0;
-										t = PT_LAVA;
-									}
-								}
-							}
-							else if (pt<973.0f)
-								t = PT_STNE;
-							else
-								s = 0;
+							t = PT_LAVA;
+							parts[i].type = PT_TUNG;
 						}
-						else
-							s = 0;
 					}
+					else if (ctemph >= elements[t].HighTemperature)
+						t = PT_LAVA;
 					else
 						s = 0;
+				}
+				else if (t == PT_CRMC)
+				{
+					float pres = std::max((pv[y/CELL][x/CELL]+pv[(y-2)/CELL][x/CELL]+pv[(y+2)/CELL][x/CELL]+pv[y/CELL][(x-2)/CELL]+pv[y/CELL][(x+2)/CELL])*2.0f, 0.0f);
+					if (ctemph < pres+elements[PT_CRMC].HighTemperature)
+						s = 0;
+					else
+						t = PT_LAVA;
+				}
+				else
+					s = 0;
+			}
+			else if (elements[t].LowTemperatureTransition > -1 && ctempl<elements[t].LowTemperature)
+			{
+				// particle type change due to low temperature
 #ifdef REALISTIC
-					pt = restrict_flt(pt, MIN_TEMP, MAX_TEMP);
-					for (j=0; j<8; j++)
+				float dbt = ctempl - pt;
+				if (elements[t].LowTemperatureTransition != PT_NUM)
+				{
+					if (platent[elements[t].LowTemperatureTransition] >= (c_heat - (elements[t].LowTemperature - dbt)*c_Cm))
 					{
-						parts[surround_hconduct[j]].temp = pt;
+						pt = (c_heat + platent[elements[t].LowTemperatureTransition])/c_Cm;
+						t = elements[t].LowTemperatureTransition;
 					}
-#endif
-					if (s) // particle type change occurred
+					else
 					{
-						if (t==PT_ICEI || t==PT_LAVA || t==PT_SNOW)
-							parts[i].ctype = parts[i].type;
-						if (!(t==PT_ICEI && parts[i].ctype==PT_FRZW))
-							parts[i].life = 0;
-						if (t == PT_FIRE)
-						{
-							//hackish, if tmp isn't 0 the FIRE might turn into DSTW later
-							//idealy transitions should use create_part(i) but some elements rely on properties staying constant
-							//and I don't feel like checking each one right now
-							parts[i].tmp = 0;
-						}
-						if ((elements[t].Properties&TYPE_GAS) && !(elements[parts[i].type].Properties&TYPE_GAS))
-							pv[y/CELL][x/CELL] += 0.50f;
-
-						if (t == PT_NONE)
+						parts[i].temp = restrict_flt(elements[t].LowTemperature - dbt, MIN_TEMP, MAX_TEMP);
+						s = 0;
+					}
+				}
+#else
+				if (elements[t].LowTemperatureTransition != PT_NUM)
+					t = elements[t].LowTemperatureTransition;
+#endif
+				else if (t == PT_WTRV)
+				{
+					if (pt < 273.0f)
+						t = PT_RIME;
+					else
+						t = PT_DSTW;
+				}
+				else if (t == PT_LAVA)
+				{
+					if (parts[i].ctype>0 && parts[i].ctype<PT_NUM && parts[i].ctype!=PT_LAVA && parts[i].ctype!=PT_LAVA && elements[parts[i].ctype].Enabled)
+					{
+						if (parts[i].ctype==PT_THRM&&pt>=elements[PT_BMTL].HighTemperature)
+							s = 0;
+						else if ((parts[i].ctype==PT_VIBR || parts[i].ctype==PT_BVBR) && pt>=273.15f)
+							s = 0;
+						else if (parts[i].ctype==PT_TUNG)
 						{
-							kill_part(i);
-							goto killed;
+							// TUNG does its own melting in its update function, so HighTemperatureTransition is not LAVA so it won't be handled by the code for HighTemperatureTransition==PT_LAVA below
+							// However, the threshold is stored in HighTemperature to allow it to be changed from Lua
+							if (pt>=elements[parts[i].ctype].HighTemperature)
+								s = 0;
 						}
-						// part_change_type could refuse to change the type and kill the particle
-						// for example, changing type to STKM but one already exists
-						// we need to account for that to not cause simulation corruption issues
-						if (part_change_type(i,x,y,t))
-							goto killed;
-
-						if (t==PT_FIRE || t==PT_PLSM || t==PT_CFLM)
-							parts[i].life = RNG::Ref().between(120, 169);
-						if (t == PT_LAVA)
+						else if (parts[i].ctype == PT_CRMC)
 						{
-							if (parts[i].ctype == PT_BRMT) parts[i].ctype = PT_BMTL;
-							else if (parts[i].ctype == PT_SAND) parts[i].ctype = PT_GLAS;
-							else if (parts[i].ctype == PT_BGLA) parts[i].ctype = PT_GLAS;
-							else if (parts[i].ctype == PT_PQRT) parts[i].ctype = PT_QRTZ;
-							parts[i].life = RNG::Ref().between(240, 359);
+							float pres = std::max((pv[y/CELL][x/CELL]+pv[(y-2)/CELL][x/CELL]+pv[(y+2)/CELL][x/CELL]+pv[y/CELL][(x-2)/CELL]+pv[y/CELL][(x+2)/CELL])*2.0f, 0.0f);
+							if (ctemph >= pres+elements[PT_CRMC].HighTemperature)
+								s = 0;
 						}
-						transitionOccurred = true;
-					}
-
-					pt = parts[i].temp = restrict_flt(parts[i].temp, MIN_TEMP, MAX_TEMP);
-					if (t == PT_LAVA)
-					{
-						parts[i].life = restrict_flt((parts[i].temp-700)/7, 0.0f, 400.0f);
-						if (parts[i].ctype==PT_THRM&&parts[i].tmp>0)
+						else if (elements[parts[i].ctype].HighTemperatureTransition == PT_LAVA || parts[i].ctype == PT_HEAC)
 						{
-							parts[i].tmp--;
-							parts[i].temp = 3500;
+							if (pt >= elements[parts[i].ctype].HighTemperature)
+								s = 0;
 						}
-						if (parts[i].ctype==PT_PLUT&&parts[i].tmp>0)
+						else if (pt>=973.0f)
+							s = 0; // freezing point for lava with any other (not listed in ptransitions as turning into lava) ctype
+						if (s)
 						{
-							parts[i].tmp--;
-							parts[i].temp = MAX_TEMP;
+							t = parts[i].ctype;
+							parts[i].ctype = PT_NONE;
+							if (t == PT_THRM)
+							{
+								parts[i].tmp = 0;
+								t = PT_BMTL;
+							}
+							if (t == PT_PLUT)
+							{
+								parts[i].tmp = 0;
+								t = PT_LAVA;
+							}
 						}
 					}
+					else if (pt<973.0f)
+						t = PT_STNE;
+					else
+						s = 0;
 				}
 				else
-				{
-					if (!(air->bmap_blockairh[y/CELL][x/CELL]&0x8))
-						air->bmap_blockairh[y/CELL][x/CELL]++;
-					parts[i].temp = restrict_flt(parts[i].temp, MIN_TEMP, MAX_TEMP);
-				}
-			}
-
-			if (t==PT_LIFE)
-			{
-				parts[i].temp = restrict_flt(parts[i].temp-50.0f, MIN_TEMP, MAX_TEMP);
+					s = 0;
 			}
-			if (t==PT_WIRE)
+			else
+				s = 0;
+#ifdef REALISTIC
+			pt = restrict_flt(pt, MIN_TEMP, MAX_TEMP);
+			for (j=0; j<8; j++)
 			{
-				//wire_placed = 1;
+				parts[surround_hconduct[j]].temp = pt;
 			}
-			//spark updates from walls
-			if ((elements[t].Properties&PROP_CONDUCTS) || t==PT_SPRK)
+#endif
+			if (s) // particle type change occurred
 			{
-				nx = x % CELL;
-				if (nx == 0)
-					nx = x/CELL - 1;
-				else if (nx == CELL-1)
-					nx = x/CELL + 1;
-				else
-					nx = x/CELL;
-				ny = y % CELL;
-				if (ny == 0)
-					ny = y/CELL - 1;
-				else if (ny == CELL-1)
-					ny = y/CELL + 1;
-				else
-					ny = y/CELL;
-				if (nx>=0 && ny>=0 && nx<XRES/CELL && ny<YRES/CELL)
+				if (t==PT_ICEI || t==PT_LAVA || t==PT_SNOW)
+					parts[i].ctype = parts[i].type;
+				if (!(t==PT_ICEI && parts[i].ctype==PT_FRZW))
+					parts[i].life = 0;
+				if (t == PT_FIRE)
 				{
-					if (t!=PT_SPRK)
-					{
-						if (emap[ny][nx]==12 && !parts[i].life && bmap[ny][nx] != WL_STASIS)
-						{
-							part_change_type(i,x,y,PT_SPRK);
-							parts[i].life = 4;
-							parts[i].ctype = t;
-							t = PT_SPRK;
-						}
-					}
-					else if (bmap[ny][nx]==WL_DETECT || bmap[ny][nx]==WL_EWALL || bmap[ny][nx]==WL_ALLOWLIQUID || bmap[ny][nx]==WL_WALLELEC || bmap[ny][nx]==WL_ALLOWALLELEC || bmap[ny][nx]==WL_EHOLE)
-						set_emap(nx, ny);
+					//hackish, if tmp isn't 0 the FIRE might turn into DSTW later
+					//idealy transitions should use create_part(i) but some elements rely on properties staying constant
+					//and I don't feel like checking each one right now
+					parts[i].tmp = 0;
 				}
-			}
+				if ((elements[t].Properties&TYPE_GAS) && !(elements[parts[i].type].Properties&TYPE_GAS))
+					pv[y/CELL][x/CELL] += 0.50f;
 
-			//the basic explosion, from the .explosive variable
-			if ((elements[t].Explosive&2) && pv[y/CELL][x/CELL]>2.5f)
-			{
-				parts[i].life = RNG::Ref().between(180, 259);
-				parts[i].temp = restrict_flt(elements[PT_FIRE].DefaultProperties.temp + (elements[t].Flammable/2), MIN_TEMP, MAX_TEMP);
-				t = PT_FIRE;
-				part_change_type(i,x,y,t);
-				pv[y/CELL][x/CELL] += 0.25f * CFDS;
-			}
-
-
-			s = 1;
-			gravtot = fabs(gravy[(y/CELL)*(XRES/CELL)+(x/CELL)])+fabs(gravx[(y/CELL)*(XRES/CELL)+(x/CELL)]);
-			if (elements[t].HighPressureTransition>-1 && pv[y/CELL][x/CELL]>elements[t].HighPressure) {
-				// particle type change due to high pressure
-				if (elements[t].HighPressureTransition!=PT_NUM)
-					t = elements[t].HighPressureTransition;
-				else if (t==PT_BMTL) {
-					if (pv[y/CELL][x/CELL]>2.5f)
-						t = PT_BRMT;
-					else if (pv[y/CELL][x/CELL]>1.0f && parts[i].tmp==1)
-						t = PT_BRMT;
-					else s = 0;
-				}
-				else s = 0;
-			} else if (elements[t].LowPressureTransition>-1 && pv[y/CELL][x/CELL]<elements[t].LowPressure && gravtot<=(elements[t].LowPressure/4.0f)) {
-				// particle type change due to low pressure
-				if (elements[t].LowPressureTransition!=PT_NUM)
-					t = elements[t].LowPressureTransition;
-				else s = 0;
-			} else if (elements[t].HighPressureTransition>-1 && gravtot>(elements[t].HighPressure/4.0f)) {
-				// particle type change due to high gravity
-				if (elements[t].HighPressureTransition!=PT_NUM)
-					t = elements[t].HighPressureTransition;
-				else if (t==PT_BMTL) {
-					if (gravtot>0.625f)
-						t = PT_BRMT;
-					else if (gravtot>0.25f && parts[i].tmp==1)
-						t = PT_BRMT;
-					else s = 0;
-				}
-				else s = 0;
-			} else s = 0;
-
-			// particle type change occurred
-			if (s)
-			{
 				if (t == PT_NONE)
 				{
 					kill_part(i);
 					goto killed;
 				}
-				parts[i].life = 0;
 				// part_change_type could refuse to change the type and kill the particle
 				// for example, changing type to STKM but one already exists
 				// we need to account for that to not cause simulation corruption issues
 				if (part_change_type(i,x,y,t))
 					goto killed;
-				if (t == PT_FIRE)
+
+				if (t==PT_FIRE || t==PT_PLSM || t==PT_CFLM)
 					parts[i].life = RNG::Ref().between(120, 169);
+				if (t == PT_LAVA)
+				{
+					if (parts[i].ctype == PT_BRMT) parts[i].ctype = PT_BMTL;
+					else if (parts[i].ctype == PT_SAND) parts[i].ctype = PT_GLAS;
+					else if (parts[i].ctype == PT_BGLA) parts[i].ctype = PT_GLAS;
+					else if (parts[i].ctype == PT_PQRT) parts[i].ctype = PT_QRTZ;
+					parts[i].life = RNG::Ref().between(240, 359);
+				}
 				transitionOccurred = true;
 			}
 
-			//call the particle update function, if there is one
-#if !defined(RENDERER) && defined(LUACONSOLE)
-			if (lua_el_mode[parts[i].type] == 3)
+			pt = parts[i].temp = restrict_flt(parts[i].temp, MIN_TEMP, MAX_TEMP);
+			if (t == PT_LAVA)
 			{
-				if (luacon_elementReplacement(this, i, x, y, surround_space, nt, parts, pmap) || t != parts[i].type)
-					continue;
-				// Need to update variables, in case they've been changed by Lua
-				x = (int)(parts[i].x+0.5f);
-				y = (int)(parts[i].y+0.5f);
+				parts[i].life = restrict_flt((parts[i].temp-700)/7, 0.0f, 400.0f);
+				if (parts[i].ctype==PT_THRM&&parts[i].tmp>0)
+				{
+					parts[i].tmp--;
+					parts[i].temp = 3500;
+				}
+				if (parts[i].ctype==PT_PLUT&&parts[i].tmp>0)
+				{
+					parts[i].tmp--;
+					parts[i].temp = MAX_TEMP;
+				}
 			}
+		}
+		else
+		{
+			if (!(air->bmap_blockairh[y/CELL][x/CELL]&0x8))
+				air->bmap_blockairh[y/CELL][x/CELL]++;
+			parts[i].temp = restrict_flt(parts[i].temp, MIN_TEMP, MAX_TEMP);
+		}
+	}
 
-			if (elements[t].Update && lua_el_mode[t] != 2)
-#else
-			if (elements[t].Update)
-#endif
+	if (t==PT_LIFE)
+	{
+		parts[i].temp = restrict_flt(parts[i].temp-50.0f, MIN_TEMP, MAX_TEMP);
+	}
+	if (t==PT_WIRE)
+	{
+		//wire_placed = 1;
+	}
+	//spark updates from walls
+	if ((elements[t].Properties&PROP_CONDUCTS) || t==PT_SPRK)
+	{
+		nx = x % CELL;
+		if (nx == 0)
+			nx = x/CELL - 1;
+		else if (nx == CELL-1)
+			nx = x/CELL + 1;
+		else
+			nx = x/CELL;
+		ny = y % CELL;
+		if (ny == 0)
+			ny = y/CELL - 1;
+		else if (ny == CELL-1)
+			ny = y/CELL + 1;
+		else
+			ny = y/CELL;
+		if (nx>=0 && ny>=0 && nx<XRES/CELL && ny<YRES/CELL)
+		{
+			if (t!=PT_SPRK)
 			{
-				if ((*(elements[t].Update))(this, i, x, y, surround_space, nt, parts, pmap))
-					continue;
-				else if (t==PT_WARP)
+				if (emap[ny][nx]==12 && !parts[i].life && bmap[ny][nx] != WL_STASIS)
 				{
-					// Warp does some movement in its update func, update variables to avoid incorrect data in pmap
-					x = (int)(parts[i].x+0.5f);
-					y = (int)(parts[i].y+0.5f);
+					part_change_type(i,x,y,PT_SPRK);
+					parts[i].life = 4;
+					parts[i].ctype = t;
+					t = PT_SPRK;
 				}
 			}
+			else if (bmap[ny][nx]==WL_DETECT || bmap[ny][nx]==WL_EWALL || bmap[ny][nx]==WL_ALLOWLIQUID || bmap[ny][nx]==WL_WALLELEC || bmap[ny][nx]==WL_ALLOWALLELEC || bmap[ny][nx]==WL_EHOLE)
+				set_emap(nx, ny);
+		}
+	}
+
+	//the basic explosion, from the .explosive variable
+	if ((elements[t].Explosive&2) && pv[y/CELL][x/CELL]>2.5f)
+	{
+		parts[i].life = RNG::Ref().between(180, 259);
+		parts[i].temp = restrict_flt(elements[PT_FIRE].DefaultProperties.temp + (elements[t].Flammable/2), MIN_TEMP, MAX_TEMP);
+		t = PT_FIRE;
+		part_change_type(i,x,y,t);
+		pv[y/CELL][x/CELL] += 0.25f * CFDS;
+	}
+
+
+	s = 1;
+	gravtot = fabs(gravy[(y/CELL)*(XRES/CELL)+(x/CELL)])+fabs(gravx[(y/CELL)*(XRES/CELL)+(x/CELL)]);
+	if (elements[t].HighPressureTransition>-1 && pv[y/CELL][x/CELL]>elements[t].HighPressure) {
+		// particle type change due to high pressure
+		if (elements[t].HighPressureTransition!=PT_NUM)
+			t = elements[t].HighPressureTransition;
+		else if (t==PT_BMTL) {
+			if (pv[y/CELL][x/CELL]>2.5f)
+				t = PT_BRMT;
+			else if (pv[y/CELL][x/CELL]>1.0f && parts[i].tmp==1)
+				t = PT_BRMT;
+			else s = 0;
+		}
+		else s = 0;
+	} else if (elements[t].LowPressureTransition>-1 && pv[y/CELL][x/CELL]<elements[t].LowPressure && gravtot<=(elements[t].LowPressure/4.0f)) {
+		// particle type change due to low pressure
+		if (elements[t].LowPressureTransition!=PT_NUM)
+			t = elements[t].LowPressureTransition;
+		else s = 0;
+	} else if (elements[t].HighPressureTransition>-1 && gravtot>(elements[t].HighPressure/4.0f)) {
+		// particle type change due to high gravity
+		if (elements[t].HighPressureTransition!=PT_NUM)
+			t = elements[t].HighPressureTransition;
+		else if (t==PT_BMTL) {
+			if (gravtot>0.625f)
+				t = PT_BRMT;
+			else if (gravtot>0.25f && parts[i].tmp==1)
+				t = PT_BRMT;
+			else s = 0;
+		}
+		else s = 0;
+	} else s = 0;
+
+	// particle type change occurred
+	if (s)
+	{
+		if (t == PT_NONE)
+		{
+			kill_part(i);
+			goto killed;
+		}
+		parts[i].life = 0;
+		// part_change_type could refuse to change the type and kill the particle
+		// for example, changing type to STKM but one already exists
+		// we need to account for that to not cause simulation corruption issues
+		if (part_change_type(i,x,y,t))
+			goto killed;
+		if (t == PT_FIRE)
+			parts[i].life = RNG::Ref().between(120, 169);
+		transitionOccurred = true;
+	}
+
+	//call the particle update function, if there is one
 #if !defined(RENDERER) && defined(LUACONSOLE)
-			if (lua_el_mode[parts[i].type] && lua_el_mode[parts[i].type] != 3)
-			{
-				if (luacon_elementReplacement(this, i, x, y, surround_space, nt, parts, pmap) || t != parts[i].type)
-					continue;
-				// Need to update variables, in case they've been changed by Lua
-				x = (int)(parts[i].x+0.5f);
-				y = (int)(parts[i].y+0.5f);
-			}
+	if (lua_el_mode[parts[i].type] == 3)
+	{
+		int luaResult;
+		{
+			ElementProfiler::Timer timer(profiler, t, ElementProfiler::LUA);
+			luaResult = luacon_elementReplacement(this, i, x, y, surround_space, nt, parts, pmap);
+		}
+		if (luaResult || t != parts[i].type)
+			return;
+		// Need to update variables, in case they've been changed by Lua
+		x = (int)(parts[i].x+0.5f);
+		y = (int)(parts[i].y+0.5f);
+	}
+
+	if (elements[t].Update && lua_el_mode[t] != 2)
+#else
+	if (elements[t].Update)
+#endif
+	{
+		int updateResult;
+		{
+			ElementProfiler::Timer timer(profiler, t, ElementProfiler::UPDATE);
+			updateResult = (*(elements[t].Update))(this, i, x, y, surround_space, nt, parts, pmap);
+		}
+		if (updateResult)
+			return;
+		else if (t==PT_WARP)
+		{
+			// Warp does some movement in its update func, update variables to avoid incorrect data in pmap
+			x = (int)(parts[i].x+0.5f);
+			y = (int)(parts[i].y+0.5f);
+		}
+	}
+#if !defined(RENDERER) && defined(LUACONSOLE)
+	if (lua_el_mode[parts[i].type] && lua_el_mode[parts[i].type] != 3)
+	{
+		int luaResult;
+		{
+			ElementProfiler::Timer timer(profiler, parts[i].type, ElementProfiler::LUA);
+			luaResult = luacon_elementReplacement(this, i, x, y, surround_space, nt, parts, pmap);
+		}
+		if (luaResult || t != parts[i].type)
+			return;
+		// Need to update variables, in case they've been changed by Lua
+		x = (int)(parts[i].x+0.5f);
+		y = (int)(parts[i].y+0.5f);
+	}
 #endif
 
-			if(legacy_enable)//if heat sim is off
-				Element::legacyUpdate(this, i,x,y,surround_space,nt, parts, pmap);
+	if(legacy_enable)//if heat sim is off
+		Element::legacyUpdate(this, i,x,y,surround_space,nt, parts, pmap);
 
 killed:
-			if (parts[i].type == PT_NONE)//if its dead, skip to next particle
-				continue;
+	if (parts[i].type == PT_NONE)//if its dead, skip to next particle
+		return;
 
-			if (transitionOccurred)
-				continue;
+	if (transitionOccurred)
+		return;
 
-			if (!parts[i].vx&&!parts[i].vy)//if its not moving, skip to next particle, movement code it next
-				continue;
+	if (!parts[i].vx&&!parts[i].vy)//if its not moving, skip to next particle, movement code it next
+		return;
+
+	if (currentStrip && !currentStrip->CanMove(y, MoveReach(i, t, nt)))
+	{
+		// Let the serial pass do movement that could reach into a strip being updated at the same time
+		currentStrip->deferredMoves.push_back(DeferredMove{ i, t, nt, surround_space, pGravX, pGravY });
+		return;
+	}
+	MoveParticle(i, t, x, y, nt, surround_space, pGravX, pGravY);
+}
+
+void Simulation::MoveParticle(int i, int t, int x, int y, int nt, int surround_space, float pGravX, float pGravY)
+{
+	int j, nx, ny, r, s, rt;
+	float mv, dx, dy, nrx, nry, dp;
+	int fin_x, fin_y, clear_x, clear_y, stagnant;
+	float fin_xf, fin_yf, clear_xf, clear_yf;
+	float nn, ct1, ct2, swappage;
+	float pGravD;
 
-			mv = fmaxf(fabsf(parts[i].vx), fabsf(parts[i].vy));
-			if (mv < ISTP)
+	mv = fmaxf(fabsf(parts[i].vx), fabsf(parts[i].vy));
+	if (mv < ISTP)
+	{
+		clear_x = x;
+		clear_y = y;
+		clear_xf = parts[i].x;
+		clear_yf = parts[i].y;
+		fin_xf = clear_xf + parts[i].vx;
+		fin_yf = clear_yf + parts[i].vy;
+		fin_x = (int)(fin_xf+0.5f);
+		fin_y = (int)(fin_yf+0.5f);
+	}
+	else
+	{
+		if (mv > SIM_MAXVELOCITY)
+		{
+			parts[i].vx *= SIM_MAXVELOCITY/mv;
+			parts[i].vy *= SIM_MAXVELOCITY/mv;
+			mv = SIM_MAXVELOCITY;
+		}
+		// interpolate to see if there is anything in the way
+		dx = parts[i].vx*ISTP/mv;
+		dy = parts[i].vy*ISTP/mv;
+		fin_xf = parts[i].x;
+		fin_yf = parts[i].y;
+		fin_x = (int)(fin_xf+0.5f);
+		fin_y = (int)(fin_yf+0.5f);
+		bool closedEholeStart = this->InBounds(fin_x, fin_y) && (bmap[fin_y/CELL][fin_x/CELL] == WL_EHOLE && !emap[fin_y/CELL][fin_x/CELL]);
+		while (1)
+		{
+			mv -= ISTP;
+			fin_xf += dx;
+			fin_yf += dy;
+			fin_x = (int)(fin_xf+0.5f);
+			fin_y = (int)(fin_yf+0.5f);
+			if (edgeMode == 2)
 			{
-				clear_x = x;
-				clear_y = y;
-				clear_xf = parts[i].x;
-				clear_yf = parts[i].y;
-				fin_xf = clear_xf + parts[i].vx;
-				fin_yf = clear_yf + parts[i].vy;
+				bool x_ok = (fin_xf >= CELL-.5f && fin_xf < XRES-CELL-.5f);
+				bool y_ok = (fin_yf >= CELL-.5f && fin_yf < YRES-CELL-.5f);
+				if (!x_ok)
+					fin_xf = remainder_p(fin_xf-CELL+.5f, XRES-CELL*2.0f)+CELL-.5f;
+				if (!y_ok)
+					fin_yf = remainder_p(fin_yf-CELL+.5f, YRES-CELL*2.0f)+CELL-.5f;
 				fin_x = (int)(fin_xf+0.5f);
 				fin_y = (int)(fin_yf+0.5f);
 			}
-			else
+			if (mv <= 0.0f)
 			{
-				if (mv > SIM_MAXVELOCITY)
+				// nothing found
+				fin_xf = parts[i].x + parts[i].vx;
+				fin_yf = parts[i].y + parts[i].vy;
+				if (edgeMode == 2)
 				{
-					parts[i].vx *= SIM_MAXVELOCITY/mv;
-					parts[i].vy *= SIM_MAXVELOCITY/mv;
-					mv = SIM_MAXVELOCITY;
+					bool x_ok = (fin_xf >= CELL-.5f && fin_xf < XRES-CELL-.5f);
+					bool y_ok = (fin_yf >= CELL-.5f && fin_yf < YRES-CELL-.5f);
+					if (!x_ok)
+						fin_xf = remainder_p(fin_xf-CELL+.5f, XRES-CELL*2.0f)+CELL-.5f;
+					if (!y_ok)
+						fin_yf = remainder_p(fin_yf-CELL+.5f, YRES-CELL*2.0f)+CELL-.5f;
 				}
-				// interpolate to see if there is anything in the way
-				dx = parts[i].vx*ISTP/mv;
-				dy = parts[i].vy*ISTP/mv;
-				fin_xf = parts[i].x;
-				fin_yf = parts[i].y;
 				fin_x = (int)(fin_xf+0.5f);
 				fin_y = (int)(fin_yf+0.5f);
-				bool closedEholeStart = this->InBounds(fin_x, fin_y) && (bmap[fin_y/CELL][fin_x/CELL] == WL_EHOLE && !emap[fin_y/CELL][fin_x/CELL]);
-				while (1)
-				{
-					mv -= ISTP;
-					fin_xf += dx;
-					fin_yf += dy;
-					fin_x = (int)(fin_xf+0.5f);
-					fin_y = (int)(fin_yf+0.5f);
-					if (edgeMode == 2)
-					{
-						bool x_ok = (fin_xf >= CELL-.5f && fin_xf < XRES-CELL-.5f);
-						bool y_ok = (fin_yf >= CELL-.5f && fin_yf < YRES-CELL-.5f);
-						if (!x_ok)
-							fin_xf = remainder_p(fin_xf-CELL+.5f, XRES-CELL*2.0f)+CELL-.5f;
-						if (!y_ok)
-							fin_yf = remainder_p(fin_yf-CELL+.5f, YRES-CELL*2.0f)+CELL-.5f;
-						fin_x = (int)(fin_xf+0.5f);
-						fin_y = (int)(fin_yf+0.5f);
-					}
-					if (mv <= 0.0f)
-					{
-						// nothing found
-						fin_xf = parts[i].x + parts[i].vx;
-						fin_yf = parts[i].y + parts[i].vy;
-						if (edgeMode == 2)
-						{
-							bool x_ok = (fin_xf >= CELL-.5f && fin_xf < XRES-CELL-.5f);
-							bool y_ok = (fin_yf >= CELL-.5f && fin_yf < YRES-CELL-.5f);
-							if (!x_ok)
-								fin_xf = remainder_p(fin_xf-CELL+.5f, XRES-CELL*2.0f)+CELL-.5f;
-							if (!y_ok)
-								fin_yf = remainder_p(fin_yf-CELL+.5f, YRES-CELL*2.0f)+CELL-.5f;
-						}
-						fin_x = (int)(fin_xf+0.5f);
-						fin_y = (int)(fin_yf+0.5f);
-						clear_xf = fin_xf-dx;
-						clear_yf = fin_yf-dy;
-						clear_x = (int)(clear_xf+0.5f);
-						clear_y = (int)(clear_yf+0.5f);
-						break;
-					}
-					//block if particle can't move (0), or some special cases where it returns 1 (can_move = 3 but returns 1 meaning particle will be eaten)
-					//also photons are still blocked (slowed down) by any particle (even ones it can move through), and absorb wall also blocks particles
-					int eval = eval_move(t, fin_x, fin_y, NULL);
-					if (!eval || (can_move[t][TYP(pmap[fin_y][fin_x])] == 3 && eval == 1) || (t == PT_PHOT && pmap[fin_y][fin_x]) || bmap[fin_y/CELL][fin_x/CELL]==WL_DESTROYALL || closedEholeStart!=(bmap[fin_y/CELL][fin_x/CELL] == WL_EHOLE && !emap[fin_y/CELL][fin_x/CELL]))
-					{
-						// found an obstacle
-						clear_xf = fin_xf-dx;
-						clear_yf = fin_yf-dy;
-						clear_x = (int)(clear_xf+0.5f);
-						clear_y = (int)(clear_yf+0.5f);
-						break;
-					}
-					if (bmap[fin_y/CELL][fin_x/CELL]==WL_DETECT && emap[fin_y/CELL][fin_x/CELL]<8)
-						set_emap(fin_x/CELL, fin_y/CELL);
-				}
+				clear_xf = fin_xf-dx;
+				clear_yf = fin_yf-dy;
+				clear_x = (int)(clear_xf+0.5f);
+				clear_y = (int)(clear_yf+0.5f);
+				break;
 			}
+			//block if particle can't move (0), or some special cases where it returns 1 (can_move = 3 but returns 1 meaning particle will be eaten)
+			//also photons are still blocked (slowed down) by any particle (even ones it can move through), and absorb wall also blocks particles
+			int eval = eval_move(t, fin_x, fin_y, NULL);
+			if (!eval || (can_move[t][TYP(pmap[fin_y][fin_x])] == 3 && eval == 1) || (t == PT_PHOT && pmap[fin_y][fin_x]) || bmap[fin_y/CELL][fin_x/CELL]==WL_DESTROYALL || closedEholeStart!=(bmap[fin_y/CELL][fin_x/CELL] == WL_EHOLE && !emap[fin_y/CELL][fin_x/CELL]))
+			{
+				// found an obstacle
+				clear_xf = fin_xf-dx;
+				clear_yf = fin_yf-dy;
+				clear_x = (int)(clear_xf+0.5f);
+				clear_y = (int)(clear_yf+0.5f);
+				break;
+			}
+			if (bmap[fin_y/CELL][fin_x/CELL]==WL_DETECT && emap[fin_y/CELL][fin_x/CELL]<8)
+				set_emap(fin_x/CELL, fin_y/CELL);
+		}
+	}
 
-			stagnant = parts[i].flags & FLAG_STAGNANT;
-			parts[i].flags &= ~FLAG_STAGNANT;
+	stagnant = parts[i].flags & FLAG_STAGNANT;
+	parts[i].flags &= ~FLAG_STAGNANT;
 
-			if (t==PT_STKM || t==PT_STKM2 || t==PT_FIGH)
+	if (t==PT_STKM || t==PT_STKM2 || t==PT_FIGH)
+	{
+		//head movement, let head pass through anything
+		parts[i].x += parts[i].vx;
+		parts[i].y += parts[i].vy;
+		int nx = (int)((float)parts[i].x+0.5f);
+		int ny = (int)((float)parts[i].y+0.5f);
+		if (edgeMode == 2)
+		{
+			bool x_ok = (nx >= CELL && nx < XRES-CELL);
+			bool y_ok = (ny >= CELL && ny < YRES-CELL);
+			int oldnx = nx, oldny = ny;
+			if (!x_ok)
 			{
-				//head movement, let head pass through anything
-				parts[i].x += parts[i].vx;
-				parts[i].y += parts[i].vy;
-				int nx = (int)((float)parts[i].x+0.5f);
-				int ny = (int)((float)parts[i].y+0.5f);
-				if (edgeMode == 2)
-				{
-					bool x_ok = (nx >= CELL && nx < XRES-CELL);
-					bool y_ok = (ny >= CELL && ny < YRES-CELL);
-					int oldnx = nx, oldny = ny;
-					if (!x_ok)
-					{
-						parts[i].x = remainder_p(parts[i].x-CELL+.5f, XRES-CELL*2.0f)+CELL-.5f;
-						nx = (int)((float)parts[i].x+0.5f);
-					}
-					if (!y_ok)
-					{
-						parts[i].y = remainder_p(parts[i].y-CELL+.5f, YRES-CELL*2.0f)+CELL-.5f;
-						ny = (int)((float)parts[i].y+0.5f);
-					}
+				parts[i].x = remainder_p(parts[i].x-CELL+.5f, XRES-CELL*2.0f)+CELL-.5f;
+				nx = (int)((float)parts[i].x+0.5f);
+			}
+			if (!y_ok)
+			{
+				parts[i].y = remainder_p(parts[i].y-CELL+.5f, YRES-CELL*2.0f)+CELL-.5f;
+				ny = (int)((float)parts[i].y+0.5f);
+			}
 
-					if (!x_ok || !y_ok) //when moving from left to right stickmen might be able to fall through solid things, fix with "eval_move(t, nx+diffx, ny+diffy, NULL)" but then they die instead
-					{
-						//adjust stickmen legs
-						playerst* stickman = NULL;
-						int t = parts[i].type;
-						if (t == PT_STKM)
-							stickman = &player;
-						else if (t == PT_STKM2)
-							stickman = &player2;
-						else if (t == PT_FIGH && parts[i].tmp >= 0 && parts[i].tmp < MAX_FIGHTERS)
-							stickman = &fighters[parts[i].tmp];
-
-						if (stickman)
-							for (int i = 0; i < 16; i+=2)
-							{
-								stickman->legs[i] += (nx-oldnx);
-								stickman->legs[i+1] += (ny-oldny);
-								stickman->accs[i/2] *= .95f;
-							}
-						parts[i].vy *= .95f;
-						parts[i].vx *= .95f;
-					}
-				}
-				if (ny!=y || nx!=x)
-				{
-					if (ID(pmap[y][x]) == i)
-						pmap[y][x] = 0;
-					else if (ID(photons[y][x]) == i)
-						photons[y][x] = 0;
-					if (nx<CELL || nx>=XRES-CELL || ny<CELL || ny>=YRES-CELL)
+			if (!x_ok || !y_ok) //when moving from left to right stickmen might be able to fall through solid things, fix with "eval_move(t, nx+diffx, ny+diffy, NULL)" but then they die instead
+			{
+				//adjust stickmen legs
+				playerst* stickman = NULL;
+				int t = parts[i].type;
+				if (t == PT_STKM)
+					stickman = &player;
+				else if (t == PT_STKM2)
+					stickman = &player2;
+				else if (t == PT_FIGH && parts[i].tmp >= 0 && parts[i].tmp < MAX_FIGHTERS)
+					stickman = &fighters[parts[i].tmp];
+
+				if (stickman)
+					for (int i = 0; i < 16; i+=2)
 					{
-						kill_part(i);
-						continue;
+						stickman->legs[i] += (nx-oldnx);
+						stickman->legs[i+1] += (ny-oldny);
+						stickman->accs[i/2] *= .95f;
 					}
-					if (elements[t].Properties & TYPE_ENERGY)
-						photons[ny][nx] = PMAP(i, t);
-					else if (t)
-						pmap[ny][nx] = PMAP(i, t);
-				}
+				parts[i].vy *= .95f;
+				parts[i].vx *= .95f;
 			}
-			else if (elements[t].Properties & TYPE_ENERGY)
+		}
+		if (ny!=y || nx!=x)
+		{
+			if (ID(pmap[y][x]) == i)
+				pmap[y][x] = 0;
+			else if (ID(photons[y][x]) == i)
+				photons[y][x] = 0;
+			if (nx<CELL || nx>=XRES-CELL || ny<CELL || ny>=YRES-CELL)
 			{
-				if (t == PT_PHOT)
-				{
-					if (parts[i].flags&FLAG_SKIPMOVE)
-					{
-						parts[i].flags &= ~FLAG_SKIPMOVE;
-						continue;
-					}
-
-					if (eval_move(PT_PHOT, fin_x, fin_y, NULL))
-					{
-						int rt = TYP(pmap[fin_y][fin_x]);
-						int lt = TYP(pmap[y][x]);
-						int rt_glas = (rt == PT_GLAS) || (rt == PT_BGLA);
-						int lt_glas = (lt == PT_GLAS) || (lt == PT_BGLA);
-						if ((rt_glas && !lt_glas) || (lt_glas && !rt_glas))
-						{
-							if (!get_normal_interp(REFRACT|t, parts[i].x, parts[i].y, parts[i].vx, parts[i].vy, &nrx, &nry)) {
-								kill_part(i);
-								continue;
-							}
+				kill_part(i);
+				return;
+			}
+			if (elements[t].Properties & TYPE_ENERGY)
+				photons[ny][nx] = PMAP(i, t);
+			else if (t)
+				pmap[ny][nx] = PMAP(i, t);
+			pmapBlocks.SetPixel(nx, ny);
+		}
+	}
+	else if (elements[t].Properties & TYPE_ENERGY)
+	{
+		if (t == PT_PHOT)
+		{
+			if (parts[i].flags&FLAG_SKIPMOVE)
+			{
+				parts[i].flags &= ~FLAG_SKIPMOVE;
+				return;
+			}
 
-							r = get_wavelength_bin(&parts[i].ctype);
-							if (r == -1 || !(parts[i].ctype&0x3FFFFFFF))
-							{
-								kill_part(i);
-								continue;
-							}
-							nn = GLASS_IOR - GLASS_DISP*(r-30)/30.0f;
-							nn *= nn;
-							nrx = -nrx;
-							nry = -nry;
-							if (rt_glas && !lt_glas)
-								nn = 1.0f/nn;
-							ct1 = parts[i].vx*nrx + parts[i].vy*nry;
-							ct2 = 1.0f - (nn*nn)*(1.0f-(ct1*ct1));
-							if (ct2 < 0.0f) {
-								// total internal reflection
-								parts[i].vx -= 2.0f*ct1*nrx;
-								parts[i].vy -= 2.0f*ct1*nry;
-								fin_xf = parts[i].x;
-								fin_yf = parts[i].y;
-								fin_x = x;
-								fin_y = y;
-							} else {
-								// refraction
-								ct2 = sqrtf(ct2);
-								ct2 = ct2 - nn*ct1;
-								parts[i].vx = nn*parts[i].vx + ct2*nrx;
-								parts[i].vy = nn*parts[i].vy + ct2*nry;
-							}
-						}
-					}
-				}
-				if (stagnant)//FLAG_STAGNANT set, was reflected on previous frame
-				{
-					// cast coords as int then back to float for compatibility with existing saves
-					if (!do_move(i, x, y, (float)fin_x, (float)fin_y) && parts[i].type) {
-						kill_part(i);
-						continue;
-					}
-				}
-				else if (!do_move(i, x, y, fin_xf, fin_yf))
+			if (eval_move(PT_PHOT, fin_x, fin_y, NULL))
+			{
+				int rt = TYP(pmap[fin_y][fin_x]);
+				int lt = TYP(pmap[y][x]);
+				int rt_glas = (rt == PT_GLAS) || (rt == PT_BGLA);
+				int lt_glas = (lt == PT_GLAS) || (lt == PT_BGLA);
+				if ((rt_glas && !lt_glas) || (lt_glas && !rt_glas))
 				{
-					if (parts[i].type == PT_NONE)
-						continue;
-					// reflection
-					parts[i].flags |= FLAG_STAGNANT;
-					if (t==PT_NEUT && RNG::Ref().chance(1, 10))
-					{
+					if (!get_normal_interp(REFRACT|t, parts[i].x, parts[i].y, parts[i].vx, parts[i].vy, &nrx, &nry)) {
 						kill_part(i);
-						continue;
+						return;
 					}
-					r = pmap[fin_y][fin_x];
 
-					if ((TYP(r)==PT_PIPE || TYP(r) == PT_PPIP) && !TYP(parts[ID(r)].ctype))
+					r = get_wavelength_bin(&parts[i].ctype);
+					if (r == -1 || !(parts[i].ctype&0x3FFFFFFF))
 					{
-						parts[ID(r)].ctype =  parts[i].type;
-						parts[ID(r)].temp = parts[i].temp;
-						parts[ID(r)].tmp2 = parts[i].life;
-						parts[ID(r)].pavg[0] = parts[i].tmp;
-						parts[ID(r)].pavg[1] = parts[i].ctype;
 						kill_part(i);
-						continue;
-					}
-
-					if (TYP(r))
-						parts[i].ctype &= elements[TYP(r)].PhotonReflectWavelengths;
-
-					if (get_normal_interp(t, parts[i].x, parts[i].y, parts[i].vx, parts[i].vy, &nrx, &nry))
-					{
-						if (TYP(r) == PT_CRMC)
-						{
-							float r = RNG::Ref().between(-50, 50) * 0.01f, rx, ry, anrx, anry;
-							r = r * r * r;
-							rx = cosf(r); ry = sinf(r);
-							anrx = rx * nrx + ry * nry;
-							anry = rx * nry - ry * nrx;
-							dp = anrx*parts[i].vx + anry*parts[i].vy;
-							parts[i].vx -= 2.0f*dp*anrx;
-							parts[i].vy -= 2.0f*dp*anry;
-						}
-						else
-						{
-							dp = nrx*parts[i].vx + nry*parts[i].vy;
-							parts[i].vx -= 2.0f*dp*nrx;
-							parts[i].vy -= 2.0f*dp*nry;
-						}
-						// leave the actual movement until next frame so that reflection of fast particles and refraction happen correctly
-					}
-					else
-					{
-						if (t!=PT_NEUT)
-							kill_part(i);
-						continue;
+						return;
 					}
-					if (!(parts[i].ctype&0x3FFFFFFF) && t == PT_PHOT)
-					{
-						kill_part(i);
-						continue;
+					nn = GLASS_IOR - GLASS_DISP*(r-30)/30.0f;
+					nn *= nn;
+					nrx = -nrx;
+					nry = -nry;
+					if (rt_glas && !lt_glas)
+						nn = 1.0f/nn;
+					ct1 = parts[i].vx*nrx + parts[i].vy*nry;
+					ct2 = 1.0f - (nn*nn)*(1.0f-(ct1*ct1));
+					if (ct2 < 0.0f) {
+						// total internal reflection
+						parts[i].vx -= 2.0f*ct1*nrx;
+						parts[i].vy -= 2.0f*ct1*nry;
+						fin_xf = parts[i].x;
+						fin_yf = parts[i].y;
+						fin_x = x;
+						fin_y = y;
+					} else {
+						// refraction
+						ct2 = sqrtf(ct2);
+						ct2 = ct2 - nn*ct1;
+						parts[i].vx = nn*parts[i].vx + ct2*nrx;
+						parts[i].vy = nn*parts[i].vy + ct2*nry;
 					}
 				}
 			}
-			else if (elements[t].Falldown==0)
+		}
+		if (stagnant)//FLAG_STAGNANT set, was reflected on previous frame
+		{
+			// cast coords as int then back to float for compatibility with existing saves
+			if (!do_move(i, x, y, (float)fin_x, (float)fin_y) && parts[i].type) {
+				kill_part(i);
+				return;
+			}
+		}
+		else if (!do_move(i, x, y, fin_xf, fin_yf))
+		{
+			if (parts[i].type == PT_NONE)
+				return;
+			// reflection
+			parts[i].flags |= FLAG_STAGNANT;
+			if (t==PT_NEUT && RNG::Ref().chance(1, 10))
+			{
+				kill_part(i);
+				return;
+			}
+			r = pmap[fin_y][fin_x];
+
+			if ((TYP(r)==PT_PIPE || TYP(r) == PT_PPIP) && !TYP(parts[ID(r)].ctype))
 			{
-				// gasses and solids (but not powders)
-				if (!do_move(i, x, y, fin_xf, fin_yf))
+				parts[ID(r)].ctype =  parts[i].type;
+				parts[ID(r)].temp = parts[i].temp;
+				parts[ID(r)].tmp2 = parts[i].life;
+				parts[ID(r)].pavg[0] = parts[i].tmp;
+				parts[ID(r)].pavg[1] = parts[i].ctype;
+				kill_part(i);
+				return;
+			}
+
+			if (TYP(r))
+				parts[i].ctype &= elements[TYP(r)].PhotonReflectWavelengths;
+
+			if (get_normal_interp(t, parts[i].x, parts[i].y, parts[i].vx, parts[i].vy, &nrx, &nry))
+			{
+				if (TYP(r) == PT_CRMC)
 				{
-					if (parts[i].type == PT_NONE)
-						continue;
-					// can't move there, so bounce off
-					// TODO
-					// TODO: Work out what previous TODO was for
-					if (fin_x>x+ISTP) fin_x=x+ISTP;
-					if (fin_x<x-ISTP) fin_x=x-ISTP;
-					if (fin_y>y+ISTP) fin_y=y+ISTP;
-					if (fin_y<y-ISTP) fin_y=y-ISTP;
-					if (do_move(i, x, y, 0.25f+(float)(2*x-fin_x), 0.25f+fin_y))
-					{
-						parts[i].vx *= elements[t].Collision;
-					}
-					else if (do_move(i, x, y, 0.25f+fin_x, 0.25f+(float)(2*y-fin_y)))
-					{
-						parts[i].vy *= elements[t].Collision;
-					}
-					else
-					{
-						parts[i].vx *= elements[t].Collision;
-						parts[i].vy *= elements[t].Collision;
-					}
+					float r = RNG::Ref().between(-50, 50) * 0.01f, rx, ry, anrx, anry;
+					r = r * r * r;
+					rx = cosf(r); ry = sinf(r);
+					anrx = rx * nrx + ry * nry;
+					anry = rx * nry - ry * nrx;
+					dp = anrx*parts[i].vx + anry*parts[i].vy;
+					parts[i].vx -= 2.0f*dp*anrx;
+					parts[i].vy -= 2.0f*dp*anry;
+				}
+				else
+				{
+					dp = nrx*parts[i].vx + nry*parts[i].vy;
+					parts[i].vx -= 2.0f*dp*nrx;
+					parts[i].vy -= 2.0f*dp*nry;
 				}
+				// leave the actual movement until next frame so that reflection of fast particles and refraction happen correctly
 			}
 			else
 			{
-				// Checking stagnant is cool, but then it doesn't update when you change it later.
-				if (water_equal_test && elements[t].Falldown == 2 && RNG::Ref().chance(1, 200))
-				{
-					if (!flood_water(x, y, i))
-						goto movedone;
-				}
-				// liquids and powders
-				if (!do_move(i, x, y, fin_xf, fin_yf))
+				if (t!=PT_NEUT)
+					kill_part(i);
+				return;
+			}
+			if (!(parts[i].ctype&0x3FFFFFFF) && t == PT_PHOT)
+			{
+				kill_part(i);
+				return;
+			}
+		}
+	}
+	else if (elements[t].Falldown==0)
+	{
+		// gasses and solids (but not powders)
+		if (!do_move(i, x, y, fin_xf, fin_yf))
+		{
+			if (parts[i].type == PT_NONE)
+				return;
+			// can't move there, so bounce off
+			// TODO
+			// TODO: Work out what previous TODO was for
+			if (fin_x>x+ISTP) fin_x=x+ISTP;
+			if (fin_x<x-ISTP) fin_x=x-ISTP;
+			if (fin_y>y+ISTP) fin_y=y+ISTP;
+			if (fin_y<y-ISTP) fin_y=y-ISTP;
+			if (do_move(i, x, y, 0.25f+(float)(2*x-fin_x), 0.25f+fin_y))
+			{
+				parts[i].vx *= elements[t].Collision;
+			}
+			else if (do_move(i, x, y, 0.25f+fin_x, 0.25f+(float)(2*y-fin_y)))
+			{
+				parts[i].vy *= elements[t].Collision;
+			}
+			else
+			{
+				parts[i].vx *= elements[t].Collision;
+				parts[i].vy *= elements[t].Collision;
+			}
+		}
+	}
+	else
+	{
+		// Checking stagnant is cool, but then it doesn't update when you change it later.
+		if (water_equal_test && elements[t].Falldown == 2 && RNG::Ref().chance(1, 200))
+		{
+			if (!flood_water(x, y, i))
+				return;
+		}
+		// liquids and powders
+		if (!do_move(i, x, y, fin_xf, fin_yf))
+		{
+			if (parts[i].type == PT_NONE)
+				return;
+			if (fin_x!=x && do_move(i, x, y, fin_xf, clear_yf))
+			{
+				parts[i].vx *= elements[t].Collision;
+				parts[i].vy *= elements[t].Collision;
+			}
+			else if (fin_y!=y && do_move(i, x, y, clear_xf, fin_yf))
+			{
+				parts[i].vx *= elements[t].Collision;
+				parts[i].vy *= elements[t].Collision;
+			}
+			else
+			{
+				s = 1;
+				r = RNG::Ref().between(0, 1) * 2 - 1;// position search direction (left/right first)
+				if ((clear_x!=x || clear_y!=y || nt || surround_space) &&
+					(fabsf(parts[i].vx)>0.01f || fabsf(parts[i].vy)>0.01f))
 				{
-					if (parts[i].type == PT_NONE)
-						continue;
-					if (fin_x!=x && do_move(i, x, y, fin_xf, clear_yf))
+					// allow diagonal movement if target position is blocked
+					// but no point trying this if particle is stuck in a block of identical particles
+					dx = parts[i].vx - parts[i].vy*r;
+					dy = parts[i].vy + parts[i].vx*r;
+					if (fabsf(dy)>fabsf(dx))
+						mv = fabsf(dy);
+					else
+						mv = fabsf(dx);
+					dx /= mv;
+					dy /= mv;
+					if (do_move(i, x, y, clear_xf+dx, clear_yf+dy))
 					{
 						parts[i].vx *= elements[t].Collision;
 						parts[i].vy *= elements[t].Collision;
+						return;
 					}
-					else if (fin_y!=y && do_move(i, x, y, clear_xf, fin_yf))
+					swappage = dx;
+					dx = dy*r;
+					dy = -swappage*r;
+					if (do_move(i, x, y, clear_xf+dx, clear_yf+dy))
 					{
 						parts[i].vx *= elements[t].Collision;
 						parts[i].vy *= elements[t].Collision;
+						return;
 					}
+				}
+				if (elements[t].Falldown>1 && !grav->IsEnabled() && gravityMode==0 && parts[i].vy>fabsf(parts[i].vx))
+				{
+					s = 0;
+					// stagnant is true if FLAG_STAGNANT was set for this particle in previous frame
+					if (!stagnant || nt) //nt is if there is an something else besides the current particle type, around the particle
+						rt = 30;//slight less water lag, although it changes how it moves a lot
 					else
+						rt = 10;
+
+					if (t==PT_GEL)
+						rt = parts[i].tmp*0.20f+5.0f;
+
+					for (j=clear_x+r; j>=0 && j>=clear_x-rt && j<clear_x+rt && j<XRES; j+=r)
 					{
-						s = 1;
-						r = RNG::Ref().between(0, 1) * 2 - 1;// position search direction (left/right first)
-						if ((clear_x!=x || clear_y!=y || nt || surround_space) &&
-							(fabsf(parts[i].vx)>0.01f || fabsf(parts[i].vy)>0.01f))
+						if ((TYP(pmap[fin_y][j])!=t || bmap[fin_y/CELL][j/CELL])
+							&& (s=do_move(i, x, y, (float)j, fin_yf)))
 						{
-							// allow diagonal movement if target position is blocked
-							// but no point trying this if particle is stuck in a block of identical particles
-							dx = parts[i].vx - parts[i].vy*r;
-							dy = parts[i].vy + parts[i].vx*r;
-							if (fabsf(dy)>fabsf(dx))
-								mv = fabsf(dy);
-							else
-								mv = fabsf(dx);
-							dx /= mv;
-							dy /= mv;
-							if (do_move(i, x, y, clear_xf+dx, clear_yf+dy))
-							{
-								parts[i].vx *= elements[t].Collision;
-								parts[i].vy *= elements[t].Collision;
-								goto movedone;
-							}
-							swappage = dx;
-							dx = dy*r;
-							dy = -swappage*r;
-							if (do_move(i, x, y, clear_xf+dx, clear_yf+dy))
-							{
-								parts[i].vx *= elements[t].Collision;
-								parts[i].vy *= elements[t].Collision;
-								goto movedone;
-							}
+							nx = (int)(parts[i].x+0.5f);
+							ny = (int)(parts[i].y+0.5f);
+							break;
 						}
-						if (elements[t].Falldown>1 && !grav->IsEnabled() && gravityMode==0 && parts[i].vy>fabsf(parts[i].vx))
+						if (fin_y!=clear_y && (TYP(pmap[clear_y][j])!=t || bmap[clear_y/CELL][j/CELL])
+							&& (s=do_move(i, x, y, (float)j, clear_yf)))
 						{
-							s = 0;
-							// stagnant is true if FLAG_STAGNANT was set for this particle in previous frame
-							if (!stagnant || nt) //nt is if there is an something else besides the current particle type, around the particle
-								rt = 30;//slight less water lag, although it changes how it moves a lot
-							else
-								rt = 10;
-
-							if (t==PT_GEL)
-								rt = parts[i].tmp*0.20f+5.0f;
-
-							for (j=clear_x+r; j>=0 && j>=clear_x-rt && j<clear_x+rt && j<XRES; j+=r)
-							{
-								if ((TYP(pmap[fin_y][j])!=t || bmap[fin_y/CELL][j/CELL])
-									&& (s=do_move(i, x, y, (float)j, fin_yf)))
-								{
-									nx = (int)(parts[i].x+0.5f);
-									ny = (int)(parts[i].y+0.5f);
-									break;
-								}
-								if (fin_y!=clear_y && (TYP(pmap[clear_y][j])!=t || bmap[clear_y/CELL][j/CELL])
-									&& (s=do_move(i, x, y, (float)j, clear_yf)))
-								{
-									nx = (int)(parts[i].x+0.5f);
-									ny = (int)(parts[i].y+0.5f);
-									break;
-								}
-								if (TYP(pmap[clear_y][j])!=t || (bmap[clear_y/CELL][j/CELL] && bmap[clear_y/CELL][j/CELL]!=WL_STREAM))
-									break;
-							}
-							if (parts[i].vy>0)
-								r = 1;
-							else
-								r = -1;
-							if (s==1)
-								for (j=ny+r; j>=0 && j<YRES && j>=ny-rt && j<ny+rt; j+=r)
-								{
-									if ((TYP(pmap[j][nx])!=t || bmap[j/CELL][nx/CELL]) && do_move(i, nx, ny, (float)nx, (float)j))
-										break;
-									if (TYP(pmap[j][nx])!=t || (bmap[j/CELL][nx/CELL] && bmap[j/CELL][nx/CELL]!=WL_STREAM))
-										break;
-								}
-							else if (s==-1) {} // particle is out of bounds
-							else if ((clear_x!=x||clear_y!=y) && do_move(i, x, y, clear_xf, clear_yf)) {}
-							else parts[i].flags |= FLAG_STAGNANT;
-							parts[i].vx *= elements[t].Collision;
-							parts[i].vy *= elements[t].Collision;
+							nx = (int)(parts[i].x+0.5f);
+							ny = (int)(parts[i].y+0.5f);
+							break;
 						}
-						else if (elements[t].Falldown>1 && fabsf(pGravX*parts[i].vx+pGravY*parts[i].vy)>fabsf(pGravY*parts[i].vx-pGravX*parts[i].vy))
+						if (TYP(pmap[clear_y][j])!=t || (bmap[clear_y/CELL][j/CELL] && bmap[clear_y/CELL][j/CELL]!=WL_STREAM))
+							break;
+					}
+					if (parts[i].vy>0)
+						r = 1;
+					else
+						r = -1;
+					if (s==1)
+						for (j=ny+r; j>=0 && j<YRES && j>=ny-rt && j<ny+rt; j+=r)
 						{
-							float nxf, nyf, prev_pGravX, prev_pGravY, ptGrav = elements[t].Gravity;
-							s = 0;
-							// stagnant is true if FLAG_STAGNANT was set for this particle in previous frame
-							if (!stagnant || nt) //nt is if there is an something else besides the current particle type, around the particle
-								rt = 30;//slight less water lag, although it changes how it moves a lot
-							else
-								rt = 10;
-							// clear_xf, clear_yf is the last known position that the particle should almost certainly be able to move to
-							nxf = clear_xf;
-							nyf = clear_yf;
-							nx = clear_x;
-							ny = clear_y;
-							// Look for spaces to move horizontally (perpendicular to gravity direction), keep going until a space is found or the number of positions examined = rt
-							for (j=0;j<rt;j++)
-							{
-								// Calculate overall gravity direction
-								switch (gravityMode)
-								{
-									default:
-									case 0:
-										pGravX = 0.0f;
-										pGravY = ptGrav;
-										break;
-									case 1:
-										pGravX = pGravY = 0.0f;
-										break;
-									case 2:
-										pGravD = 0.01f - hypotf((nx - XCNTR), (ny - YCNTR));
-										pGravX = ptGrav * ((float)(nx - XCNTR) / pGravD);
-										pGravY = ptGrav * ((float)(ny - YCNTR) / pGravD);
-										break;
-								}
-								pGravX += gravx[(ny/CELL)*(XRES/CELL)+(nx/CELL)];
-								pGravY += gravy[(ny/CELL)*(XRES/CELL)+(nx/CELL)];
-								// Scale gravity vector so that the largest component is 1 pixel
-								if (fabsf(pGravY)>fabsf(pGravX))
-									mv = fabsf(pGravY);
-								else
-									mv = fabsf(pGravX);
-								if (mv<0.0001f) break;
-								pGravX /= mv;
-								pGravY /= mv;
-								// Move 1 pixel perpendicularly to gravity
-								// r is +1/-1, to try moving left or right at random
-								if (j)
-								{
-									// Not quite the gravity direction
-									// Gravity direction + last change in gravity direction
-									// This makes liquid movement a bit less frothy, particularly for balls of liquid in radial gravity. With radial gravity, instead of just moving along a tangent, the attempted movement will follow the curvature a bit better.
-									nxf += r*(pGravY*2.0f-prev_pGravY);
-									nyf += -r*(pGravX*2.0f-prev_pGravX);
-								}
-								else
-								{
-									nxf += r*pGravY;
-									nyf += -r*pGravX;
-								}
-								prev_pGravX = pGravX;
-								prev_pGravY = pGravY;
-								// Check whether movement is allowed
-								nx = (int)(nxf+0.5f);
-								ny = (int)(nyf+0.5f);
-								if (nx<0 || ny<0 || nx>=XRES || ny >=YRES)
-									break;
-								if (TYP(pmap[ny][nx])!=t || bmap[ny/CELL][nx/CELL])
-								{
-									s = do_move(i, x, y, nxf, nyf);
-									if (s)
-									{
-										// Movement was successful
-										nx = (int)(parts[i].x+0.5f);
-										ny = (int)(parts[i].y+0.5f);
-										break;
-									}
-									// A particle of a different type, or a wall, was found. Stop trying to move any further horizontally unless the wall should be completely invisible to particles.
-									if (TYP(pmap[ny][nx])!=t || bmap[ny/CELL][nx/CELL]!=WL_STREAM)
-										break;
-								}
-							}
-							if (s==1)
-							{
-								// The particle managed to move horizontally, now try to move vertically (parallel to gravity direction)
-								// Keep going until the particle is blocked (by something that isn't the same element) or the number of positions examined = rt
-								clear_x = nx;
-								clear_y = ny;
-								for (j=0;j<rt;j++)
-								{
-									// Calculate overall gravity direction
-									switch (gravityMode)
-									{
-										default:
-										case 0:
-											pGravX = 0.0f;
-											pGravY = ptGrav;
-											break;
-										case 1:
-											pGravX = pGravY = 0.0f;
-											break;
-										case 2:
-											pGravD = 0.01f - hypotf((nx - XCNTR), (ny - YCNTR));
-											pGravX = ptGrav * ((float)(nx - XCNTR) / pGravD);
-											pGravY = ptGrav * ((float)(ny - YCNTR) / pGravD);
-											break;
-									}
-									pGravX += gravx[(ny/CELL)*(XRES/CELL)+(nx/CELL)];
-									pGravY += gravy[(ny/CELL)*(XRES/CELL)+(nx/CELL)];
-									// Scale gravity vector so that the largest component is 1 pixel
-									if (fabsf(pGravY)>fabsf(pGravX))
-										mv = fabsf(pGravY);
-									else
-										mv = fabsf(pGravX);
-									if (mv<0.0001f) break;
-									pGravX /= mv;
-									pGravY /= mv;
-									// Move 1 pixel in the direction of gravity
-									nxf += pGravX;
-									nyf += pGravY;
-									nx = (int)(nxf+0.5f);
-									ny = (int)(nyf+0.5f);
-									if (nx<0 || ny<0 || nx>=XRES || ny>=YRES)
-										break;
-									// If the space is anything except the same element (a wall, empty space, or occupied by a particle of a different element), try to move into it
-									if (TYP(pmap[ny][nx])!=t || bmap[ny/CELL][nx/CELL])
-									{
-										s = do_move(i, clear_x, clear_y, nxf, nyf);
-										if (s || TYP(pmap[ny][nx])!=t || bmap[ny/CELL][nx/CELL]!=WL_STREAM)
-											break; // found the edge of the liquid and movement into it succeeded, so stop moving down
-									}
-								}
+							if ((TYP(pmap[j][nx])!=t || bmap[j/CELL][nx/CELL]) && do_move(i, nx, ny, (float)nx, (float)j))
+								break;
+							if (TYP(pmap[j][nx])!=t || (bmap[j/CELL][nx/CELL] && bmap[j/CELL][nx/CELL]!=WL_STREAM))
+								break;
+						}
+					else if (s==-1) {} // particle is out of bounds
+					else if ((clear_x!=x||clear_y!=y) && do_move(i, x, y, clear_xf, clear_yf)) {}
+					else parts[i].flags |= FLAG_STAGNANT;
+					parts[i].vx *= elements[t].Collision;
+					parts[i].vy *= elements[t].Collision;
+				}
+				else if (elements[t].Falldown>1 && fabsf(pGravX*parts[i].vx+pGravY*parts[i].vy)>fabsf(pGravY*parts[i].vx-pGravX*parts[i].vy))
+				{
+					float nxf, nyf, prev_pGravX, prev_pGravY, ptGrav = elements[t].Gravity;
+					s = 0;
+					// stagnant is true if FLAG_STAGNANT was set for this particle in previous frame
+					if (!stagnant || nt) //nt is if there is an something else besides the current particle type, around the particle
+						rt = 30;//slight less water lag, although it changes how it moves a lot
+					else
+						rt = 10;
+					// clear_xf, clear_yf is the last known position that the particle should almost certainly be able to move to
+					nxf = clear_xf;
+					nyf = clear_yf;
+					nx = clear_x;
+					ny = clear_y;
+					// Look for spaces to move horizontally (perpendicular to gravity direction), keep going until a space is found or the number of positions examined = rt
+					for (j=0;j<rt;j++)
+					{
+						// Calculate overall gravity direction
+						switch (gravityMode)
+						{
+							default:
+							case 0:
+								pGravX = 0.0f;
+								pGravY = ptGrav;
+								break;
+							case 1:
+								pGravX = pGravY = 0.0f;
+								break;
+							case 2:
+								pGravD = 0.01f - hypotf((nx - XCNTR), (ny - YCNTR));
+								pGravX = ptGrav * ((float)(nx - XCNTR) / pGravD);
+								pGravY = ptGrav * ((float)(ny - YCNTR) / pGravD);
+								break;
+						}
+						pGravX += gravx[(ny/CELL)*(XRES/CELL)+(nx/CELL)];
+						pGravY += gravy[(ny/CELL)*(XRES/CELL)+(nx/CELL)];
+						// Scale gravity vector so that the largest component is 1 pixel
+						if (fabsf(pGravY)>fabsf(pGravX))
+							mv = fabsf(pGravY);
+						else
+							mv = fabsf(pGravX);
+						if (mv<0.0001f) break;
+						pGravX /= mv;
+						pGravY /= mv;
+						// Move 1 pixel perpendicularly to gravity
+						// r is +1/-1, to try moving left or right at random
+						if (j)
+						{
+							// Not quite the gravity direction
+							// Gravity direction + last change in gravity direction
+							// This makes liquid movement a bit less frothy, particularly for balls of liquid in radial gravity. With radial gravity, instead of just moving along a tangent, the attempted movement will follow the curvature a bit better.
+							nxf += r*(pGravY*2.0f-prev_pGravY);
+							nyf += -r*(pGravX*2.0f-prev_pGravX);
+						}
+						else
+						{
+							nxf += r*pGravY;
+							nyf += -r*pGravX;
+						}
+						prev_pGravX = pGravX;
+						prev_pGravY = pGravY;
+						// Check whether movement is allowed
+						nx = (int)(nxf+0.5f);
+						ny = (int)(nyf+0.5f);
+						if (nx<0 || ny<0 || nx>=XRES || ny >=YRES)
+							break;
+						if (TYP(pmap[ny][nx])!=t || bmap[ny/CELL][nx/CELL])
+						{
+							s = do_move(i, x, y, nxf, nyf);
+							if (s)
+							{
+								// Movement was successful
+								nx = (int)(parts[i].x+0.5f);
+								ny = (int)(parts[i].y+0.5f);
+								break;
 							}
-							else if (s==-1) {} // particle is out of bounds
-							else if ((clear_x!=x||clear_y!=y) && do_move(i, x, y, clear_xf, clear_yf)) {} // try moving to the last clear position
-							else parts[i].flags |= FLAG_STAGNANT;
-							parts[i].vx *= elements[t].Collision;
-							parts[i].vy *= elements[t].Collision;
+							// A particle of a different type, or a wall, was found. Stop trying to move any further horizontally unless the wall should be completely invisible to particles.
+							if (TYP(pmap[ny][nx])!=t || bmap[ny/CELL][nx/CELL]!=WL_STREAM)
+								break;
 						}
-						else
+					}
+					if (s==1)
+					{
+						// The particle managed to move horizontally, now try to move vertically (parallel to gravity direction)
+						// Keep going until the particle is blocked (by something that isn't the same element) or the number of positions examined = rt
+						clear_x = nx;
+						clear_y = ny;
+						for (j=0;j<rt;j++)
 						{
-							// if interpolation was done, try moving to last clear position
-							if ((clear_x!=x||clear_y!=y) && do_move(i, x, y, clear_xf, clear_yf)) {}
-							else parts[i].flags |= FLAG_STAGNANT;
-							parts[i].vx *= elements[t].Collision;
-							parts[i].vy *= elements[t].Collision;
+							// Calculate overall gravity direction
+							switch (gravityMode)
+							{
+								default:
+								case 0:
+									pGravX = 0.0f;
+									pGravY = ptGrav;
+									break;
+								case 1:
+									pGravX = pGravY = 0.0f;
+									break;
+								case 2:
+									pGravD = 0.01f - hypotf((nx - XCNTR), (ny - YCNTR));
+									pGravX = ptGrav * ((float)(nx - XCNTR) / pGravD);
+									pGravY = ptGrav * ((float)(ny - YCNTR) / pGravD);
+									break;
+							}
+							pGravX += gravx[(ny/CELL)*(XRES/CELL)+(nx/CELL)];
+							pGravY += gravy[(ny/CELL)*(XRES/CELL)+(nx/CELL)];
+							// Scale gravity vector so that the largest component is 1 pixel
+							if (fabsf(pGravY)>fabsf(pGravX))
+								mv = fabsf(pGravY);
+							else
+								mv = fabsf(pGravX);
+							if (mv<0.0001f) break;
+							pGravX /= mv;
+							pGravY /= mv;
+							// Move 1 pixel in the direction of gravity
+							nxf += pGravX;
+							nyf += pGravY;
+							nx = (int)(nxf+0.5f);
+							ny = (int)(nyf+0.5f);
+							if (nx<0 || ny<0 || nx>=XRES || ny>=YRES)
+								break;
+							// If the space is anything except the same element (a wall, empty space, or occupied by a particle of a different element), try to move into it
+							if (TYP(pmap[ny][nx])!=t || bmap[ny/CELL][nx/CELL])
+							{
+								s = do_move(i, clear_x, clear_y, nxf, nyf);
+								if (s || TYP(pmap[ny][nx])!=t || bmap[ny/CELL][nx/CELL]!=WL_STREAM)
+									break; // found the edge of the liquid and movement into it succeeded, so stop moving down
+							}
 						}
 					}
+					else if (s==-1) {} // particle is out of bounds
+					else if ((clear_x!=x||clear_y!=y) && do_move(i, x, y, clear_xf, clear_yf)) {} // try moving to the last clear position
+					else parts[i].flags |= FLAG_STAGNANT;
+					parts[i].vx *= elements[t].Collision;
+					parts[i].vy *= elements[t].Collision;
+				}
+				else
+				{
+					// if interpolation was done, try moving to last clear position
+					if ((clear_x!=x||clear_y!=y) && do_move(i, x, y, clear_xf, clear_yf)) {}
+					else parts[i].flags |= FLAG_STAGNANT;
+					parts[i].vx *= elements[t].Collision;
+					parts[i].vy *= elements[t].Collision;
 				}
 			}
-movedone:
-			continue;
 		}
+	}
+}
+
+void Simulation::UpdateParticles(int start, int end)
+{
+	InputLog::Scope logScope(inputLog);
+	StepRNGScope rngScope(*this, stepRNG, STREAM_STRIP_SETUP);
+	if ((updatePool || deterministic) && start == 0 && end >= NPART-1 && CanUpdateInStrips())
+		UpdateParticlesParallel();
+	else
+	{
+		//the main particle loop function, goes over all particles.
+		for (int i = start; i <= end && i <= parts_lastActiveIndex; i++)
+			if (parts[i].type)
+			{
+				if (deterministic)
+					stepRNG.SetStream(randomSeed, currentTick, i);
+				UpdateParticle(i);
+			}
+	}
+
+	// a pipelined air update started in BeforeSim runs alongside the particles, wait for it here
+	air->EndPipelinedUpdate();
 
 	//'f' was pressed (single frame)
 	if (framerender)
 		framerender--;
 }
 
+int Simulation::AllocateParticle()
+{
+	if (currentStrip)
+	{
+		if (currentStrip->nextReserved >= currentStrip->reserved.size())
+			return -1;
+		return currentStrip->reserved[currentStrip->nextReserved++];
+	}
+	if (pfree == -1)
+		return -1;
+	int i = pfree;
+	pfree = parts[i].life;
+	return i;
+}
+
+void Simulation::ChangeElementCount(int t, int delta)
+{
+	if (currentStrip)
+		currentStrip->elementCountDelta[t] += delta;
+	else
+		elementCount[t] += delta;
+}
+
+void Simulation::NotifyUnloggedChange()
+{
+	if (inputLog)
+		inputLog->Changed();
+}
+
+void Simulation::SetUpdateThreads(int threads)
+{
+	if (threads < 1)
+		threads = 1;
+	if (threads == updateThreads)
+		return;
+	updateThreads = threads;
+	delete updatePool;
+	updatePool = NULL;
+	if (threads > 1)
+		updatePool = new ThreadPool(threads);
+	air->pool = updatePool;
+}
+
+// Elements with an update function that only touches the particles and air cells right next to them
+static const int localUpdateElements[] = {
+	PT_WATR, PT_DSTW, PT_SLTW, PT_FIRE, PT_PLSM, PT_LAVA, PT_COAL, PT_BCOL, PT_ICEI, PT_SNOW, PT_WTRV,
+	PT_WOOD, PT_GLAS, PT_IRON, PT_CO2, PT_O2, PT_BMTL, PT_BRMT, PT_RIME, PT_FOG, PT_FRZW, PT_FRZZ,
+	PT_ACID, PT_CAUS, PT_GEL, PT_GOO, PT_PLNT, PT_YEST, PT_TTAN, PT_SPNG, PT_BOYL, PT_MERC
+};
+
+// Types the special transitions (to PT_NUM) in UpdateParticle can turn a particle into, other than its ctype
+static const int specialTransitionTypes[] = {
+	PT_BRMT, PT_SALT, PT_WTRV, PT_LAVA, PT_TUNG, PT_RIME, PT_DSTW, PT_STNE, PT_BMTL
+};
+
+bool Simulation::CanUpdateInStrips()
+{
+	// Loop edge mode and water equalization move particles across the whole screen
+	if (edgeMode == 2 || water_equal_test)
+		return false;
+	// Portals and elements with a ChangeType function keep state that isn't tied to a position
+	for (int t = 1; t < PT_NUM; t++)
+		if (elementCount[t] > 0 && (t == PT_PRTI || elements[t].ChangeType))
+			return false;
+	return true;
+}
+
+// A transition into a type with a ChangeType function can't happen in a strip, melting ice and solidifying lava
+// become their ctype, so that has to be checked for each particle
+bool Simulation::CanUpdateInStrip(int i)
+{
+	int t = parts[i].type;
+	if (!stripSafe[t])
+		return false;
+	int ctype = parts[i].ctype;
+	return !stripCheckCtype[t] || ctype <= 0 || ctype >= PT_NUM || !elements[ctype].ChangeType;
+}
+
+float Simulation::MoveReach(int i, int t, int nt)
+{
+	// How far up or down MoveParticle may look, see the liquid search loops there
+	float reach = fabsf(parts[i].vy) + 2.0f;
+	if (elements[t].Falldown > 1)
+	{
+		float rt = ((parts[i].flags & FLAG_STAGNANT) && !nt) ? 10.0f : 30.0f;
+		if (t == PT_GEL)
+			rt = std::max(rt, parts[i].tmp*0.20f+5.0f);
+		reach += (gravityMode == 0 && !grav->IsEnabled()) ? rt : 2*rt;
+	}
+	return reach;
+}
+
+// Updates particles in horizontal strips, running every other strip at the same time. Each particle
+// belongs to the strip it was in at the start of the frame and strips go through their particles in
+// index order. Particles that may affect things far away, and movement that would reach into another
+// strip, are left for a serial pass at the end. The result is the same for any number of threads,
+// but is not the same as the single-threaded update. Deterministic mode runs the strips one after
+// another when there is no thread pool.
+void Simulation::UpdateParticlesParallel()
+{
+	int stripCount = (YRES+UPDATE_STRIP_HEIGHT-1)/UPDATE_STRIP_HEIGHT;
+	updateStrips.resize(stripCount);
+
+	for (int t = 0; t < PT_NUM; t++)
+	{
+		Element &el = elements[t];
+		bool safe = el.Enabled && !(el.Properties & TYPE_ENERGY) && !el.ChangeType;
+		if (safe && el.Update)
+			safe = std::find(std::begin(localUpdateElements), std::end(localUpdateElements), t) != std::end(localUpdateElements);
+#if !defined(RENDERER) && defined(LUACONSOLE)
+		if (lua_el_mode[t])
+			safe = false;
+#endif
+		int transitions[] = { el.LowPressureTransition, el.HighPressureTransition, el.LowTemperatureTransition, el.HighTemperatureTransition };
+		for (int target : transitions)
+		{
+			if (target > 0 && target < PT_NUM && elements[target].ChangeType)
+				safe = false;
+			if (target == PT_NUM)
+				for (int special : specialTransitionTypes)
+					if (elements[special].ChangeType)
+						safe = false;
+		}
+		stripSafe[t] = safe;
+		stripCheckCtype[t] = ((t == PT_ICEI || t == PT_SNOW) && el.HighTemperatureTransition == PT_NUM) || (t == PT_LAVA && el.LowTemperatureTransition == PT_NUM);
+	}
+
+	for (int s = 0; s < stripCount; s++)
+	{
+		UpdateStrip &strip = updateStrips[s];
+		strip.top = s*UPDATE_STRIP_HEIGHT;
+		strip.bottom = std::min(strip.top+UPDATE_STRIP_HEIGHT, YRES);
+		strip.particles.clear();
+		strip.deferred.clear();
+		strip.deferredMoves.clear();
+		strip.killed.clear();
+		strip.emapQueue.clear();
+		std::fill(strip.elementCountDelta, strip.elementCountDelta+PT_NUM, 0);
+		strip.lastActiveIndex = -1;
+		strip.rng.seed(RNG::Ref()());
+		// Take IDs off the free list in order, so a strip always creates particles in the same slots
+		strip.reserved.clear();
+		strip.nextReserved = 0;
+		while (strip.reserved.size() < UPDATE_STRIP_RESERVE && pfree != -1)
+		{
+			strip.reserved.push_back(pfree);
+			pfree = parts[pfree].life;
+		}
+	}
+
+	std::vector<int> serial;
+	for (int i = 0; i <= parts_lastActiveIndex; i++)
+	{
+		int t = parts[i].type;
+		if (!t)
+			continue;
+		int y = (int)(parts[i].y+0.5f);
+		if (!CanUpdateInStrip(i) || y < 0 || y >= YRES)
+			serial.push_back(i);
+		else
+			updateStrips[y/UPDATE_STRIP_HEIGHT].particles.push_back(i);
+	}
+
+	for (int phase = 0; phase < 2; phase++)
+	{
+		auto updateStrip = [this, phase](int n) {
+			UpdateStrip &strip = updateStrips[phase+2*n];
+			currentStrip = &strip;
+			RNG *previousRNG = RNG::GetThreadRNG();
+			RNG::SetThreadRNG(&strip.rng);
+			for (auto i : strip.particles)
+			{
+				if (!parts[i].type)
+					continue;
+				// The particle may have been pushed away or changed into something else by a neighbouring strip
+				if (!CanUpdateInStrip(i) || !strip.CanUpdate((int)(parts[i].y+0.5f)))
+					strip.deferred.push_back(i);
+				else
+				{
+					if (deterministic)
+						strip.rng.SetStream(randomSeed, currentTick, i);
+					UpdateParticle(i);
+				}
+			}
+			RNG::SetThreadRNG(previousRNG);
+			currentStrip = NULL;
+		};
+		int count = (stripCount-phase+1)/2;
+		if (updatePool)
+			updatePool->ParallelFor(count, updateStrip);
+		else
+			for (int n = 0; n < count; n++)
+				updateStrip(n);
+	}
+
+	// Unused IDs go back to the front of the free list in the order they were taken
+	for (int s = stripCount-1; s >= 0; s--)
+	{
+		UpdateStrip &strip = updateStrips[s];
+		for (size_t n = strip.reserved.size(); n > strip.nextReserved; n--)
+		{
+			int i = strip.reserved[n-1];
+			parts[i].life = pfree;
+			pfree = i;
+		}
+	}
+	for (auto &strip : updateStrips)
+	{
+		for (int t = 0; t < PT_NUM; t++)
+			elementCount[t] += strip.elementCountDelta[t];
+		if (strip.lastActiveIndex > parts_lastActiveIndex)
+			parts_lastActiveIndex = strip.lastActiveIndex;
+		for (auto i : strip.killed)
+		{
+			parts[i].life = pfree;
+			pfree = i;
+		}
+		for (auto &cell : strip.emapQueue)
+			set_emap(cell.first, cell.second);
+	}
+
+	for (auto &strip : updateStrips)
+		for (auto &move : strip.deferredMoves)
+		{
+			int i = move.i;
+			if (parts[i].type != move.t || (!parts[i].vx && !parts[i].vy))
+				continue;
+			if (deterministic)
+				stepRNG.SetStream(randomSeed, currentTick, STREAM_DEFERRED_MOVE+i);
+			MoveParticle(i, move.t, (int)(parts[i].x+0.5f), (int)(parts[i].y+0.5f), move.nt, move.surround_space, move.pGravX, move.pGravY);
+		}
+
+	for (auto &strip : updateStrips)
+		serial.insert(serial.end(), strip.deferred.begin(), strip.deferred.end());
+	std::sort(serial.begin(), serial.end());
+	for (auto i : serial)
+		if (parts[i].type)
+		{
+			if (deterministic)
+				stepRNG.SetStream(randomSeed, currentTick, i);
+			UpdateParticle(i);
+		}
+}
+
 int Simulation::GetParticleType(ByteString type)
 {
 	char * txt = (char*)type.c_str();
@@ -4658,113 +5095,280 @@ int Simulation::GetParticleType(ByteString type)
 	return -1;
 }
 
-void Simulation::SimulateGoL()
+// Same as the neighbour table update in SimulateGoL, for the common case of all LIFE using the same rule.
+// Rows are stored as bits, so neighbours can be counted for 64 pixels at a time, and only the pixels where
+// something will happen are then visited, in the same order as SimulateGoL would. Returns false without
+// changing anything if there is more than one rule, so the general version can be used instead
+bool Simulation::SimulateGoLSingleRule(const ActivityMap &golBlocks)
 {
-	CGOL = 0;
-	//TODO: maybe this should only loop through active particles
+	static const uint64_t zeroRow[golWords] = {};
+	int golnum = 0;
+	bool singleRule = true;
+	for (int ny = CELL; ny < YRES-CELL && singleRule; ny++)
+	{
+		if (golBlocks.RowEmpty(ny/CELL))
+			continue;
+		std::fill_n(golEmpty[ny], golWords, 0);
+		std::fill_n(golLife[ny], golWords, 0);
+		std::fill_n(golAlive[ny], golWords, 0);
+		golBlocks.ForEachInRow(ny/CELL, [&](int bx) {
+			for (int nx = bx*CELL; nx < (bx+1)*CELL; nx++)
+			{
+				int r = pmap[ny][nx];
+				uint64_t bit = uint64_t(1) << (nx%64);
+				if (!r)
+					golEmpty[ny][nx/64] |= bit;
+				else if (TYP(r) == PT_LIFE)
+				{
+					if (!golnum)
+						golnum = parts[ID(r)].ctype + 1;
+					// LIFE with an invalid type is killed by SimulateGoL, and rules with less than two states aren't handled here
+					if (parts[ID(r)].ctype + 1 != golnum || golnum <= 0 || golnum > NGOL || grule[golnum][9] < 2)
+					{
+						singleRule = false;
+						return;
+					}
+					golLife[ny][nx/64] |= bit;
+					if (parts[ID(r)].tmp == grule[golnum][9]-1)
+						golAlive[ny][nx/64] |= bit;
+				}
+			}
+		});
+	}
+	if (!singleRule || !golnum)
+		return false;
+
+	// Neighbours wrap around inside the border, copy the pixels on the other side into the border
 	for (int ny = CELL; ny < YRES-CELL; ny++)
 	{
-		//go through every particle and set neighbor map
-		for (int nx = CELL; nx < XRES-CELL; nx++)
+		if (golBlocks.RowEmpty(ny/CELL))
+			continue;
+		uint64_t *row = golAlive[ny];
+		int left = CELL-1, right = XRES-CELL;
+		row[left/64] = (row[left/64] & ~(uint64_t(1) << (left%64))) | (((row[(right-1)/64] >> ((right-1)%64)) & 1) << (left%64));
+		row[right/64] = (row[right/64] & ~(uint64_t(1) << (right%64))) | (((row[CELL/64] >> (CELL%64)) & 1) << (right%64));
+	}
+	auto aliveRow = [this, &golBlocks](int ny) -> const uint64_t * {
+		if (ny < CELL)
+			ny += YRES-2*CELL;
+		else if (ny >= YRES-CELL)
+			ny -= YRES-2*CELL;
+		return golBlocks.RowEmpty(ny/CELL) ? zeroRow : golAlive[ny];
+	};
+
+	// Which neighbour counts (including the pixel itself) lead to something happening
+	unsigned int birth = 0, death = 0;
+	for (int n = 1; n <= 9; n++)
+	{
+		if (n < 9 && grule[golnum][n] >= 2)
+			birth |= 1 << n;
+		if (grule[golnum][n-1] == 0 || grule[golnum][n-1] == 2)
+			death |= 1 << n;
+	}
+
+	for (int ny = CELL; ny < YRES-CELL; ny++)
+	{
+		if (golBlocks.RowEmpty(ny/CELL))
+			continue;
+		// Add up the alive pixels in each column of three, then add three neighbouring columns together,
+		// giving the four bits of each pixel's neighbour count
+		const uint64_t *up = aliveRow(ny-1), *mid = golAlive[ny], *down = aliveRow(ny+1);
+		uint64_t col0[golWords], col1[golWords];
+		for (int w = 0; w < golWords; w++)
+		{
+			col0[w] = up[w] ^ mid[w] ^ down[w];
+			col1[w] = (up[w] & mid[w]) | (down[w] & (up[w] ^ mid[w]));
+		}
+		uint64_t count[4][golWords];
+		for (int w = 0; w < golWords; w++)
+		{
+			uint64_t l0 = (col0[w] << 1) | (w ? col0[w-1] >> 63 : 0);
+			uint64_t l1 = (col1[w] << 1) | (w ? col1[w-1] >> 63 : 0);
+			uint64_t r0 = (col0[w] >> 1) | (w < golWords-1 ? col0[w+1] << 63 : 0);
+			uint64_t r1 = (col1[w] >> 1) | (w < golWords-1 ? col1[w+1] << 63 : 0);
+			uint64_t s0 = l0 ^ col0[w], c0 = l0 & col0[w];
+			uint64_t s1 = l1 ^ col1[w] ^ c0, s2 = (l1 & col1[w]) | (c0 & (l1 ^ col1[w]));
+			uint64_t k0 = s0 & r0;
+			uint64_t k1 = (s1 & r1) | (k0 & (s1 ^ r1));
+			count[0][w] = s0 ^ r0;
+			count[1][w] = s1 ^ r1 ^ k0;
+			count[2][w] = s2 ^ k1;
+			count[3][w] = s2 & k1;
+		}
+
+		for (int w = 0; w < golWords; w++)
 		{
-			int r = pmap[ny][nx];
-			if (!r)
+			uint64_t born = 0, dying = 0;
+			for (int n = 1; n <= 9; n++)
 			{
-				gol[ny][nx] = 0;
-				continue;
+				if (!((birth | death) & (1 << n)))
+					continue;
+				uint64_t equal = ~uint64_t(0);
+				for (int b = 0; b < 4; b++)
+					equal &= ((n >> b) & 1) ? count[b][w] : ~count[b][w];
+				if (birth & (1 << n))
+					born |= equal;
+				if (death & (1 << n))
+					dying |= equal;
 			}
-			if (TYP(r) == PT_LIFE)
+			// LIFE that isn't alive is counting down, and has to be visited whatever the neighbours are
+			uint64_t countingDown = golLife[ny][w] & ~golAlive[ny][w];
+			uint64_t visit = (golEmpty[ny][w] & born) | (golLife[ny][w] & (dying | ~golAlive[ny][w]));
+			for (int nx = w*64; visit; nx++, visit >>= 1)
 			{
-				int golnum = parts[ID(r)].ctype + 1;
-				if (golnum <= 0 || golnum > NGOL)
+				if (!(visit & 1))
+					continue;
+				int neighbors = 0;
+				for (int b = 0; b < 4; b++)
+					neighbors |= int((count[b][w] >> (nx%64)) & 1) << b;
+				int r = pmap[ny][nx];
+				if (r && TYP(r)!=PT_LIFE)
+					continue;
+				if ((countingDown >> (nx%64)) & 1)
+					parts[ID(r)].tmp--;
+				if (neighbors && !(bmap[ny/CELL][nx/CELL] == WL_STASIS && emap[ny/CELL][nx/CELL] < 8))
 				{
+					if (!r)
+					{
+						if (grule[golnum][neighbors] >= 2)
+							create_part(-1, nx, ny, PT_LIFE, golnum-1);
+					}
+					else if (grule[golnum][neighbors-1] == 0 || grule[golnum][neighbors-1] == 2)
+					{
+						if (parts[ID(r)].tmp == grule[golnum][9]-1)
+							parts[ID(r)].tmp--;
+					}
+				}
+				if (r && parts[ID(r)].tmp <= 0)
 					kill_part(ID(r));
+			}
+		}
+	}
+	return true;
+}
+
+void Simulation::SimulateGoL()
+{
+	CGOL = 0;
+	// Only blocks next to a block with LIFE in it can change. Neighbours wrap around inside the
+	// border, so the blocks next to the edge count the ones on the opposite side as neighbours
+	ActivityMap golBlocks;
+	for (int by = 1; by < YRES/CELL-1; by++)
+	{
+		lifeBlocks.ForEachInRow(by, [&](int bx) {
+			if (bx < 1 || bx >= XRES/CELL-1)
+				return;
+			for (int dy = -1; dy < 2; dy++)
+				for (int dx = -1; dx < 2; dx++)
+					golBlocks.Set((bx+dx-1+XRES/CELL-2)%(XRES/CELL-2)+1, (by+dy-1+YRES/CELL-2)%(YRES/CELL-2)+1);
+		});
+	}
+	if (SimulateGoLSingleRule(golBlocks))
+		return;
+	for (int ny = CELL; ny < YRES-CELL; ny++)
+	{
+		//go through every particle and set neighbor map
+		golBlocks.ForEachInRow(ny/CELL, [&](int bx) {
+			for (int nx = bx*CELL; nx < (bx+1)*CELL; nx++)
+			{
+				int r = pmap[ny][nx];
+				if (!r)
 					continue;
-				}
-				gol[ny][nx] = golnum;
-				if (parts[ID(r)].tmp == grule[golnum][9]-1)
+				if (TYP(r) == PT_LIFE)
 				{
-					for (int nnx = -1; nnx < 2; nnx++)
+					int golnum = parts[ID(r)].ctype + 1;
+					if (golnum <= 0 || golnum > NGOL)
+					{
+						kill_part(ID(r));
+						continue;
+					}
+					gol[ny][nx] = golnum;
+					if (parts[ID(r)].tmp == grule[golnum][9]-1)
 					{
-						//it will count itself as its own neighbor, which is needed, but will have 1 extra for delete check
-						for (int nny = -1; nny < 2; nny++)
+						for (int nnx = -1; nnx < 2; nnx++)
 						{
-							int adx = ((nx+nnx+XRES-3*CELL)%(XRES-2*CELL))+CELL;
-							int ady = ((ny+nny+YRES-3*CELL)%(YRES-2*CELL))+CELL;
-							int rt = pmap[ady][adx];
-							if (!rt || TYP(rt) == PT_LIFE)
+							//it will count itself as its own neighbor, which is needed, but will have 1 extra for delete check
+							for (int nny = -1; nny < 2; nny++)
 							{
-								//the total neighbor count is in 0
-								gol2[ady][adx][0] ++;
-								//insert golnum into neighbor table
-								for (int i = 1; i < 9; i++)
+								int adx = ((nx+nnx+XRES-3*CELL)%(XRES-2*CELL))+CELL;
+								int ady = ((ny+nny+YRES-3*CELL)%(YRES-2*CELL))+CELL;
+								int rt = pmap[ady][adx];
+								if (!rt || TYP(rt) == PT_LIFE)
 								{
-									if (!gol2[ady][adx][i])
-									{
-										gol2[ady][adx][i] = (golnum<<4)+1;
-										break;
-									}
-									else if((gol2[ady][adx][i]>>4)==golnum)
+									//the total neighbor count is in 0
+									gol2[ady][adx][0] ++;
+									//insert golnum into neighbor table
+									for (int i = 1; i < 9; i++)
 									{
-										gol2[ady][adx][i]++;
-										break;
+										if (!gol2[ady][adx][i])
+										{
+											gol2[ady][adx][i] = (golnum<<4)+1;
+											break;
+										}
+										else if((gol2[ady][adx][i]>>4)==golnum)
+										{
+											gol2[ady][adx][i]++;
+											break;
+										}
 									}
 								}
 							}
 						}
 					}
-				}
-				else
-				{
-					parts[ID(r)].tmp --;
+					else
+					{
+						parts[ID(r)].tmp --;
+					}
 				}
 			}
-		}
+		});
 	}
 	for (int ny = CELL; ny < YRES-CELL; ny++)
 	{
 		//go through every particle again, but check neighbor map, then update particles
-		for (int nx = CELL; nx < XRES-CELL; nx++)
-		{
-			int r = pmap[ny][nx];
-			if (r && TYP(r)!=PT_LIFE)
-				continue;
-			int neighbors = gol2[ny][nx][0];
-			if (neighbors)
+		golBlocks.ForEachInRow(ny/CELL, [&](int bx) {
+			for (int nx = bx*CELL; nx < (bx+1)*CELL; nx++)
 			{
-				if (!(bmap[ny/CELL][nx/CELL] == WL_STASIS && emap[ny/CELL][nx/CELL] < 8))
+				int r = pmap[ny][nx];
+				if (r && TYP(r)!=PT_LIFE)
+					continue;
+				int neighbors = gol2[ny][nx][0];
+				if (neighbors)
 				{
-					int golnum = gol[ny][nx];
-					if (!r)
+					if (!(bmap[ny/CELL][nx/CELL] == WL_STASIS && emap[ny/CELL][nx/CELL] < 8))
 					{
-						//Find which type we can try and create
-						int creategol = 0xFF;
-						for (int i = 1; i < 9; i++)
+						int golnum = gol[ny][nx];
+						if (!r)
 						{
-							if (!gol2[ny][nx][i]) break;
-							golnum = (gol2[ny][nx][i]>>4);
-							if (grule[golnum][neighbors]>= 2 && (gol2[ny][nx][i]&0xF) >= (neighbors%2)+neighbors/2)
+							//Find which type we can try and create
+							int creategol = 0xFF;
+							for (int i = 1; i < 9; i++)
 							{
-								if (golnum < creategol)
-									creategol = golnum;
+								if (!gol2[ny][nx][i]) break;
+								golnum = (gol2[ny][nx][i]>>4);
+								if (grule[golnum][neighbors]>= 2 && (gol2[ny][nx][i]&0xF) >= (neighbors%2)+neighbors/2)
+								{
+									if (golnum < creategol)
+										creategol = golnum;
+								}
 							}
+							if (creategol < 0xFF)
+								create_part(-1, nx, ny, PT_LIFE, creategol-1);
+						}
+						else if (grule[golnum][neighbors-1] == 0 || grule[golnum][neighbors-1] == 2)//subtract 1 because it counted itself
+						{
+							if (parts[ID(r)].tmp == grule[golnum][9]-1)
+								parts[ID(r)].tmp--;
 						}
-						if (creategol < 0xFF)
-							create_part(-1, nx, ny, PT_LIFE, creategol-1);
-					}
-					else if (grule[golnum][neighbors-1] == 0 || grule[golnum][neighbors-1] == 2)//subtract 1 because it counted itself
-					{
-						if (parts[ID(r)].tmp == grule[golnum][9]-1)
-							parts[ID(r)].tmp--;
 					}
+					for (int z = 0; z < 9; z++)
+						gol2[ny][nx][z] = 0;//this improves performance A LOT compared to the memset, i was getting ~23 more fps with this.
 				}
-				for (int z = 0; z < 9; z++)
-					gol2[ny][nx][z] = 0;//this improves performance A LOT compared to the memset, i was getting ~23 more fps with this.
+				//we still need to kill things with 0 neighbors (higher state life)
+				if (r && parts[ID(r)].tmp <= 0)
+					kill_part(ID(r));
 			}
-			//we still need to kill things with 0 neighbors (higher state life)
-			if (r && parts[ID(r)].tmp <= 0)
-				kill_part(ID(r));
-		}
+		});
 	}
 	//memset(gol2, 0, sizeof(gol2));
 }
@@ -4775,9 +5379,57 @@ void Simulation::RecalcFreeParticles(bool do_life_dec)
 	int lastPartUsed = 0;
 	int lastPartUnused = -1;
 
-	memset(pmap, 0, sizeof(pmap));
-	memset(pmap_count, 0, sizeof(pmap_count));
-	memset(photons, 0, sizeof(photons));
+	if (!do_life_dec || !(currentTick%180))
+	{
+#ifdef DEBUG
+		// The partial clear below relies on everything in the particle maps being inside a marked block,
+		// so check that before throwing the maps away
+		if (do_life_dec)
+		{
+			pmapBlocks.Merge(activeBlocks);
+			int missed = 0;
+			for (y = 0; y < YRES; y++)
+				for (x = 0; x < XRES; x++)
+					if ((pmap[y][x] || pmap_count[y][x] || photons[y][x]) && !pmapBlocks.Get(x/CELL, y/CELL))
+						missed++;
+			if (missed)
+				std::cerr << "RecalcFreeParticles: " << missed << " particle map entries outside the marked blocks" << std::endl;
+		}
+#endif
+		memset(pmap, 0, sizeof(pmap));
+		memset(pmap_count, 0, sizeof(pmap_count));
+		memset(photons, 0, sizeof(photons));
+	}
+	else
+	{
+		// Anything in the particle maps was either put there by the last rebuild or marked since,
+		// so only those blocks need clearing. Every 180 frames they are cleared completely, as a fallback
+		// in case something wrote to them without marking its block
+		pmapBlocks.Merge(activeBlocks);
+		for (int by = 0; by < YRES/CELL; by++)
+		{
+			pmapBlocks.ForEachRunInRow(by, [this, by](int start, int end) {
+				if (start == 0 && end == XRES/CELL)
+				{
+					// A full row of blocks is one contiguous piece of memory
+					std::fill_n(pmap[by*CELL], CELL*XRES, 0);
+					std::fill_n(pmap_count[by*CELL], CELL*XRES, 0);
+					std::fill_n(photons[by*CELL], CELL*XRES, 0);
+					return;
+				}
+				for (int y = by*CELL; y < (by+1)*CELL; y++)
+				{
+					std::fill(&pmap[y][start*CELL], &pmap[y][end*CELL], 0);
+					std::fill(&pmap_count[y][start*CELL], &pmap_count[y][end*CELL], 0);
+					std::fill(&photons[y][start*CELL], &photons[y][end*CELL], 0);
+				}
+			});
+		}
+	}
+	pmapBlocks.Clear();
+	lifeBlocks.Clear();
+	wireBlocks.Clear();
+	stackBlocks.Clear();
 
 	NUM_PARTS = 0;
 	//the particle loop that resets the pmap/photon maps every frame, to update them.
@@ -4801,8 +5453,14 @@ void Simulation::RecalcFreeParticles(bool do_life_dec)
 						pmap[y][x] = PMAP(i, t);
 					// (there are a few exceptions, including energy particles - currently no limit on stacking those)
 					if (t!=PT_THDR && t!=PT_EMBR && t!=PT_FIGH && t!=PT_PLSM)
+					{
 						pmap_count[y][x]++;
+						if (pmap_count[y][x] == 6)
+							stackBlocks.Set(x/CELL, y/CELL);
+					}
 				}
+				MarkActive(x, y, t);
+				pmapBlocks.Set(x/CELL, y/CELL);
 				inBounds = true;
 			}
 			lastPartUsed = i;
@@ -4870,29 +5528,37 @@ void Simulation::CheckStacking()
 {
 	bool excessive_stacking_found = false;
 	force_stacking_check = false;
-	for (int y = 0; y < YRES; y++)
+	// Only blocks with a pixel that has more than 5 particles stacked on it are checked, in the same row by row order as a full scan
+	for (int by = 0; by < YRES/CELL; by++)
 	{
-		for (int x = 0; x < XRES; x++)
+		if (stackBlocks.RowEmpty(by))
+			continue;
+		for (int y = by*CELL; y < (by+1)*CELL; y++)
 		{
-			// Use a threshold, since some particle stacking can be normal (e.g. BIZR + FILT)
-			// Setting pmap_count[y][x] > NPART means BHOL will form in that spot
-			if (pmap_count[y][x]>5)
-			{
-				if (bmap[y/CELL][x/CELL]==WL_EHOLE)
+			stackBlocks.ForEachInRow(by, [&](int bx) {
+				for (int x = bx*CELL; x < (bx+1)*CELL; x++)
 				{
-					// Allow more stacking in E-hole
-					if (pmap_count[y][x]>1500)
+					// Use a threshold, since some particle stacking can be normal (e.g. BIZR + FILT)
+					// Setting pmap_count[y][x] > NPART means BHOL will form in that spot
+					if (pmap_count[y][x]>5)
 					{
-						pmap_count[y][x] = pmap_count[y][x] + NPART;
-						excessive_stacking_found = 1;
+						if (bmap[y/CELL][x/CELL]==WL_EHOLE)
+						{
+							// Allow more stacking in E-hole
+							if (pmap_count[y][x]>1500)
+							{
+								pmap_count[y][x] = pmap_count[y][x] + NPART;
+								excessive_stacking_found = 1;
+							}
+						}
+						else if (pmap_count[y][x]>1500 || (unsigned int)RNG::Ref().between(0, 1599) <= (pmap_count[y][x]+100))
+						{
+							pmap_count[y][x] = pmap_count[y][x] + NPART;
+							excessive_stacking_found = true;
+						}
 					}
 				}
-				else if (pmap_count[y][x]>1500 || (unsigned int)RNG::Ref().between(0, 1599) <= (pmap_count[y][x]+100))
-				{
-					pmap_count[y][x] = pmap_count[y][x] + NPART;
-					excessive_stacking_found = true;
-				}
-			}
+			});
 		}
 	}
 	if (excessive_stacking_found)
@@ -4928,14 +5594,38 @@ void Simulation::CheckStacking()
 }
 
 //updates pmap, gol, and some other simulation stuff (but not particles)
+void Simulation::UpdateWallBlock(int x, int y)
+{
+	if (emap[y][x])
+		emap[y][x] --;
+	if (emap[y][x])
+		emapBlocks.Set(x, y);
+	else
+		emapBlocks.Unset(x, y);
+	air->bmap_blockair[y][x] = (bmap[y][x]==WL_WALL || bmap[y][x]==WL_WALLELEC || bmap[y][x]==WL_BLOCKAIR || (bmap[y][x]==WL_EWALL && !emap[y][x]));
+	air->bmap_blockairh[y][x] = (bmap[y][x]==WL_WALL || bmap[y][x]==WL_WALLELEC || bmap[y][x]==WL_BLOCKAIR || bmap[y][x]==WL_GRAV || (bmap[y][x]==WL_EWALL && !emap[y][x])) ? 0x8:0;
+}
+
 void Simulation::BeforeSim()
 {
+	if (inputLog && (!sys_pause||framerender))
+		inputLog->BeforeStep(*this);
+	InputLog::Scope logScope(inputLog);
+	StepRNGScope rngScope(*this, stepRNG, STREAM_BEFORE_SIM);
 	if (!sys_pause||framerender)
 	{
-		air->update_air();
+		if (profiler.enabled)
+			profiler.simFrames++;
 
-		if(aheat_enable)
-			air->update_airh();
+		if (air->IsPipelined())
+			air->BeginPipelinedUpdate(aheat_enable);
+		else
+		{
+			air->update_air();
+
+			if(aheat_enable)
+				air->update_airh();
+		}
 
 		if(grav->IsEnabled())
 		{
@@ -4971,21 +5661,41 @@ void Simulation::BeforeSim()
 
 	if (debug_currentParticle == 0)
 		RecalcFreeParticles(true);
+	else
+	{
+		// pmap hasn't been rebuilt, so the particle maps might be out of date
+		activeBlocks.Fill();
+		lifeBlocks.Fill();
+		wireBlocks.Fill();
+		stackBlocks.Fill();
+	}
 
 	if (!sys_pause || framerender)
 	{
 		// decrease wall conduction, make walls block air and ambient heat
-		int x, y;
-		for (y = 0; y < YRES/CELL; y++)
+		// Rows where walls or the electrode map were changed are redone completely, otherwise only
+		// blocks with particles or a counting down electrode map need it
+		for (int y = 0; y < YRES/CELL; y++)
 		{
-			for (x = 0; x < XRES/CELL; x++)
+			if (memcmp(bmap[y], checkedBmap[y], sizeof(bmap[y])) || memcmp(emap[y], checkedEmap[y], sizeof(emap[y])))
 			{
-				if (emap[y][x])
-					emap[y][x] --;
-				air->bmap_blockair[y][x] = (bmap[y][x]==WL_WALL || bmap[y][x]==WL_WALLELEC || bmap[y][x]==WL_BLOCKAIR || (bmap[y][x]==WL_EWALL && !emap[y][x]));
-				air->bmap_blockairh[y][x] = (bmap[y][x]==WL_WALL || bmap[y][x]==WL_WALLELEC || bmap[y][x]==WL_BLOCKAIR || bmap[y][x]==WL_GRAV || (bmap[y][x]==WL_EWALL && !emap[y][x])) ? 0x8:0;
+				for (int x = 0; x < XRES/CELL; x++)
+					UpdateWallBlock(x, y);
 			}
+			else
+			{
+				activeBlocks.ForEachInRow(y, [this, y](int x) {
+					UpdateWallBlock(x, y);
+				});
+				emapBlocks.ForEachInRow(y, [this, y](int x) {
+					if (!activeBlocks.Get(x, y))
+						UpdateWallBlock(x, y);
+				});
+			}
+			memcpy(checkedBmap[y], bmap[y], sizeof(bmap[y]));
+			memcpy(checkedEmap[y], emap[y], sizeof(emap[y]));
 		}
+		activeBlocks.Clear();
 
 		// check for stacking and create BHOL if found
 		if (force_stacking_check || RNG::Ref().chance(1, 10))
@@ -5066,16 +5776,21 @@ void Simulation::BeforeSim()
 		// make WIRE work
 		if(elementCount[PT_WIRE] > 0)
 		{
-			for (int nx = 0; nx < XRES; nx++)
+			for (int by = 0; by < YRES/CELL; by++)
 			{
-				for (int ny = 0; ny < YRES; ny++)
-				{
-					int r = pmap[ny][nx];
-					if (!r)
-						continue;
-					if(parts[ID(r)].type == PT_WIRE)
-						parts[ID(r)].tmp = parts[ID(r)].ctype;
-				}
+				wireBlocks.ForEachInRow(by, [&](int bx) {
+					for (int ny = by*CELL; ny < (by+1)*CELL; ny++)
+					{
+						for (int nx = bx*CELL; nx < (bx+1)*CELL; nx++)
+						{
+							int r = pmap[ny][nx];
+							if (!r)
+								continue;
+							if(parts[ID(r)].type == PT_WIRE)
+								parts[ID(r)].tmp = parts[ID(r)].ctype;
+						}
+					}
+				});
 			}
 		}
 
@@ -5123,6 +5838,8 @@ void Simulation::BeforeSim()
 
 void Simulation::AfterSim()
 {
+	InputLog::Scope logScope(inputLog);
+	StepRNGScope rngScope(*this, stepRNG, STREAM_AFTER_SIM);
 	if (emp_trigger_count)
 	{
 		// pitiful attempt at trying to keep code relating to a given element in the same file
@@ -5134,6 +5851,8 @@ void Simulation::AfterSim()
 
 Simulation::~Simulation()
 {
+	delete inputLog;
+	delete updatePool;
 	delete grav;
 	delete air;
 }
@@ -5161,7 +5880,12 @@ Simulation::Simulation():
 	framerender(0),
 	pretty_powder(0),
 	sandcolour_frame(0),
-	deco_space(0)
+	deco_space(0),
+	deterministic(false),
+	randomSeed(0),
+	inputLog(NULL),
+	updateThreads(1),
+	updatePool(NULL)
 {
 	int tportal_rx[] = {-1, 0, 1, 1, 1, 0,-1,-1};
 	int tportal_ry[] = {-1,-1,-1, 0, 1, 1, 1, 0};
@@ -5176,6 +5900,8 @@ Simulation::Simulation():
 	//Create and attach gravity simulation
 	grav = new Gravity();
 	//Give air sim references to our data
+	memset(checkedBmap, 0, sizeof(checkedBmap));
+	memset(checkedEmap, 0, sizeof(checkedEmap));
 	grav->bmap = bmap;
 	//Gravity sim gives us maps to use
 	gravx = grav->gravx;
@@ -15,12 +15,16 @@
 #include "MenuSection.h"
 
 #include "CoordStack.h"
+#include "ActivityMap.h"
+#include "UpdateStrip.h"
+#include "ElementProfiler.h"
 
 #include "Element.h"
 
 #define CHANNELS ((int)(MAX_TEMP-73)/100+2)
 
 class Snapshot;
+class InputLog;
 class SimTool;
 class Brush;
 class SimulationSample;
@@ -32,6 +36,7 @@ class Renderer;
 class Gravity;
 class Air;
 class GameSave;
+class ThreadPool;
 
 class Simulation
 {
@@ -105,6 +110,14 @@ public:
 	int pmap[YRES][XRES];
 	int photons[YRES][XRES];
 	unsigned int pmap_count[YRES][XRES];
+	//Active blocks, used to skip the parts of the screen where nothing is happening
+	ActivityMap activeBlocks; // particles were updated, created, moved, changed or killed here since the walls were last checked
+	ActivityMap lifeBlocks; // contain LIFE
+	ActivityMap wireBlocks; // contain WIRE
+	ActivityMap stackBlocks; // contain a pixel with enough particles stacked on it to be checked by CheckStacking
+	ActivityMap emapBlocks; // electrode map is still counting down
+	ActivityMap pmapBlocks; // may have entries in pmap, photons or pmap_count that weren't put there through MarkActive'd changes
+	ElementProfiler profiler;
 	//Simulation Settings
 	int edgeMode;
 	int gravityMode;
@@ -127,6 +140,8 @@ public:
 
 	Snapshot * CreateSnapshot();
 	void Restore(const Snapshot & snap);
+	// Copies everything the renderer reads from another simulation, for one that is only used to draw it
+	void CopyRenderState(const Simulation & from);
 
 	int is_blocking(int t, int x, int y);
 	int is_boundary(int pt, int x, int y);
@@ -161,6 +176,8 @@ public:
 	int parts_avg(int ci, int ni, int t);
 	void create_arc(int sx, int sy, int dx, int dy, int midpoints, int variance, int type, int flags);
 	void UpdateParticles(int start, int end);
+	void UpdateParticle(int i);
+	void MoveParticle(int i, int t, int x, int y, int nt, int surround_space, float pGravX, float pGravY);
 	void SimulateGoL();
 	void RecalcFreeParticles(bool do_life_dec);
 	void CheckStacking();
@@ -171,6 +188,19 @@ public:
 
 	void SetEdgeMode(int newEdgeMode);
 	void SetDecoSpace(int newDecoSpace);
+	// Number of threads used by UpdateParticles, 1 is the reference single-threaded update
+	void SetUpdateThreads(int threads);
+	int GetUpdateThreads() { return updateThreads; }
+
+	// In deterministic mode every particle update draws from its own random stream, picked by randomSeed,
+	// the tick and the particle ID, and particles are always updated in strips. A run then gives the same
+	// result for any number of threads, and every time it is started from the same save with the same seed
+	bool deterministic;
+	unsigned int randomSeed;
+	// Records what is done to the simulation so it can be played back, see InputLog.h. Owned by the simulation
+	InputLog *inputLog;
+	// For changes made by writing to the simulation directly rather than through functions the input log records
+	void NotifyUnloggedChange();
 
 	//Drawing Deco
 	void ApplyDecoration(int x, int y, int colR, int colG, int colB, int colA, int mode);
@@ -226,6 +256,32 @@ public:
 
 private:
 	CoordStack& getCoordStackSingleton();
+
+	int updateThreads;
+	ThreadPool *updatePool;
+	std::vector<UpdateStrip> updateStrips;
+	bool stripSafe[PT_NUM];
+	bool stripCheckCtype[PT_NUM]; // a special transition can turn the particle into its ctype
+	RNG stepRNG; // used in place of the global generator during a deterministic update
+
+	unsigned char checkedBmap[YRES/CELL][XRES/CELL];
+	unsigned char checkedEmap[YRES/CELL][XRES/CELL];
+
+	// One bit per pixel, for SimulateGoLSingleRule
+	static const int golWords = (XRES+63)/64;
+	uint64_t golEmpty[YRES][golWords]; // nothing in pmap
+	uint64_t golLife[YRES][golWords]; // LIFE in pmap
+	uint64_t golAlive[YRES][golWords]; // LIFE in its first state, the only one that counts as a neighbour
+
+	void MarkActive(int x, int y, int t);
+	void UpdateWallBlock(int x, int y);
+	bool SimulateGoLSingleRule(const ActivityMap &golBlocks);
+	int AllocateParticle();
+	void ChangeElementCount(int t, int delta);
+	bool CanUpdateInStrips();
+	bool CanUpdateInStrip(int i);
+	float MoveReach(int i, int t, int nt);
+	void UpdateParticlesParallel();
 };
 
 #endif /* SIMULATION_H */
@@ -3,6 +3,8 @@
 #include <vector>
 
 #include "Particle.h"
+#include "Stickman.h"
+#include "Sign.h"
 #include "json/json.h"
 
 class Snapshot
@@ -60,4 +62,16 @@ public:
 	{
 
 	}
+
+	// Approximate memory used, in bytes
+	size_t Size() const
+	{
+		return sizeof(Snapshot) +
+			(AirPressure.size() + AirVelocityX.size() + AirVelocityY.size() + AmbientHeat.size()) * sizeof(float) +
+			(Particles.size() + PortalParticles.size()) * sizeof(Particle) +
+			(GravVelocityX.size() + GravVelocityY.size() + GravValue.size() + GravMap.size()) * sizeof(float) +
+			(BlockMap.size() + ElecMap.size()) * sizeof(unsigned char) +
+			(FanVelocityX.size() + FanVelocityY.size()) * sizeof(float) +
+			WirelessData.size() * sizeof(int) + stickmen.size() * sizeof(playerst) + signs.size() * sizeof(sign);
+	}
 };
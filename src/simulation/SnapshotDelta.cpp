@@ -0,0 +1,134 @@
+#include "SnapshotDelta.h"
+
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+
+template<class T>
+SnapshotDelta::Field SnapshotDelta::makeField(const std::vector<T> &oldData, const std::vector<T> &newData)
+{
+	Field field;
+	field.oldSize = oldData.size();
+	size_t oldBytes = oldData.size()*sizeof(T), newBytes = newData.size()*sizeof(T);
+	field.xorBytes = std::max(oldBytes, newBytes);
+	field.raw = false;
+	if (!field.xorBytes)
+		return field;
+
+	// The shorter of the two is padded with zeroes
+	std::vector<unsigned char> xorData(field.xorBytes, 0);
+	if (oldBytes)
+		memcpy(&xorData[0], &oldData[0], oldBytes);
+	const unsigned char *newBytesPtr = reinterpret_cast<const unsigned char *>(newData.data());
+	for (size_t i = 0; i < newBytes; i++)
+		xorData[i] ^= newBytesPtr[i];
+
+	uLongf compressedSize = compressBound(field.xorBytes);
+	field.compressed.resize(compressedSize);
+	if (compress2(&field.compressed[0], &compressedSize, &xorData[0], field.xorBytes, Z_BEST_SPEED) != Z_OK)
+	{
+		// Not worth failing the whole snapshot for, keep the XOR as it is
+		field.raw = true;
+		field.compressed.swap(xorData);
+		return field;
+	}
+	field.compressed.resize(compressedSize);
+	field.compressed.shrink_to_fit();
+	return field;
+}
+
+template<class T>
+bool SnapshotDelta::restoreField(const Field &field, const std::vector<T> &newData, std::vector<T> &oldData)
+{
+	oldData.resize(field.oldSize);
+	if (!field.xorBytes)
+		return true;
+
+	std::vector<unsigned char> xorData(field.xorBytes);
+	if (field.raw)
+	{
+		if (field.compressed.size() != field.xorBytes)
+			return false;
+		xorData = field.compressed;
+	}
+	else
+	{
+		uLongf xorSize = field.xorBytes;
+		if (uncompress(&xorData[0], &xorSize, &field.compressed[0], field.compressed.size()) != Z_OK || xorSize != field.xorBytes)
+			return false;
+	}
+	const unsigned char *newBytesPtr = reinterpret_cast<const unsigned char *>(newData.data());
+	size_t newBytes = std::min(newData.size()*sizeof(T), field.xorBytes);
+	for (size_t i = 0; i < newBytes; i++)
+		xorData[i] ^= newBytesPtr[i];
+	if (field.oldSize)
+		memcpy(&oldData[0], &xorData[0], field.oldSize*sizeof(T));
+	return true;
+}
+
+SnapshotDelta *SnapshotDelta::FromSnapshots(const Snapshot &oldSnap, const Snapshot &newSnap)
+{
+	SnapshotDelta *delta = new SnapshotDelta();
+	delta->AirPressure = makeField(oldSnap.AirPressure, newSnap.AirPressure);
+	delta->AirVelocityX = makeField(oldSnap.AirVelocityX, newSnap.AirVelocityX);
+	delta->AirVelocityY = makeField(oldSnap.AirVelocityY, newSnap.AirVelocityY);
+	delta->AmbientHeat = makeField(oldSnap.AmbientHeat, newSnap.AmbientHeat);
+	delta->Particles = makeField(oldSnap.Particles, newSnap.Particles);
+	delta->GravVelocityX = makeField(oldSnap.GravVelocityX, newSnap.GravVelocityX);
+	delta->GravVelocityY = makeField(oldSnap.GravVelocityY, newSnap.GravVelocityY);
+	delta->GravValue = makeField(oldSnap.GravValue, newSnap.GravValue);
+	delta->GravMap = makeField(oldSnap.GravMap, newSnap.GravMap);
+	delta->BlockMap = makeField(oldSnap.BlockMap, newSnap.BlockMap);
+	delta->ElecMap = makeField(oldSnap.ElecMap, newSnap.ElecMap);
+	delta->FanVelocityX = makeField(oldSnap.FanVelocityX, newSnap.FanVelocityX);
+	delta->FanVelocityY = makeField(oldSnap.FanVelocityY, newSnap.FanVelocityY);
+	delta->PortalParticles = makeField(oldSnap.PortalParticles, newSnap.PortalParticles);
+	delta->WirelessData = makeField(oldSnap.WirelessData, newSnap.WirelessData);
+	delta->stickmen = makeField(oldSnap.stickmen, newSnap.stickmen);
+	delta->signs = oldSnap.signs;
+	delta->Authors = oldSnap.Authors;
+	return delta;
+}
+
+Snapshot *SnapshotDelta::Restore(const Snapshot &newSnap) const
+{
+	Snapshot *snap = new Snapshot();
+	bool ok = true;
+	ok = ok && restoreField(AirPressure, newSnap.AirPressure, snap->AirPressure);
+	ok = ok && restoreField(AirVelocityX, newSnap.AirVelocityX, snap->AirVelocityX);
+	ok = ok && restoreField(AirVelocityY, newSnap.AirVelocityY, snap->AirVelocityY);
+	ok = ok && restoreField(AmbientHeat, newSnap.AmbientHeat, snap->AmbientHeat);
+	ok = ok && restoreField(Particles, newSnap.Particles, snap->Particles);
+	ok = ok && restoreField(GravVelocityX, newSnap.GravVelocityX, snap->GravVelocityX);
+	ok = ok && restoreField(GravVelocityY, newSnap.GravVelocityY, snap->GravVelocityY);
+	ok = ok && restoreField(GravValue, newSnap.GravValue, snap->GravValue);
+	ok = ok && restoreField(GravMap, newSnap.GravMap, snap->GravMap);
+	ok = ok && restoreField(BlockMap, newSnap.BlockMap, snap->BlockMap);
+	ok = ok && restoreField(ElecMap, newSnap.ElecMap, snap->ElecMap);
+	ok = ok && restoreField(FanVelocityX, newSnap.FanVelocityX, snap->FanVelocityX);
+	ok = ok && restoreField(FanVelocityY, newSnap.FanVelocityY, snap->FanVelocityY);
+	ok = ok && restoreField(PortalParticles, newSnap.PortalParticles, snap->PortalParticles);
+	ok = ok && restoreField(WirelessData, newSnap.WirelessData, snap->WirelessData);
+	ok = ok && restoreField(stickmen, newSnap.stickmen, snap->stickmen);
+	if (!ok)
+	{
+		delete snap;
+		return NULL;
+	}
+	snap->signs = signs;
+	snap->Authors = Authors;
+	return snap;
+}
+
+size_t SnapshotDelta::Size() const
+{
+	const Field *fields[] = {
+		&AirPressure, &AirVelocityX, &AirVelocityY, &AmbientHeat, &Particles,
+		&GravVelocityX, &GravVelocityY, &GravValue, &GravMap, &BlockMap, &ElecMap,
+		&FanVelocityX, &FanVelocityY, &PortalParticles, &WirelessData, &stickmen
+	};
+	size_t size = sizeof(SnapshotDelta) + signs.size()*sizeof(sign);
+	for (auto field : fields)
+		size += field->compressed.capacity();
+	return size;
+}
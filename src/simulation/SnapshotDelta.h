@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+
+#include "Snapshot.h"
+
+// What changed between two snapshots. Each array is stored as the XOR of its old and new contents,
+// compressed, which is small when little has changed. Used for all but the newest undo history entries
+class SnapshotDelta
+{
+	struct Field
+	{
+		size_t oldSize; // number of elements in the old version of the array
+		size_t xorBytes; // size of the XOR before it was compressed
+		bool raw; // the XOR couldn't be compressed and is stored as it is
+		std::vector<unsigned char> compressed;
+	};
+
+	Field AirPressure;
+	Field AirVelocityX;
+	Field AirVelocityY;
+	Field AmbientHeat;
+	Field Particles;
+	Field GravVelocityX;
+	Field GravVelocityY;
+	Field GravValue;
+	Field GravMap;
+	Field BlockMap;
+	Field ElecMap;
+	Field FanVelocityX;
+	Field FanVelocityY;
+	Field PortalParticles;
+	Field WirelessData;
+	Field stickmen;
+
+	// Small enough to be kept as they are
+	std::vector<sign> signs;
+	Json::Value Authors;
+
+	template<class T>
+	static Field makeField(const std::vector<T> &oldData, const std::vector<T> &newData);
+	template<class T>
+	static bool restoreField(const Field &field, const std::vector<T> &newData, std::vector<T> &oldData);
+
+public:
+	// Returns a delta that turns newSnap back into oldSnap
+	static SnapshotDelta *FromSnapshots(const Snapshot &oldSnap, const Snapshot &newSnap);
+	// Returns NULL if the delta couldn't be decompressed
+	Snapshot *Restore(const Snapshot &newSnap) const;
+	// Approximate memory used, in bytes
+	size_t Size() const;
+};
@@ -0,0 +1,56 @@
+#ifndef UPDATESTRIP_H
+#define UPDATESTRIP_H
+
+#include <vector>
+#include <utility>
+#include "Config.h"
+#include "ElementDefs.h"
+#include "common/tpt-rand.h"
+
+// Height of the horizontal strips that the particle update is split into when running on several threads
+#define UPDATE_STRIP_HEIGHT 64
+// How far outside its own rows a strip may touch the simulation. Strips that are updated at the same time
+// are one strip apart, so this can be at most half of UPDATE_STRIP_HEIGHT
+#define UPDATE_STRIP_REACH 32
+// How far from a particle its update may reach, not counting movement (neighbours two pixels away, and the surrounding air cells)
+#define UPDATE_PARTICLE_REACH (2*CELL)
+// Number of free particle IDs set aside for each strip every frame
+#define UPDATE_STRIP_RESERVE 1024
+
+// Movement that had to wait until the strips were done, replayed in strip order
+struct DeferredMove
+{
+	int i, t, nt, surround_space;
+	float pGravX, pGravY;
+};
+
+// Bookkeeping for one strip during a multi-threaded particle update
+// Anything that would normally change state shared by the whole simulation (the free particle list,
+// element counts, the electrode map) is collected here instead and merged in strip order afterwards,
+// so the result doesn't depend on how strips were assigned to threads
+class UpdateStrip
+{
+public:
+	int top, bottom;
+	std::vector<int> particles; // particles that were in the strip at the start of the frame, in index order
+	std::vector<int> deferred; // particles that can't safely be updated by this strip, left for the serial pass
+	std::vector<DeferredMove> deferredMoves;
+	std::vector<int> reserved; // IDs taken from the free list in advance for particles created by this strip
+	size_t nextReserved;
+	std::vector<int> killed;
+	std::vector<std::pair<int, int> > emapQueue;
+	int elementCountDelta[PT_NUM];
+	int lastActiveIndex;
+	RNG rng;
+
+	bool CanUpdate(int y) const
+	{
+		return y >= top - (UPDATE_STRIP_REACH-UPDATE_PARTICLE_REACH) && y < bottom + (UPDATE_STRIP_REACH-UPDATE_PARTICLE_REACH);
+	}
+	bool CanMove(int y, float reach) const
+	{
+		return y - reach >= top - UPDATE_STRIP_REACH && y + reach < bottom + UPDATE_STRIP_REACH;
+	}
+};
+
+#endif /* UPDATESTRIP_H */
@@ -308,6 +308,7 @@ static int MoveStack(Simulation * sim, int stackX, int stackY, int directionX, i
 				sim->parts[jP].x = destX;
 				sim->parts[jP].y = destY;
 				sim->pmap[destY][destX] = PMAP(jP, sim->parts[jP].type);
+				sim->pmapBlocks.SetPixel(destX, destY);
 			}
 			return amount;
 		}
@@ -331,6 +332,7 @@ static int MoveStack(Simulation * sim, int stackX, int stackY, int directionX, i
 				sim->parts[jP].x = destX;
 				sim->parts[jP].y = destY;
 				sim->pmap[destY][destX] = PMAP(jP, sim->parts[jP].type);
+				sim->pmapBlocks.SetPixel(destX, destY);
 			}
 			return possibleMovement;
 		}
@@ -0,0 +1,67 @@
+#ifdef TESTS
+
+#include "Tests.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "simulation/Air.h"
+#include "simulation/Simulation.h"
+#include "simulation/SimulationData.h"
+
+// Runs the air and ambient heat updates over a fixed pattern of pressure, velocity and heat between walls, with
+// the blur done one cell at a time and with SSE2, and checks that both leave the same air behind
+void TestAirBlur()
+{
+	Simulation *sim = new Simulation();
+	Air &air = *sim->air;
+	air.airMode = 0;
+	for (int y = 0; y < YRES/CELL; y++)
+		for (int x = 0; x < XRES/CELL; x++)
+		{
+			bool wall = (x % 37 == 5 && y % 11 < 7) || (y == 40 && x > 20 && x < 90);
+			sim->bmap[y][x] = wall ? WL_WALL : 0;
+			air.bmap_blockair[y][x] = wall;
+			air.bmap_blockairh[y][x] = wall ? 0x8 : 0;
+		}
+
+	auto run = [&air](bool scalar) {
+		for (int y = 0; y < YRES/CELL; y++)
+			for (int x = 0; x < XRES/CELL; x++)
+			{
+				air.pv[y][x] = 40.0f * std::sin(x * 0.21f) * std::cos(y * 0.17f);
+				air.vx[y][x] = 3.0f * std::cos(x * 0.13f + y * 0.07f);
+				air.vy[y][x] = 3.0f * std::sin(x * 0.05f - y * 0.19f);
+				air.hv[y][x] = 295.15f + 200.0f * std::sin((x + y) * 0.11f);
+			}
+		air.scalarBlur = scalar;
+		for (int i = 0; i < 20; i++)
+		{
+			air.update_air();
+			air.update_airh();
+		}
+		air.scalarBlur = false;
+	};
+	AirState *vectorised = new AirState;
+	run(false);
+	*vectorised = air;
+	run(true);
+
+	float maxDifference = 0;
+	auto compare = [&maxDifference](float (*a)[XRES/CELL], float (*b)[XRES/CELL]) {
+		for (int y = 0; y < YRES/CELL; y++)
+			for (int x = 0; x < XRES/CELL; x++)
+				maxDifference = std::max(maxDifference, std::fabs(a[y][x] - b[y][x]));
+	};
+	compare(air.pv, vectorised->pv);
+	compare(air.vx, vectorised->vx);
+	compare(air.vy, vectorised->vy);
+	compare(air.hv, vectorised->hv);
+	// The vectorised sums are added in the same order as the scalar ones, so they should match exactly
+	Check("air blur with and without SSE2", maxDifference == 0, ByteString::Build(Air::BlurVectorised() ? "vectorised" : "not vectorised in this build", ", largest difference ", maxDifference));
+
+	delete vectorised;
+	delete sim;
+}
+
+#endif
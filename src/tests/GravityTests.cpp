@@ -0,0 +1,167 @@
+#ifdef TESTS
+
+#include "Tests.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include "Config.h"
+#include "simulation/FFT.h"
+#include "simulation/Gravity.h"
+
+// Discrete Fourier transform of n values by summing every term, the same direction and scale as FFT2D::Forward
+static void DirectDFT(std::vector<double> &re, std::vector<double> &im, int offset, int stride, int n)
+{
+	std::vector<double> outRe(n), outIm(n);
+	for (int k = 0; k < n; k++)
+	{
+		for (int j = 0; j < n; j++)
+		{
+			double angle = -2.0 * M_PI * ((long(k) * j) % n) / n;
+			double r = re[offset + j * stride], i = im[offset + j * stride];
+			outRe[k] += r * std::cos(angle) - i * std::sin(angle);
+			outIm[k] += r * std::sin(angle) + i * std::cos(angle);
+		}
+	}
+	for (int k = 0; k < n; k++)
+	{
+		re[offset + k * stride] = outRe[k];
+		im[offset + k * stride] = outIm[k];
+	}
+}
+
+// Transforms a map sized the way gravity does, only the rows of the map are filled, and checks the result against
+// a direct sum and the map a round trip gives back
+void TestFFT()
+{
+	int width = 1, height = 1;
+	while (width < XRES/CELL*2-1)
+		width *= 2;
+	while (height < YRES/CELL*2-1)
+		height *= 2;
+	int rows = YRES/CELL;
+	FFT2D fft(width, height);
+	std::vector<float> re(width * height), im(width * height);
+	for (int y = 0; y < rows; y++)
+		for (int x = 0; x < XRES/CELL; x++)
+		{
+			re[y * width + x] = std::sin(x * 0.37f + y * 0.11f) + ((x * 7 + y * 13) % 17 == 0 ? 4.0f : 0.0f);
+			im[y * width + x] = std::cos(x * 0.05f - y * 0.29f);
+		}
+	std::vector<float> inputRe = re, inputIm = im;
+
+	std::vector<double> directRe(re.begin(), re.end()), directIm(im.begin(), im.end());
+	for (int y = 0; y < rows; y++)
+		DirectDFT(directRe, directIm, y * width, 1, width);
+	for (int x = 0; x < width; x++)
+		DirectDFT(directRe, directIm, x, width, height);
+	fft.Forward(&re[0], &im[0], rows);
+	double largest = 0, forwardError = 0;
+	for (int i = 0; i < width * height; i++)
+	{
+		largest = std::max(largest, std::hypot(directRe[i], directIm[i]));
+		forwardError = std::max(forwardError, std::hypot(re[i] - directRe[i], im[i] - directIm[i]));
+	}
+	forwardError /= largest;
+
+	fft.Inverse(&re[0], &im[0], rows);
+	double scale = double(width) * height, inputLargest = 0, roundTripError = 0;
+	for (int i = 0; i < rows * width; i++)
+	{
+		inputLargest = std::max(inputLargest, std::hypot(double(inputRe[i]), double(inputIm[i])));
+		roundTripError = std::max(roundTripError, std::hypot(re[i] / scale - inputRe[i], im[i] / scale - inputIm[i]));
+	}
+	roundTripError /= inputLargest;
+
+	// Relative to the largest value, single precision gives errors around 1e-6
+	Check("built in FFT against a direct sum", forwardError < 1e-4, ByteString::Build("relative error ", forwardError));
+	Check("built in FFT round trip", roundTripError < 1e-4, ByteString::Build("relative error ", roundTripError));
+}
+
+// Largest difference between a field and the one summed directly, relative to the largest value of the direct one
+static double FieldError(const std::vector<double> &directX, const std::vector<double> &directY, const float *fieldX, const float *fieldY)
+{
+	double largest = 0, error = 0;
+	for (size_t i = 0; i < directX.size(); i++)
+	{
+		largest = std::max(largest, std::hypot(directX[i], directY[i]));
+		error = std::max(error, std::hypot(fieldX[i] - directX[i], fieldY[i] - directY[i]));
+	}
+	return error / largest;
+}
+
+// Finds the gravity field of a fixed layout of masses with the built in FFT, and with whatever the Gravity class
+// uses in this build (FFTW where it's available), and checks both against the field summed over every pair of
+// cells, the way gravity was calculated before either transform was used
+void TestGravity()
+{
+	const int size = (XRES/CELL)*(YRES/CELL);
+	std::vector<float> masses(size);
+	for (int y = 30; y < 40; y++)
+		for (int x = 20; x < 35; x++)
+			masses[y*(XRES/CELL)+x] = 2.0f;
+	for (int i = 0; i < 40; i++)
+		masses[((i * 37) % (YRES/CELL))*(XRES/CELL) + (i * 53) % (XRES/CELL)] += (i % 3) ? 5.0f : -3.0f;
+	masses[0] = 10.0f;
+	masses[size-1] = 10.0f;
+
+	std::vector<double> directX(size), directY(size);
+	for (int sy = 0; sy < YRES/CELL; sy++)
+		for (int sx = 0; sx < XRES/CELL; sx++)
+		{
+			double mass = masses[sy*(XRES/CELL)+sx];
+			if (!mass)
+				continue;
+			for (int y = 0; y < YRES/CELL; y++)
+				for (int x = 0; x < XRES/CELL; x++)
+				{
+					if (x == sx && y == sy)
+						continue;
+					double distance = std::sqrt(double((sx-x)*(sx-x) + (sy-y)*(sy-y)));
+					directX[y*(XRES/CELL)+x] += M_GRAV * mass * (sx-x) / (distance * distance * distance);
+					directY[y*(XRES/CELL)+x] += M_GRAV * mass * (sy-y) / (distance * distance * distance);
+				}
+		}
+
+	std::vector<float> fieldX(size), fieldY(size);
+	GravityConvolution convolution;
+	convolution.Calculate(&masses[0], &fieldX[0], &fieldY[0]);
+	double error = FieldError(directX, directY, &fieldX[0], &fieldY[0]);
+	Check("gravity field with the built in FFT against a direct sum", error < 1e-4, ByteString::Build("relative error ", error));
+
+	// The gravity thread needs the masses again every frame, and hands back a field a frame or so later
+	unsigned char bmap[YRES/CELL][XRES/CELL] = {};
+	Gravity *gravity = new Gravity();
+	gravity->bmap = bmap;
+	gravity->Clear();
+	gravity->start_grav_async();
+	bool found = false;
+	auto start = std::chrono::steady_clock::now();
+	while (!found && std::chrono::steady_clock::now() - start < std::chrono::seconds(30))
+	{
+		std::copy(masses.begin(), masses.end(), gravity->gravmap);
+		gravity->gravity_update_async();
+		for (int i = 0; i < size && !found; i++)
+			found = gravity->gravx[i] != 0;
+		if (!found)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+#ifdef GRAVFFT
+	ByteString name = "gravity field with FFTW against a direct sum";
+#else
+	ByteString name = "gravity field from the gravity thread against a direct sum";
+#endif
+	if (found)
+	{
+		error = FieldError(directX, directY, gravity->gravx, gravity->gravy);
+		Check(name, error < 1e-4, ByteString::Build("relative error ", error));
+	}
+	else
+		Check(name, false, "the gravity thread didn't produce a field");
+	delete gravity;
+}
+
+#endif
@@ -0,0 +1,77 @@
+#ifdef TESTS
+
+#include "Tests.h"
+
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+#ifdef WIN
+#include <direct.h>
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "client/Client.h"
+
+static int checks = 0;
+static int failures = 0;
+
+void Check(ByteString name, bool passed, ByteString details)
+{
+	checks++;
+	if (!passed)
+		failures++;
+	std::cout << (passed ? "ok     " : "FAILED ") << name;
+	if (details.size())
+		std::cout << " (" << details << ")";
+	std::cout << std::endl;
+}
+
+ByteString MakeTemporaryDirectory()
+{
+#ifdef WIN
+	char base[MAX_PATH + 1];
+	if (!GetTempPathA(sizeof(base), base))
+		return "";
+	ByteString pattern = ByteString(base) + "tpt-tests-XXXXXX";
+	std::vector<char> name(pattern.begin(), pattern.end());
+	name.push_back(0);
+	if (_mktemp_s(&name[0], name.size()) || _mkdir(&name[0]))
+		return "";
+#else
+	const char *base = getenv("TMPDIR");
+	ByteString pattern = ByteString(base && base[0] ? base : "/tmp") + "/tpt-tests-XXXXXX";
+	std::vector<char> name(pattern.begin(), pattern.end());
+	name.push_back(0);
+	if (!mkdtemp(&name[0]))
+		return "";
+#endif
+	return ByteString(&name[0]);
+}
+
+void RemoveTemporaryDirectory(ByteString directory)
+{
+	for (auto &filename : Client::Ref().DirectorySearch(directory, "", std::vector<ByteString>()))
+		remove(filename.c_str());
+#ifdef WIN
+	_rmdir(directory.c_str());
+#else
+	rmdir(directory.c_str());
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+	TestThumbnailCache();
+	TestAirBlur();
+	TestFFT();
+	TestGravity();
+
+	std::cout << (checks - failures) << " of " << checks << " checks passed" << std::endl;
+	return failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef TESTS_H
+#define TESTS_H
+
+#include "common/String.h"
+
+// Self tests, built with scons --tests. Each one runs optimised code next to the plain code it replaces, or next
+// to a slower reference, and reports what it found through Check. The tests exit with 1 if any check failed
+void Check(ByteString name, bool passed, ByteString details = "");
+
+// A new empty directory under the system's temporary directory, or an empty string if one couldn't be made
+ByteString MakeTemporaryDirectory();
+// Removes the files a test left in a directory from MakeTemporaryDirectory, then the directory itself
+void RemoveTemporaryDirectory(ByteString directory);
+
+void TestThumbnailCache();
+void TestAirBlur();
+void TestFFT();
+void TestGravity();
+
+#endif
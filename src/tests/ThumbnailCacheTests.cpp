@@ -0,0 +1,68 @@
+#ifdef TESTS
+
+#include "Tests.h"
+
+#include <vector>
+
+#include "Format.h"
+#include "client/ThumbnailCache.h"
+#include "graphics/Graphics.h"
+
+// Stores thumbnails in a cache of its own, reads them back, and checks that the least recently used one is
+// the one removed once the cache grows past its size
+void TestThumbnailCache()
+{
+	ByteString directory = MakeTemporaryDirectory();
+	if (!directory.size())
+	{
+		Check("thumbnail cache directory", false, "couldn't create a temporary directory");
+		return;
+	}
+
+	std::vector<VideoBuffer> thumbnails;
+	unsigned long totalSize = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		VideoBuffer thumbnail(64, 48);
+		for (int p = 0; p < 64 * 48; p++)
+			thumbnail.Buffer[p] = PIXRGB((p * (i + 1)) & 0xFF, (p >> 4) & 0xFF, i * 80);
+		totalSize += format::VideoBufferToPTI(thumbnail).size();
+		thumbnails.push_back(thumbnail);
+	}
+	auto key = [](int i) {
+		return ThumbnailCache::Key(ByteString::Build("test", i), 64, 48, false, false, false);
+	};
+	auto matches = [&thumbnails](VideoBuffer *found, int i) {
+		bool same = found && found->Width == thumbnails[i].Width && found->Height == thumbnails[i].Height;
+		for (int p = 0; same && p < found->Width * found->Height; p++)
+			same = PIXRGB(PIXR(found->Buffer[p]), PIXG(found->Buffer[p]), PIXB(found->Buffer[p])) == thumbnails[i].Buffer[p];
+		delete found;
+		return same;
+	};
+
+	{
+		// One byte too small for all three
+		ThumbnailCache cache(directory, totalSize - 1);
+		bool empty = !cache.Get(key(0));
+		cache.Put(key(0), thumbnails[0]);
+		cache.Put(key(1), thumbnails[1]);
+		bool stored = matches(cache.Get(key(0)), 0) && matches(cache.Get(key(1)), 1);
+		Check("thumbnail cache stores thumbnails", empty && stored);
+
+		// 0 was used last, so 1 is the one to go
+		matches(cache.Get(key(0)), 0);
+		cache.Put(key(2), thumbnails[2]);
+		VideoBuffer *evicted = cache.Get(key(1));
+		bool evictedOldest = !evicted && matches(cache.Get(key(0)), 0) && matches(cache.Get(key(2)), 2);
+		delete evicted;
+		Check("thumbnail cache evicts the least recently used thumbnail", evictedOldest);
+	}
+	{
+		// Another cache on the same directory finds what the first one left behind
+		ThumbnailCache cache(directory, totalSize - 1);
+		Check("thumbnail cache reloads its index", matches(cache.Get(key(2)), 2));
+	}
+	RemoveTemporaryDirectory(directory);
+}
+
+#endif